@@ -110,6 +110,7 @@ var AppHelpFlagGroups = []flagGroup{
 		Flags: []cli.Flag{
 			utils.CacheFlag,
 			utils.TrieCacheGenFlag,
+			utils.TriePreimagesFlag,
 		},
 	},
 	{
@@ -52,6 +52,7 @@ import (
 	"github.com/trust-tech/go-trustmachine/p2p/nat"
 	"github.com/trust-tech/go-trustmachine/p2p/netutil"
 	"github.com/trust-tech/go-trustmachine/params"
+	"github.com/trust-tech/go-trustmachine/trie"
 	whisper "github.com/trust-tech/go-trustmachine/whisper/whisperv5"
 	"gopkg.in/urfave/cli.v1"
 )
@@ -259,6 +260,11 @@ var (
 		Usage: "Number of trie node generations to keep in memory",
 		Value: int(state.MaxTrieCacheGen),
 	}
+	TriePreimagesFlag = cli.StringFlag{
+		Name:  "trie-preimages",
+		Usage: `State trie key preimages to record for dumps and debugging ("all", "sampled" or "none")`,
+		Value: state.TriePreimageMode.String(),
+	}
 	// Miner settings
 	MiningEnabledFlag = cli.BoolFlag{
 		Name:  "mine",
@@ -984,6 +990,13 @@ func SetEntrustConfig(ctx *cli.Context, stack *node.Node, cfg *entrust.Config) {
 	if gen := ctx.GlobalInt(TrieCacheGenFlag.Name); gen > 0 {
 		state.MaxTrieCacheGen = uint16(gen)
 	}
+	if ctx.GlobalIsSet(TriePreimagesFlag.Name) {
+		mode, err := trie.ParsePreimageMode(ctx.GlobalString(TriePreimagesFlag.Name))
+		if err != nil {
+			Fatalf("Option %q: %v", TriePreimagesFlag.Name, err)
+		}
+		state.TriePreimageMode = mode
+	}
 }
 
 // RegisterEntrustService adds an Trustmachine client to the stack.
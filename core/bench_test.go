@@ -20,55 +20,72 @@ import (
 	"crypto/ecdsa"
 	"io/ioutil"
 	"math/big"
+	mrand "math/rand"
 	"os"
 	"testing"
 
 	"github.com/trust-tech/go-trustmachine/common"
 	"github.com/trust-tech/go-trustmachine/common/math"
 	"github.com/trust-tech/go-trustmachine/consensus/entrustash"
+	"github.com/trust-tech/go-trustmachine/core/state"
 	"github.com/trust-tech/go-trustmachine/core/types"
 	"github.com/trust-tech/go-trustmachine/core/vm"
 	"github.com/trust-tech/go-trustmachine/crypto"
 	"github.com/trust-tech/go-trustmachine/entrustdb"
 	"github.com/trust-tech/go-trustmachine/event"
 	"github.com/trust-tech/go-trustmachine/params"
+	"github.com/trust-tech/go-trustmachine/trie"
 )
 
 func BenchmarkInsertChain_empty_memdb(b *testing.B) {
-	benchInsertChain(b, false, nil)
+	benchInsertChain(b, false, true, nil)
 }
 func BenchmarkInsertChain_empty_diskdb(b *testing.B) {
-	benchInsertChain(b, true, nil)
+	benchInsertChain(b, true, true, nil)
 }
 func BenchmarkInsertChain_valueTx_memdb(b *testing.B) {
-	benchInsertChain(b, false, genValueTx(0))
+	benchInsertChain(b, false, true, genValueTx(0))
 }
 func BenchmarkInsertChain_valueTx_diskdb(b *testing.B) {
-	benchInsertChain(b, true, genValueTx(0))
+	benchInsertChain(b, true, true, genValueTx(0))
 }
 func BenchmarkInsertChain_valueTx_100kB_memdb(b *testing.B) {
-	benchInsertChain(b, false, genValueTx(100*1024))
+	benchInsertChain(b, false, true, genValueTx(100*1024))
 }
 func BenchmarkInsertChain_valueTx_100kB_diskdb(b *testing.B) {
-	benchInsertChain(b, true, genValueTx(100*1024))
+	benchInsertChain(b, true, true, genValueTx(100*1024))
 }
 func BenchmarkInsertChain_uncles_memdb(b *testing.B) {
-	benchInsertChain(b, false, genUncles)
+	benchInsertChain(b, false, true, genUncles)
 }
 func BenchmarkInsertChain_uncles_diskdb(b *testing.B) {
-	benchInsertChain(b, true, genUncles)
+	benchInsertChain(b, true, true, genUncles)
 }
 func BenchmarkInsertChain_ring200_memdb(b *testing.B) {
-	benchInsertChain(b, false, genTxRing(200))
+	benchInsertChain(b, false, true, genTxRing(200))
 }
 func BenchmarkInsertChain_ring200_diskdb(b *testing.B) {
-	benchInsertChain(b, true, genTxRing(200))
+	benchInsertChain(b, true, true, genTxRing(200))
 }
 func BenchmarkInsertChain_ring1000_memdb(b *testing.B) {
-	benchInsertChain(b, false, genTxRing(1000))
+	benchInsertChain(b, false, true, genTxRing(1000))
 }
 func BenchmarkInsertChain_ring1000_diskdb(b *testing.B) {
-	benchInsertChain(b, true, genTxRing(1000))
+	benchInsertChain(b, true, true, genTxRing(1000))
+}
+func BenchmarkInsertChain_valueTx_diskdb_noprefetch(b *testing.B) {
+	benchInsertChain(b, true, false, genValueTx(0))
+}
+func BenchmarkInsertChain_ring200_diskdb_noprefetch(b *testing.B) {
+	benchInsertChain(b, true, false, genTxRing(200))
+}
+func BenchmarkInsertChain_ring1000_diskdb_noprefetch(b *testing.B) {
+	benchInsertChain(b, true, false, genTxRing(1000))
+}
+func BenchmarkInsertChain_ring200_diskdb_nopreimages(b *testing.B) {
+	defer func(mode trie.PreimageMode) { state.TriePreimageMode = mode }(state.TriePreimageMode)
+	state.TriePreimageMode = trie.PreimagesNone
+	benchInsertChain(b, true, true, genTxRing(200))
 }
 
 var (
@@ -146,7 +163,7 @@ func genUncles(i int, gen *BlockGen) {
 	}
 }
 
-func benchInsertChain(b *testing.B, disk bool, gen func(int, *BlockGen)) {
+func benchInsertChain(b *testing.B, disk, prefetch bool, gen func(int, *BlockGen)) {
 	// Create the database in memory or in a temporary directory.
 	var db entrustdb.Database
 	if !disk {
@@ -178,6 +195,9 @@ func benchInsertChain(b *testing.B, disk bool, gen func(int, *BlockGen)) {
 	evmux := new(event.TypeMux)
 	chainman, _ := NewBlockChain(db, gspec.Config, entrustash.NewFaker(), evmux, vm.Config{})
 	defer chainman.Stop()
+	if !prefetch {
+		chainman.prefetcher = nil
+	}
 	b.ReportAllocs()
 	b.ResetTimer()
 	if i, err := chainman.InsertChain(chain); err != nil {
@@ -303,3 +323,161 @@ func benchReadChain(b *testing.B, full bool, count uint64) {
 		db.Close()
 	}
 }
+
+func BenchmarkChainReorg_100_memdb(b *testing.B) {
+	benchReorgChain(b, false, 100)
+}
+func BenchmarkChainReorg_100_diskdb(b *testing.B) {
+	benchReorgChain(b, true, 100)
+}
+func BenchmarkChainReorg_500_memdb(b *testing.B) {
+	benchReorgChain(b, false, 500)
+}
+func BenchmarkChainReorg_500_diskdb(b *testing.B) {
+	benchReorgChain(b, true, 500)
+}
+
+// benchReorgChain measures switching the canonical chain over to a competing
+// fork of the given depth. Both forks are imported outside of the timed region
+// apart from the final two fork blocks. The first of these is mined faster than
+// its canonical counterpart, so its strictly higher total difficulty triggers
+// the reorg instead of a random tie-break.
+func benchReorgChain(b *testing.B, disk bool, depth int) {
+	gspec := Genesis{
+		Config: params.TestChainConfig,
+		Alloc:  GenesisAlloc{benchRootAddr: {Balance: benchRootFunds}},
+	}
+	b.ReportAllocs()
+	b.ResetTimer()
+	b.StopTimer()
+
+	for i := 0; i < b.N; i++ {
+		var (
+			db  entrustdb.Database
+			dir string
+		)
+		if !disk {
+			db, _ = entrustdb.NewMemDatabase()
+		} else {
+			var err error
+			if dir, err = ioutil.TempDir("", "entrust-reorg-bench"); err != nil {
+				b.Fatalf("cannot create temporary directory: %v", err)
+			}
+			if db, err = entrustdb.NewLDBDatabase(dir, 128, 128); err != nil {
+				b.Fatalf("cannot create temporary database: %v", err)
+			}
+		}
+		genesis := gspec.MustCommit(db)
+
+		// Generate two forks with differing transactions, the second one longer
+		canon, _ := GenerateChain(gspec.Config, genesis, db, depth, genValueTx(100))
+		fork, _ := GenerateChain(gspec.Config, genesis, db, depth+1, func(i int, gen *BlockGen) {
+			gen.SetCoinbase(common.Address{0x01})
+			if i == depth-1 {
+				gen.OffsetTime(-5)
+			}
+			genValueTx(101)(i, gen)
+		})
+		chain, _ := NewBlockChain(db, gspec.Config, entrustash.NewFaker(), new(event.TypeMux), vm.Config{})
+		if n, err := chain.InsertChain(canon); err != nil {
+			b.Fatalf("canonical insert error (block %d): %v", n, err)
+		}
+		if n, err := chain.InsertChain(fork[:depth-1]); err != nil {
+			b.Fatalf("fork insert error (block %d): %v", n, err)
+		}
+		b.StartTimer()
+		if n, err := chain.InsertChain(fork[depth-1:]); err != nil {
+			b.Fatalf("reorg insert error (block %d): %v", n, err)
+		}
+		b.StopTimer()
+
+		if chain.GetTdByHash(fork[depth-1].Hash()).Cmp(chain.GetTdByHash(canon[depth-1].Hash())) <= 0 {
+			b.Fatalf("fork does not outweigh the canonical chain at #%d", depth)
+		}
+		if chain.CurrentBlock().Hash() != fork[depth].Hash() {
+			b.Fatalf("head mismatch: have %x, want %x", chain.CurrentBlock().Hash(), fork[depth].Hash())
+		}
+		chain.Stop()
+		db.Close()
+		if disk {
+			os.RemoveAll(dir)
+		}
+	}
+}
+
+func BenchmarkChainServe_mixed(b *testing.B) {
+	benchServeChain(b, 8192)
+}
+
+// makeServingChainForBench writes a chain of blocks with very uneven body sizes
+// into a database: most blocks hold a single small transaction, but every 8th
+// one carries 64KB of transaction data.
+func makeServingChainForBench(db entrustdb.Database, count uint64) {
+	var hash common.Hash
+	for n := uint64(0); n < count; n++ {
+		header := &types.Header{
+			Number:     big.NewInt(int64(n)),
+			ParentHash: hash,
+			Difficulty: big.NewInt(1),
+			UncleHash:  types.EmptyUncleHash,
+		}
+		hash = header.Hash()
+		WriteHeader(db, header)
+		WriteCanonicalHash(db, hash, n)
+		WriteTd(db, hash, n, big.NewInt(int64(n+1)))
+
+		data := make([]byte, 128)
+		if n%8 == 0 {
+			data = make([]byte, 64*1024)
+		}
+		tx := types.NewTransaction(n, common.Address{}, big.NewInt(1), bigTxGas, nil, data)
+		WriteBody(db, hash, n, &types.Body{Transactions: types.Transactions{tx}})
+	}
+}
+
+// benchServeChain simulates serving peers from a chain: most requests go to the
+// blocks near the head (Zipf distributed by distance), the rest to a syncing
+// peer walking the whole chain. Requests alternate between entire blocks (RPC)
+// and RLP encoded bodies (network).
+func benchServeChain(b *testing.B, count uint64) {
+	dir, err := ioutil.TempDir("", "entrust-chain-bench")
+	if err != nil {
+		b.Fatalf("cannot create temporary directory: %v", err)
+	}
+	defer os.RemoveAll(dir)
+
+	db, err := entrustdb.NewLDBDatabase(dir, 128, 1024)
+	if err != nil {
+		b.Fatalf("error opening database at %v: %v", dir, err)
+	}
+	defer db.Close()
+
+	makeServingChainForBench(db, count)
+	chain, err := NewBlockChain(db, params.TestChainConfig, entrustash.NewFaker(), new(event.TypeMux), vm.Config{})
+	if err != nil {
+		b.Fatalf("error creating chain: %v", err)
+	}
+	var (
+		rand = mrand.New(mrand.NewSource(1))
+		zipf = mrand.NewZipf(rand, 1.1, 1, count-1)
+		scan = uint64(0)
+	)
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		number := count - 1 - zipf.Uint64()
+		if i%5 == 4 {
+			number, scan = scan, (scan+1)%count
+		}
+		if i%2 == 0 {
+			if chain.GetBlockByNumber(number) == nil {
+				b.Fatalf("block %d missing", number)
+			}
+		} else {
+			if chain.GetBodyRLP(chain.GetHeaderByNumber(number).Hash()) == nil {
+				b.Fatalf("body %d missing", number)
+			}
+		}
+	}
+}
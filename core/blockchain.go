@@ -18,6 +18,7 @@
 package core
 
 import (
+	"bytes"
 	"errors"
 	"fmt"
 	"io"
@@ -52,8 +53,6 @@ var (
 )
 
 const (
-	bodyCacheLimit      = 256
-	blockCacheLimit     = 256
 	maxFutureBlocks     = 256
 	maxTimeFutureBlocks = 30
 	badBlockLimit       = 10
@@ -93,10 +92,8 @@ type BlockChain struct {
 	currentFastBlock *types.Block // Current head of the fast-sync chain (may be above the block chain!)
 
 	stateCache   state.Database // State database to reuse between imports (contains state cache)
-	bodyCache    *lru.Cache     // Cache for the most recent block bodies
-	bodyRLPCache *lru.Cache     // Cache for the most recent block bodies in RLP encoded format
-	blockCache   *lru.Cache     // Cache for the most recent entire blocks
-	futureBlocks *lru.Cache     // future blocks are blocks added for later processing
+	cache        *chainCache    // Shared cache for block bodies (decoded and RLP), entire blocks and receipts
+	futureBlocks *futureQueue   // future blocks are blocks added for later processing
 
 	quit    chan struct{} // blockchain quit channel
 	running int32         // running must be called atomically
@@ -104,10 +101,11 @@ type BlockChain struct {
 	procInterrupt int32          // interrupt signaler for block processing
 	wg            sync.WaitGroup // chain processing wait group for shutting down
 
-	engine    consensus.Engine
-	processor Processor // block processor interface
-	validator Validator // block and state validator interface
-	vmConfig  vm.Config
+	engine     consensus.Engine
+	processor  Processor  // block processor interface
+	prefetcher Prefetcher // state prefetcher interface, racing the processor
+	validator  Validator  // block and state validator interface
+	vmConfig   vm.Config
 
 	badBlocks *lru.Cache // Bad block cache
 }
@@ -116,10 +114,6 @@ type BlockChain struct {
 // available in the database. It initialises the default Trustmachine Validator and
 // Processor.
 func NewBlockChain(chainDb entrustdb.Database, config *params.ChainConfig, engine consensus.Engine, mux *event.TypeMux, vmConfig vm.Config) (*BlockChain, error) {
-	bodyCache, _ := lru.New(bodyCacheLimit)
-	bodyRLPCache, _ := lru.New(bodyCacheLimit)
-	blockCache, _ := lru.New(blockCacheLimit)
-	futureBlocks, _ := lru.New(maxFutureBlocks)
 	badBlocks, _ := lru.New(badBlockLimit)
 
 	bc := &BlockChain{
@@ -128,16 +122,15 @@ func NewBlockChain(chainDb entrustdb.Database, config *params.ChainConfig, engin
 		stateCache:   state.NewDatabase(chainDb),
 		eventMux:     mux,
 		quit:         make(chan struct{}),
-		bodyCache:    bodyCache,
-		bodyRLPCache: bodyRLPCache,
-		blockCache:   blockCache,
-		futureBlocks: futureBlocks,
+		cache:        newChainCache(chainCacheBudget),
+		futureBlocks: newFutureQueue(maxFutureBlocks),
 		engine:       engine,
 		vmConfig:     vmConfig,
 		badBlocks:    badBlocks,
 	}
 	bc.SetValidator(NewBlockValidator(config, bc, engine))
 	bc.SetProcessor(NewStateProcessor(config, bc, engine))
+	bc.prefetcher = newStatePrefetcher(config, bc)
 
 	var err error
 	bc.hc, err = NewHeaderChain(chainDb, config, engine, bc.getProcInterrupt)
@@ -246,10 +239,8 @@ func (bc *BlockChain) SetHead(head uint64) error {
 	currentHeader := bc.hc.CurrentHeader()
 
 	// Clear out any stale content from the caches
-	bc.bodyCache.Purge()
-	bc.bodyRLPCache.Purge()
-	bc.blockCache.Purge()
-	bc.futureBlocks.Purge()
+	bc.cache.purge()
+	bc.futureBlocks.purge()
 
 	// Rewind the block chain, ensuring we don't end up with a stateless head block
 	if bc.currentBlock != nil && currentHeader.Number.Uint64() < bc.currentBlock.NumberU64() {
@@ -405,7 +396,7 @@ func (bc *BlockChain) ResetWithGenesisBlock(genesis *types.Block) error {
 		log.Crit("Failed to write genesis block", "err", err)
 	}
 	bc.genesisBlock = genesis
-	bc.insert(bc.genesisBlock)
+	bc.insert(bc.genesisBlock, false)
 	bc.currentBlock = bc.genesisBlock
 	bc.hc.SetGenesis(bc.genesisBlock.Header())
 	bc.hc.SetCurrentHeader(bc.genesisBlock.Header())
@@ -446,12 +437,16 @@ func (bc *BlockChain) ExportN(w io.Writer, first uint64, last uint64) error {
 // insert injects a new head block into the current block chain. This method
 // assumes that the block is indeed a true head. It will also reset the head
 // header and the head fast sync block to this very same block if they are older
-// or if they are on a different side chain.
+// or if they are on a different side chain. The reorged flag forces the update,
+// as a reorg leaves the canonical mappings of the old chain above its head intact.
 //
 // Note, this function assumes that the `mu` mutex is held!
-func (bc *BlockChain) insert(block *types.Block) {
-	// If the block is on a side chain or an unknown one, force other heads onto it too
-	updateHeads := GetCanonicalHash(bc.chainDb, block.NumberU64()) != block.Hash()
+func (bc *BlockChain) insert(block *types.Block, reorged bool) {
+	// If the block is on a side chain or an unknown one, or the current header
+	// left the canonical chain, force other heads onto it too
+	head := bc.hc.CurrentHeader()
+	updateHeads := reorged || GetCanonicalHash(bc.chainDb, block.NumberU64()) != block.Hash() ||
+		GetCanonicalHash(bc.chainDb, head.Number.Uint64()) != head.Hash()
 
 	// Add the block to the canonical chain number scheme and mark as the head
 	if err := WriteCanonicalHash(bc.chainDb, block.Hash(), block.NumberU64()); err != nil {
@@ -479,27 +474,48 @@ func (bc *BlockChain) Genesis() *types.Block {
 }
 
 // GetBody retrieves a block body (transactions and uncles) from the database by
-// hash, caching it if found.
+// hash, caching it if found. A body missing from the cache is decoded from its
+// cached RLP encoding if available, only hitting the database otherwise.
 func (bc *BlockChain) GetBody(hash common.Hash) *types.Body {
 	// Short circuit if the body's already in the cache, retrieve otherwise
-	if cached, ok := bc.bodyCache.Get(hash); ok {
-		body := cached.(*types.Body)
-		return body
+	if cached, ok := bc.cache.get(cacheBody, hash); ok {
+		return cached.(*types.Body)
 	}
-	body := GetBody(bc.chainDb, hash, bc.hc.GetBlockNumber(hash))
+	body, size := bc.decodeBody(hash, bc.hc.GetBlockNumber(hash))
 	if body == nil {
 		return nil
 	}
 	// Cache the found body for next time and return
-	bc.bodyCache.Add(hash, body)
+	bc.cache.add(cacheBody, hash, body, size)
 	return body
 }
 
+// decodeBody assembles a block body from its RLP encoding, preferring a cached
+// copy of the latter over the database. The encoded size is returned alongside
+// as an estimate of the body's memory footprint.
+func (bc *BlockChain) decodeBody(hash common.Hash, number uint64) (*types.Body, int) {
+	var data rlp.RawValue
+	if cached, ok := bc.cache.peek(cacheBodyRLP, hash); ok {
+		data = cached.(rlp.RawValue)
+	} else {
+		data = GetBodyRLP(bc.chainDb, hash, number)
+	}
+	if len(data) == 0 {
+		return nil, 0
+	}
+	body := new(types.Body)
+	if err := rlp.Decode(bytes.NewReader(data), body); err != nil {
+		log.Error("Invalid block body RLP", "hash", hash, "err", err)
+		return nil, 0
+	}
+	return body, len(data)
+}
+
 // GetBodyRLP retrieves a block body in RLP encoding from the database by hash,
 // caching it if found.
 func (bc *BlockChain) GetBodyRLP(hash common.Hash) rlp.RawValue {
 	// Short circuit if the body's already in the cache, retrieve otherwise
-	if cached, ok := bc.bodyRLPCache.Get(hash); ok {
+	if cached, ok := bc.cache.get(cacheBodyRLP, hash); ok {
 		return cached.(rlp.RawValue)
 	}
 	body := GetBodyRLP(bc.chainDb, hash, bc.hc.GetBlockNumber(hash))
@@ -507,10 +523,19 @@ func (bc *BlockChain) GetBodyRLP(hash common.Hash) rlp.RawValue {
 		return nil
 	}
 	// Cache the found body for next time and return
-	bc.bodyRLPCache.Add(hash, body)
+	bc.cache.add(cacheBodyRLP, hash, body, len(body))
 	return body
 }
 
+// getBlockReceipts retrieves the receipts of a block, preferring the ones computed
+// during a recent import over decoding them from the database.
+func (bc *BlockChain) getBlockReceipts(hash common.Hash, number uint64) types.Receipts {
+	if receipts, ok := bc.cache.get(cacheReceipts, hash); ok {
+		return receipts.(types.Receipts)
+	}
+	return GetBlockReceipts(bc.chainDb, hash, number)
+}
+
 // HasBlock checks if a block is fully present in the database or not, caching
 // it if present.
 func (bc *BlockChain) HasBlock(hash common.Hash) bool {
@@ -534,15 +559,21 @@ func (bc *BlockChain) HasBlockAndState(hash common.Hash) bool {
 // caching it if found.
 func (bc *BlockChain) GetBlock(hash common.Hash, number uint64) *types.Block {
 	// Short circuit if the block's already in the cache, retrieve otherwise
-	if block, ok := bc.blockCache.Get(hash); ok {
+	if block, ok := bc.cache.get(cacheBlock, hash); ok {
 		return block.(*types.Block)
 	}
-	block := GetBlock(bc.chainDb, hash, number)
-	if block == nil {
+	header := bc.hc.GetHeader(hash, number)
+	if header == nil {
 		return nil
 	}
+	body, size := bc.decodeBody(hash, number)
+	if body == nil {
+		return nil
+	}
+	block := types.NewBlockWithHeader(header).WithBody(body.Transactions, body.Uncles)
+
 	// Cache the found block for next time and return
-	bc.blockCache.Add(block.Hash(), block)
+	bc.cache.add(cacheBlock, hash, block, size+headerSizeEstimate)
 	return block
 }
 
@@ -601,20 +632,11 @@ func (bc *BlockChain) Stop() {
 	log.Info("Blockchain manager stopped")
 }
 
+// procFutureBlocks imports all the queued future blocks that became valid by
+// now, in batches of contiguous chain segments.
 func (bc *BlockChain) procFutureBlocks() {
-	blocks := make([]*types.Block, 0, bc.futureBlocks.Len())
-	for _, hash := range bc.futureBlocks.Keys() {
-		if block, exist := bc.futureBlocks.Peek(hash); exist {
-			blocks = append(blocks, block.(*types.Block))
-		}
-	}
-	if len(blocks) > 0 {
-		types.BlockBy(types.Number).Sort(blocks)
-
-		// Insert one by one as chain insertion needs contiguous ancestry between blocks
-		for i := range blocks {
-			bc.InsertChain(blocks[i : i+1])
-		}
+	for _, batch := range bc.futureBlocks.pop(time.Now()) {
+		bc.InsertChain(batch)
 	}
 }
 
@@ -843,18 +865,19 @@ func (bc *BlockChain) WriteBlock(block *types.Block) (status WriteStatus, err er
 	// Please refer to http://www.cs.cornell.edu/~ie53/publications/btcProcFC.pdf
 	if externTd.Cmp(localTd) > 0 || (externTd.Cmp(localTd) == 0 && mrand.Float64() < 0.5) {
 		// Reorganise the chain if the parent is not the head block
-		if block.ParentHash() != bc.currentBlock.Hash() {
+		reorged := block.ParentHash() != bc.currentBlock.Hash()
+		if reorged {
 			if err := bc.reorg(bc.currentBlock, block); err != nil {
 				return NonStatTy, err
 			}
 		}
-		bc.insert(block) // Insert the block as the new head of the chain
+		bc.insert(block, reorged) // Insert the block as the new head of the chain
 		status = CanonStatTy
 	} else {
 		status = SideStatTy
 	}
 
-	bc.futureBlocks.Remove(block.Hash())
+	bc.futureBlocks.remove(block.Hash())
 
 	return
 }
@@ -899,6 +922,29 @@ func (bc *BlockChain) InsertChain(chain types.Blocks) (int, error) {
 	abort, results := bc.engine.VerifyHeaders(bc, headers, seals)
 	defer close(abort)
 
+	// Prefetch the state of every block on a throwaway statedb, ahead of its
+	// processing. A block's prefetch runs until its own processing starts, so it
+	// overlaps with the verification and import of the blocks before it.
+	var prefetching *uint32
+	stopPrefetch := func() {
+		if prefetching != nil {
+			atomic.StoreUint32(prefetching, 1)
+			prefetching = nil
+		}
+	}
+	prefetch := func(block *types.Block, root common.Hash) {
+		if throwaway, err := state.New(root, state.NewPrefetchDatabase(bc.stateCache)); err == nil {
+			prefetching = new(uint32)
+			go bc.prefetcher.Prefetch(block, throwaway, bc.vmConfig, prefetching)
+		}
+	}
+	defer stopPrefetch()
+
+	if bc.prefetcher != nil && len(chain) > 0 {
+		if parent := bc.GetBlock(chain[0].ParentHash(), chain[0].NumberU64()-1); parent != nil {
+			prefetch(chain[0], parent.Root())
+		}
+	}
 	// Iterate over the blocks and insert when the verifier permits
 	for i, block := range chain {
 		// If the chain is terminating, stop processing blocks
@@ -932,13 +978,13 @@ func (bc *BlockChain) InsertChain(chain types.Blocks) (int, error) {
 				if block.Time().Cmp(max) > 0 {
 					return i, fmt.Errorf("future block: %v > %v", block.Time(), max)
 				}
-				bc.futureBlocks.Add(block.Hash(), block)
+				bc.futureBlocks.add(block)
 				stats.queued++
 				continue
 			}
 
-			if err == consensus.ErrUnknownAncestor && bc.futureBlocks.Contains(block.ParentHash()) {
-				bc.futureBlocks.Add(block.Hash(), block)
+			if err == consensus.ErrUnknownAncestor && bc.futureBlocks.contains(block.ParentHash()) {
+				bc.futureBlocks.add(block)
 				stats.queued++
 				continue
 			}
@@ -954,6 +1000,12 @@ func (bc *BlockChain) InsertChain(chain types.Blocks) (int, error) {
 		} else {
 			parent = chain[i-1]
 		}
+		// This block's processing takes over from its prefetch, start on the
+		// next one. Its parent state isn't committed yet, use the current one.
+		stopPrefetch()
+		if bc.prefetcher != nil && i+1 < len(chain) {
+			prefetch(chain[i+1], parent.Root())
+		}
 		state, err := state.New(parent.Root(), bc.stateCache)
 		if err != nil {
 			return i, err
@@ -981,6 +1033,8 @@ func (bc *BlockChain) InsertChain(chain types.Blocks) (int, error) {
 		if err = WriteBlockReceipts(bc.chainDb, block.Hash(), block.NumberU64(), receipts); err != nil {
 			return i, err
 		}
+		// keep the receipts around, a side block may become canonical on the next reorg
+		bc.cache.addFresh(cacheReceipts, block.Hash(), receipts, receiptsSize(receipts))
 
 		// write the block to the chain and get the status
 		status, err := bc.WriteBlock(block)
@@ -1076,68 +1130,49 @@ func countTransactions(chain []*types.Block) (c int) {
 
 // reorgs takes two blocks, an old chain and a new chain and will reconstruct the blocks and inserts them
 // to be part of the new canonical chain and accumulates potential missing transactions and post an
-// event about them
+// event about them.
+//
+// The common ancestor is searched for using headers only, and all the canonical
+// hash, transaction lookup and bloom changes are committed in a single batch.
+// The new head itself is left to the caller to insert.
 func (bc *BlockChain) reorg(oldBlock, newBlock *types.Block) error {
 	var (
-		newChain    types.Blocks
-		oldChain    types.Blocks
-		commonBlock *types.Block
-		deletedTxs  types.Transactions
-		deletedLogs []*types.Log
-		// collectLogs collects the logs that were generated during the
-		// processing of the block that corresponds with the given hash.
-		// These logs are later announced as deleted.
-		collectLogs = func(h common.Hash) {
-			// Coalesce logs and set 'Removed'.
-			receipts := GetBlockReceipts(bc.chainDb, h, bc.hc.GetBlockNumber(h))
-			for _, receipt := range receipts {
-				for _, log := range receipt.Logs {
-					del := *log
-					del.Removed = true
-					deletedLogs = append(deletedLogs, &del)
-				}
-			}
-		}
+		oldChain    []*types.Header
+		newChain    []*types.Header
+		oldHeader   = oldBlock.Header()
+		newHeader   = newBlock.Header()
+		commonBlock *types.Header
 	)
-
 	// first reduce whoever is higher bound
-	if oldBlock.NumberU64() > newBlock.NumberU64() {
+	for oldHeader != nil && oldHeader.Number.Uint64() > newHeader.Number.Uint64() {
 		// reduce old chain
-		for ; oldBlock != nil && oldBlock.NumberU64() != newBlock.NumberU64(); oldBlock = bc.GetBlock(oldBlock.ParentHash(), oldBlock.NumberU64()-1) {
-			oldChain = append(oldChain, oldBlock)
-			deletedTxs = append(deletedTxs, oldBlock.Transactions()...)
-
-			collectLogs(oldBlock.Hash())
-		}
-	} else {
-		// reduce new chain and append new chain blocks for inserting later on
-		for ; newBlock != nil && newBlock.NumberU64() != oldBlock.NumberU64(); newBlock = bc.GetBlock(newBlock.ParentHash(), newBlock.NumberU64()-1) {
-			newChain = append(newChain, newBlock)
-		}
+		oldChain = append(oldChain, oldHeader)
+		oldHeader = bc.GetHeader(oldHeader.ParentHash, oldHeader.Number.Uint64()-1)
 	}
-	if oldBlock == nil {
+	for newHeader != nil && oldHeader != nil && newHeader.Number.Uint64() > oldHeader.Number.Uint64() {
+		// reduce new chain and append new chain headers for inserting later on
+		newChain = append(newChain, newHeader)
+		newHeader = bc.GetHeader(newHeader.ParentHash, newHeader.Number.Uint64()-1)
+	}
+	if oldHeader == nil {
 		return fmt.Errorf("Invalid old chain")
 	}
-	if newBlock == nil {
+	if newHeader == nil {
 		return fmt.Errorf("Invalid new chain")
 	}
-
 	for {
-		if oldBlock.Hash() == newBlock.Hash() {
-			commonBlock = oldBlock
+		if oldHeader.Hash() == newHeader.Hash() {
+			commonBlock = oldHeader
 			break
 		}
+		oldChain = append(oldChain, oldHeader)
+		newChain = append(newChain, newHeader)
 
-		oldChain = append(oldChain, oldBlock)
-		newChain = append(newChain, newBlock)
-		deletedTxs = append(deletedTxs, oldBlock.Transactions()...)
-		collectLogs(oldBlock.Hash())
-
-		oldBlock, newBlock = bc.GetBlock(oldBlock.ParentHash(), oldBlock.NumberU64()-1), bc.GetBlock(newBlock.ParentHash(), newBlock.NumberU64()-1)
-		if oldBlock == nil {
+		oldHeader, newHeader = bc.GetHeader(oldHeader.ParentHash, oldHeader.Number.Uint64()-1), bc.GetHeader(newHeader.ParentHash, newHeader.Number.Uint64()-1)
+		if oldHeader == nil {
 			return fmt.Errorf("Invalid old chain")
 		}
-		if newBlock == nil {
+		if newHeader == nil {
 			return fmt.Errorf("Invalid new chain")
 		}
 	}
@@ -1147,55 +1182,113 @@ func (bc *BlockChain) reorg(oldBlock, newBlock *types.Block) error {
 		if len(oldChain) > 63 {
 			logFn = log.Warn
 		}
-		logFn("Chain split detected", "number", commonBlock.Number(), "hash", commonBlock.Hash(),
+		logFn("Chain split detected", "number", commonBlock.Number, "hash", commonBlock.Hash(),
 			"drop", len(oldChain), "dropfrom", oldChain[0].Hash(), "add", len(newChain), "addfrom", newChain[0].Hash())
 	} else {
 		log.Error("Impossible reorg, please file an issue", "oldnum", oldBlock.Number(), "oldhash", oldBlock.Hash(), "newnum", newBlock.Number(), "newhash", newBlock.Hash())
 	}
-	var addedTxs types.Transactions
-	// insert blocks. Order does not matter. Last block will be written in ImportChain itself which creates the new head properly
-	for _, block := range newChain {
-		// insert the block in the canonical way, re-writing history
-		bc.insert(block)
-		// write lookup entries for hash based transaction/receipt searches
-		if err := WriteTxLookupEntries(bc.chainDb, block); err != nil {
+	// Only the bodies of the diverging blocks are needed from here on
+	oldBlocks := make(types.Blocks, 0, len(oldChain))
+	for _, header := range oldChain {
+		block := bc.GetBlock(header.Hash(), header.Number.Uint64())
+		if block == nil {
+			return fmt.Errorf("Invalid old chain")
+		}
+		oldBlocks = append(oldBlocks, block)
+	}
+	newBlocks := make(types.Blocks, 0, len(newChain))
+	for _, header := range newChain {
+		block := newBlock
+		if header.Hash() != newBlock.Hash() {
+			if block = bc.GetBlock(header.Hash(), header.Number.Uint64()); block == nil {
+				return fmt.Errorf("Invalid new chain")
+			}
+		}
+		newBlocks = append(newBlocks, block)
+	}
+	var deletedTxs, addedTxs types.Transactions
+	for _, block := range oldBlocks {
+		deletedTxs = append(deletedTxs, block.Transactions()...)
+	}
+	// Rewrite history in a single batch, so the canonical mappings above the new
+	// head are only dropped along with the new ones being written. The head
+	// markers are updated by insert afterwards.
+	var (
+		batch   = bc.chainDb.NewBatch()
+		mipmaps = newMipmapBloomBatch(bc.chainDb)
+	)
+	mipmapBloomMu.Lock()
+	defer mipmapBloomMu.Unlock()
+
+	for _, block := range newBlocks {
+		if err := WriteCanonicalHash(batch, block.Hash(), block.NumberU64()); err != nil {
 			return err
 		}
-		// Write map map bloom filters
-		receipts := GetBlockReceipts(bc.chainDb, block.Hash(), block.NumberU64())
-		if err := WriteMipmapBloom(bc.chainDb, block.NumberU64(), receipts); err != nil {
+		// write lookup entries for hash based transaction/receipt searches
+		if err := writeTxLookupEntries(batch, block); err != nil {
 			return err
 		}
+		mipmaps.add(block.NumberU64(), bc.getBlockReceipts(block.Hash(), block.NumberU64()))
 		addedTxs = append(addedTxs, block.Transactions()...)
 	}
-
+	if err := mipmaps.flush(batch); err != nil {
+		return err
+	}
+	// Drop the canonical mappings of old blocks and headers above the new head
+	last := oldBlock.NumberU64()
+	if number := bc.hc.CurrentHeader().Number.Uint64(); number > last {
+		last = number
+	}
+	for number := newBlock.NumberU64() + 1; number <= last; number++ {
+		DeleteCanonicalHash(batch, number)
+	}
 	// calculate the difference between deleted and added transactions
 	diff := types.TxDifference(deletedTxs, addedTxs)
 	// When transactions get deleted from the database that means the
 	// receipts that were created in the fork must also be deleted
 	for _, tx := range diff {
-		DeleteTxLookupEntry(bc.chainDb, tx.Hash())
+		DeleteTxLookupEntry(batch, tx.Hash())
+	}
+	if err := batch.Write(); err != nil {
+		log.Crit("Failed to write chain reorganisation", "err", err)
 	}
 	// Must be posted in a goroutine because of the transaction pool trying
 	// to acquire the chain manager lock
 	if len(diff) > 0 {
 		go bc.eventMux.Post(RemovedTransactionEvent{diff})
 	}
-	if len(deletedLogs) > 0 {
-		go bc.eventMux.Post(RemovedLogsEvent{deletedLogs})
+	if len(oldBlocks) > 0 && bc.eventMux.Subscribed(RemovedLogsEvent{}) {
+		go bc.postRemovedLogs(oldBlocks)
 	}
-
-	if len(oldChain) > 0 {
+	if len(oldBlocks) > 0 {
 		go func() {
-			for _, block := range oldChain {
+			for _, block := range oldBlocks {
 				bc.eventMux.Post(ChainSideEvent{Block: block})
 			}
 		}()
 	}
-
 	return nil
 }
 
+// postRemovedLogs collects the logs that were generated during the processing
+// of the given dropped blocks and announces them as deleted.
+func (bc *BlockChain) postRemovedLogs(blocks types.Blocks) {
+	var deletedLogs []*types.Log
+	for _, block := range blocks {
+		// Coalesce logs and set 'Removed'.
+		for _, receipt := range bc.getBlockReceipts(block.Hash(), block.NumberU64()) {
+			for _, log := range receipt.Logs {
+				del := *log
+				del.Removed = true
+				deletedLogs = append(deletedLogs, &del)
+			}
+		}
+	}
+	if len(deletedLogs) > 0 {
+		bc.eventMux.Post(RemovedLogsEvent{deletedLogs})
+	}
+}
+
 // postChainEvents iterates over the events generated by a chain insertion and
 // posts them into the event mux.
 func (bc *BlockChain) postChainEvents(events []interface{}, logs []*types.Log) {
@@ -1215,12 +1308,26 @@ func (bc *BlockChain) postChainEvents(events []interface{}, logs []*types.Log) {
 	}
 }
 
+// update imports queued future blocks as they become valid, sleeping until the
+// earliest one is due (or a new earlier one is queued).
 func (bc *BlockChain) update() {
-	futureTimer := time.Tick(5 * time.Second)
+	futureTimer := time.NewTimer(0)
+	defer futureTimer.Stop()
+	<-futureTimer.C
+
 	for {
+		var wait <-chan time.Time
+		if next, ok := bc.futureBlocks.next(); ok {
+			futureTimer.Reset(next.Sub(time.Now()))
+			wait = futureTimer.C
+		}
 		select {
-		case <-futureTimer:
+		case <-wait:
 			bc.procFutureBlocks()
+		case <-bc.futureBlocks.wake:
+			if wait != nil && !futureTimer.Stop() {
+				<-futureTimer.C
+			}
 		case <-bc.quit:
 			return
 		}
@@ -183,7 +183,7 @@ func insertChain(done chan bool, blockchain *BlockChain, chain types.Blocks, t *
 func TestLastBlock(t *testing.T) {
 	bchain := newTestBlockChain(false)
 	block := makeBlockChain(bchain.CurrentBlock(), 1, bchain.chainDb, 0)[0]
-	bchain.insert(block)
+	bchain.insert(block, false)
 	if block.Hash() != GetHeadBlockHash(bchain.chainDb) {
 		t.Errorf("Write/Get HeadBlockHash failed")
 	}
@@ -410,6 +410,16 @@ func testReorg(t *testing.T, first, second []int, td int64, full bool) {
 			}
 		}
 	}
+	// Make sure the header chain followed the reorg and no stale canonical
+	// mappings remain above the new head
+	if full {
+		if head := bc.CurrentHeader(); head.Hash() != bc.CurrentBlock().Hash() {
+			t.Errorf("head header mismatch: have %x, want %x", head.Hash(), bc.CurrentBlock().Hash())
+		}
+		if hash := GetCanonicalHash(bc.chainDb, bc.CurrentBlock().NumberU64()+1); hash != (common.Hash{}) {
+			t.Errorf("stale canonical hash above head: %x", hash)
+		}
+	}
 	// Make sure the chain total difficulty is the correct one
 	want := new(big.Int).Add(bc.genesisBlock.Difficulty(), big.NewInt(td))
 	if full {
@@ -423,6 +433,39 @@ func testReorg(t *testing.T, first, second []int, td int64, full bool) {
 	}
 }
 
+// Tests that a reorg below a header chain running ahead of the blocks moves the
+// head header over to the new chain and drops the old headers' canonical links.
+func TestReorgBelowHeaderHead(t *testing.T) {
+	bc := newTestBlockChain(true)
+
+	first := makeBlockChainWithDiff(bc.genesisBlock, []int{1, 2, 3, 4}, 11)
+	headers := make([]*types.Header, len(first))
+	for i, block := range first {
+		headers[i] = block.Header()
+	}
+	if n, err := bc.InsertHeaderChain(headers, 1); err != nil {
+		t.Fatalf("failed to insert header %d: %v", n, err)
+	}
+	if n, err := bc.InsertChain(first[:2]); err != nil {
+		t.Fatalf("failed to insert block %d: %v", n, err)
+	}
+	second := makeBlockChainWithDiff(bc.genesisBlock, []int{1, 5}, 22)
+	if n, err := bc.InsertChain(second); err != nil {
+		t.Fatalf("failed to insert fork block %d: %v", n, err)
+	}
+	if head := bc.CurrentBlock(); head.Hash() != second[1].Hash() {
+		t.Fatalf("head block mismatch: have %x, want %x", head.Hash(), second[1].Hash())
+	}
+	if head := bc.CurrentHeader(); head.Hash() != second[1].Hash() {
+		t.Errorf("head header mismatch: have %x, want %x", head.Hash(), second[1].Hash())
+	}
+	for number := uint64(3); number <= 4; number++ {
+		if hash := GetCanonicalHash(bc.chainDb, number); hash != (common.Hash{}) {
+			t.Errorf("stale canonical hash at #%d: %x", number, hash)
+		}
+	}
+}
+
 // Tests that the insertion functions detect banned hashes.
 func TestBadHeaderHashes(t *testing.T) { testBadHashes(t, false) }
 func TestBadBlockHashes(t *testing.T)  { testBadHashes(t, true) }
@@ -0,0 +1,364 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package core
+
+import (
+	"container/list"
+	"encoding/binary"
+	"sync"
+
+	gometrics "github.com/rcrowley/go-metrics"
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/core/types"
+	"github.com/trust-tech/go-trustmachine/metrics"
+)
+
+const (
+	chainCacheBudget = 32 * 1024 * 1024 // Memory allowance shared by all cached chain data
+	chainCacheAvg    = 2 * 1024         // Expected average entry size, used to size the frequency sketch
+	chainCacheWindow = 10               // Inverse fraction of the budget held by the fresh entry admission window
+
+	sketchDepth    = 4  // Number of counter rows in the frequency sketch
+	sketchMaxCount = 15 // Saturation value of a single frequency counter
+	sketchPeriod   = 10 // Sample size (in multiples of the row width) after which counters are halved
+
+	headerSizeEstimate = 512 // Approximate memory footprint of a block header
+)
+
+// chainCacheKind identifies the representation of a piece of chain data held
+// in the shared chain cache.
+type chainCacheKind uint8
+
+const (
+	cacheBody     chainCacheKind = iota // Decoded block body
+	cacheBodyRLP                        // RLP encoded block body
+	cacheBlock                          // Fully assembled block
+	cacheReceipts                       // Block receipts
+	cacheKinds
+)
+
+var cacheKindNames = [cacheKinds]string{"body", "bodyrlp", "block", "receipts"}
+
+var (
+	chainCacheHitMeters  [cacheKinds]gometrics.Meter
+	chainCacheMissMeters [cacheKinds]gometrics.Meter
+	chainCacheDropMeter  = metrics.NewMeter("chain/cache/reject")
+)
+
+func init() {
+	for kind, name := range cacheKindNames {
+		chainCacheHitMeters[kind] = metrics.NewMeter("chain/cache/" + name + "/hit")
+		chainCacheMissMeters[kind] = metrics.NewMeter("chain/cache/" + name + "/miss")
+	}
+}
+
+// chainCacheKey is the key of a chain cache entry.
+type chainCacheKey struct {
+	kind chainCacheKind
+	hash common.Hash
+}
+
+// chainCacheEntry is a single cached item along with its estimated size.
+type chainCacheEntry struct {
+	key    chainCacheKey
+	value  interface{}
+	size   int
+	window bool // Whether the entry is still in the admission window
+}
+
+// chainCache is a byte-budgeted cache for the bodies, blocks and receipts the
+// block chain serves. All representations share a single memory budget, so a
+// few huge blocks can't blow up memory use and many tiny ones aren't limited
+// by an arbitrary entry count.
+//
+// Eviction is least-recently-used, but admission is frequency based (TinyLFU):
+// a new entry may only displace the entries it would evict if it was accessed
+// more often than each of them. Access counts are tracked approximately in a
+// count-min sketch that is periodically halved, so the history favours recent
+// popularity. This keeps a one-off sequential scan (e.g. a syncing peer) from
+// flushing the blocks that are actually requested over and over.
+//
+// Data produced locally by block import has no access history yet, so it first
+// lands in a small admission window (W-TinyLFU). Entries falling out of the
+// window are offered to the main segment like any other, so a long import run
+// can displace at most the window's worth of popular data.
+//
+// Frequencies are counted per block hash, irrespective of representation, since
+// a popular block tends to be requested in all of its forms.
+type chainCache struct {
+	budget int                             // Maximum total size of the cached entries
+	used   int                             // Current total size of the cached entries
+	items  map[chainCacheKey]*list.Element // Entries by key, for lookups
+	recent *list.List                      // Admitted entries ordered by recency, most recent first
+	sketch *freqSketch                     // Approximate access frequencies
+
+	window       *list.List // Fresh entries awaiting admission, most recent first
+	windowBudget int        // Maximum total size of the entries in the window
+	windowUsed   int        // Current total size of the entries in the window
+
+	lock sync.Mutex
+}
+
+// newChainCache creates a chain data cache with the given memory budget in bytes.
+func newChainCache(budget int) *chainCache {
+	return &chainCache{
+		budget: budget,
+		items:  make(map[chainCacheKey]*list.Element),
+		recent: list.New(),
+		sketch: newFreqSketch(budget / chainCacheAvg),
+
+		window:       list.New(),
+		windowBudget: budget / chainCacheWindow,
+	}
+}
+
+// get retrieves a cached entry, recording the access for admission purposes
+// whether it's a hit or not.
+func (c *chainCache) get(kind chainCacheKind, hash common.Hash) (interface{}, bool) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	c.sketch.add(hash)
+	if elem, ok := c.items[chainCacheKey{kind, hash}]; ok {
+		c.touch(elem)
+		chainCacheHitMeters[kind].Mark(1)
+		return elem.Value.(*chainCacheEntry).value, true
+	}
+	chainCacheMissMeters[kind].Mark(1)
+	return nil, false
+}
+
+// peek retrieves a cached entry without updating its recency or frequency, nor
+// the hit statistics.
+func (c *chainCache) peek(kind chainCacheKind, hash common.Hash) (interface{}, bool) {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	if elem, ok := c.items[chainCacheKey{kind, hash}]; ok {
+		return elem.Value.(*chainCacheEntry).value, true
+	}
+	return nil, false
+}
+
+// add inserts an entry of the given estimated size into the cache, provided it
+// is more popular than everything it would need to evict. It reports whether
+// the entry was admitted.
+func (c *chainCache) add(kind chainCacheKind, hash common.Hash, value interface{}, size int) bool {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	return c.insert(kind, hash, value, size)
+}
+
+// addFresh inserts newly produced chain data (e.g. the receipts of an imported
+// block) into the admission window. Such entries have no access history yet,
+// but are the most likely ones to be needed next; they only have to earn their
+// place in the main segment once they are pushed out of the window.
+func (c *chainCache) addFresh(kind chainCacheKind, hash common.Hash, value interface{}, size int) bool {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	key := chainCacheKey{kind, hash}
+	if elem, ok := c.items[key]; ok {
+		c.update(elem, value, size)
+		return true
+	}
+	if size > c.windowBudget {
+		return c.insert(kind, hash, value, size)
+	}
+	c.items[key] = c.window.PushFront(&chainCacheEntry{key: key, value: value, size: size, window: true})
+	c.used += size
+	c.windowUsed += size
+	c.drain()
+	c.shrink(nil)
+	return true
+}
+
+// insert adds or updates an entry in the main segment, requiring it to beat all
+// its eviction victims in popularity. The cache lock must be held.
+func (c *chainCache) insert(kind chainCacheKind, hash common.Hash, value interface{}, size int) bool {
+	key := chainCacheKey{kind, hash}
+	if elem, ok := c.items[key]; ok {
+		c.update(elem, value, size)
+		return true
+	}
+	// Entries must fit beside a full window, so admitted ones can always be
+	// made room for by evicting from the main segment
+	if size > c.budget-c.windowBudget {
+		chainCacheDropMeter.Mark(1)
+		return false
+	}
+	// Make sure the candidate beats every victim before evicting anything
+	if need := c.used + size - c.budget; need > 0 {
+		freq := c.sketch.estimate(hash)
+		for elem := c.recent.Back(); need > 0; elem = elem.Prev() {
+			victim := elem.Value.(*chainCacheEntry)
+			if c.sketch.estimate(victim.key.hash) >= freq {
+				chainCacheDropMeter.Mark(1)
+				return false
+			}
+			need -= victim.size
+		}
+	}
+	c.items[key] = c.recent.PushFront(&chainCacheEntry{key: key, value: value, size: size})
+	c.used += size
+	c.shrink(nil)
+	return true
+}
+
+// update replaces the value of a cached entry in place (the size may have
+// changed). The cache lock must be held.
+func (c *chainCache) update(elem *list.Element, value interface{}, size int) {
+	entry := elem.Value.(*chainCacheEntry)
+	c.used += size - entry.size
+	if entry.window {
+		c.windowUsed += size - entry.size
+	}
+	entry.value, entry.size = value, size
+	c.touch(elem)
+	c.drain()
+	c.shrink(elem)
+}
+
+// touch marks an entry as the most recently used one of its segment.
+func (c *chainCache) touch(elem *list.Element) {
+	if elem.Value.(*chainCacheEntry).window {
+		c.window.MoveToFront(elem)
+	} else {
+		c.recent.MoveToFront(elem)
+	}
+}
+
+// drain moves the least recently used entries out of an overfull admission
+// window, offering each of them to the main segment.
+func (c *chainCache) drain() {
+	for c.windowUsed > c.windowBudget {
+		entry := c.evict(c.window.Back())
+		c.insert(entry.key.kind, entry.key.hash, entry.value, entry.size)
+	}
+}
+
+// shrink evicts least recently used entries from the main segment until the
+// cache fits its budget, never evicting the keep element.
+func (c *chainCache) shrink(keep *list.Element) {
+	for c.used > c.budget {
+		elem := c.recent.Back()
+		if elem == keep {
+			elem = elem.Prev()
+		}
+		if elem == nil {
+			return
+		}
+		c.evict(elem)
+	}
+}
+
+// evict drops a single entry from the cache, returning it.
+func (c *chainCache) evict(elem *list.Element) *chainCacheEntry {
+	entry := elem.Value.(*chainCacheEntry)
+	if entry.window {
+		c.window.Remove(elem)
+		c.windowUsed -= entry.size
+	} else {
+		c.recent.Remove(elem)
+	}
+	delete(c.items, entry.key)
+	c.used -= entry.size
+	return entry
+}
+
+// purge drops all cached entries. Access frequencies are retained.
+func (c *chainCache) purge() {
+	c.lock.Lock()
+	defer c.lock.Unlock()
+
+	c.items = make(map[chainCacheKey]*list.Element)
+	c.recent.Init()
+	c.window.Init()
+	c.used, c.windowUsed = 0, 0
+}
+
+// freqSketch is a count-min sketch of small saturating counters, estimating how
+// often individual hashes were accessed recently. Once enough accesses have been
+// sampled all counters are halved, aging out stale popularity.
+//
+// Since the counted keys are Keccak256 hashes, row positions are taken directly
+// from the key bytes instead of rehashing them.
+type freqSketch struct {
+	rows    [sketchDepth][]uint8
+	mask    uint64
+	samples int // Accesses counted since the last aging
+	period  int // Number of accesses after which counters are aged
+}
+
+// newFreqSketch creates a frequency sketch able to tell apart roughly the given
+// number of distinct hashes.
+func newFreqSketch(items int) *freqSketch {
+	width := 64
+	for width < items {
+		width <<= 1
+	}
+	s := &freqSketch{
+		mask:   uint64(width - 1),
+		period: sketchPeriod * width,
+	}
+	for i := range s.rows {
+		s.rows[i] = make([]uint8, width)
+	}
+	return s
+}
+
+// add records an access of the given hash.
+func (s *freqSketch) add(hash common.Hash) {
+	for i := range s.rows {
+		pos := binary.BigEndian.Uint64(hash[8*i:]) & s.mask
+		if s.rows[i][pos] < sketchMaxCount {
+			s.rows[i][pos]++
+		}
+	}
+	if s.samples++; s.samples >= s.period {
+		for _, row := range s.rows {
+			for j := range row {
+				row[j] >>= 1
+			}
+		}
+		s.samples /= 2
+	}
+}
+
+// estimate returns the approximate number of recent accesses of the given hash.
+func (s *freqSketch) estimate(hash common.Hash) uint8 {
+	min := uint8(sketchMaxCount)
+	for i := range s.rows {
+		if count := s.rows[i][binary.BigEndian.Uint64(hash[8*i:])&s.mask]; count < min {
+			min = count
+		}
+	}
+	return min
+}
+
+// receiptsSize approximates the memory footprint of a set of block receipts.
+func receiptsSize(receipts types.Receipts) int {
+	size := 0
+	for _, receipt := range receipts {
+		size += len(receipt.Bloom) + common.HashLength + common.AddressLength + 64
+		for _, log := range receipt.Logs {
+			size += common.AddressLength + len(log.Topics)*common.HashLength + len(log.Data) + 128
+		}
+	}
+	return size
+}
@@ -0,0 +1,171 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package core
+
+import (
+	"testing"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/crypto"
+)
+
+func cacheTestHash(i int) common.Hash {
+	return crypto.Keccak256Hash([]byte{byte(i >> 8), byte(i)})
+}
+
+// Tests that the chain cache never exceeds its byte budget, evicting the least
+// recently used entries to make room.
+func TestChainCacheBudget(t *testing.T) {
+	cache := newChainCache(1000)
+	for i := 0; i < 10; i++ {
+		cache.get(cacheBody, cacheTestHash(i))
+		if !cache.add(cacheBody, cacheTestHash(i), i, 100) {
+			t.Fatalf("entry %d: rejected from non-full cache", i)
+		}
+	}
+	// Touch the first entry and make room for a big, popular one
+	cache.get(cacheBody, cacheTestHash(0))
+	for i := 0; i < 3; i++ {
+		cache.get(cacheBlock, cacheTestHash(100))
+	}
+	if !cache.add(cacheBlock, cacheTestHash(100), 100, 350) {
+		t.Fatalf("popular entry rejected")
+	}
+	if cache.used > cache.budget {
+		t.Fatalf("budget exceeded: have %d, limit %d", cache.used, cache.budget)
+	}
+	if _, ok := cache.peek(cacheBody, cacheTestHash(0)); !ok {
+		t.Errorf("recently used entry evicted")
+	}
+	for i := 1; i <= 4; i++ {
+		if _, ok := cache.peek(cacheBody, cacheTestHash(i)); ok {
+			t.Errorf("entry %d: not evicted", i)
+		}
+	}
+	// Oversized entries must never be admitted
+	if cache.add(cacheBodyRLP, cacheTestHash(200), nil, 1001) {
+		t.Errorf("oversized entry admitted")
+	}
+}
+
+// Tests that a full cache only admits entries accessed more often than the ones
+// they would displace, so a one-off scan can't flush popular data.
+func TestChainCacheAdmission(t *testing.T) {
+	cache := newChainCache(1000)
+	for i := 0; i < 10; i++ {
+		for j := 0; j < 3; j++ {
+			cache.get(cacheBodyRLP, cacheTestHash(i))
+		}
+		cache.add(cacheBodyRLP, cacheTestHash(i), i, 100)
+	}
+	// Scan through a lot of cold entries, none should get in
+	for i := 10; i < 100; i++ {
+		cache.get(cacheBodyRLP, cacheTestHash(i))
+		if cache.add(cacheBodyRLP, cacheTestHash(i), i, 100) {
+			t.Fatalf("entry %d: cold entry admitted", i)
+		}
+	}
+	for i := 0; i < 10; i++ {
+		if _, ok := cache.peek(cacheBodyRLP, cacheTestHash(i)); !ok {
+			t.Errorf("entry %d: popular entry evicted", i)
+		}
+	}
+	// Once requested often enough, a new entry should make it in
+	for j := 0; j < 4; j++ {
+		cache.get(cacheBodyRLP, cacheTestHash(100))
+	}
+	if !cache.add(cacheBodyRLP, cacheTestHash(100), 100, 100) {
+		t.Fatalf("hot entry rejected")
+	}
+	// Purging should drop everything
+	cache.purge()
+	if cache.used != 0 || len(cache.items) != 0 || cache.recent.Len() != 0 || cache.window.Len() != 0 {
+		t.Fatalf("cache not empty after purge: used %d, items %d", cache.used, len(cache.items))
+	}
+}
+
+// Tests that freshly produced entries make it into a full cache through the
+// admission window, but a long stream of them can't flush the popular entries.
+func TestChainCacheFreshAdmission(t *testing.T) {
+	cache := newChainCache(1000)
+	for i := 0; i < 10; i++ {
+		for j := 0; j < 3; j++ {
+			cache.get(cacheReceipts, cacheTestHash(i))
+		}
+		cache.add(cacheReceipts, cacheTestHash(i), i, 100)
+	}
+	if !cache.addFresh(cacheReceipts, cacheTestHash(100), 100, 100) {
+		t.Fatalf("fresh entry rejected")
+	}
+	if cached, ok := cache.get(cacheReceipts, cacheTestHash(100)); !ok || cached.(int) != 100 {
+		t.Fatalf("fresh entry not retrievable: have %v, %v", cached, ok)
+	}
+	// Import a lot more, only the window's worth of popular entries may go
+	for i := 101; i < 200; i++ {
+		cache.addFresh(cacheReceipts, cacheTestHash(i), i, 50)
+		if cache.used > cache.budget || cache.windowUsed > cache.windowBudget {
+			t.Fatalf("entry %d: budget exceeded: have %d/%d, limit %d/%d", i, cache.used, cache.windowUsed, cache.budget, cache.windowBudget)
+		}
+	}
+	for i := 1; i < 10; i++ {
+		if _, ok := cache.peek(cacheReceipts, cacheTestHash(i)); !ok {
+			t.Errorf("entry %d: popular entry evicted", i)
+		}
+	}
+	for _, i := range []int{100, 150} {
+		if _, ok := cache.peek(cacheReceipts, cacheTestHash(i)); ok {
+			t.Errorf("entry %d: cold fresh entry admitted", i)
+		}
+	}
+	if _, ok := cache.peek(cacheReceipts, cacheTestHash(199)); !ok {
+		t.Errorf("latest fresh entry not in window")
+	}
+	// Fresh entries requested while in the window should get admitted
+	for j := 0; j < 4; j++ {
+		cache.get(cacheReceipts, cacheTestHash(199))
+	}
+	for i := 200; i < 210; i++ {
+		cache.addFresh(cacheReceipts, cacheTestHash(i), i, 50)
+	}
+	if _, ok := cache.peek(cacheReceipts, cacheTestHash(199)); !ok {
+		t.Errorf("hot fresh entry not admitted")
+	}
+}
+
+// Tests that the frequency sketch ages its counters, so past popularity fades.
+func TestFreqSketchAging(t *testing.T) {
+	sketch := newFreqSketch(64)
+
+	hot := cacheTestHash(0)
+	for i := 0; i < 10; i++ {
+		sketch.add(hot)
+	}
+	if freq := sketch.estimate(hot); freq != 10 {
+		t.Fatalf("frequency mismatch: have %d, want 10", freq)
+	}
+	// Feed other accesses until the counters are halved once
+	for i := 1; ; i++ {
+		before := sketch.samples
+		sketch.add(cacheTestHash(i))
+		if sketch.samples < before {
+			break
+		}
+	}
+	if freq := sketch.estimate(hot); freq > 7 {
+		t.Fatalf("frequency not aged: have %d, want <= 7", freq)
+	}
+}
@@ -314,7 +314,7 @@ func GetReceipt(db entrustdb.Database, hash common.Hash) (*types.Receipt, common
 }
 
 // WriteCanonicalHash stores the canonical hash for the given block number.
-func WriteCanonicalHash(db entrustdb.Database, hash common.Hash, number uint64) error {
+func WriteCanonicalHash(db entrustdb.Putter, hash common.Hash, number uint64) error {
 	key := append(append(headerPrefix, encodeBlockNumber(number)...), numSuffix...)
 	if err := db.Put(key, hash.Bytes()); err != nil {
 		log.Crit("Failed to store number to hash mapping", "err", err)
@@ -435,7 +435,19 @@ func WriteBlockReceipts(db entrustdb.Database, hash common.Hash, number uint64,
 // a block, enabling hash based transaction and receipt lookups.
 func WriteTxLookupEntries(db entrustdb.Database, block *types.Block) error {
 	batch := db.NewBatch()
+	if err := writeTxLookupEntries(batch, block); err != nil {
+		return err
+	}
+	// Write the scheduled data into the database
+	if err := batch.Write(); err != nil {
+		log.Crit("Failed to store lookup entries", "err", err)
+	}
+	return nil
+}
 
+// writeTxLookupEntries schedules the positional metadata of every transaction
+// from a block into the given writer, typically a batch owned by the caller.
+func writeTxLookupEntries(db entrustdb.Putter, block *types.Block) error {
 	// Iterate over each transaction and encode its metadata
 	for i, tx := range block.Transactions() {
 		entry := txLookupEntry{
@@ -447,19 +459,15 @@ func WriteTxLookupEntries(db entrustdb.Database, block *types.Block) error {
 		if err != nil {
 			return err
 		}
-		if err := batch.Put(append(lookupPrefix, tx.Hash().Bytes()...), data); err != nil {
+		if err := db.Put(append(lookupPrefix, tx.Hash().Bytes()...), data); err != nil {
 			return err
 		}
 	}
-	// Write the scheduled data into the database
-	if err := batch.Write(); err != nil {
-		log.Crit("Failed to store lookup entries", "err", err)
-	}
 	return nil
 }
 
 // DeleteCanonicalHash removes the number to hash canonical mapping.
-func DeleteCanonicalHash(db entrustdb.Database, number uint64) {
+func DeleteCanonicalHash(db entrustdb.Deleter, number uint64) {
 	db.Delete(append(append(headerPrefix, encodeBlockNumber(number)...), numSuffix...))
 }
 
@@ -493,7 +501,7 @@ func DeleteBlockReceipts(db entrustdb.Database, hash common.Hash, number uint64)
 }
 
 // DeleteTxLookupEntry removes all transaction data associated with a hash.
-func DeleteTxLookupEntry(db entrustdb.Database, hash common.Hash) {
+func DeleteTxLookupEntry(db entrustdb.Deleter, hash common.Hash) {
 	db.Delete(append(lookupPrefix, hash.Bytes()...))
 }
 
@@ -532,6 +540,54 @@ func WriteMipmapBloom(db entrustdb.Database, number uint64, receipts types.Recei
 	return nil
 }
 
+// mipmapBloomBatch accumulates the MIP bloom bin updates of several blocks, so
+// that every affected bin is read from the database and written back only once.
+//
+// Note, the owner must hold mipmapBloomMu from the first add until the flushed
+// batch has been written to the database.
+type mipmapBloomBatch struct {
+	db   entrustdb.Database
+	bins map[string]*types.Bloom
+}
+
+// newMipmapBloomBatch creates an empty MIP bloom accumulator on top of db.
+func newMipmapBloomBatch(db entrustdb.Database) *mipmapBloomBatch {
+	return &mipmapBloomBatch{
+		db:   db,
+		bins: make(map[string]*types.Bloom),
+	}
+}
+
+// add merges each address included in the receipts' logs into the bins that
+// cover the given block number.
+func (b *mipmapBloomBatch) add(number uint64, receipts types.Receipts) {
+	for _, level := range MIPMapLevels {
+		key := string(mipmapKey(number, level))
+		bloom, ok := b.bins[key]
+		if !ok {
+			bloomDat, _ := b.db.Get([]byte(key))
+			bin := types.BytesToBloom(bloomDat)
+			bloom = &bin
+			b.bins[key] = bloom
+		}
+		for _, receipt := range receipts {
+			for _, log := range receipt.Logs {
+				bloom.Add(log.Address.Big())
+			}
+		}
+	}
+}
+
+// flush schedules all the accumulated bins into the given writer.
+func (b *mipmapBloomBatch) flush(db entrustdb.Putter) error {
+	for key, bloom := range b.bins {
+		if err := db.Put([]byte(key), bloom.Bytes()); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
 // GetMipmapBloom returns a bloom filter using the number and level as input
 // parameters. For available levels see MIPMapLevels.
 func GetMipmapBloom(db entrustdb.Database, number, level uint64) types.Bloom {
@@ -0,0 +1,216 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package core
+
+import (
+	"container/heap"
+	"sync"
+	"time"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/core/types"
+)
+
+// futureBlock is a block waiting in the future queue, along with the unix time
+// it may be imported at.
+type futureBlock struct {
+	block *types.Block
+	due   uint64
+	index int // Position in the heap, -1 once popped
+}
+
+// futureHeap is a min-heap of queued blocks ordered by due time, then number.
+type futureHeap []*futureBlock
+
+func (h futureHeap) Len() int { return len(h) }
+func (h futureHeap) Less(i, j int) bool {
+	if h[i].due != h[j].due {
+		return h[i].due < h[j].due
+	}
+	return h[i].block.NumberU64() < h[j].block.NumberU64()
+}
+func (h futureHeap) Swap(i, j int) {
+	h[i], h[j] = h[j], h[i]
+	h[i].index, h[j].index = i, j
+}
+func (h *futureHeap) Push(x interface{}) {
+	item := x.(*futureBlock)
+	item.index = len(*h)
+	*h = append(*h, item)
+}
+func (h *futureHeap) Pop() interface{} {
+	old := *h
+	item := old[len(old)-1]
+	old[len(old)-1] = nil
+	*h = old[:len(old)-1]
+	item.index = -1
+	return item
+}
+
+// futureQueue holds blocks that arrived ahead of the local clock (or that build
+// on such blocks) until they become valid for import.
+//
+// Blocks are kept in a heap ordered by the time they become due, so the chain
+// can sleep exactly until the earliest one may be imported, instead of polling
+// and re-verifying everything that's queued. A block descending from another
+// queued block is never due before its parent.
+//
+// The queue holds at most limit blocks. When full, the block due furthest in
+// the future is dropped, since it's the one most likely to be superseded.
+type futureQueue struct {
+	blocks map[common.Hash]*futureBlock
+	queue  futureHeap
+	limit  int
+	wake   chan struct{} // Notification that the earliest due time changed
+	lock   sync.Mutex
+}
+
+// newFutureQueue creates an empty future block queue holding at most limit blocks.
+func newFutureQueue(limit int) *futureQueue {
+	return &futureQueue{
+		blocks: make(map[common.Hash]*futureBlock),
+		limit:  limit,
+		wake:   make(chan struct{}, 1),
+	}
+}
+
+// add queues a block until its timestamp (and that of its queued ancestors) is
+// reached. It reports whether the block is queued after the call.
+func (q *futureQueue) add(block *types.Block) bool {
+	q.lock.Lock()
+	defer q.lock.Unlock()
+
+	hash := block.Hash()
+	if _, ok := q.blocks[hash]; ok {
+		return true
+	}
+	due := block.Time().Uint64()
+	if parent, ok := q.blocks[block.ParentHash()]; ok && parent.due > due {
+		due = parent.due
+	}
+	item := &futureBlock{block: block, due: due}
+	heap.Push(&q.queue, item)
+	q.blocks[hash] = item
+
+	if len(q.queue) > q.limit {
+		// Over the limit, drop the block due last (a leaf of the heap)
+		last := len(q.queue) / 2
+		for i := last + 1; i < len(q.queue); i++ {
+			if q.queue.Less(last, i) {
+				last = i
+			}
+		}
+		drop := q.queue[last]
+		heap.Remove(&q.queue, last)
+		delete(q.blocks, drop.block.Hash())
+		if drop == item {
+			return false
+		}
+	}
+	if q.queue[0] == item {
+		select {
+		case q.wake <- struct{}{}:
+		default:
+		}
+	}
+	return true
+}
+
+// contains reports whether a block is currently queued.
+func (q *futureQueue) contains(hash common.Hash) bool {
+	q.lock.Lock()
+	defer q.lock.Unlock()
+
+	_, ok := q.blocks[hash]
+	return ok
+}
+
+// remove drops a block from the queue, if present.
+func (q *futureQueue) remove(hash common.Hash) {
+	q.lock.Lock()
+	defer q.lock.Unlock()
+
+	if item, ok := q.blocks[hash]; ok {
+		heap.Remove(&q.queue, item.index)
+		delete(q.blocks, hash)
+	}
+}
+
+// purge drops all queued blocks.
+func (q *futureQueue) purge() {
+	q.lock.Lock()
+	defer q.lock.Unlock()
+
+	q.blocks = make(map[common.Hash]*futureBlock)
+	q.queue = nil
+}
+
+// len returns the number of queued blocks.
+func (q *futureQueue) len() int {
+	q.lock.Lock()
+	defer q.lock.Unlock()
+
+	return len(q.queue)
+}
+
+// next returns the time the earliest queued block becomes due, or false if the
+// queue is empty.
+func (q *futureQueue) next() (time.Time, bool) {
+	q.lock.Lock()
+	defer q.lock.Unlock()
+
+	if len(q.queue) == 0 {
+		return time.Time{}, false
+	}
+	return time.Unix(int64(q.queue[0].due), 0), true
+}
+
+// pop removes all the blocks due at the given time from the queue, and returns
+// them split into batches of contiguous chain segments, in ascending order.
+func (q *futureQueue) pop(now time.Time) []types.Blocks {
+	q.lock.Lock()
+	defer q.lock.Unlock()
+
+	var due types.Blocks
+	for len(q.queue) > 0 && int64(q.queue[0].due) <= now.Unix() {
+		item := heap.Pop(&q.queue).(*futureBlock)
+		delete(q.blocks, item.block.Hash())
+		due = append(due, item.block)
+	}
+	if len(due) == 0 {
+		return nil
+	}
+	types.BlockBy(types.Number).Sort(due)
+
+	// Group the blocks into segments that can be imported in one go. Each block
+	// is appended to the segment ending with its parent, if any.
+	var (
+		batches []types.Blocks
+		tails   = make(map[common.Hash]int)
+	)
+	for _, block := range due {
+		if i, ok := tails[block.ParentHash()]; ok {
+			delete(tails, block.ParentHash())
+			batches[i] = append(batches[i], block)
+			tails[block.Hash()] = i
+			continue
+		}
+		tails[block.Hash()] = len(batches)
+		batches = append(batches, types.Blocks{block})
+	}
+	return batches
+}
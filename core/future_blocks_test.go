@@ -0,0 +1,180 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package core
+
+import (
+	"math/big"
+	"testing"
+	"time"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/consensus/entrustash"
+	"github.com/trust-tech/go-trustmachine/core/types"
+	"github.com/trust-tech/go-trustmachine/core/vm"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+	"github.com/trust-tech/go-trustmachine/event"
+	"github.com/trust-tech/go-trustmachine/params"
+)
+
+// makeFutureChain creates a chain of header-only blocks starting at the given
+// time, one second apart.
+func makeFutureChain(parent common.Hash, number uint64, start int64, n int, extra byte) types.Blocks {
+	blocks := make(types.Blocks, n)
+	for i := range blocks {
+		blocks[i] = types.NewBlockWithHeader(&types.Header{
+			ParentHash: parent,
+			Number:     new(big.Int).SetUint64(number + uint64(i)),
+			Time:       big.NewInt(start + int64(i)),
+			Extra:      []byte{extra},
+		})
+		parent = blocks[i].Hash()
+	}
+	return blocks
+}
+
+// Tests that only due blocks are popped from the future queue, grouped into
+// contiguous chain segments.
+func TestFutureQueuePop(t *testing.T) {
+	queue := newFutureQueue(16)
+
+	// Queue two competing chains out of order
+	a := makeFutureChain(common.Hash{0x01}, 10, 100, 4, 'a')
+	b := makeFutureChain(common.Hash{0x01}, 10, 101, 4, 'b')
+	for i := len(a) - 1; i >= 0; i-- {
+		queue.add(a[i])
+		queue.add(b[i])
+	}
+	if next, _ := queue.next(); next.Unix() != 100 {
+		t.Fatalf("next due time mismatch: have %d, want 100", next.Unix())
+	}
+	if batches := queue.pop(time.Unix(99, 0)); len(batches) != 0 {
+		t.Fatalf("popped %d batches before due time", len(batches))
+	}
+	batches := queue.pop(time.Unix(102, 0))
+	if len(batches) != 2 {
+		t.Fatalf("batch count mismatch: have %d, want 2", len(batches))
+	}
+	if len(batches[0]) != 3 || batches[0][0] != a[0] || batches[0][2] != a[2] {
+		t.Errorf("first batch mismatch: have %v", batches[0])
+	}
+	if len(batches[1]) != 2 || batches[1][0] != b[0] || batches[1][1] != b[1] {
+		t.Errorf("second batch mismatch: have %v", batches[1])
+	}
+	if queue.len() != 3 || !queue.contains(a[3].Hash()) || queue.contains(a[2].Hash()) {
+		t.Errorf("remaining blocks mismatch")
+	}
+}
+
+// Tests that blocks descending from queued ones are never due before their
+// ancestors, even if their own timestamp is earlier.
+func TestFutureQueueAncestry(t *testing.T) {
+	queue := newFutureQueue(16)
+
+	parent := makeFutureChain(common.Hash{}, 1, 200, 1, 0)[0]
+	child := makeFutureChain(parent.Hash(), 2, 150, 1, 0)[0]
+	queue.add(parent)
+	queue.add(child)
+
+	if batches := queue.pop(time.Unix(199, 0)); len(batches) != 0 {
+		t.Fatalf("child popped before its parent")
+	}
+	if batches := queue.pop(time.Unix(200, 0)); len(batches) != 1 || len(batches[0]) != 2 {
+		t.Fatalf("parent and child not popped together: %v", batches)
+	}
+}
+
+// Tests that the queue is capped, dropping the blocks due last.
+func TestFutureQueueLimit(t *testing.T) {
+	queue := newFutureQueue(8)
+
+	blocks := makeFutureChain(common.Hash{}, 1, 1000, 16, 0)
+	for i := 15; i >= 8; i-- {
+		queue.add(blocks[i])
+	}
+	for i := 0; i < 8; i++ {
+		if !queue.add(blocks[i]) {
+			t.Fatalf("block %d: early block rejected", i)
+		}
+	}
+	if queue.add(makeFutureChain(common.Hash{}, 1, 2000, 1, 0)[0]) {
+		t.Fatalf("late block accepted into full queue")
+	}
+	if queue.len() != 8 {
+		t.Fatalf("queue size mismatch: have %d, want 8", queue.len())
+	}
+	for i, block := range blocks {
+		if queue.contains(block.Hash()) != (i < 8) {
+			t.Errorf("block %d: presence mismatch", i)
+		}
+	}
+	queue.remove(blocks[0].Hash())
+	if next, _ := queue.next(); next.Unix() != 1001 {
+		t.Fatalf("next due time mismatch after removal: have %d, want 1001", next.Unix())
+	}
+}
+
+// Tests that a blockchain imports a future block as soon as it becomes valid,
+// rather than on some polling interval.
+func TestFutureBlockImportLatency(t *testing.T) {
+	db, _ := entrustdb.NewMemDatabase()
+	genesis := (&Genesis{Config: params.TestChainConfig}).MustCommit(db)
+	blockchain, _ := NewBlockChain(db, params.TestChainConfig, entrustash.NewFaker(), new(event.TypeMux), vm.Config{})
+	defer blockchain.Stop()
+
+	// Wait for a fresh second to maximize the time the block stays in the future
+	now := time.Now()
+	time.Sleep(time.Unix(now.Unix()+1, 0).Sub(now))
+
+	due := time.Now().Unix() + 2
+	blocks, _ := GenerateChain(params.TestChainConfig, genesis, db, 1, func(i int, b *BlockGen) {
+		b.OffsetTime(due - b.header.Time.Int64())
+	})
+	if _, err := blockchain.InsertChain(blocks); err != nil {
+		t.Fatalf("failed to queue future block: %v", err)
+	}
+	if blockchain.CurrentBlock().Hash() == blocks[0].Hash() {
+		t.Fatalf("future block imported immediately")
+	}
+	for time.Now().Before(time.Unix(due, 0).Add(time.Second)) {
+		if blockchain.CurrentBlock().Hash() == blocks[0].Hash() {
+			if delay := time.Now().Sub(time.Unix(due, 0)); delay < 0 {
+				t.Fatalf("future block imported %v early", -delay)
+			}
+			return
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	t.Fatalf("future block not imported within a second of becoming valid")
+}
+
+// Benchmarks the scheduling overhead of a future queue with a full backlog of
+// blocks, only a few of which become due each time.
+func BenchmarkFutureQueue(b *testing.B) {
+	queue := newFutureQueue(maxFutureBlocks)
+	blocks := makeFutureChain(common.Hash{}, 1, 0, b.N+maxFutureBlocks, 0)
+	for _, block := range blocks[:maxFutureBlocks] {
+		queue.add(block)
+	}
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		queue.add(blocks[maxFutureBlocks+i])
+		queue.next()
+		queue.pop(time.Unix(int64(i), 0))
+	}
+}
@@ -59,20 +59,28 @@ type Genesis struct {
 	Number     uint64      `json:"number"`
 	GasUsed    uint64      `json:"gasUsed"`
 	ParentHash common.Hash `json:"parentHash"`
+
+	// allocFile is the JSON genesis file the allocation is streamed from when
+	// writing the state, instead of Alloc (see LoadGenesis).
+	allocFile string
 }
 
 // GenesisAlloc specifies the initial state that is part of the genesis block.
 type GenesisAlloc map[common.Address]GenesisAccount
 
+// UnmarshalJSON decodes the accounts of the allocation one by one, without first
+// collecting them into an intermediate map. The whole allocation still ends up in
+// memory; use LoadGenesis or ImportGenesisAlloc to stream large ones instead.
 func (ga *GenesisAlloc) UnmarshalJSON(data []byte) error {
-	m := make(map[common.UnprefixedAddress]GenesisAccount)
-	if err := json.Unmarshal(data, &m); err != nil {
+	alloc := make(GenesisAlloc)
+	err := decodeGenesisAlloc(json.NewDecoder(bytes.NewReader(data)), func(addr common.Address, account GenesisAccount) error {
+		alloc[addr] = account
+		return nil
+	})
+	if err != nil {
 		return err
 	}
-	*ga = make(GenesisAlloc)
-	for addr, a := range m {
-		(*ga)[common.Address(addr)] = a
-	}
+	*ga = alloc
 	return nil
 }
 
@@ -169,7 +177,10 @@ func SetupGenesisBlock(db entrustdb.Database, genesis *Genesis) (*params.ChainCo
 
 	// Check whether the genesis block is already written.
 	if genesis != nil {
-		block, _ := genesis.ToBlock()
+		block, err := genesis.toBlock(discardDatabase{})
+		if err != nil {
+			return genesis.Config, common.Hash{}, err
+		}
 		hash := block.Hash()
 		if hash != stored {
 			return genesis.Config, block.Hash(), &GenesisMismatchError{stored, hash}
@@ -223,16 +234,29 @@ func (g *Genesis) configOrDefault(ghash common.Hash) *params.ChainConfig {
 // ToBlock creates the block and state of a genesis specification.
 func (g *Genesis) ToBlock() (*types.Block, *state.StateDB) {
 	db, _ := entrustdb.NewMemDatabase()
-	statedb, _ := state.New(common.Hash{}, state.NewDatabase(db))
-	for addr, account := range g.Alloc {
-		statedb.AddBalance(addr, account.Balance)
-		statedb.SetCode(addr, account.Code)
-		statedb.SetNonce(addr, account.Nonce)
-		for key, value := range account.Storage {
-			statedb.SetState(addr, key, value)
-		}
+	block, err := g.toBlock(db)
+	if err != nil {
+		panic(err) // can't fail writing into memory
+	}
+	statedb, _ := state.New(block.Root(), state.NewDatabase(db))
+	return block, statedb
+}
+
+// toBlock writes the state of a genesis specification into db and assembles the
+// genesis block on top of it.
+func (g *Genesis) toBlock(db entrustdb.Database) (*types.Block, error) {
+	var (
+		root common.Hash
+		err  error
+	)
+	if g.allocFile != "" {
+		root, err = importGenesisFile(db, g.allocFile)
+	} else {
+		root, err = g.Alloc.write(db)
+	}
+	if err != nil {
+		return nil, err
 	}
-	root := statedb.IntermediateRoot(false)
 	head := &types.Header{
 		Number:     new(big.Int).SetUint64(g.Number),
 		Nonce:      types.EncodeNonce(g.Nonce),
@@ -252,17 +276,17 @@ func (g *Genesis) ToBlock() (*types.Block, *state.StateDB) {
 	if g.Difficulty == nil {
 		head.Difficulty = params.GenesisDifficulty
 	}
-	return types.NewBlock(head, nil, nil, nil), statedb
+	return types.NewBlock(head, nil, nil, nil), nil
 }
 
 // Commit writes the block and state of a genesis specification to the database.
 // The block is committed as the canonical head block.
 func (g *Genesis) Commit(db entrustdb.Database) (*types.Block, error) {
-	block, statedb := g.ToBlock()
-	if block.Number().Sign() != 0 {
+	if g.Number != 0 {
 		return nil, fmt.Errorf("can't commit genesis block with number > 0")
 	}
-	if _, err := statedb.CommitTo(db, false); err != nil {
+	block, err := g.toBlock(db)
+	if err != nil {
 		return nil, fmt.Errorf("cannot write state: %v", err)
 	}
 	if err := WriteTd(db, block.Hash(), block.NumberU64(), g.Difficulty); err != nil {
@@ -0,0 +1,337 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package core
+
+import (
+	"bytes"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"io"
+	"math/big"
+	"os"
+	"sort"
+	"strings"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/core/state"
+	"github.com/trust-tech/go-trustmachine/crypto"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+	"github.com/trust-tech/go-trustmachine/rlp"
+	"github.com/trust-tech/go-trustmachine/trie"
+)
+
+// genesisBatchSize is the amount of data accumulated before a genesis state
+// write batch is flushed to the database.
+const genesisBatchSize = 100 * 1024
+
+var emptyCodeHash = crypto.Keccak256(nil)
+
+// genesisBatch is a database writer that transparently flushes its pending
+// writes in fixed size batches.
+type genesisBatch struct {
+	db    entrustdb.Database
+	batch entrustdb.Batch
+	size  int
+}
+
+func newGenesisBatch(db entrustdb.Database) *genesisBatch {
+	return &genesisBatch{db: db, batch: db.NewBatch()}
+}
+
+// Put implements trie.DatabaseWriter, flushing the batch when it grows too big.
+func (b *genesisBatch) Put(key, value []byte) error {
+	if err := b.batch.Put(key, value); err != nil {
+		return err
+	}
+	if b.size += len(key) + len(value); b.size >= genesisBatchSize {
+		return b.flush()
+	}
+	return nil
+}
+
+// flush writes out any pending data and starts a new batch.
+func (b *genesisBatch) flush() error {
+	if b.size == 0 {
+		return nil
+	}
+	if err := b.batch.Write(); err != nil {
+		return err
+	}
+	b.batch, b.size = b.db.NewBatch(), 0
+	return nil
+}
+
+// genesisEntry is an encoded trie entry of the genesis state (an account or a
+// storage slot), keyed by the hash of its address or storage key.
+type genesisEntry struct {
+	hash common.Hash
+	blob []byte
+}
+
+// genesisEntries implements sort.Interface to order trie entries by key hash.
+type genesisEntries []genesisEntry
+
+func (e genesisEntries) Len() int           { return len(e) }
+func (e genesisEntries) Less(i, j int) bool { return bytes.Compare(e[i].hash[:], e[j].hash[:]) < 0 }
+func (e genesisEntries) Swap(i, j int)      { e[i], e[j] = e[j], e[i] }
+
+// genesisStateBuilder assembles the state of a genesis allocation directly as
+// tries, without going through the caching and journaling of state.StateDB.
+// Storage tries are built as soon as an account is added; the account trie is
+// built once all accounts are known, since it requires them sorted by hash.
+// Only the hashes and encodings of the accounts are kept in memory meanwhile.
+type genesisStateBuilder struct {
+	batch    *genesisBatch
+	accounts genesisEntries
+}
+
+func newGenesisStateBuilder(db entrustdb.Database) *genesisStateBuilder {
+	return &genesisStateBuilder{batch: newGenesisBatch(db)}
+}
+
+// add writes the code and storage of an account into the database and queues
+// the account itself for insertion into the state trie.
+func (b *genesisStateBuilder) add(addr common.Address, account GenesisAccount) error {
+	// Store the contract code, if any
+	codeHash := emptyCodeHash
+	if len(account.Code) > 0 {
+		codeHash = crypto.Keccak256(account.Code)
+		if err := b.batch.Put(codeHash, account.Code); err != nil {
+			return err
+		}
+	}
+	// Build the storage trie of the account, skipping zero slots like SetState does
+	slots := make(genesisEntries, 0, len(account.Storage))
+	for key, value := range account.Storage {
+		if value == (common.Hash{}) {
+			continue
+		}
+		hash := crypto.Keccak256Hash(key[:])
+		if err := trie.WritePreimage(b.batch, hash[:], common.CopyBytes(key[:])); err != nil {
+			return err
+		}
+		blob, _ := rlp.EncodeToBytes(bytes.TrimLeft(value[:], "\x00"))
+		slots = append(slots, genesisEntry{hash, blob})
+	}
+	sort.Sort(slots)
+
+	storage := trie.NewBuilder(b.batch)
+	for _, slot := range slots {
+		if err := storage.Add(slot.hash[:], slot.blob); err != nil {
+			return err
+		}
+	}
+	root, err := storage.Commit()
+	if err != nil {
+		return err
+	}
+	// Encode the account and queue it up for the state trie
+	balance := account.Balance
+	if balance == nil {
+		balance = new(big.Int)
+	}
+	blob, err := rlp.EncodeToBytes(state.Account{
+		Nonce:    account.Nonce,
+		Balance:  balance,
+		Root:     root,
+		CodeHash: codeHash,
+	})
+	if err != nil {
+		return err
+	}
+	hash := crypto.Keccak256Hash(addr[:])
+	if err := trie.WritePreimage(b.batch, hash[:], common.CopyBytes(addr[:])); err != nil {
+		return err
+	}
+	b.accounts = append(b.accounts, genesisEntry{hash, blob})
+	return nil
+}
+
+// commit builds the state trie from all the added accounts, flushes every
+// pending write and returns the state root.
+func (b *genesisStateBuilder) commit() (common.Hash, error) {
+	sort.Sort(b.accounts)
+	builder := trie.NewBuilder(b.batch)
+	for i, account := range b.accounts {
+		if i > 0 && account.hash == b.accounts[i-1].hash {
+			return common.Hash{}, fmt.Errorf("duplicate genesis account %x", account.hash)
+		}
+		if err := builder.Add(account.hash[:], account.blob); err != nil {
+			return common.Hash{}, err
+		}
+	}
+	root, err := builder.Commit()
+	if err != nil {
+		return common.Hash{}, err
+	}
+	b.accounts = nil
+	return root, b.batch.flush()
+}
+
+// write stores the state of the genesis allocation into db, returning its root.
+func (ga GenesisAlloc) write(db entrustdb.Database) (common.Hash, error) {
+	builder := newGenesisStateBuilder(db)
+	for addr, account := range ga {
+		if err := builder.add(addr, account); err != nil {
+			return common.Hash{}, err
+		}
+	}
+	return builder.commit()
+}
+
+// ImportGenesisAlloc parses a JSON encoded genesis allocation from r and writes
+// its state into db, returning the state root. Contrary to decoding the alloc
+// into a GenesisAlloc first, accounts are processed one by one as they are read,
+// so memory use stays proportional to the hashes of the accounts, not their
+// full contents.
+func ImportGenesisAlloc(db entrustdb.Database, r io.Reader) (common.Hash, error) {
+	builder := newGenesisStateBuilder(db)
+	if err := decodeGenesisAlloc(json.NewDecoder(r), builder.add); err != nil {
+		return common.Hash{}, err
+	}
+	return builder.commit()
+}
+
+// LoadGenesis reads a JSON genesis specification from the given file. The
+// allocation is only validated, not kept: whenever the genesis state is written,
+// its accounts are streamed from the file again, so arbitrarily large ones can be
+// imported.
+func LoadGenesis(path string) (*Genesis, error) {
+	file, err := os.Open(path)
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+
+	dec := json.NewDecoder(file)
+	fields := make(map[string]json.RawMessage)
+	err = decodeGenesisFields(dec, func(key string) error {
+		if strings.EqualFold(key, "alloc") {
+			fields[key] = json.RawMessage("{}")
+			return decodeGenesisAlloc(dec, func(common.Address, GenesisAccount) error { return nil })
+		}
+		var value json.RawMessage
+		if err := dec.Decode(&value); err != nil {
+			return err
+		}
+		fields[key] = value
+		return nil
+	})
+	if err != nil {
+		return nil, err
+	}
+	// Decode everything else the usual way, with a placeholder allocation
+	blob, err := json.Marshal(fields)
+	if err != nil {
+		return nil, err
+	}
+	genesis := new(Genesis)
+	if err := json.Unmarshal(blob, genesis); err != nil {
+		return nil, err
+	}
+	genesis.allocFile = path
+	return genesis, nil
+}
+
+// importGenesisFile streams the allocation of a JSON genesis file into db,
+// returning the state root.
+func importGenesisFile(db entrustdb.Database, path string) (common.Hash, error) {
+	file, err := os.Open(path)
+	if err != nil {
+		return common.Hash{}, err
+	}
+	defer file.Close()
+
+	builder := newGenesisStateBuilder(db)
+	dec := json.NewDecoder(file)
+	err = decodeGenesisFields(dec, func(key string) error {
+		if strings.EqualFold(key, "alloc") {
+			return decodeGenesisAlloc(dec, builder.add)
+		}
+		var skip json.RawMessage
+		return dec.Decode(&skip)
+	})
+	if err != nil {
+		return common.Hash{}, err
+	}
+	return builder.commit()
+}
+
+// decodeGenesisFields iterates over the top level fields of a JSON genesis
+// specification, invoking fn with each key. fn must consume the field's value
+// from dec.
+func decodeGenesisFields(dec *json.Decoder, fn func(key string) error) error {
+	if tok, err := dec.Token(); err != nil {
+		return err
+	} else if tok != json.Delim('{') {
+		return fmt.Errorf("invalid genesis: expected object, got %v", tok)
+	}
+	for dec.More() {
+		tok, err := dec.Token()
+		if err != nil {
+			return err
+		}
+		if err := fn(tok.(string)); err != nil {
+			return err
+		}
+	}
+	_, err := dec.Token()
+	return err
+}
+
+// discardDatabase is a database dropping all writes, used to compute the hash of
+// a genesis block without keeping its state.
+type discardDatabase struct{}
+
+func (discardDatabase) Put(key []byte, value []byte) error { return nil }
+func (discardDatabase) Delete(key []byte) error            { return nil }
+func (discardDatabase) Get(key []byte) ([]byte, error)     { return nil, errors.New("not found") }
+func (discardDatabase) Close()                             {}
+func (db discardDatabase) NewBatch() entrustdb.Batch       { return db }
+func (discardDatabase) Write() error                       { return nil }
+
+// decodeGenesisAlloc streams the accounts of a JSON genesis allocation object
+// from dec, invoking fn for each of them in the order they appear.
+func decodeGenesisAlloc(dec *json.Decoder, fn func(common.Address, GenesisAccount) error) error {
+	if tok, err := dec.Token(); err != nil {
+		return err
+	} else if tok == nil {
+		return nil // null alloc, nothing to decode
+	} else if tok != json.Delim('{') {
+		return fmt.Errorf("invalid genesis alloc: expected object, got %v", tok)
+	}
+	for dec.More() {
+		tok, err := dec.Token()
+		if err != nil {
+			return err
+		}
+		var addr common.UnprefixedAddress
+		if err := addr.UnmarshalText([]byte(tok.(string))); err != nil {
+			return err
+		}
+		var account GenesisAccount
+		if err := dec.Decode(&account); err != nil {
+			return err
+		}
+		if err := fn(common.Address(addr), account); err != nil {
+			return err
+		}
+	}
+	_, err := dec.Token()
+	return err
+}
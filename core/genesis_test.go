@@ -17,13 +17,18 @@
 package core
 
 import (
+	"bytes"
+	"encoding/json"
+	"io/ioutil"
 	"math/big"
+	"os"
 	"reflect"
 	"testing"
 
 	"github.com/davecgh/go-spew/spew"
 	"github.com/trust-tech/go-trustmachine/common"
 	"github.com/trust-tech/go-trustmachine/consensus/entrustash"
+	"github.com/trust-tech/go-trustmachine/core/state"
 	"github.com/trust-tech/go-trustmachine/core/vm"
 	"github.com/trust-tech/go-trustmachine/entrustdb"
 	"github.com/trust-tech/go-trustmachine/event"
@@ -159,3 +164,152 @@ func TestSetupGenesis(t *testing.T) {
 		}
 	}
 }
+
+// makeGenesisAlloc creates a deterministic genesis allocation with the given
+// number of accounts, every tenth of them being a contract with some storage.
+func makeGenesisAlloc(accounts int) GenesisAlloc {
+	alloc := make(GenesisAlloc, accounts)
+	for i := 0; i < accounts; i++ {
+		addr := common.BigToAddress(big.NewInt(int64(i + 1)))
+		account := GenesisAccount{Balance: big.NewInt(int64(i) * 1000000007), Nonce: uint64(i % 3)}
+		if i%10 == 0 {
+			account.Code = []byte{0x60, 0x00, byte(i), byte(i >> 8), 0xf3}
+			account.Storage = make(map[common.Hash]common.Hash)
+			for j := 0; j < i%7; j++ {
+				account.Storage[common.BigToHash(big.NewInt(int64(j)))] = common.BigToHash(big.NewInt(int64(i*j + j)))
+			}
+			account.Storage[common.BigToHash(big.NewInt(1000))] = common.Hash{} // zero slot, must be skipped
+		}
+		alloc[addr] = account
+	}
+	return alloc
+}
+
+// commitGenesisStateDB writes a genesis allocation through a journaled StateDB,
+// which is the reference the direct trie construction must agree with.
+func commitGenesisStateDB(db entrustdb.Database, alloc GenesisAlloc) common.Hash {
+	statedb, _ := state.New(common.Hash{}, state.NewDatabase(db))
+	for addr, account := range alloc {
+		statedb.AddBalance(addr, account.Balance)
+		statedb.SetCode(addr, account.Code)
+		statedb.SetNonce(addr, account.Nonce)
+		for key, value := range account.Storage {
+			statedb.SetState(addr, key, value)
+		}
+	}
+	root, _ := statedb.CommitTo(db, false)
+	return root
+}
+
+// Tests that the genesis state is constructed identically to filling it into a
+// StateDB, both from an in-memory alloc and when streamed from JSON.
+func TestGenesisState(t *testing.T) {
+	alloc := makeGenesisAlloc(1000)
+
+	refdb, _ := entrustdb.NewMemDatabase()
+	want := commitGenesisStateDB(refdb, alloc)
+
+	db, _ := entrustdb.NewMemDatabase()
+	root, err := alloc.write(db)
+	if err != nil {
+		t.Fatalf("failed to write genesis state: %v", err)
+	}
+	if root != want {
+		t.Fatalf("state root mismatch: have %x, want %x", root, want)
+	}
+	for _, key := range refdb.Keys() {
+		if have, _ := db.Get(key); have == nil {
+			t.Fatalf("database entry %x missing", key)
+		}
+	}
+	blob, err := json.Marshal(alloc)
+	if err != nil {
+		t.Fatalf("failed to encode alloc: %v", err)
+	}
+	db, _ = entrustdb.NewMemDatabase()
+	if root, err = ImportGenesisAlloc(db, bytes.NewReader(blob)); err != nil {
+		t.Fatalf("failed to import genesis alloc: %v", err)
+	}
+	if root != want {
+		t.Fatalf("imported state root mismatch: have %x, want %x", root, want)
+	}
+	var decoded GenesisAlloc
+	if err := json.Unmarshal(blob, &decoded); err != nil {
+		t.Fatalf("failed to decode alloc: %v", err)
+	}
+	if len(decoded) != len(alloc) {
+		t.Fatalf("decoded alloc size mismatch: have %d, want %d", len(decoded), len(alloc))
+	}
+}
+
+// Tests that a genesis loaded from a file, with its allocation streamed from it,
+// produces the same block as the fully decoded specification.
+func TestLoadGenesis(t *testing.T) {
+	genesis := &Genesis{
+		Config:     params.TestChainConfig,
+		Difficulty: big.NewInt(131072),
+		GasLimit:   4712388,
+		ExtraData:  []byte("loaded"),
+		Alloc:      makeGenesisAlloc(1000),
+	}
+	blob, err := json.Marshal(genesis)
+	if err != nil {
+		t.Fatalf("failed to encode genesis: %v", err)
+	}
+	file, err := ioutil.TempFile("", "genesis")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.Remove(file.Name())
+	file.Write(blob)
+	file.Close()
+
+	loaded, err := LoadGenesis(file.Name())
+	if err != nil {
+		t.Fatalf("failed to load genesis: %v", err)
+	}
+	if len(loaded.Alloc) != 0 {
+		t.Fatalf("alloc decoded into memory: %d accounts", len(loaded.Alloc))
+	}
+	want, _ := genesis.ToBlock()
+	db, _ := entrustdb.NewMemDatabase()
+	config, hash, err := SetupGenesisBlock(db, loaded)
+	if err != nil {
+		t.Fatalf("failed to set up genesis: %v", err)
+	}
+	if hash != want.Hash() {
+		t.Fatalf("genesis hash mismatch: have %x, want %x", hash, want.Hash())
+	}
+	if !reflect.DeepEqual(config, genesis.Config) {
+		t.Fatalf("chain config mismatch: have %v, want %v", config, genesis.Config)
+	}
+	// Setting up the same genesis again must match the stored one
+	if _, hash, err = SetupGenesisBlock(db, loaded); err != nil || hash != want.Hash() {
+		t.Fatalf("repeated setup mismatch: hash %x, err %v", hash, err)
+	}
+	if _, err := state.New(want.Root(), state.NewDatabase(db)); err != nil {
+		t.Fatalf("genesis state missing: %v", err)
+	}
+}
+
+func BenchmarkGenesisCommit10K(b *testing.B)        { benchGenesisCommit(b, 10000, false) }
+func BenchmarkGenesisCommit1M(b *testing.B)         { benchGenesisCommit(b, 1000000, false) }
+func BenchmarkGenesisCommitStateDB10K(b *testing.B) { benchGenesisCommit(b, 10000, true) }
+func BenchmarkGenesisCommitStateDB1M(b *testing.B)  { benchGenesisCommit(b, 1000000, true) }
+
+// benchGenesisCommit measures the time and memory needed to write the state of
+// a large genesis allocation, either directly or through a StateDB.
+func benchGenesisCommit(b *testing.B, accounts int, statedb bool) {
+	alloc := makeGenesisAlloc(accounts)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		db, _ := entrustdb.NewMemDatabase()
+		if statedb {
+			commitGenesisStateDB(db, alloc)
+		} else if _, err := alloc.write(db); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
@@ -29,6 +29,9 @@ import (
 // Trie cache generation limit after which to evic trie nodes from memory.
 var MaxTrieCacheGen = uint16(120)
 
+// Keys of the state tries whose preimages are recorded, for dumps and debugging.
+var TriePreimageMode = trie.PreimagesAll
+
 const (
 	// Number of past tries to keep. This value is chosen such that
 	// reasonable chain reorg depths will hit an existing trie.
@@ -63,11 +66,44 @@ type Trie interface {
 	GetKey([]byte) []byte // TODO(fjl): remove this when SecureTrie is removed
 }
 
+// traverse returns a node iterator for a full traversal of a trie. Tries able to
+// resolve the upcoming nodes concurrently (all but the light client's) do so.
+func traverse(t Trie) trie.NodeIterator {
+	if t, ok := t.(interface {
+		PrefetchNodeIterator(start []byte) trie.NodeIterator
+	}); ok {
+		return t.PrefetchNodeIterator(nil)
+	}
+	return t.NodeIterator(nil)
+}
+
 // NewDatabase creates a backing store for state. The returned database is safe for
 // concurrent use and retains cached trie nodes in memory.
 func NewDatabase(db entrustdb.Database) Database {
 	csc, _ := lru.New(codeSizeCacheSize)
-	return &cachingDB{db: db, codeSizeCache: csc}
+	return &cachingDB{
+		db:            db,
+		codeSizeCache: csc,
+		nodes:         newNodeCache(NodeCacheSize),
+		preimages:     trie.NewPreimages(TriePreimageMode),
+	}
+}
+
+// NewPrefetchDatabase creates a view of a state database for prefetching state
+// on behalf of its other users. Reading through it loads the trie nodes into the
+// shared node cache, tracking how many of them are eventually used.
+func NewPrefetchDatabase(db Database) Database {
+	cdb, ok := db.(*cachingDB)
+	if !ok {
+		return db
+	}
+	return &cachingDB{
+		db:            cdb.db,
+		codeSizeCache: cdb.codeSizeCache,
+		nodes:         cdb.nodes,
+		preimages:     cdb.preimages,
+		prefetch:      true,
+	}
 }
 
 type cachingDB struct {
@@ -75,6 +111,14 @@ type cachingDB struct {
 	mu            sync.Mutex
 	pastTries     []*trie.SecureTrie
 	codeSizeCache *lru.Cache
+	nodes         *nodeCache      // Trie nodes shared by all tries
+	preimages     *trie.Preimages // Preimages of the trie keys, written on state commit
+	prefetch      bool            // Whether the database is a prefetching view
+}
+
+// trieDB returns the database to open tries on, reading through the node cache.
+func (db *cachingDB) trieDB() trie.Database {
+	return &nodeDatabase{db: db.db, cache: db.nodes, prefetch: db.prefetch}
 }
 
 func (db *cachingDB) OpenTrie(root common.Hash) (Trie, error) {
@@ -86,14 +130,18 @@ func (db *cachingDB) OpenTrie(root common.Hash) (Trie, error) {
 			return cachedTrie{db.pastTries[i].Copy(), db}, nil
 		}
 	}
-	tr, err := trie.NewSecure(root, db.db, MaxTrieCacheGen)
+	tr, err := trie.NewSecure(root, db.trieDB(), MaxTrieCacheGen)
 	if err != nil {
 		return nil, err
 	}
+	tr.SetPreimages(db.preimages)
 	return cachedTrie{tr, db}, nil
 }
 
 func (db *cachingDB) pushTrie(t *trie.SecureTrie) {
+	if db.prefetch {
+		return
+	}
 	db.mu.Lock()
 	defer db.mu.Unlock()
 
@@ -106,13 +154,20 @@ func (db *cachingDB) pushTrie(t *trie.SecureTrie) {
 }
 
 func (db *cachingDB) OpenStorageTrie(addrHash, root common.Hash) (Trie, error) {
-	return trie.NewSecure(root, db.db, 0)
+	tr, err := trie.NewSecure(root, db.trieDB(), 0)
+	if err != nil {
+		return nil, err
+	}
+	tr.SetPreimages(db.preimages)
+	return storageTrie{tr, db.nodes}, nil
 }
 
 func (db *cachingDB) CopyTrie(t Trie) Trie {
 	switch t := t.(type) {
 	case cachedTrie:
 		return cachedTrie{t.SecureTrie.Copy(), db}
+	case storageTrie:
+		return storageTrie{t.SecureTrie.Copy(), t.nodes}
 	case *trie.SecureTrie:
 		return t.Copy()
 	default:
@@ -146,9 +201,26 @@ type cachedTrie struct {
 }
 
 func (m cachedTrie) CommitTo(dbw trie.DatabaseWriter) (common.Hash, error) {
-	root, err := m.SecureTrie.CommitTo(dbw)
+	w := newNodeWriter(dbw, m.db.nodes)
+	root, err := m.SecureTrie.CommitTo(w)
 	if err == nil {
+		w.flush()
 		m.db.pushTrie(m.SecureTrie)
 	}
 	return root, err
 }
+
+// storageTrie adds its nodes to the node cache on commit.
+type storageTrie struct {
+	*trie.SecureTrie
+	nodes *nodeCache
+}
+
+func (m storageTrie) CommitTo(dbw trie.DatabaseWriter) (common.Hash, error) {
+	w := newNodeWriter(dbw, m.nodes)
+	root, err := m.SecureTrie.CommitTo(w)
+	if err == nil {
+		w.flush()
+	}
+	return root, err
+}
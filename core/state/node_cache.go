@@ -0,0 +1,134 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package state
+
+import (
+	lru "github.com/hashicorp/golang-lru"
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+	"github.com/trust-tech/go-trustmachine/metrics"
+	"github.com/trust-tech/go-trustmachine/trie"
+)
+
+// Number of trie nodes kept in the shared node cache.
+var NodeCacheSize = 65536
+
+var (
+	nodeCacheHitMeter  = metrics.NewMeter("state/nodecache/hit")
+	nodeCacheMissMeter = metrics.NewMeter("state/nodecache/miss")
+	prefetchLoadMeter  = metrics.NewMeter("state/prefetch/load")
+	prefetchHitMeter   = metrics.NewMeter("state/prefetch/hit")
+	prefetchWasteMeter = metrics.NewMeter("state/prefetch/waste")
+)
+
+// cachedNode is an encoded trie node in the node cache. Prefetched nodes are
+// replaced by plain ones on their first use, the ones evicted unused count as
+// wasted prefetching.
+type cachedNode struct {
+	blob       []byte
+	prefetched bool
+}
+
+// nodeCache is a cache of the encoded trie nodes, shared by all the tries of a
+// state database. Nodes are keyed by their hash, so entries never go stale.
+type nodeCache struct {
+	nodes *lru.Cache
+}
+
+func newNodeCache(size int) *nodeCache {
+	nodes, _ := lru.NewWithEvict(size, func(key, value interface{}) {
+		if value.(*cachedNode).prefetched {
+			prefetchWasteMeter.Mark(1)
+		}
+	})
+	return &nodeCache{nodes: nodes}
+}
+
+// nodeDatabase is a trie database serving nodes from a node cache. Nodes read
+// from disk and written on commit are added to the cache.
+type nodeDatabase struct {
+	db       entrustdb.Database
+	cache    *nodeCache
+	prefetch bool // Whether the reads are prefetching for another user
+}
+
+func (db *nodeDatabase) Get(key []byte) ([]byte, error) {
+	// Only trie nodes are keyed by plain hashes, anything else goes to disk
+	if len(key) != common.HashLength {
+		return db.db.Get(key)
+	}
+	hash := common.BytesToHash(key)
+	if cached, ok := db.cache.nodes.Get(hash); ok {
+		node := cached.(*cachedNode)
+		if node.prefetched && !db.prefetch {
+			prefetchHitMeter.Mark(1)
+			db.cache.nodes.Add(hash, &cachedNode{blob: node.blob})
+		}
+		if !db.prefetch {
+			nodeCacheHitMeter.Mark(1)
+		}
+		return node.blob, nil
+	}
+	blob, err := db.db.Get(key)
+	if err != nil {
+		return nil, err
+	}
+	if db.prefetch {
+		prefetchLoadMeter.Mark(1)
+	} else {
+		nodeCacheMissMeter.Mark(1)
+	}
+	db.cache.nodes.Add(hash, &cachedNode{blob: blob, prefetched: db.prefetch})
+	return blob, nil
+}
+
+func (db *nodeDatabase) Put(key, value []byte) error {
+	return db.db.Put(key, value)
+}
+
+// nodeWriter collects the trie nodes committed to a database writer, to add
+// them to the cache once they are written. Nodes put into a batch are not
+// collected, as the batch may never be written; they are cached on first read.
+type nodeWriter struct {
+	trie.DatabaseWriter
+	cache   *nodeCache
+	written map[common.Hash][]byte
+}
+
+func newNodeWriter(dbw trie.DatabaseWriter, cache *nodeCache) *nodeWriter {
+	return &nodeWriter{DatabaseWriter: dbw, cache: cache, written: make(map[common.Hash][]byte)}
+}
+
+func (w *nodeWriter) Put(key, value []byte) error {
+	if err := w.DatabaseWriter.Put(key, value); err != nil {
+		return err
+	}
+	if _, batch := w.DatabaseWriter.(entrustdb.Batch); !batch && len(key) == common.HashLength {
+		// The trie reuses the value slice across calls
+		w.written[common.BytesToHash(key)] = common.CopyBytes(value)
+	}
+	return nil
+}
+
+// flush adds the nodes written so far to the cache. It must only be called once
+// the commit succeeded.
+func (w *nodeWriter) flush() {
+	for hash, blob := range w.written {
+		w.cache.nodes.Add(hash, &cachedNode{blob: blob})
+	}
+	w.written = make(map[common.Hash][]byte)
+}
@@ -0,0 +1,149 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package state
+
+import (
+	"errors"
+	"math/big"
+	"testing"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+)
+
+// countingDatabase is a database counting the reads of trie nodes.
+type countingDatabase struct {
+	*entrustdb.MemDatabase
+	reads int
+}
+
+func (db *countingDatabase) Get(key []byte) ([]byte, error) {
+	if len(key) == common.HashLength {
+		db.reads++
+	}
+	return db.MemDatabase.Get(key)
+}
+
+// Tests that the state read through a prefetching view of a database is served
+// to its other users from the shared node cache.
+func TestPrefetchDatabase(t *testing.T) {
+	mem, _ := entrustdb.NewMemDatabase()
+	diskdb := &countingDatabase{MemDatabase: mem}
+
+	// Create some state with storage and commit it straight to disk
+	state, _ := New(common.Hash{}, NewDatabase(diskdb))
+	for i := byte(0); i < 64; i++ {
+		addr := common.BytesToAddress([]byte{i})
+		state.AddBalance(addr, big.NewInt(int64(i)+1))
+		for j := byte(0); j < 8; j++ {
+			state.SetState(addr, common.Hash{j}, common.Hash{i, j})
+		}
+	}
+	root, err := state.CommitTo(diskdb, false)
+	if err != nil {
+		t.Fatalf("failed to commit state: %v", err)
+	}
+	// Prefetch half of the accounts on a fresh database
+	db := NewDatabase(diskdb)
+	prefetch, _ := New(root, NewPrefetchDatabase(db))
+	for i := byte(0); i < 64; i += 2 {
+		prefetch.GetState(common.BytesToAddress([]byte{i}), common.Hash{1})
+	}
+	if diskdb.reads == 0 {
+		t.Fatalf("nothing prefetched")
+	}
+	// Read the prefetched state, it must all come from the cache
+	diskdb.reads = 0
+	state, _ = New(root, db)
+	for i := byte(0); i < 64; i += 2 {
+		addr := common.BytesToAddress([]byte{i})
+		if balance := state.GetBalance(addr); balance.Int64() != int64(i)+1 {
+			t.Fatalf("account %d: balance mismatch: have %v, want %d", i, balance, i+1)
+		}
+		if value := state.GetState(addr, common.Hash{1}); value != (common.Hash{i, 1}) {
+			t.Fatalf("account %d: storage mismatch: have %x, want %x", i, value, common.Hash{i, 1})
+		}
+	}
+	if diskdb.reads != 0 {
+		t.Errorf("prefetched nodes read again: %d reads", diskdb.reads)
+	}
+	// The prefetched nodes were all used, none of them may count as waste
+	nodes := db.(*cachingDB).nodes.nodes
+	for _, key := range nodes.Keys() {
+		if node, _ := nodes.Peek(key); node.(*cachedNode).prefetched {
+			t.Errorf("used node %x still marked prefetched", key)
+		}
+	}
+}
+
+// failingWriter is a database writer failing after a number of writes.
+type failingWriter struct {
+	*entrustdb.MemDatabase
+	left int
+}
+
+func (w *failingWriter) Put(key, value []byte) error {
+	if w.left--; w.left < 0 {
+		return errors.New("disk full")
+	}
+	return w.MemDatabase.Put(key, value)
+}
+
+// Tests that committed nodes only get into the node cache once they are surely
+// written to disk.
+func TestNodeCacheCommit(t *testing.T) {
+	newState := func() (*StateDB, *nodeCache) {
+		mem, _ := entrustdb.NewMemDatabase()
+		db := NewDatabase(mem)
+		state, _ := New(common.Hash{}, db)
+		for i := byte(0); i < 16; i++ {
+			addr := common.BytesToAddress([]byte{i})
+			state.AddBalance(addr, big.NewInt(1))
+			state.SetState(addr, common.Hash{i}, common.Hash{i})
+		}
+		return state, db.(*cachingDB).nodes
+	}
+	// Nodes put into a batch may never be written
+	state, nodes := newState()
+	mem, _ := entrustdb.NewMemDatabase()
+	if _, err := state.CommitTo(mem.NewBatch(), false); err != nil {
+		t.Fatalf("failed to commit state: %v", err)
+	}
+	if n := nodes.nodes.Len(); n != 0 {
+		t.Errorf("batched nodes cached: %d", n)
+	}
+	// Nodes of a failed trie commit may be missing their children on disk
+	state, nodes = newState()
+	mem, _ = entrustdb.NewMemDatabase()
+	if _, err := state.CommitTo(&failingWriter{MemDatabase: mem, left: 20}, false); err == nil {
+		t.Fatalf("commit succeeded on failing writer")
+	}
+	for _, key := range nodes.nodes.Keys() {
+		if _, err := mem.Get(key.(common.Hash).Bytes()); err != nil {
+			t.Errorf("unwritten node %x cached", key)
+		}
+	}
+	// Nodes written straight to disk should be cached
+	state, nodes = newState()
+	mem, _ = entrustdb.NewMemDatabase()
+	if _, err := state.CommitTo(mem, false); err != nil {
+		t.Fatalf("failed to commit state: %v", err)
+	}
+	if nodes.nodes.Len() == 0 {
+		t.Errorf("written nodes not cached")
+	}
+}
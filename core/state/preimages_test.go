@@ -0,0 +1,147 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package state
+
+import (
+	"io/ioutil"
+	"math/big"
+	"os"
+	"testing"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+	"github.com/trust-tech/go-trustmachine/trie"
+)
+
+// writeCountingDatabase is a database counting the writes made to it.
+type writeCountingDatabase struct {
+	entrustdb.Database
+	puts, batches int
+}
+
+func (db *writeCountingDatabase) Put(key, value []byte) error {
+	db.puts++
+	return db.Database.Put(key, value)
+}
+
+func (db *writeCountingDatabase) NewBatch() entrustdb.Batch {
+	return &writeCountingBatch{Batch: db.Database.NewBatch(), db: db}
+}
+
+type writeCountingBatch struct {
+	entrustdb.Batch
+	db *writeCountingDatabase
+}
+
+func (b *writeCountingBatch) Write() error {
+	b.db.batches++
+	return b.Batch.Write()
+}
+
+// Tests that the preimages of all the tries committed with a state are written
+// in a single batch, and can be used to dump the state afterwards.
+func TestCommitPreimages(t *testing.T) {
+	mem, _ := entrustdb.NewMemDatabase()
+	db := &writeCountingDatabase{Database: mem}
+
+	state, _ := New(common.Hash{}, NewDatabase(db))
+	for i := byte(0); i < 16; i++ {
+		addr := common.BytesToAddress([]byte{i})
+		state.AddBalance(addr, big.NewInt(1))
+		state.SetState(addr, common.Hash{i}, common.Hash{i + 1})
+	}
+	root, err := state.CommitTo(db, false)
+	if err != nil {
+		t.Fatalf("failed to commit state: %v", err)
+	}
+	if db.batches != 1 {
+		t.Fatalf("preimage batch count mismatch: have %d, want 1", db.batches)
+	}
+	state, _ = New(root, NewDatabase(db))
+	dump := state.RawDump()
+	if len(dump.Accounts) != 16 {
+		t.Fatalf("dumped account count mismatch: have %d, want 16", len(dump.Accounts))
+	}
+	for addr, account := range dump.Accounts {
+		if len(account.Storage) != 1 {
+			t.Fatalf("account %s: dumped storage mismatch: have %v", addr, account.Storage)
+		}
+	}
+}
+
+func BenchmarkCommitPreimagesDirect(b *testing.B) {
+	benchmarkCommitPreimages(b, false, trie.PreimagesAll)
+}
+func BenchmarkCommitPreimagesAll(b *testing.B) { benchmarkCommitPreimages(b, true, trie.PreimagesAll) }
+func BenchmarkCommitPreimagesSampled(b *testing.B) {
+	benchmarkCommitPreimages(b, true, trie.PreimagesSampled)
+}
+func BenchmarkCommitPreimagesNone(b *testing.B) {
+	benchmarkCommitPreimages(b, true, trie.PreimagesNone)
+}
+
+// benchmarkCommitPreimages commits state changes to a disk database, updating
+// 100 of 1000 accounts and 4 storage slots of each per commit, and reports the
+// database writes per commit. Direct commits write every preimage on its own as
+// SecureTrie does by default, the others collect them in the given mode.
+func benchmarkCommitPreimages(b *testing.B, collect bool, mode trie.PreimageMode) {
+	dir, err := ioutil.TempDir("", "state-preimages-")
+	if err != nil {
+		b.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	ldb, err := entrustdb.NewLDBDatabase(dir, 128, 128)
+	if err != nil {
+		b.Fatal(err)
+	}
+	defer ldb.Close()
+	db := &writeCountingDatabase{Database: ldb}
+
+	defer func(mode trie.PreimageMode) { TriePreimageMode = mode }(TriePreimageMode)
+	TriePreimageMode = mode
+	sdb := NewDatabase(db)
+	if !collect {
+		sdb.(*cachingDB).preimages = nil
+	}
+	root := common.Hash{}
+	commit := func(round int) {
+		state, _ := New(root, sdb)
+		for i := 0; i < 100; i++ {
+			n := (round*100 + i) % 1000
+			addr := common.BytesToAddress([]byte{byte(n / 256), byte(n)})
+			state.AddBalance(addr, big.NewInt(1))
+			for j := byte(0); j < 4; j++ {
+				state.SetState(addr, common.Hash{j}, common.BigToHash(big.NewInt(int64(round+2))))
+			}
+		}
+		if root, err = state.CommitTo(db, false); err != nil {
+			b.Fatalf("failed to commit state: %v", err)
+		}
+	}
+	for i := 0; i < 10; i++ {
+		commit(i)
+	}
+	db.puts, db.batches = 0, 0
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		commit(i)
+	}
+	b.StopTimer()
+	b.ReportMetric(float64(db.puts)/float64(b.N), "puts/op")
+	b.ReportMetric(float64(db.batches)/float64(b.N), "batches/op")
+}
@@ -26,6 +26,7 @@ import (
 	"github.com/trust-tech/go-trustmachine/common"
 	"github.com/trust-tech/go-trustmachine/core/types"
 	"github.com/trust-tech/go-trustmachine/crypto"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
 	"github.com/trust-tech/go-trustmachine/log"
 	"github.com/trust-tech/go-trustmachine/rlp"
 	"github.com/trust-tech/go-trustmachine/trie"
@@ -618,5 +619,23 @@ func (s *StateDB) CommitTo(dbw trie.DatabaseWriter, deleteEmptyObjects bool) (ro
 	// Write trie changes.
 	root, err = s.trie.CommitTo(dbw)
 	log.Debug("Trie cache stats after commit", "misses", trie.CacheMisses(), "unloads", trie.CacheUnloads())
-	return root, err
+	if err != nil {
+		return root, err
+	}
+	// Write the preimages of the keys of all the committed tries at once
+	if db, ok := s.db.(*cachingDB); ok && db.preimages != nil && db.preimages.Len() > 0 {
+		if err := writePreimages(db.preimages, dbw); err != nil {
+			return common.Hash{}, err
+		}
+	}
+	return root, nil
+}
+
+// writePreimages flushes the collected trie key preimages to dbw, in a batch if
+// it's a database.
+func writePreimages(preimages *trie.Preimages, dbw trie.DatabaseWriter) error {
+	if db, ok := dbw.(entrustdb.Database); ok {
+		return preimages.Flush(db.NewBatch())
+	}
+	return preimages.Flush(dbw)
 }
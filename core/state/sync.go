@@ -30,8 +30,9 @@ import (
 // and reconstructs the state database step by step until all is done.
 type StateSync trie.TrieSync
 
-// NewStateSync create a new state trie download scheduler.
-func NewStateSync(root common.Hash, database trie.DatabaseReader) *StateSync {
+// NewStateSync create a new state trie download scheduler. The optional bloom
+// filter is used to skip database lookups for state entries not yet known.
+func NewStateSync(root common.Hash, database trie.DatabaseReader, bloom *trie.SyncBloom) *StateSync {
 	var syncer *trie.TrieSync
 
 	callback := func(leaf []byte, parent common.Hash) error {
@@ -49,7 +50,7 @@ func NewStateSync(root common.Hash, database trie.DatabaseReader) *StateSync {
 
 		return nil
 	}
-	syncer = trie.NewTrieSync(root, database, callback)
+	syncer = trie.NewTrieSync(root, database, callback, bloom)
 	return (*StateSync)(syncer)
 }
 
@@ -65,6 +66,13 @@ func (s *StateSync) Process(list []trie.SyncResult) (bool, int, error) {
 	return (*trie.TrieSync)(s).Process(list)
 }
 
+// ProcessBatch injects a batch of retrieved trie nodes data, skipping the ones
+// not requested or already processed and returning their numbers, as well as
+// the index of an entry if processing of it failed.
+func (s *StateSync) ProcessBatch(list []trie.SyncResult) (bool, int, int, int, error) {
+	return (*trie.TrieSync)(s).ProcessBatch(list)
+}
+
 // Commit flushes the data stored in the internal memcache out to persistent
 // storage, returning th enumber of items written and any occurred error.
 func (s *StateSync) Commit(dbw trie.DatabaseWriter) (int, error) {
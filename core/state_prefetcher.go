@@ -0,0 +1,83 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package core
+
+import (
+	"sync/atomic"
+
+	"github.com/trust-tech/go-trustmachine/core/state"
+	"github.com/trust-tech/go-trustmachine/core/types"
+	"github.com/trust-tech/go-trustmachine/core/vm"
+	"github.com/trust-tech/go-trustmachine/params"
+)
+
+// statePrefetcher is a basic Prefetcher, which warms the state caches with the
+// accounts and storage a block is going to touch, ahead of its processing.
+//
+// statePrefetcher implements Prefetcher.
+type statePrefetcher struct {
+	config *params.ChainConfig // Chain configuration options
+	bc     *BlockChain         // Canonical block chain
+}
+
+// newStatePrefetcher initialises a new statePrefetcher.
+func newStatePrefetcher(config *params.ChainConfig, bc *BlockChain) *statePrefetcher {
+	return &statePrefetcher{
+		config: config,
+		bc:     bc,
+	}
+}
+
+// Prefetch loads the accounts the transactions of a block send from and to, then
+// runs the transactions on the throwaway statedb to load the storage and the
+// contracts they touch. The statedb may predate the block's parent, so failures
+// are ignored: the state is only read to get it into the caches. Prefetching
+// stops as soon as interrupt is set.
+func (p *statePrefetcher) Prefetch(block *types.Block, statedb *state.StateDB, cfg vm.Config, interrupt *uint32) {
+	var (
+		header = block.Header()
+		signer = types.MakeSigner(p.config, header.Number)
+	)
+	// The senders and recipients are known upfront, get them in first. This also
+	// caches the senders in the transactions for the processing.
+	for _, tx := range block.Transactions() {
+		if atomic.LoadUint32(interrupt) == 1 {
+			return
+		}
+		if from, err := types.Sender(signer, tx); err == nil {
+			statedb.Exist(from)
+		}
+		if to := tx.To(); to != nil {
+			statedb.Exist(*to)
+		}
+	}
+	// Run the transactions for the rest of the state they touch
+	for i, tx := range block.Transactions() {
+		if atomic.LoadUint32(interrupt) == 1 {
+			return
+		}
+		from, err := types.Sender(signer, tx)
+		if err != nil {
+			continue
+		}
+		msg := types.NewMessage(from, tx.To(), tx.Nonce(), tx.Value(), tx.Gas(), tx.GasPrice(), tx.Data(), false)
+
+		statedb.Prepare(tx.Hash(), block.Hash(), i)
+		vmenv := vm.NewEVM(NewEVMContext(msg, header, p.bc, nil), statedb, p.config, cfg)
+		ApplyMessage(vmenv, msg, new(GasPool).AddGas(tx.Gas()))
+	}
+}
@@ -22,6 +22,7 @@ import (
 	"math/big"
 	"sort"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/trust-tech/go-trustmachine/common"
@@ -167,6 +168,9 @@ type TxPool struct {
 	all     map[common.Hash]*types.Transaction // All transactions to allow lookups
 	priced  *txPricedList                      // All transactions sorted by price
 
+	snapshot atomic.Value // Last *TxPoolSnapshot of the content, for lock free introspection
+	version  uint64       // Content version, increased on every change to invalidate the snapshot (atomic)
+
 	wg   sync.WaitGroup // for shutdown sync
 	quit chan struct{}
 
@@ -348,6 +352,13 @@ func (pool *TxPool) Content() (map[common.Address]types.Transactions, map[common
 	pool.mu.RLock()
 	defer pool.mu.RUnlock()
 
+	return pool.content()
+}
+
+// content retrieves the data content of the transaction pool.
+//
+// Note, this method assumes the pool lock is held!
+func (pool *TxPool) content() (map[common.Address]types.Transactions, map[common.Address]types.Transactions) {
 	pending := make(map[common.Address]types.Transactions)
 	for addr, list := range pool.pending {
 		pending[addr] = list.Flatten()
@@ -359,6 +370,30 @@ func (pool *TxPool) Content() (map[common.Address]types.Transactions, map[common
 	return pending, queued
 }
 
+// Snapshot retrieves an immutable snapshot of the current content of the
+// transaction pool. As long as the pool doesn't change, the same snapshot is
+// returned without taking the pool lock; after a change, the next call takes a
+// new one.
+func (pool *TxPool) Snapshot() *TxPoolSnapshot {
+	if snap, _ := pool.snapshot.Load().(*TxPoolSnapshot); snap != nil && snap.version == atomic.LoadUint64(&pool.version) {
+		return snap
+	}
+	pool.mu.RLock()
+	snap := NewTxPoolSnapshot(pool.content())
+	snap.version = atomic.LoadUint64(&pool.version)
+	pool.mu.RUnlock()
+
+	pool.snapshot.Store(snap)
+	return snap
+}
+
+// changed invalidates the content snapshot after a change to the pool.
+//
+// Note, this method assumes the pool lock is held!
+func (pool *TxPool) changed() {
+	atomic.AddUint64(&pool.version, 1)
+}
+
 // Pending retrieves all currently processable transactions, groupped by origin
 // account and sorted by nonce. The returned transaction set is a copy and can be
 // freely modified by calling code.
@@ -473,6 +508,7 @@ func (pool *TxPool) add(tx *types.Transaction, local bool) (bool, error) {
 		}
 		pool.all[tx.Hash()] = tx
 		pool.priced.Put(tx)
+		pool.changed()
 
 		log.Trace("Pooled new executable transaction", "hash", hash, "from", from, "to", tx.To())
 		return old != nil, nil
@@ -512,6 +548,7 @@ func (pool *TxPool) enqueueTx(hash common.Hash, tx *types.Transaction) (bool, er
 	}
 	pool.all[hash] = tx
 	pool.priced.Put(tx)
+	pool.changed()
 	return old != nil, nil
 }
 
@@ -519,6 +556,8 @@ func (pool *TxPool) enqueueTx(hash common.Hash, tx *types.Transaction) (bool, er
 //
 // Note, this method assumes the pool lock is held!
 func (pool *TxPool) promoteTx(addr common.Address, hash common.Hash, tx *types.Transaction) {
+	pool.changed()
+
 	// Try to insert the transaction into the pending queue
 	if pool.pending[addr] == nil {
 		pool.pending[addr] = newTxList(true)
@@ -672,6 +711,7 @@ func (pool *TxPool) removeTx(hash common.Hash) {
 	// Remove it from the list of known transactions
 	delete(pool.all, hash)
 	pool.priced.Removed()
+	pool.changed()
 
 	// Remove the transaction from the pending lists and reset the account nonce
 	if pending := pool.pending[addr]; pending != nil {
@@ -706,6 +746,8 @@ func (pool *TxPool) removeTx(hash common.Hash) {
 // future queue to the set of pending transactions. During this process, all
 // invalidated transactions (low nonce, low balance) are deleted.
 func (pool *TxPool) promoteExecutables(state *state.StateDB, accounts []common.Address) {
+	defer pool.changed()
+
 	gaslimit := pool.gasLimit()
 
 	// Gather all the accounts potentially needing updates
@@ -875,6 +917,8 @@ func (pool *TxPool) promoteExecutables(state *state.StateDB, accounts []common.A
 // executable/pending queue and any subsequent transactions that become unexecutable
 // are moved back into the future queue.
 func (pool *TxPool) demoteUnexecutables(state *state.StateDB) {
+	defer pool.changed()
+
 	gaslimit := pool.gasLimit()
 
 	// Iterate over all accounts and demote any non-executable transactions
@@ -0,0 +1,157 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package core
+
+import (
+	"bytes"
+	"sort"
+	"sync"
+	"time"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/core/types"
+)
+
+// TxPoolSnapshot is an immutable view of the content of a transaction pool at a
+// point in time, for the introspection of the pool without holding its lock.
+// The transactions are indexed by sender, so their senders are known without
+// recovering them.
+//
+// The transaction lists returned by a snapshot are shared and must not be
+// modified. TxPoolSnapshot is safe for concurrent use.
+type TxPoolSnapshot struct {
+	time     time.Time
+	version  uint64 // Content version of the pool the snapshot was taken at
+	pending  map[common.Address]types.Transactions
+	queued   map[common.Address]types.Transactions
+	accounts []common.Address // Accounts with pending or queued transactions, sorted
+
+	pendingCount int
+	queuedCount  int
+
+	indexOnce sync.Once
+	senders   map[common.Hash]common.Address // Senders of the transactions by hash, indexed on first use
+	byPrice   types.Transactions             // Pending transactions by descending gas price, sorted on first use
+}
+
+// NewTxPoolSnapshot creates a snapshot of a pool content, the transactions of
+// each account sorted by nonce. The snapshot takes ownership of the maps.
+func NewTxPoolSnapshot(pending, queued map[common.Address]types.Transactions) *TxPoolSnapshot {
+	snap := &TxPoolSnapshot{
+		time:     time.Now(),
+		pending:  pending,
+		queued:   queued,
+		accounts: make([]common.Address, 0, len(pending)+len(queued)),
+	}
+	for addr, txs := range pending {
+		snap.accounts = append(snap.accounts, addr)
+		snap.pendingCount += len(txs)
+	}
+	for addr, txs := range queued {
+		if _, ok := pending[addr]; !ok {
+			snap.accounts = append(snap.accounts, addr)
+		}
+		snap.queuedCount += len(txs)
+	}
+	sort.Sort(addressesByBytes(snap.accounts))
+	return snap
+}
+
+// Time returns the time the snapshot was taken at.
+func (snap *TxPoolSnapshot) Time() time.Time {
+	return snap.time
+}
+
+// Stats returns the number of pending and queued transactions in the snapshot.
+func (snap *TxPoolSnapshot) Stats() (int, int) {
+	return snap.pendingCount, snap.queuedCount
+}
+
+// Content returns the pending and queued transactions, grouped by account and
+// sorted by nonce.
+func (snap *TxPoolSnapshot) Content() (map[common.Address]types.Transactions, map[common.Address]types.Transactions) {
+	return snap.pending, snap.queued
+}
+
+// Accounts returns the accounts with pending or queued transactions, sorted by
+// address.
+func (snap *TxPoolSnapshot) Accounts() []common.Address {
+	return snap.accounts
+}
+
+// Pending returns the pending transactions of an account, sorted by nonce.
+func (snap *TxPoolSnapshot) Pending(addr common.Address) types.Transactions {
+	return snap.pending[addr]
+}
+
+// Queued returns the queued transactions of an account, sorted by nonce.
+func (snap *TxPoolSnapshot) Queued(addr common.Address) types.Transactions {
+	return snap.queued[addr]
+}
+
+// Sender returns the sender of a transaction in the snapshot.
+func (snap *TxPoolSnapshot) Sender(hash common.Hash) (common.Address, bool) {
+	snap.index()
+	addr, ok := snap.senders[hash]
+	return addr, ok
+}
+
+// PendingByPrice returns the pending transactions, sorted by descending gas
+// price. Equally priced transactions are ordered by hash.
+func (snap *TxPoolSnapshot) PendingByPrice() types.Transactions {
+	snap.index()
+	return snap.byPrice
+}
+
+// index builds the sender index and the price ordering of the transactions, for
+// the lookups across accounts.
+func (snap *TxPoolSnapshot) index() {
+	snap.indexOnce.Do(func() {
+		snap.senders = make(map[common.Hash]common.Address, snap.pendingCount+snap.queuedCount)
+		snap.byPrice = make(types.Transactions, 0, snap.pendingCount)
+		for addr, txs := range snap.pending {
+			for _, tx := range txs {
+				snap.senders[tx.Hash()] = addr
+			}
+			snap.byPrice = append(snap.byPrice, txs...)
+		}
+		for addr, txs := range snap.queued {
+			for _, tx := range txs {
+				snap.senders[tx.Hash()] = addr
+			}
+		}
+		sort.Sort(txsByHash(snap.byPrice))
+		sort.Stable(types.TxByPrice(snap.byPrice))
+	})
+}
+
+// addressesByBytes implements sort.Interface to order addresses.
+type addressesByBytes []common.Address
+
+func (s addressesByBytes) Len() int           { return len(s) }
+func (s addressesByBytes) Less(i, j int) bool { return bytes.Compare(s[i][:], s[j][:]) < 0 }
+func (s addressesByBytes) Swap(i, j int)      { s[i], s[j] = s[j], s[i] }
+
+// txsByHash implements sort.Interface to order transactions by hash.
+type txsByHash types.Transactions
+
+func (s txsByHash) Len() int { return len(s) }
+func (s txsByHash) Less(i, j int) bool {
+	hi, hj := s[i].Hash(), s[j].Hash()
+	return bytes.Compare(hi[:], hj[:]) < 0
+}
+func (s txsByHash) Swap(i, j int) { s[i], s[j] = s[j], s[i] }
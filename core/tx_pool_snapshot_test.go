@@ -0,0 +1,162 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package core
+
+import (
+	"bytes"
+	"math/big"
+	"testing"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/core/types"
+	"github.com/trust-tech/go-trustmachine/crypto"
+)
+
+// fillTxPool adds txs pending and txs queued transactions of each of a number
+// of new accounts to the pool, priced by their nonce.
+func fillTxPool(pool *TxPool, accounts, txs int) {
+	pool.mu.Lock()
+	defer pool.mu.Unlock()
+
+	for i := 0; i < accounts; i++ {
+		key, _ := crypto.GenerateKey()
+		account := crypto.PubkeyToAddress(key.PublicKey)
+
+		for j := 0; j < txs; j++ {
+			tx := pricedTransaction(uint64(j), big.NewInt(100000), big.NewInt(int64(j+1)), key)
+			pool.promoteTx(account, tx.Hash(), tx)
+		}
+		for j := 0; j < txs; j++ {
+			tx := pricedTransaction(uint64(txs+1+j), big.NewInt(100000), big.NewInt(int64(j+1)), key)
+			pool.enqueueTx(tx.Hash(), tx)
+		}
+	}
+}
+
+// Tests that snapshots hold the content of the pool when they were taken, and
+// that they are retaken once the pool changes.
+func TestTxPoolSnapshot(t *testing.T) {
+	// Stop the pool loops, so snapshots are only taken on reads
+	pool, _ := setupTxPool()
+	pool.Stop()
+
+	fillTxPool(pool, 8, 4)
+	snap := pool.Snapshot()
+
+	if pending, queued := snap.Stats(); pending != 32 || queued != 32 {
+		t.Fatalf("stats mismatch: have %d pending, %d queued, want 32, 32", pending, queued)
+	}
+	pending, queued := pool.Content()
+	accounts := snap.Accounts()
+	if len(accounts) != len(pending) {
+		t.Fatalf("accounts mismatch: have %d, want %d", len(accounts), len(pending))
+	}
+	for i, account := range accounts {
+		if i > 0 && bytes.Compare(accounts[i-1][:], account[:]) >= 0 {
+			t.Errorf("accounts not sorted: %x before %x", accounts[i-1], account)
+		}
+		for _, list := range []struct{ have, want []common.Hash }{
+			{hashes(snap.Pending(account)), hashes(pending[account])},
+			{hashes(snap.Queued(account)), hashes(queued[account])},
+		} {
+			if len(list.have) != len(list.want) {
+				t.Fatalf("account %x: transactions mismatch: have %d, want %d", account, len(list.have), len(list.want))
+			}
+			for j := range list.have {
+				if list.have[j] != list.want[j] {
+					t.Errorf("account %x: transaction %d mismatch: have %x, want %x", account, j, list.have[j], list.want[j])
+				}
+				if from, ok := snap.Sender(list.have[j]); !ok || from != account {
+					t.Errorf("account %x: transaction %d sender mismatch: have %x, %v", account, j, from, ok)
+				}
+			}
+		}
+	}
+	byPrice := snap.PendingByPrice()
+	if len(byPrice) != 32 {
+		t.Fatalf("priced transactions mismatch: have %d, want 32", len(byPrice))
+	}
+	for i := 1; i < len(byPrice); i++ {
+		if byPrice[i-1].GasPrice().Cmp(byPrice[i].GasPrice()) < 0 {
+			t.Errorf("transaction %d: price %v above previous %v", i, byPrice[i].GasPrice(), byPrice[i-1].GasPrice())
+		}
+	}
+	// The snapshot is kept while the pool doesn't change, and retaken right after
+	if pool.Snapshot() != snap {
+		t.Fatalf("snapshot of unchanged pool retaken")
+	}
+	fillTxPool(pool, 1, 1)
+	fresh := pool.Snapshot()
+	if fresh == snap || len(fresh.Accounts()) != 9 {
+		t.Fatalf("stale snapshot not retaken after addition")
+	}
+	pool.Remove(fresh.Pending(accounts[0])[3].Hash())
+	if pending, _ := pool.Snapshot().Stats(); pending != 32 {
+		t.Fatalf("stale snapshot not retaken after removal: have %d pending, want 32", pending)
+	}
+	if pending, queued := snap.Stats(); pending != 32 || queued != 32 {
+		t.Fatalf("snapshot modified: have %d pending, %d queued, want 32, 32", pending, queued)
+	}
+}
+
+func hashes(txs []*types.Transaction) []common.Hash {
+	hashes := make([]common.Hash, len(txs))
+	for i, tx := range txs {
+		hashes[i] = tx.Hash()
+	}
+	return hashes
+}
+
+// Benchmarks how long the pool lock, taken to admit transactions, waits on the
+// introspection of the pool content, read either directly or from snapshots.
+func BenchmarkTxPoolLockContent(b *testing.B)  { benchmarkTxPoolLock(b, false) }
+func BenchmarkTxPoolLockSnapshot(b *testing.B) { benchmarkTxPoolLock(b, true) }
+
+func benchmarkTxPoolLock(b *testing.B, snapshot bool) {
+	pool, _ := setupTxPool()
+	defer pool.Stop()
+
+	fillTxPool(pool, 256, 8)
+
+	// Keep reading the pool content, as a busy RPC endpoint would
+	quit, done := make(chan struct{}), make(chan struct{})
+	go func() {
+		defer close(done)
+		for {
+			select {
+			case <-quit:
+				return
+			default:
+			}
+			if snapshot {
+				pool.Snapshot().Content()
+			} else {
+				pool.Content()
+			}
+		}
+	}()
+	// Measure the time it takes to take the pool lock
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		pool.mu.Lock()
+		pool.mu.Unlock()
+	}
+	b.StopTimer()
+
+	close(quit)
+	<-done
+}
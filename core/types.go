@@ -46,3 +46,10 @@ type Validator interface {
 type Processor interface {
 	Process(block *types.Block, statedb *state.StateDB, cfg vm.Config) (types.Receipts, []*types.Log, *big.Int, error)
 }
+
+// Prefetcher is an interface for warming the state caches ahead of processing
+// a block, by reading the state it's going to touch from a throwaway statedb.
+// It should stop as soon as interrupt is set.
+type Prefetcher interface {
+	Prefetch(block *types.Block, statedb *state.StateDB, cfg vm.Config, interrupt *uint32)
+}
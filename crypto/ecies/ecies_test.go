@@ -47,9 +47,7 @@ import (
 var dumpEnc bool
 
 func init() {
-	flDump := flag.Bool("dump", false, "write encrypted test message to file")
-	flag.Parse()
-	dumpEnc = *flDump
+	flag.BoolVar(&dumpEnc, "dump", false, "write encrypted test message to file")
 }
 
 // Ensure the KDF generates appropriately sized keys.
@@ -657,3 +655,123 @@ func hexKey(prv string) *PrivateKey {
 	}
 	return ImportECDSA(key)
 }
+
+// Verify that a session decrypts exactly what a one-off private key decryption
+// does, both individually and in batches mixed with foreign messages.
+func TestSessionDecrypt(t *testing.T) {
+	prv, err := GenerateKey(rand.Reader, DefaultCurve, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	other, err := GenerateKey(rand.Reader, DefaultCurve, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	s1, s2 := []byte("shared 1"), []byte("shared 2")
+
+	var (
+		cts  [][]byte
+		want [][]byte
+	)
+	for i := 0; i < 16; i++ {
+		msg := []byte(fmt.Sprintf("message number %d", i))
+		key := &prv.PublicKey
+		if i%3 == 0 {
+			key, msg = &other.PublicKey, nil
+		}
+		ct, err := Encrypt(rand.Reader, key, []byte(fmt.Sprintf("message number %d", i)), s1, s2)
+		if err != nil {
+			t.Fatal(err)
+		}
+		cts, want = append(cts, ct), append(want, msg)
+	}
+	session := NewSession(prv)
+	for i, ct := range cts {
+		have, err := session.Decrypt(ct, s1, s2)
+		if want[i] == nil {
+			if err != ErrInvalidMessage {
+				t.Errorf("message %d: foreign message error mismatch: have %v, want %v", i, err, ErrInvalidMessage)
+			}
+			continue
+		}
+		if err != nil || !bytes.Equal(have, want[i]) {
+			t.Errorf("message %d: have %q (%v), want %q", i, have, err, want[i])
+		}
+		if _, err := session.Decrypt(ct, s1, nil); err != ErrInvalidMessage {
+			t.Errorf("message %d: wrong shared info accepted: %v", i, err)
+		}
+	}
+	msgs, errs := session.DecryptBatch(cts, s1, s2)
+	for i := range cts {
+		if !bytes.Equal(msgs[i], want[i]) || (want[i] == nil) != (errs[i] != nil) {
+			t.Errorf("batch message %d: have %q (%v), want %q", i, msgs[i], errs[i], want[i])
+		}
+	}
+}
+
+func benchmarkMessages(b *testing.B, n int) (*PrivateKey, [][]byte) {
+	prv, err := GenerateKey(rand.Reader, DefaultCurve, nil)
+	if err != nil {
+		b.Fatal(err)
+	}
+	cts := make([][]byte, n)
+	for i := range cts {
+		if cts[i], err = Encrypt(rand.Reader, &prv.PublicKey, make([]byte, 256), nil, nil); err != nil {
+			b.Fatal(err)
+		}
+	}
+	return prv, cts
+}
+
+// Benchmark the encryption of a 256 byte message with an S256 key.
+func BenchmarkEncryptS256(b *testing.B) {
+	prv, _ := benchmarkMessages(b, 0)
+	msg := make([]byte, 256)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := Encrypt(rand.Reader, &prv.PublicKey, msg, nil, nil); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// Benchmark one-off decryptions of 256 byte messages with an S256 key.
+func BenchmarkDecryptS256(b *testing.B) {
+	prv, cts := benchmarkMessages(b, 1)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := prv.Decrypt(rand.Reader, cts[0], nil, nil); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// Benchmark session decryptions of 256 byte messages with an S256 key.
+func BenchmarkSessionDecryptS256(b *testing.B) {
+	prv, cts := benchmarkMessages(b, 1)
+	session := NewSession(prv)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := session.Decrypt(cts[0], nil, nil); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// Benchmark batch decryptions of 64 messages per operation with an S256 key.
+func BenchmarkSessionDecryptBatchS256(b *testing.B) {
+	prv, cts := benchmarkMessages(b, 64)
+	session := NewSession(prv)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		session.DecryptBatch(cts, nil, nil)
+	}
+}
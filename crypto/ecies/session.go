@@ -0,0 +1,235 @@
+// Copyright (c) 2013 Kyle Isom <kyle@tyrfingr.is>
+// Copyright (c) 2012 The Go Authors. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//    * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//    * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//    * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHTRUST IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+package ecies
+
+import (
+	"crypto/cipher"
+	"crypto/elliptic"
+	"crypto/subtle"
+	"hash"
+	"runtime"
+	"sync"
+)
+
+// Session is a reusable decryption context bound to a single private key, meant
+// for recipients decrypting many messages with the same static key (e.g. whisper
+// filters). The key's scalar and the ECIES parameters are resolved only once,
+// and the hashing state needed for key derivation and message authentication is
+// recycled between messages instead of being allocated for each.
+//
+// A Session is safe for concurrent use.
+type Session struct {
+	prv    *PrivateKey
+	params *ECIESParams
+	scalar []byte // Big endian private scalar, extracted once
+	states sync.Pool
+}
+
+// sessionState is the per-message scratch space of a session.
+type sessionState struct {
+	hash  hash.Hash // KDF and MAC key hasher
+	inner hash.Hash // HMAC inner hasher
+	outer hash.Hash // HMAC outer hasher
+	pad   []byte    // HMAC key pad
+	kdf   []byte    // Derived key material
+	macs  []byte    // HMAC intermediate and final sums
+}
+
+// NewSession creates a decryption session for the given private key.
+func NewSession(prv *PrivateKey) *Session {
+	params := prv.PublicKey.Params
+	if params == nil {
+		params = ParamsFromCurve(prv.PublicKey.Curve)
+	}
+	s := &Session{prv: prv, params: params, scalar: prv.D.Bytes()}
+	if params != nil {
+		s.states.New = func() interface{} {
+			st := &sessionState{hash: params.Hash(), inner: params.Hash(), outer: params.Hash()}
+			st.pad = make([]byte, st.inner.BlockSize())
+			return st
+		}
+	}
+	return s
+}
+
+// Decrypt decrypts an ECIES ciphertext, behaving exactly like PrivateKey.Decrypt.
+func (s *Session) Decrypt(c, s1, s2 []byte) ([]byte, error) {
+	if len(c) == 0 {
+		return nil, ErrInvalidMessage
+	}
+	if s.params == nil {
+		return nil, ErrUnsupportedECIESParameters
+	}
+	st := s.states.Get().(*sessionState)
+	defer s.states.Put(st)
+
+	// Split the message into ephemeral key, ciphertext and tag
+	curve := s.prv.PublicKey.Curve
+	hLen := st.hash.Size()
+
+	var rLen int
+	switch c[0] {
+	case 2, 3, 4:
+		rLen = (curve.Params().BitSize + 7) / 4
+		if len(c) < (rLen + hLen + 1) {
+			return nil, ErrInvalidMessage
+		}
+	default:
+		return nil, ErrInvalidPublicKey
+	}
+	mStart, mEnd := rLen, len(c)-hLen
+
+	// Run the key agreement against the ephemeral public key
+	x, y := elliptic.Unmarshal(curve, c[:rLen])
+	if x == nil {
+		return nil, ErrInvalidPublicKey
+	}
+	if !curve.IsOnCurve(x, y) {
+		return nil, ErrInvalidCurve
+	}
+	keyLen := s.params.KeyLen
+	if 2*keyLen > MaxSharedKeyLength(&s.prv.PublicKey) {
+		return nil, ErrSharedKeyTooBig
+	}
+	sx, _ := curve.ScalarMult(x, y, s.scalar)
+	if sx == nil {
+		return nil, ErrSharedKeyIsPointAtInfinity
+	}
+	z := make([]byte, 2*keyLen)
+	sxBytes := sx.Bytes()
+	copy(z[len(z)-len(sxBytes):], sxBytes)
+
+	// Derive the encryption and MAC keys and authenticate the message
+	K, err := st.deriveKeys(z, s1, 2*keyLen)
+	if err != nil {
+		return nil, err
+	}
+	Ke, Km := K[:keyLen], K[keyLen:]
+
+	st.hash.Reset()
+	st.hash.Write(Km)
+	Km = st.hash.Sum(Km[:0])
+
+	if subtle.ConstantTimeCompare(c[mEnd:], st.tag(Km, c[mStart:mEnd], s2)) != 1 {
+		return nil, ErrInvalidMessage
+	}
+	// Authentic message, decrypt it (the AES key differs per message, so there's
+	// no cipher state to recycle)
+	block, err := s.params.Cipher(Ke)
+	if err != nil {
+		return nil, err
+	}
+	ct := c[mStart:mEnd]
+	m := make([]byte, len(ct)-s.params.BlockSize)
+	cipher.NewCTR(block, ct[:s.params.BlockSize]).XORKeyStream(m, ct[s.params.BlockSize:])
+	return m, nil
+}
+
+// DecryptBatch tries the session key against many ciphertexts, as done when
+// matching a batch of envelopes against a single filter. The work is spread over
+// all available cores. The results are returned in input order, with a nil
+// plaintext and a non-nil error for each message that failed to decrypt.
+func (s *Session) DecryptBatch(cs [][]byte, s1, s2 []byte) ([][]byte, []error) {
+	var (
+		msgs = make([][]byte, len(cs))
+		errs = make([]error, len(cs))
+	)
+	threads := runtime.NumCPU()
+	if threads > len(cs) {
+		threads = len(cs)
+	}
+	var pend sync.WaitGroup
+	pend.Add(threads)
+	for t := 0; t < threads; t++ {
+		go func(t int) {
+			defer pend.Done()
+			for i := t; i < len(cs); i += threads {
+				msgs[i], errs[i] = s.Decrypt(cs[i], s1, s2)
+			}
+		}(t)
+	}
+	pend.Wait()
+	return msgs, errs
+}
+
+// deriveKeys runs the concatenation KDF into the state's scratch buffer. The
+// returned slice is only valid until the state is reused.
+func (st *sessionState) deriveKeys(z, s1 []byte, kdLen int) ([]byte, error) {
+	reps := ((kdLen + 7) * 8) / (st.hash.BlockSize() * 8)
+	if int64(reps) > big2To32M1.Int64() {
+		return nil, ErrKeyDataTooLong
+	}
+	counter := []byte{0, 0, 0, 1}
+	k := st.kdf[:0]
+	for i := 0; i <= reps; i++ {
+		st.hash.Reset()
+		st.hash.Write(counter)
+		st.hash.Write(z)
+		st.hash.Write(s1)
+		k = st.hash.Sum(k)
+		incCounter(counter)
+	}
+	st.kdf = k
+	return k[:kdLen], nil
+}
+
+// tag computes the HMAC of a message and the shared information s2 keyed with
+// km, reusing the state's inner and outer hashers. The returned slice is only
+// valid until the state is reused.
+func (st *sessionState) tag(km, msg, s2 []byte) []byte {
+	if len(km) > len(st.pad) {
+		st.hash.Reset()
+		st.hash.Write(km)
+		km = st.hash.Sum(nil)
+	}
+	for i := range st.pad {
+		st.pad[i] = 0
+	}
+	copy(st.pad, km)
+	for i := range st.pad {
+		st.pad[i] ^= 0x36
+	}
+	st.inner.Reset()
+	st.inner.Write(st.pad)
+	st.inner.Write(msg)
+	st.inner.Write(s2)
+	sums := st.inner.Sum(st.macs[:0])
+
+	for i := range st.pad {
+		st.pad[i] ^= 0x36 ^ 0x5c
+	}
+	st.outer.Reset()
+	st.outer.Write(st.pad)
+	st.outer.Write(sums)
+	sums = st.outer.Sum(sums)
+	st.macs = sums
+
+	return sums[len(sums)/2:]
+}
@@ -114,6 +114,38 @@ func (api *PublicMinerAPI) GetWork() ([3]string, error) {
 	return work, nil
 }
 
+// NewWork sends a notification with the work package, in the format returned by
+// GetWork, each time the node has a new work for external miners.
+func (api *PublicMinerAPI) NewWork(ctx context.Context) (*rpc.Subscription, error) {
+	notifier, supported := rpc.NotifierFromContext(ctx)
+	if !supported {
+		return &rpc.Subscription{}, rpc.ErrNotificationsUnsupported
+	}
+	rpcSub := notifier.CreateSubscription()
+
+	go func() {
+		works := make(chan [3]string, 1) // only the latest work is of interest
+		sub := api.agent.SubscribeWork(works)
+		defer sub.Unsubscribe()
+
+		// Start with the current work, if there's one already
+		if work, err := api.agent.GetWork(); err == nil {
+			notifier.Notify(rpcSub.ID, work)
+		}
+		for {
+			select {
+			case work := <-works:
+				notifier.Notify(rpcSub.ID, work)
+			case <-rpcSub.Err():
+				return
+			case <-notifier.Closed():
+				return
+			}
+		}
+	}()
+	return rpcSub, nil
+}
+
 // SubmitHashrate can be used for remote miners to submit their hash rate. This enables the node to report the combined
 // hash rate of all miners which submit work through this node. It accepts the miner hash rate and an identifier which
 // must be unique between nodes.
@@ -151,6 +151,10 @@ func (b *EntrustApiBackend) TxPoolContent() (map[common.Address]types.Transactio
 	return b.entrust.TxPool().Content()
 }
 
+func (b *EntrustApiBackend) TxPoolSnapshot() *core.TxPoolSnapshot {
+	return b.entrust.TxPool().Snapshot()
+}
+
 func (b *EntrustApiBackend) Downloader() *downloader.Downloader {
 	return b.entrust.Downloader()
 }
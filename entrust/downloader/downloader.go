@@ -34,6 +34,7 @@ import (
 	"github.com/trust-tech/go-trustmachine/event"
 	"github.com/trust-tech/go-trustmachine/log"
 	"github.com/trust-tech/go-trustmachine/params"
+	"github.com/trust-tech/go-trustmachine/trie"
 	"github.com/rcrowley/go-metrics"
 )
 
@@ -102,6 +103,10 @@ type Downloader struct {
 	peers   *peerSet // Set of active peers from which download can proceed
 	stateDB entrustdb.Database
 
+	stateBloom     *trie.SyncBloom // Existence filter of the state entries synced into stateDB
+	stateBloomOnce sync.Once       // Ensures the existence filter is loaded only once
+	stateFresh     bool            // Whether the database had no chain beyond genesis on startup
+
 	fsPivotLock  *types.Header // Pivot header on critical section entry (cannot change between retries)
 	fsPivotFails uint32        // Number of subsequent fast sync failures in the critical section
 
@@ -228,6 +233,7 @@ func New(mode SyncMode, stateDb entrustdb.Database, mux *event.TypeMux, chain Bl
 		stateSyncStart: make(chan *stateSync),
 		trackStateReq:  make(chan *stateReq),
 	}
+	dl.stateFresh = lightchain.CurrentHeader().Number.Uint64() == 0
 	go dl.qosTuner()
 	go dl.stateFetcher()
 	return dl
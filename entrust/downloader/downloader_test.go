@@ -46,6 +46,7 @@ func init() {
 	MaxForkAncestry = uint64(10000)
 	blockCacheLimit = 1024
 	fsCriticalTrials = 10
+	stateBloomSize = 1 << 16
 }
 
 // downloadTester is a test simulator for mocking out local block chain.
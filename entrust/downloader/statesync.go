@@ -18,7 +18,7 @@ package downloader
 
 import (
 	"fmt"
-	"hash"
+	"runtime"
 	"sync"
 	"sync/atomic"
 	"time"
@@ -30,6 +30,10 @@ import (
 	"github.com/trust-tech/go-trustmachine/trie"
 )
 
+var stateBloomSize = uint64(1 << 27) // Size of the state existence filter in bits (16MB)
+
+const stateHashMinItems = 16 // Minimum delivered state entries per hashing thread
+
 // stateReq represents a batch of state fetch requests groupped togotruster into
 // a single data retrieval network packet.
 type stateReq struct {
@@ -55,6 +59,34 @@ type stateSyncStats struct {
 	pending    uint64 // Number of still pending state entries
 }
 
+// syncBloom retrieves the existence filter of the locally known state entries,
+// loading it from the database on first use. It's nil if no trustworthy filter
+// is available (e.g. the last sync was interrupted), in which case state sync
+// falls back to database lookups.
+//
+// The filter only tracks the entries written by state sync, not the ones written
+// by block import. That's fine since fast sync only runs on a fresh database and
+// is disabled for good once blocks get imported; at worst a node found missing
+// by the filter is downloaded again.
+func (d *Downloader) syncBloom() *trie.SyncBloom {
+	d.stateBloomOnce.Do(func() {
+		d.stateBloom = trie.LoadSyncBloom(d.stateDB, stateBloomSize, d.stateFresh)
+	})
+	return d.stateBloom
+}
+
+// storeBloom persists the existence filter of the state sync into the database.
+// It's called once the sync ends, be it done, failed or cancelled on shutdown.
+func (s *stateSync) storeBloom() {
+	if !s.dirty || s.d.syncBloom() == nil {
+		return
+	}
+	if err := s.d.syncBloom().Store(s.d.stateDB); err != nil {
+		log.Warn("Failed to persist state sync bloom", "err", err)
+	}
+	s.dirty = false
+}
+
 // syncState starts downloading state with the given root hash.
 func (d *Downloader) syncState(root common.Hash) *stateSync {
 	s := newStateSync(d, root)
@@ -187,9 +219,9 @@ func (d *Downloader) runStateSync(s *stateSync) *stateSync {
 type stateSync struct {
 	d *Downloader // Downloader instance to access and manage current peerset
 
-	sched  *state.StateSync           // State trie sync scheduler defining the tasks
-	keccak hash.Hash                  // Keccak256 hasher to verify deliveries with
-	tasks  map[common.Hash]*stateTask // Set of tasks currently queued for retrieval
+	sched *state.StateSync           // State trie sync scheduler defining the tasks
+	tasks map[common.Hash]*stateTask // Set of tasks currently queued for retrieval
+	dirty bool                       // Whether entries were written since the last persist
 
 	deliver    chan *stateReq // Delivery channel multiplexing peer responses
 	cancel     chan struct{}  // Channel to signal a termination request
@@ -209,8 +241,7 @@ type stateTask struct {
 func newStateSync(d *Downloader, root common.Hash) *stateSync {
 	return &stateSync{
 		d:       d,
-		sched:   state.NewStateSync(root, d.stateDB),
-		keccak:  sha3.NewKeccak256(),
+		sched:   state.NewStateSync(root, d.stateDB, d.syncBloom()),
 		tasks:   make(map[common.Hash]*stateTask),
 		deliver: make(chan *stateReq),
 		cancel:  make(chan struct{}),
@@ -223,6 +254,7 @@ func newStateSync(d *Downloader, root common.Hash) *stateSync {
 // finish.
 func (s *stateSync) run() {
 	s.err = s.loop()
+	s.storeBloom()
 	close(s.done)
 }
 
@@ -355,27 +387,20 @@ func (s *stateSync) process(req *stateReq) (bool, error) {
 		}
 	}(time.Now())
 
-	// Iterate over all the delivered data and inject one-by-one into the trie
-	progress, stale := false, len(req.response) > 0
-
-	for _, blob := range req.response {
-		prog, hash, err := s.processNodeData(blob)
-		switch err {
-		case nil:
-			processed++
-		case trie.ErrNotRequested:
-			unexpected++
-		case trie.ErrAlreadyProcessed:
-			duplicate++
-		default:
-			return stale, fmt.Errorf("invalid state node %s: %v", hash.TerminalString(), err)
-		}
-		if prog {
-			progress = true
-		}
-		// If the node delivered a requested item, mark the delivery non-stale
-		if _, ok := req.tasks[hash]; ok {
-			delete(req.tasks, hash)
+	// Inject all the delivered data into the trie, skipping the unwanted items
+	stale := len(req.response) > 0
+
+	results := hashNodeData(req.response)
+	progress, unexpected, duplicate, index, err := s.sched.ProcessBatch(results)
+	if err != nil {
+		return stale, fmt.Errorf("invalid state node %s: %v", results[index].Hash.TerminalString(), err)
+	}
+	processed = len(results) - unexpected - duplicate
+
+	// If the node delivered a requested item, mark the delivery non-stale
+	for _, item := range results {
+		if _, ok := req.tasks[item.Hash]; ok {
+			delete(req.tasks, item.Hash)
 			stale = false
 		}
 	}
@@ -388,10 +413,17 @@ func (s *stateSync) process(req *stateReq) (bool, error) {
 		if err != nil {
 			return stale, err
 		}
+		// The persisted filter lacks the new entries until stored again
+		if bloom := s.d.syncBloom(); bloom != nil && !s.dirty {
+			if err := bloom.MarkStale(batch); err != nil {
+				return stale, err
+			}
+		}
 		if err := batch.Write(); err != nil {
 			return stale, err
 		}
 		written = count
+		s.dirty = true
 
 		// If we're inside the critical section, reset fail counter since we progressed
 		if atomic.LoadUint32(&s.d.fsPivotFails) > 1 {
@@ -420,18 +452,36 @@ func (s *stateSync) process(req *stateReq) (bool, error) {
 	return stale, nil
 }
 
-// processNodeData tries to inject a trie node data blob delivered from a remote
-// peer into the state trie, returning whether anything useful was written or any
-// error occurred.
-func (s *stateSync) processNodeData(blob []byte) (bool, common.Hash, error) {
-	res := trie.SyncResult{Data: blob}
+// hashNodeData computes the hashes of a batch of trie node data blobs delivered
+// from a remote peer, spreading the work over multiple threads if worthwhile.
+func hashNodeData(blobs [][]byte) []trie.SyncResult {
+	results := make([]trie.SyncResult, len(blobs))
 
-	s.keccak.Reset()
-	s.keccak.Write(blob)
-	s.keccak.Sum(res.Hash[:0])
-
-	committed, _, err := s.sched.Process([]trie.SyncResult{res})
-	return committed, res.Hash, err
+	threads := runtime.NumCPU()
+	if threads > len(blobs)/stateHashMinItems {
+		threads = len(blobs) / stateHashMinItems
+	}
+	if threads < 1 {
+		threads = 1
+	}
+	var pend sync.WaitGroup
+	pend.Add(threads)
+	for t := 0; t < threads; t++ {
+		go func(t int) {
+			defer pend.Done()
+
+			keccak := sha3.NewKeccak256()
+			for i := t; i < len(blobs); i += threads {
+				results[i].Data = blobs[i]
+
+				keccak.Reset()
+				keccak.Write(blobs[i])
+				keccak.Sum(results[i].Hash[:0])
+			}
+		}(t)
+	}
+	pend.Wait()
+	return results
 }
 
 // updateStats bumps the various state sync progress counters and displays a log
@@ -25,6 +25,7 @@ import (
 	"sync"
 	"time"
 
+	"github.com/hashicorp/golang-lru"
 	"github.com/trust-tech/go-trustmachine/common"
 	"github.com/trust-tech/go-trustmachine/common/hexutil"
 	"github.com/trust-tech/go-trustmachine/core/types"
@@ -37,6 +38,13 @@ var (
 	deadline = 5 * time.Minute // consider a filter inactive if it has not been polled for within deadline
 )
 
+// maxLogsPerQuery is the maximum number of logs a single log query may return.
+const maxLogsPerQuery = 100000
+
+// payloadCacheLimit is the number of recently notified headers and logs whose
+// serialized form is kept for reuse across subscriptions.
+const payloadCacheLimit = 1024
+
 // filter is a helper struct that holds meta information over the filter type
 // and associated subscription in the event system.
 type filter struct {
@@ -59,10 +67,12 @@ type PublicFilterAPI struct {
 	events    *EventSystem
 	filtersMu sync.Mutex
 	filters   map[rpc.ID]*filter
+	payloads  *lru.Cache // shared notification payloads keyed by event object
 }
 
 // NewPublicFilterAPI returns a new PublicFilterAPI instance.
 func NewPublicFilterAPI(backend Backend, lightMode bool) *PublicFilterAPI {
+	payloads, _ := lru.New(payloadCacheLimit)
 	api := &PublicFilterAPI{
 		backend:   backend,
 		useMipMap: !lightMode,
@@ -70,6 +80,7 @@ func NewPublicFilterAPI(backend Backend, lightMode bool) *PublicFilterAPI {
 		chainDb:   backend.ChainDb(),
 		events:    NewEventSystem(backend.EventMux(), backend, lightMode),
 		filters:   make(map[rpc.ID]*filter),
+		payloads:  payloads,
 	}
 
 	go api.timeoutLoop()
@@ -77,6 +88,18 @@ func NewPublicFilterAPI(backend Backend, lightMode bool) *PublicFilterAPI {
 	return api
 }
 
+// payload returns the shared notification payload of a header or log. The event
+// system hands the same object to every matching subscription, so it only has
+// to be serialized once no matter how many clients are notified.
+func (api *PublicFilterAPI) payload(obj interface{}) *rpc.Payload {
+	if cached, ok := api.payloads.Get(obj); ok {
+		return cached.(*rpc.Payload)
+	}
+	payload := rpc.NewPayload(obj)
+	api.payloads.Add(obj, payload)
+	return payload
+}
+
 // timeoutLoop runs every 5 minutes and deletes filters that have not been recently used.
 // Tt is started when the api is created.
 func (api *PublicFilterAPI) timeoutLoop() {
@@ -217,7 +240,7 @@ func (api *PublicFilterAPI) NewHeads(ctx context.Context) (*rpc.Subscription, er
 		for {
 			select {
 			case h := <-headers:
-				notifier.Notify(rpcSub.ID, h)
+				notifier.Notify(rpcSub.ID, api.payload(h))
 			case <-rpcSub.Err():
 				headersSub.Unsubscribe()
 				return
@@ -254,7 +277,7 @@ func (api *PublicFilterAPI) Logs(ctx context.Context, crit FilterCriteria) (*rpc
 			select {
 			case logs := <-matchedLogs:
 				for _, log := range logs {
-					notifier.Notify(rpcSub.ID, &log)
+					notifier.Notify(rpcSub.ID, api.payload(log))
 				}
 			case <-rpcSub.Err(): // client send an unsubscribe request
 				logsSub.Unsubscribe()
@@ -269,6 +292,59 @@ func (api *PublicFilterAPI) Logs(ctx context.Context, crit FilterCriteria) (*rpc
 	return rpcSub, nil
 }
 
+// PastLogs creates a subscription streaming the logs already stored in the chain
+// that match the given filter criteria, in block order as they are found. Unlike
+// GetLogs the results are not collected first, so there is no limit on their
+// number and the client gets the first ones right away. A null notification
+// marks the end of the stream, it is not sent if the search fails. Either way the
+// subscription is removed once the search ends.
+func (api *PublicFilterAPI) PastLogs(ctx context.Context, crit FilterCriteria) (*rpc.Subscription, error) {
+	notifier, supported := rpc.NotifierFromContext(ctx)
+	if !supported {
+		return &rpc.Subscription{}, rpc.ErrNotificationsUnsupported
+	}
+	if crit.FromBlock == nil {
+		crit.FromBlock = big.NewInt(rpc.LatestBlockNumber.Int64())
+	}
+	if crit.ToBlock == nil {
+		crit.ToBlock = big.NewInt(rpc.LatestBlockNumber.Int64())
+	}
+	filter := New(api.backend, api.useMipMap)
+	filter.SetBeginBlock(crit.FromBlock.Int64())
+	filter.SetEndBlock(crit.ToBlock.Int64())
+	filter.SetAddresses(crit.Addresses)
+	filter.SetTopics(crit.Topics)
+
+	rpcSub := notifier.CreateSubscription()
+	go func() {
+		defer notifier.Done(rpcSub)
+
+		// The search outlives the subscribe request, stop it on unsubscribe
+		ctx, cancel := context.WithCancel(context.Background())
+		defer cancel()
+		go func() {
+			select {
+			case <-rpcSub.Err():
+			case <-notifier.Closed():
+			case <-ctx.Done():
+			}
+			cancel()
+		}()
+		err := filter.Stream(ctx, func(logs []*types.Log) bool {
+			for _, log := range logs {
+				if notifier.NotifyWait(rpcSub, log) != nil {
+					return false
+				}
+			}
+			return true
+		})
+		if err == nil && ctx.Err() == nil {
+			notifier.NotifyWait(rpcSub, nil)
+		}
+	}()
+	return rpcSub, nil
+}
+
 // FilterCriteria represents a request to create a new filter.
 type FilterCriteria struct {
 	FromBlock *big.Int
@@ -338,6 +414,7 @@ func (api *PublicFilterAPI) GetLogs(ctx context.Context, crit FilterCriteria) ([
 	filter.SetEndBlock(crit.ToBlock.Int64())
 	filter.SetAddresses(crit.Addresses)
 	filter.SetTopics(crit.Topics)
+	filter.SetLimit(maxLogsPerQuery)
 
 	logs, err := filter.Find(ctx)
 	return returnLogs(logs), err
@@ -386,6 +463,7 @@ func (api *PublicFilterAPI) GetFilterLogs(ctx context.Context, id rpc.ID) ([]*ty
 	}
 	filter.SetAddresses(f.crit.Addresses)
 	filter.SetTopics(f.crit.Topics)
+	filter.SetLimit(maxLogsPerQuery)
 
 	logs, err := filter.Find(ctx)
 	if err != nil {
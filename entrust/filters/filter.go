@@ -18,7 +18,7 @@ package filters
 
 import (
 	"context"
-	"math"
+	"fmt"
 	"math/big"
 	"time"
 
@@ -30,6 +30,11 @@ import (
 	"github.com/trust-tech/go-trustmachine/rpc"
 )
 
+const (
+	logWorkers   = 8   // number of blocks whose receipts are retrieved concurrently
+	logReadAhead = 256 // number of candidate blocks scheduled ahead of delivery
+)
+
 type Backend interface {
 	ChainDb() entrustdb.Database
 	EventMux() *event.TypeMux
@@ -48,6 +53,7 @@ type Filter struct {
 	begin, end int64
 	addresses  []common.Address
 	topics     [][]common.Hash
+	limit      int
 }
 
 // New creates a new filter which uses a bloom filter on blocks to figure out whether
@@ -85,14 +91,47 @@ func (f *Filter) SetTopics(topics [][]common.Hash) {
 	f.topics = topics
 }
 
+// SetLimit caps the number of logs Find may return, 0 meaning unlimited. Queries
+// exceeding the limit are aborted with an error.
+func (f *Filter) SetLimit(limit int) {
+	f.limit = limit
+}
+
 // FindOnce searches the blockchain for matching log entries, returning
 // all matching entries from the first block that contains matches,
 // updating the start point of the filter accordingly. If no results are
 // found, a nil slice is returned.
 func (f *Filter) FindOnce(ctx context.Context) ([]*types.Log, error) {
+	var logs []*types.Log
+	err := f.Stream(ctx, func(found []*types.Log) bool {
+		logs = found
+		return false
+	})
+	return logs, err
+}
+
+// Find filters logs with the current parameters set, returning all the matching
+// entries of the configured block range.
+func (f *Filter) Find(ctx context.Context) (logs []*types.Log, err error) {
+	err = f.Stream(ctx, func(found []*types.Log) bool {
+		logs = append(logs, found...)
+		return f.limit == 0 || len(logs) <= f.limit
+	})
+	if err == nil && f.limit > 0 && len(logs) > f.limit {
+		return nil, fmt.Errorf("query returned more than %d results", f.limit)
+	}
+	return logs, err
+}
+
+// Stream searches the blockchain for matching log entries and delivers them to
+// the callback block by block, in ascending block order, as soon as they are
+// found. The search stops at the end of the configured range, when the callback
+// returns false, or when the context is cancelled. The start point of the filter
+// is moved past the blocks examined, so a further search resumes right after.
+func (f *Filter) Stream(ctx context.Context, deliver func([]*types.Log) bool) error {
 	head, _ := f.backend.HeaderByNumber(ctx, rpc.LatestBlockNumber)
 	if head == nil {
-		return nil, nil
+		return nil
 	}
 	headBlockNumber := head.Number.Uint64()
 
@@ -104,96 +143,164 @@ func (f *Filter) FindOnce(ctx context.Context) ([]*types.Log, error) {
 	if f.end == -1 {
 		endBlockNo = headBlockNumber
 	}
+	next, err := f.streamLogs(ctx, beginBlockNo, endBlockNo, deliver)
+	f.begin = int64(next)
+	return err
+}
 
-	// if no addresses are present we can't make use of fast search which
-	// uses the mipmap bloom filters to check for fast inclusion and uses
-	// higher range probability in order to ensure at least a false positive
-	if !f.useMipMap || len(f.addresses) == 0 {
-		logs, blockNumber, err := f.getLogs(ctx, beginBlockNo, endBlockNo)
-		f.begin = int64(blockNumber + 1)
-		return logs, err
-	}
+// logTask is the retrieval and filtering of the logs of a single block.
+type logTask struct {
+	number uint64
+	logs   []*types.Log
+	err    error
+	end    bool          // block is not available, the chain ends before it
+	done   chan struct{} // closed when the task has been processed
+}
 
-	logs, blockNumber := f.mipFind(beginBlockNo, endBlockNo, 0)
-	f.begin = int64(blockNumber + 1)
-	return logs, nil
+// streamLogs searches the blocks in [start, end] and calls deliver with the logs
+// of each matching block in ascending block order. Candidate blocks are produced
+// ahead of delivery and their receipts retrieved and filtered concurrently by a
+// pool of workers. It returns the number of the first block not examined yet.
+func (f *Filter) streamLogs(ctx context.Context, start, end uint64, deliver func([]*types.Log) bool) (uint64, error) {
+	ctx, cancel := context.WithCancel(ctx)
+	defer cancel()
+
+	var (
+		tasks   = make(chan *logTask)               // tasks waiting for a worker
+		pending = make(chan *logTask, logReadAhead) // tasks in delivery order
+	)
+	go func() {
+		defer close(pending)
+		defer close(tasks)
+
+		f.candidates(start, end, func(number uint64) bool {
+			task := &logTask{number: number, done: make(chan struct{})}
+			select {
+			case pending <- task:
+			case <-ctx.Done():
+				return false
+			}
+			select {
+			case tasks <- task:
+				return true
+			case <-ctx.Done():
+				return false
+			}
+		})
+	}()
+	for i := 0; i < logWorkers; i++ {
+		go func() {
+			for task := range tasks {
+				task.logs, task.end, task.err = f.blockLogs(ctx, task.number)
+				close(task.done)
+			}
+		}()
+	}
+	// Deliver the results in order as they become available
+	next := start
+	for task := range pending {
+		select {
+		case <-task.done:
+		case <-ctx.Done():
+			return next, ctx.Err()
+		}
+		if task.err != nil {
+			return task.number, task.err
+		}
+		if task.end {
+			return end + 1, nil
+		}
+		next = task.number + 1
+		if len(task.logs) > 0 && !deliver(task.logs) {
+			return next, nil
+		}
+	}
+	// The candidates may have been cut short by a cancellation
+	if err := ctx.Err(); err != nil {
+		return next, err
+	}
+	return end + 1, nil
 }
 
-// Run filters logs with the current parameters set
-func (f *Filter) Find(ctx context.Context) (logs []*types.Log, err error) {
-	for {
-		newLogs, err := f.FindOnce(ctx)
-		if len(newLogs) == 0 || err != nil {
-			return logs, err
+// candidates calls yield with every block number in [start, end] which may hold
+// matching logs, in ascending order, until yield returns false. When MIP maps are
+// available, bins whose blooms contain none of the addresses are skipped.
+func (f *Filter) candidates(start, end uint64, yield func(uint64) bool) bool {
+	if !f.useMipMap || len(f.addresses) == 0 {
+		for num := start; num <= end; num++ {
+			if !yield(num) {
+				return false
+			}
 		}
-		logs = append(logs, newLogs...)
+		return true
 	}
+	return f.mipCandidates(start, end, 0, yield)
 }
 
-func (f *Filter) mipFind(start, end uint64, depth int) (logs []*types.Log, blockNumber uint64) {
+func (f *Filter) mipCandidates(start, end uint64, depth int, yield func(uint64) bool) bool {
 	level := core.MIPMapLevels[depth]
 	// normalise numerator so we can work in level specific batches and
 	// work with the proper range checks
 	for num := start / level * level; num <= end; num += level {
-		// find addresses in bloom filters
-		bloom := core.GetMipmapBloom(f.db, num, level)
-		// Don't bother checking the first time through the loop - we're probably picking
+		// Don't bother checking the bin we start in - we're probably picking
 		// up where a previous run left off.
-		first := true
-		for _, addr := range f.addresses {
-			if first || bloom.TestBytes(addr[:]) {
-				first = false
-				// range check normalised values and make sure that
-				// we're resolving the correct range instead of the
-				// normalised values.
-				start := uint64(math.Max(float64(num), float64(start)))
-				end := uint64(math.Min(float64(num+level-1), float64(end)))
-				if depth+1 == len(core.MIPMapLevels) {
-					l, blockNumber, _ := f.getLogs(context.Background(), start, end)
-					if len(l) > 0 {
-						return l, blockNumber
-					}
-				} else {
-					l, blockNumber := f.mipFind(start, end, depth+1)
-					if len(l) > 0 {
-						return l, blockNumber
-					}
+		if num > start && !f.mipmapMatch(core.GetMipmapBloom(f.db, num, level)) {
+			continue
+		}
+		// range check normalised values and make sure that we're resolving
+		// the correct range instead of the normalised values.
+		from, to := num, num+level-1
+		if from < start {
+			from = start
+		}
+		if to > end {
+			to = end
+		}
+		if depth+1 == len(core.MIPMapLevels) {
+			for n := from; n <= to; n++ {
+				if !yield(n) {
+					return false
 				}
 			}
+		} else if !f.mipCandidates(from, to, depth+1, yield) {
+			return false
 		}
 	}
-
-	return nil, end
+	return true
 }
 
-func (f *Filter) getLogs(ctx context.Context, start, end uint64) (logs []*types.Log, blockNumber uint64, err error) {
-	for i := start; i <= end; i++ {
-		blockNumber := rpc.BlockNumber(i)
-		header, err := f.backend.HeaderByNumber(ctx, blockNumber)
-		if header == nil || err != nil {
-			return logs, end, err
-		}
-
-		// Use bloom filtering to see if this block is interesting given the
-		// current parameters
-		if f.bloomFilter(header.Bloom) {
-			// Get the logs of the block
-			receipts, err := f.backend.GetReceipts(ctx, header.Hash())
-			if err != nil {
-				return nil, end, err
-			}
-			var unfiltered []*types.Log
-			for _, receipt := range receipts {
-				unfiltered = append(unfiltered, ([]*types.Log)(receipt.Logs)...)
-			}
-			logs = filterLogs(unfiltered, nil, nil, f.addresses, f.topics)
-			if len(logs) > 0 {
-				return logs, uint64(blockNumber), nil
-			}
+// mipmapMatch reports whether any of the filter addresses is in a MIP bloom bin.
+func (f *Filter) mipmapMatch(bloom types.Bloom) bool {
+	for _, addr := range f.addresses {
+		if bloom.TestBytes(addr[:]) {
+			return true
 		}
 	}
+	return false
+}
 
-	return logs, end, nil
+// blockLogs retrieves the logs of a single block matching the filter criteria.
+// The end flag is set if the block is not available.
+func (f *Filter) blockLogs(ctx context.Context, number uint64) (logs []*types.Log, end bool, err error) {
+	header, err := f.backend.HeaderByNumber(ctx, rpc.BlockNumber(number))
+	if header == nil || err != nil {
+		return nil, true, err
+	}
+	// Use bloom filtering to see if this block is interesting given the
+	// current parameters
+	if !f.bloomFilter(header.Bloom) {
+		return nil, false, nil
+	}
+	// Get the logs of the block
+	receipts, err := f.backend.GetReceipts(ctx, header.Hash())
+	if err != nil {
+		return nil, false, err
+	}
+	var unfiltered []*types.Log
+	for _, receipt := range receipts {
+		unfiltered = append(unfiltered, ([]*types.Log)(receipt.Logs)...)
+	}
+	return filterLogs(unfiltered, nil, nil, f.addresses, f.topics), false, nil
 }
 
 func includes(addresses []common.Address, a common.Address) bool {
@@ -209,45 +316,44 @@ func includes(addresses []common.Address, a common.Address) bool {
 // filterLogs creates a slice of logs matching the given criteria.
 func filterLogs(logs []*types.Log, fromBlock, toBlock *big.Int, addresses []common.Address, topics [][]common.Hash) []*types.Log {
 	var ret []*types.Log
-Logs:
 	for _, log := range logs {
-		if fromBlock != nil && fromBlock.Int64() >= 0 && fromBlock.Uint64() > log.BlockNumber {
-			continue
+		if matchLog(log, fromBlock, toBlock, addresses, topics) {
+			ret = append(ret, log)
 		}
-		if toBlock != nil && toBlock.Int64() >= 0 && toBlock.Uint64() < log.BlockNumber {
-			continue
-		}
-
-		if len(addresses) > 0 && !includes(addresses, log.Address) {
-			continue
-		}
-
-		logTopics := make([]common.Hash, len(topics))
-		copy(logTopics, log.Topics)
-
-		// If the to filtered topics is greater than the amount of topics in logs, skip.
-		if len(topics) > len(log.Topics) {
-			continue Logs
-		}
-
-		for i, topics := range topics {
-			var match bool
-			for _, topic := range topics {
-				// common.Hash{} is a match all (wildcard)
-				if (topic == common.Hash{}) || log.Topics[i] == topic {
-					match = true
-					break
-				}
-			}
+	}
+	return ret
+}
 
-			if !match {
-				continue Logs
+// matchLog reports whether a single log satisfies the given block range, address
+// and topic criteria.
+func matchLog(log *types.Log, fromBlock, toBlock *big.Int, addresses []common.Address, topics [][]common.Hash) bool {
+	if fromBlock != nil && fromBlock.Int64() >= 0 && fromBlock.Uint64() > log.BlockNumber {
+		return false
+	}
+	if toBlock != nil && toBlock.Int64() >= 0 && toBlock.Uint64() < log.BlockNumber {
+		return false
+	}
+	if len(addresses) > 0 && !includes(addresses, log.Address) {
+		return false
+	}
+	// If the to filtered topics is greater than the amount of topics in logs, skip.
+	if len(topics) > len(log.Topics) {
+		return false
+	}
+	for i, topics := range topics {
+		var match bool
+		for _, topic := range topics {
+			// common.Hash{} is a match all (wildcard)
+			if (topic == common.Hash{}) || log.Topics[i] == topic {
+				match = true
+				break
 			}
 		}
-		ret = append(ret, log)
+		if !match {
+			return false
+		}
 	}
-
-	return ret
+	return true
 }
 
 func (f *Filter) bloomFilter(bloom types.Bloom) bool {
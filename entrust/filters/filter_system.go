@@ -22,6 +22,7 @@ import (
 	"context"
 	"errors"
 	"fmt"
+	"math/big"
 	"sync"
 	"time"
 
@@ -68,6 +69,10 @@ type subscription struct {
 	headers   chan *types.Header
 	installed chan struct{} // closed when the filter is installed
 	err       chan error    // closed when the filter is uninstalled
+
+	logsQueue  chan []*types.Log // bounded buffer of matched logs awaiting delivery
+	quit       chan struct{}     // closed when the log forwarder should stop
+	overflowed bool              // whether matched logs were already dropped
 }
 
 // EventSystem creates subscriptions, processes events and broadcasts them to the
@@ -276,8 +281,16 @@ func (es *EventSystem) SubscribePendingTxEvents(hashes chan common.Hash) *Subscr
 
 type filterIndex map[Type]map[rpc.ID]*subscription
 
+// logsIndex holds the inverted log subscription index per log subscription type.
+type logsIndex map[Type]*logIndex
+
+// isLogsSubscription reports whether a subscription delivers logs.
+func isLogsSubscription(typ Type) bool {
+	return typ == LogsSubscription || typ == PendingLogsSubscription || typ == MinedAndPendingLogsSubscription
+}
+
 // broadcast event to filters that match criteria.
-func (es *EventSystem) broadcast(filters filterIndex, ev *event.TypeMuxEvent) {
+func (es *EventSystem) broadcast(filters filterIndex, logs logsIndex, ev *event.TypeMuxEvent) {
 	if ev == nil {
 		return
 	}
@@ -285,30 +298,12 @@ func (es *EventSystem) broadcast(filters filterIndex, ev *event.TypeMuxEvent) {
 	switch e := ev.Data.(type) {
 	case []*types.Log:
 		if len(e) > 0 {
-			for _, f := range filters[LogsSubscription] {
-				if ev.Time.After(f.created) {
-					if matchedLogs := filterLogs(e, f.logsCrit.FromBlock, f.logsCrit.ToBlock, f.logsCrit.Addresses, f.logsCrit.Topics); len(matchedLogs) > 0 {
-						f.logs <- matchedLogs
-					}
-				}
-			}
+			es.broadcastLogs(logs[LogsSubscription], e, ev, true, true)
 		}
 	case core.RemovedLogsEvent:
-		for _, f := range filters[LogsSubscription] {
-			if ev.Time.After(f.created) {
-				if matchedLogs := filterLogs(e.Logs, f.logsCrit.FromBlock, f.logsCrit.ToBlock, f.logsCrit.Addresses, f.logsCrit.Topics); len(matchedLogs) > 0 {
-					f.logs <- matchedLogs
-				}
-			}
-		}
+		es.broadcastLogs(logs[LogsSubscription], e.Logs, ev, true, true)
 	case core.PendingLogsEvent:
-		for _, f := range filters[PendingLogsSubscription] {
-			if ev.Time.After(f.created) {
-				if matchedLogs := filterLogs(e.Logs, nil, f.logsCrit.ToBlock, f.logsCrit.Addresses, f.logsCrit.Topics); len(matchedLogs) > 0 {
-					f.logs <- matchedLogs
-				}
-			}
-		}
+		es.broadcastLogs(logs[PendingLogsSubscription], e.Logs, ev, false, true)
 	case core.TxPreEvent:
 		for _, f := range filters[PendingTransactionsSubscription] {
 			if ev.Time.After(f.created) {
@@ -316,25 +311,45 @@ func (es *EventSystem) broadcast(filters filterIndex, ev *event.TypeMuxEvent) {
 			}
 		}
 	case core.ChainEvent:
+		// all subscribers share the same header copy so it can be encoded once
+		header := e.Block.Header()
 		for _, f := range filters[BlocksSubscription] {
 			if ev.Time.After(f.created) {
-				f.headers <- e.Block.Header()
+				f.headers <- header
 			}
 		}
 		if es.lightMode && len(filters[LogsSubscription]) > 0 {
 			es.lightFilterNewHead(e.Block.Header(), func(header *types.Header, remove bool) {
-				for _, f := range filters[LogsSubscription] {
-					if ev.Time.After(f.created) {
-						if matchedLogs := es.lightFilterLogs(header, f.logsCrit.Addresses, f.logsCrit.Topics, remove); len(matchedLogs) > 0 {
-							f.logs <- matchedLogs
-						}
-					}
+				if unfiltered := es.lightFilterLogs(header, filters[LogsSubscription], remove); len(unfiltered) > 0 {
+					es.broadcastLogs(logs[LogsSubscription], unfiltered, ev, false, false)
 				}
 			})
 		}
 	}
 }
 
+// broadcastLogs matches a batch of logs against the indexed subscriptions and
+// queues the results for delivery. The from and to flags select which bounds of
+// the subscriptions' block ranges are enforced.
+func (es *EventSystem) broadcastLogs(index *logIndex, logs []*types.Log, ev *event.TypeMuxEvent, from, to bool) {
+	subs, matches := index.match(logs, func(f *subscription, log *types.Log) bool {
+		if !ev.Time.After(f.created) {
+			return false
+		}
+		var fromBlock, toBlock *big.Int
+		if from {
+			fromBlock = f.logsCrit.FromBlock
+		}
+		if to {
+			toBlock = f.logsCrit.ToBlock
+		}
+		return matchLog(log, fromBlock, toBlock, f.logsCrit.Addresses, f.logsCrit.Topics)
+	})
+	for _, f := range subs {
+		f.deliverLogs(matches[f])
+	}
+}
+
 func (es *EventSystem) lightFilterNewHead(newHeader *types.Header, callBack func(*types.Header, bool)) {
 	oldh := es.lastHead
 	es.lastHead = newHeader
@@ -368,34 +383,44 @@ func (es *EventSystem) lightFilterNewHead(newHeader *types.Header, callBack func
 	}
 }
 
-// filter logs of a single header in light client mode
-func (es *EventSystem) lightFilterLogs(header *types.Header, addresses []common.Address, topics [][]common.Hash, remove bool) []*types.Log {
-	if bloomFilter(header.Bloom, addresses, topics) {
-		// Get the logs of the block
-		ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
-		defer cancel()
-		receipts, err := es.backend.GetReceipts(ctx, header.Hash())
-		if err != nil {
-			return nil
+// lightFilterLogs retrieves the logs of a single header in light client mode,
+// provided the header bloom indicates they may be interesting for any of the
+// given subscriptions. The receipts are fetched once, regardless of the number
+// of subscriptions.
+func (es *EventSystem) lightFilterLogs(header *types.Header, filters map[rpc.ID]*subscription, remove bool) []*types.Log {
+	var interested bool
+	for _, f := range filters {
+		if bloomFilter(header.Bloom, f.logsCrit.Addresses, f.logsCrit.Topics) {
+			interested = true
+			break
 		}
-		var unfiltered []*types.Log
-		for _, receipt := range receipts {
-			for _, log := range receipt.Logs {
-				logcopy := *log
-				logcopy.Removed = remove
-				unfiltered = append(unfiltered, &logcopy)
-			}
+	}
+	if !interested {
+		return nil
+	}
+	// Get the logs of the block
+	ctx, cancel := context.WithTimeout(context.Background(), time.Second*5)
+	defer cancel()
+	receipts, err := es.backend.GetReceipts(ctx, header.Hash())
+	if err != nil {
+		return nil
+	}
+	var unfiltered []*types.Log
+	for _, receipt := range receipts {
+		for _, log := range receipt.Logs {
+			logcopy := *log
+			logcopy.Removed = remove
+			unfiltered = append(unfiltered, &logcopy)
 		}
-		logs := filterLogs(unfiltered, nil, nil, addresses, topics)
-		return logs
 	}
-	return nil
+	return unfiltered
 }
 
 // eventLoop (un)installs filters and processes mux events.
 func (es *EventSystem) eventLoop() {
 	var (
 		index = make(filterIndex)
+		logs  = logsIndex{LogsSubscription: newLogIndex(), PendingLogsSubscription: newLogIndex()}
 		sub   = es.mux.Subscribe(core.PendingLogsEvent{}, core.RemovedLogsEvent{}, []*types.Log{}, core.TxPreEvent{}, core.ChainEvent{})
 	)
 
@@ -409,14 +434,22 @@ func (es *EventSystem) eventLoop() {
 			if !active { // system stopped
 				return
 			}
-			es.broadcast(index, ev)
+			es.broadcast(index, logs, ev)
 		case f := <-es.install:
 			if f.typ == MinedAndPendingLogsSubscription {
 				// the type are logs and pending logs subscriptions
 				index[LogsSubscription][f.id] = f
 				index[PendingLogsSubscription][f.id] = f
+				logs[LogsSubscription].add(f)
+				logs[PendingLogsSubscription].add(f)
 			} else {
 				index[f.typ][f.id] = f
+				if idx, ok := logs[f.typ]; ok {
+					idx.add(f)
+				}
+			}
+			if isLogsSubscription(f.typ) {
+				f.startLogQueue()
 			}
 			close(f.installed)
 		case f := <-es.uninstall:
@@ -424,8 +457,16 @@ func (es *EventSystem) eventLoop() {
 				// the type are logs and pending logs subscriptions
 				delete(index[LogsSubscription], f.id)
 				delete(index[PendingLogsSubscription], f.id)
+				logs[LogsSubscription].remove(f)
+				logs[PendingLogsSubscription].remove(f)
 			} else {
 				delete(index[f.typ], f.id)
+				if idx, ok := logs[f.typ]; ok {
+					idx.remove(f)
+				}
+			}
+			if isLogsSubscription(f.typ) {
+				f.stopLogQueue()
 			}
 			close(f.err)
 		}
@@ -20,6 +20,7 @@ import (
 	"context"
 	"math/big"
 	"reflect"
+	"sync"
 	"testing"
 	"time"
 
@@ -461,3 +462,137 @@ func TestPendingLogsSubscription(t *testing.T) {
 		}
 	}
 }
+
+// TestSlowLogSubscriber tests that a log subscriber which stopped consuming does
+// not stall delivery to the other subscribers.
+func TestSlowLogSubscriber(t *testing.T) {
+	t.Parallel()
+
+	var (
+		mux     = new(event.TypeMux)
+		db, _   = entrustdb.NewMemDatabase()
+		backend = &testBackend{mux, db}
+		es      = NewEventSystem(mux, backend, false)
+
+		addr   = common.HexToAddress("0x1111111111111111111111111111111111111111")
+		stuck  = make(chan []*types.Log)
+		active = make(chan []*types.Log)
+		total  = 2 * logQueueLimit
+	)
+	stuckSub, _ := es.SubscribeLogs(FilterCriteria{Addresses: []common.Address{addr}}, stuck)
+	activeSub, _ := es.SubscribeLogs(FilterCriteria{Addresses: []common.Address{addr}}, active)
+	defer activeSub.Unsubscribe()
+
+	time.Sleep(100 * time.Millisecond)
+	for i := 0; i < total; i++ {
+		mux.Post([]*types.Log{{Address: addr, BlockNumber: uint64(i)}})
+		select {
+		case <-active:
+		case <-time.After(5 * time.Second):
+			t.Fatalf("active subscriber stalled after %d of %d batches", i, total)
+		}
+	}
+	stuckSub.Unsubscribe()
+}
+
+func BenchmarkLogSubscriptions_1k(b *testing.B)  { benchmarkLogSubscriptions(b, 1000) }
+func BenchmarkLogSubscriptions_10k(b *testing.B) { benchmarkLogSubscriptions(b, 10000) }
+
+// benchmarkLogSubscriptions measures the dispatch of log batches to many
+// concurrent subscribers, each interested in a single contract address.
+func benchmarkLogSubscriptions(b *testing.B, subscribers int) {
+	var (
+		mux     = new(event.TypeMux)
+		db, _   = entrustdb.NewMemDatabase()
+		backend = &testBackend{mux, db}
+		es      = NewEventSystem(mux, backend, false)
+		topic   = common.HexToHash("0x1111111111111111111111111111111111111111111111111111111111111111")
+		addrs   = make([]common.Address, subscribers)
+		pending sync.WaitGroup
+	)
+	for i := range addrs {
+		addrs[i] = common.BigToAddress(big.NewInt(int64(i + 1)))
+
+		logs := make(chan []*types.Log)
+		sub, _ := es.SubscribeLogs(FilterCriteria{Addresses: []common.Address{addrs[i]}, Topics: [][]common.Hash{{topic}}}, logs)
+		defer sub.Unsubscribe()
+
+		go func() {
+			for {
+				select {
+				case <-logs:
+					pending.Done()
+				case <-sub.Err():
+					return
+				}
+			}
+		}()
+	}
+	// Every batch carries a log for 100 distinct subscribers
+	batches := make([][]*types.Log, 16)
+	for i := range batches {
+		for j := 0; j < 100; j++ {
+			addr := addrs[(i*100+j)%subscribers]
+			batches[i] = append(batches[i], &types.Log{Address: addr, Topics: []common.Hash{topic}})
+		}
+	}
+	time.Sleep(100 * time.Millisecond)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		pending.Add(100)
+		mux.Post(batches[i%len(batches)])
+		pending.Wait()
+	}
+}
+
+// Tests that the logs stored in the chain are streamed to a past logs subscriber
+// in order, with a null notification ending the stream.
+func TestPastLogsSubscription(t *testing.T) {
+	t.Parallel()
+
+	var (
+		db, _   = entrustdb.NewMemDatabase()
+		backend = &testBackend{new(event.TypeMux), db}
+		api     = NewPublicFilterAPI(backend, false)
+		addr    = common.BytesToAddress([]byte("addr"))
+	)
+	makeLogChain(t, db, 200, addr)
+
+	server := rpc.NewServer()
+	if err := server.RegisterName("entrust", api); err != nil {
+		t.Fatalf("failed to register filter API: %v", err)
+	}
+	client := rpc.DialInProc(server)
+	defer client.Close()
+
+	logs := make(chan *types.Log)
+	sub, err := client.EntrustSubscribe(context.Background(), logs, "pastLogs", map[string]interface{}{
+		"fromBlock": "0x0",
+		"address":   addr,
+	})
+	if err != nil {
+		t.Fatalf("failed to subscribe: %v", err)
+	}
+	defer sub.Unsubscribe()
+
+	for i := 0; ; i++ {
+		select {
+		case log := <-logs:
+			if log == nil {
+				if i != 200 {
+					t.Fatalf("stream ended after %d logs, want 200", i)
+				}
+				return
+			}
+			if log.BlockNumber != uint64(i+1) {
+				t.Fatalf("log %d: block mismatch: have %d, want %d", i, log.BlockNumber, i+1)
+			}
+		case err := <-sub.Err():
+			t.Fatalf("subscription failed: %v", err)
+		case <-time.After(5 * time.Second):
+			t.Fatalf("log %d: timeout", i)
+		}
+	}
+}
@@ -98,12 +98,12 @@ func BenchmarkMipmaps(b *testing.B) {
 	}
 	b.ResetTimer()
 
-	filter := New(backend, true)
-	filter.SetAddresses([]common.Address{addr1, addr2, addr3, addr4})
-	filter.SetBeginBlock(0)
-	filter.SetEndBlock(-1)
-
 	for i := 0; i < b.N; i++ {
+		filter := New(backend, true)
+		filter.SetAddresses([]common.Address{addr1, addr2, addr3, addr4})
+		filter.SetBeginBlock(0)
+		filter.SetEndBlock(-1)
+
 		logs, _ := filter.Find(context.Background())
 		if len(logs) != 4 {
 			b.Fatal("expected 4 logs, got", len(logs))
@@ -273,4 +273,135 @@ func TestFilters(t *testing.T) {
 	if len(logs) != 0 {
 		t.Error("expected 0 log, got", len(logs))
 	}
+
+	filter = New(backend, true)
+	filter.SetAddresses([]common.Address{addr})
+	filter.SetBeginBlock(0)
+	filter.SetEndBlock(-1)
+	filter.SetLimit(3)
+
+	if logs, err := filter.Find(context.Background()); err == nil {
+		t.Errorf("expected limit error, got %d logs", len(logs))
+	}
+
+	ctx, cancel := context.WithCancel(context.Background())
+	cancel()
+	filter = New(backend, false)
+	filter.SetBeginBlock(0)
+	filter.SetEndBlock(-1)
+
+	if _, err := filter.Find(ctx); err != context.Canceled {
+		t.Errorf("expected cancellation error, got %v", err)
+	}
+}
+
+// makeLogChain creates a chain of blocks with a single log in each but genesis.
+func makeLogChain(t *testing.T, db entrustdb.Database, n int, addr common.Address) {
+	genesis := core.GenesisBlockForTesting(db, addr, big.NewInt(1000000))
+	chain, receipts := core.GenerateChain(params.TestChainConfig, genesis, db, n, func(i int, gen *core.BlockGen) {
+		receipt := types.NewReceipt(nil, new(big.Int))
+		receipt.Logs = []*types.Log{{Address: addr, BlockNumber: uint64(i + 1)}}
+		gen.AddUncheckedReceipt(receipt)
+		core.WriteMipmapBloom(db, uint64(i+1), types.Receipts{receipt})
+	})
+	for i, block := range chain {
+		core.WriteBlock(db, block)
+		if err := core.WriteCanonicalHash(db, block.Hash(), block.NumberU64()); err != nil {
+			t.Fatalf("failed to insert block number: %v", err)
+		}
+		if err := core.WriteHeadBlockHash(db, block.Hash()); err != nil {
+			t.Fatalf("failed to insert block number: %v", err)
+		}
+		if err := core.WriteBlockReceipts(db, block.Hash(), block.NumberU64(), receipts[i]); err != nil {
+			t.Fatal("error writing block receipts:", err)
+		}
+	}
+}
+
+// Tests that a cancelled search resumes right after the last examined block,
+// neither skipping nor repeating any.
+func TestFilterResume(t *testing.T) {
+	var (
+		db, _   = entrustdb.NewMemDatabase()
+		backend = &testBackend{new(event.TypeMux), db}
+		addr    = common.BytesToAddress([]byte("addr"))
+	)
+	makeLogChain(t, db, 200, addr)
+
+	for _, stop := range []int{1, 10, 100} {
+		filter := New(backend, false)
+		filter.SetAddresses([]common.Address{addr})
+		filter.SetBeginBlock(0)
+		filter.SetEndBlock(-1)
+
+		var logs []*types.Log
+		ctx, cancel := context.WithCancel(context.Background())
+		err := filter.Stream(ctx, func(found []*types.Log) bool {
+			if logs = append(logs, found...); len(logs) == stop {
+				cancel()
+			}
+			return true
+		})
+		if err != context.Canceled {
+			t.Fatalf("stop %d: expected cancellation error, got %v", stop, err)
+		}
+		rest, err := filter.Find(context.Background())
+		if err != nil {
+			t.Fatalf("stop %d: failed to resume: %v", stop, err)
+		}
+		logs = append(logs, rest...)
+		if len(logs) != 200 {
+			t.Fatalf("stop %d: log count mismatch: have %d, want 200", stop, len(logs))
+		}
+		for i, log := range logs {
+			if log.BlockNumber != uint64(i+1) {
+				t.Fatalf("stop %d: log %d: block mismatch: have %d, want %d", stop, i, log.BlockNumber, i+1)
+			}
+		}
+	}
+}
+
+// BenchmarkFilterRange measures a log query over a long block range in which
+// every block holds a matching log, without the help of MIP maps.
+func BenchmarkFilterRange(b *testing.B) {
+	dir, err := ioutil.TempDir("", "filter-range")
+	if err != nil {
+		b.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	var (
+		db, _   = entrustdb.NewLDBDatabase(dir, 0, 0)
+		mux     = new(event.TypeMux)
+		backend = &testBackend{mux, db}
+		key1, _ = crypto.HexToECDSA("b71c71a67e1177ad4e901695e1b4b9ee17ae16c6668d313eac2f96dbcda3f291")
+		addr1   = crypto.PubkeyToAddress(key1.PublicKey)
+		blocks  = 20000
+	)
+	defer db.Close()
+
+	genesis := core.GenesisBlockForTesting(db, addr1, big.NewInt(1000000))
+	chain, receipts := core.GenerateChain(params.TestChainConfig, genesis, db, blocks, func(i int, gen *core.BlockGen) {
+		gen.AddUncheckedReceipt(makeReceipt(addr1))
+	})
+	for i, block := range chain {
+		core.WriteBlock(db, block)
+		core.WriteCanonicalHash(db, block.Hash(), block.NumberU64())
+		core.WriteHeadBlockHash(db, block.Hash())
+		core.WriteBlockReceipts(db, block.Hash(), block.NumberU64(), receipts[i])
+	}
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		filter := New(backend, false)
+		filter.SetAddresses([]common.Address{addr1})
+		filter.SetBeginBlock(0)
+		filter.SetEndBlock(-1)
+
+		logs, _ := filter.Find(context.Background())
+		if len(logs) != blocks {
+			b.Fatalf("expected %d logs, got %d", blocks, len(logs))
+		}
+	}
 }
@@ -0,0 +1,193 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package filters
+
+import (
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/core/types"
+	"github.com/trust-tech/go-trustmachine/log"
+	"github.com/trust-tech/go-trustmachine/metrics"
+	"github.com/trust-tech/go-trustmachine/rpc"
+)
+
+// logQueueLimit is the maximum number of matched log batches buffered for a
+// single subscription before further batches are dropped.
+const logQueueLimit = 1024
+
+var logDropMeter = metrics.NewMeter("entrust/filters/logs/drop")
+
+// logIndex is an inverted index of log subscriptions, used to find the few
+// subscriptions a log may be interesting for without evaluating the criteria of
+// every installed subscription.
+//
+// Subscriptions filtering on addresses are indexed by each of their addresses,
+// ones without addresses but with a concrete first topic position by each of
+// those topics. Anything else can match any log and is kept aside as wildcard.
+type logIndex struct {
+	addresses map[common.Address]map[rpc.ID]*subscription
+	topics    map[common.Hash]map[rpc.ID]*subscription
+	wildcard  map[rpc.ID]*subscription
+}
+
+// newLogIndex creates an empty log subscription index.
+func newLogIndex() *logIndex {
+	return &logIndex{
+		addresses: make(map[common.Address]map[rpc.ID]*subscription),
+		topics:    make(map[common.Hash]map[rpc.ID]*subscription),
+		wildcard:  make(map[rpc.ID]*subscription),
+	}
+}
+
+// indexTopics returns the first position topics a subscription can be indexed
+// by, or nil if it may match logs with any (or no) topic.
+func indexTopics(crit FilterCriteria) []common.Hash {
+	if len(crit.Topics) == 0 || len(crit.Topics[0]) == 0 {
+		return nil
+	}
+	for _, topic := range crit.Topics[0] {
+		if topic == (common.Hash{}) {
+			return nil
+		}
+	}
+	return crit.Topics[0]
+}
+
+// add inserts a subscription into the index.
+func (idx *logIndex) add(f *subscription) {
+	if len(f.logsCrit.Addresses) > 0 {
+		for _, addr := range f.logsCrit.Addresses {
+			if idx.addresses[addr] == nil {
+				idx.addresses[addr] = make(map[rpc.ID]*subscription)
+			}
+			idx.addresses[addr][f.id] = f
+		}
+		return
+	}
+	if topics := indexTopics(f.logsCrit); topics != nil {
+		for _, topic := range topics {
+			if idx.topics[topic] == nil {
+				idx.topics[topic] = make(map[rpc.ID]*subscription)
+			}
+			idx.topics[topic][f.id] = f
+		}
+		return
+	}
+	idx.wildcard[f.id] = f
+}
+
+// remove deletes a subscription from the index.
+func (idx *logIndex) remove(f *subscription) {
+	if len(f.logsCrit.Addresses) > 0 {
+		for _, addr := range f.logsCrit.Addresses {
+			if subs := idx.addresses[addr]; subs != nil {
+				if delete(subs, f.id); len(subs) == 0 {
+					delete(idx.addresses, addr)
+				}
+			}
+		}
+		return
+	}
+	if topics := indexTopics(f.logsCrit); topics != nil {
+		for _, topic := range topics {
+			if subs := idx.topics[topic]; subs != nil {
+				if delete(subs, f.id); len(subs) == 0 {
+					delete(idx.topics, topic)
+				}
+			}
+		}
+		return
+	}
+	delete(idx.wildcard, f.id)
+}
+
+// match runs each log only against the candidate subscriptions of its address
+// and first topic (plus the wildcard ones), and returns the matched logs grouped
+// per subscription. Log order is retained within every group.
+func (idx *logIndex) match(logs []*types.Log, filter func(*subscription, *types.Log) bool) ([]*subscription, map[*subscription][]*types.Log) {
+	var (
+		order   []*subscription
+		matches = make(map[*subscription][]*types.Log)
+	)
+	check := func(f *subscription, log *types.Log) {
+		if !filter(f, log) {
+			return
+		}
+		if _, ok := matches[f]; !ok {
+			order = append(order, f)
+		}
+		matches[f] = append(matches[f], log)
+	}
+	for _, log := range logs {
+		for _, f := range idx.addresses[log.Address] {
+			check(f, log)
+		}
+		if len(log.Topics) > 0 {
+			for _, f := range idx.topics[log.Topics[0]] {
+				check(f, log)
+			}
+		}
+		for _, f := range idx.wildcard {
+			check(f, log)
+		}
+	}
+	return order, matches
+}
+
+// startLogQueue sets up the bounded delivery buffer of a log subscription and
+// starts forwarding buffered batches to the subscriber, so that a slow consumer
+// never blocks the event loop.
+func (f *subscription) startLogQueue() {
+	f.logsQueue = make(chan []*types.Log, logQueueLimit)
+	f.quit = make(chan struct{})
+
+	go func() {
+		for {
+			select {
+			case logs := <-f.logsQueue:
+				select {
+				case f.logs <- logs:
+				case <-f.quit:
+					return
+				}
+			case <-f.quit:
+				return
+			}
+		}
+	}()
+}
+
+// stopLogQueue terminates the forwarder of a log subscription. Buffered batches
+// not yet consumed are discarded.
+func (f *subscription) stopLogQueue() {
+	if f.quit != nil {
+		close(f.quit)
+	}
+}
+
+// deliverLogs schedules a batch of matched logs for delivery without blocking.
+// If the subscriber fell too far behind, the batch is dropped.
+func (f *subscription) deliverLogs(logs []*types.Log) {
+	select {
+	case f.logsQueue <- logs:
+	default:
+		logDropMeter.Mark(int64(len(logs)))
+		if !f.overflowed {
+			log.Warn("Log subscription overflowed, dropping logs", "id", f.id, "queued", logQueueLimit)
+			f.overflowed = true
+		}
+	}
+}
@@ -99,6 +99,16 @@ func (mux *TypeMux) Post(ev interface{}) error {
 	return nil
 }
 
+// Subscribed reports whether any receiver is currently registered for the
+// type of the given event. It allows producers to skip assembling expensive
+// events nobody is listening for.
+func (mux *TypeMux) Subscribed(ev interface{}) bool {
+	mux.mutex.RLock()
+	defer mux.mutex.RUnlock()
+
+	return !mux.stopped && len(mux.subm[reflect.TypeOf(ev)]) > 0
+}
+
 // Stop closes a mux. The mux can no longer be used.
 // Future Post calls will fail with ErrMuxClosed.
 // Stop blocks until all current deliveries have finished.
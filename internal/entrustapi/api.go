@@ -21,7 +21,12 @@ import (
 	"errors"
 	"fmt"
 	"math/big"
+	"runtime"
+	"sort"
+	"strconv"
 	"strings"
+	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/trust-tech/go-trustmachine/accounts"
@@ -104,33 +109,122 @@ func NewPublicTxPoolAPI(b Backend) *PublicTxPoolAPI {
 	return &PublicTxPoolAPI{b}
 }
 
+// Maximum number of accounts or transactions returned in a page of the pool content.
+const maxTxPoolPageSize = 1024
+
 // Content returns the transactions contained within the transaction pool.
 func (s *PublicTxPoolAPI) Content() map[string]map[string]map[string]*RPCTransaction {
+	pending, queue := s.b.TxPoolSnapshot().Content()
+
 	content := map[string]map[string]map[string]*RPCTransaction{
-		"pending": make(map[string]map[string]*RPCTransaction),
-		"queued":  make(map[string]map[string]*RPCTransaction),
+		"pending": make(map[string]map[string]*RPCTransaction, len(pending)),
+		"queued":  make(map[string]map[string]*RPCTransaction, len(queue)),
 	}
-	pending, queue := s.b.TxPoolContent()
-
 	// Flatten the pending transactions
 	for account, txs := range pending {
-		dump := make(map[string]*RPCTransaction)
-		for _, tx := range txs {
-			dump[fmt.Sprintf("%d", tx.Nonce())] = newRPCPendingTransaction(tx)
-		}
-		content["pending"][account.Hex()] = dump
+		content["pending"][account.Hex()] = newRPCPoolTransactions(account, txs)
 	}
 	// Flatten the queued transactions
 	for account, txs := range queue {
-		dump := make(map[string]*RPCTransaction)
-		for _, tx := range txs {
-			dump[fmt.Sprintf("%d", tx.Nonce())] = newRPCPendingTransaction(tx)
-		}
-		content["queued"][account.Hex()] = dump
+		content["queued"][account.Hex()] = newRPCPoolTransactions(account, txs)
 	}
 	return content
 }
 
+// ContentFrom returns the transactions sent by an account contained within the
+// transaction pool.
+func (s *PublicTxPoolAPI) ContentFrom(account common.Address) map[string]map[string]*RPCTransaction {
+	snap := s.b.TxPoolSnapshot()
+	return map[string]map[string]*RPCTransaction{
+		"pending": newRPCPoolTransactions(account, snap.Pending(account)),
+		"queued":  newRPCPoolTransactions(account, snap.Queued(account)),
+	}
+}
+
+// RPCTxPoolPage is a page of the transaction pool content, holding the
+// transactions of a range of the accounts in the pool.
+type RPCTxPoolPage struct {
+	Pending map[string]map[string]*RPCTransaction `json:"pending"`
+	Queued  map[string]map[string]*RPCTransaction `json:"queued"`
+	Next    *hexutil.Uint                         `json:"next"` // Offset of the next page, nil on the last one
+}
+
+// ContentPage returns the transactions of up to limit accounts contained within
+// the transaction pool, starting at the given offset in the accounts ordered by
+// address. As the pool changes between calls, the pages of a walk may overlap
+// or miss accounts.
+func (s *PublicTxPoolAPI) ContentPage(offset, limit hexutil.Uint) *RPCTxPoolPage {
+	snap := s.b.TxPoolSnapshot()
+	start, end := txPoolPage(len(snap.Accounts()), offset, limit)
+	accounts := snap.Accounts()[start:end]
+
+	page := &RPCTxPoolPage{
+		Pending: make(map[string]map[string]*RPCTransaction, len(accounts)),
+		Queued:  make(map[string]map[string]*RPCTransaction, len(accounts)),
+	}
+	for _, account := range accounts {
+		if txs := snap.Pending(account); len(txs) > 0 {
+			page.Pending[account.Hex()] = newRPCPoolTransactions(account, txs)
+		}
+		if txs := snap.Queued(account); len(txs) > 0 {
+			page.Queued[account.Hex()] = newRPCPoolTransactions(account, txs)
+		}
+	}
+	if end < len(snap.Accounts()) {
+		next := hexutil.Uint(end)
+		page.Next = &next
+	}
+	return page
+}
+
+// PendingByPrice returns up to limit pending transactions of the transaction pool
+// paying a gas price of at least minPrice, starting at the given offset in the
+// transactions ordered by descending gas price.
+func (s *PublicTxPoolAPI) PendingByPrice(minPrice *hexutil.Big, offset, limit hexutil.Uint) []*RPCTransaction {
+	snap := s.b.TxPoolSnapshot()
+
+	txs := snap.PendingByPrice()
+	if minPrice != nil {
+		txs = txs[:sort.Search(len(txs), func(i int) bool {
+			return txs[i].GasPrice().Cmp(minPrice.ToInt()) < 0
+		})]
+	}
+	start, end := txPoolPage(len(txs), offset, limit)
+
+	result := make([]*RPCTransaction, 0, end-start)
+	for _, tx := range txs[start:end] {
+		from, _ := snap.Sender(tx.Hash())
+		result = append(result, newRPCTransactionFrom(tx, from, common.Hash{}, 0, 0))
+	}
+	return result
+}
+
+// txPoolPage returns the bounds of a page of items of the transaction pool
+// content, capping its size to maxTxPoolPageSize.
+func txPoolPage(items int, offset, limit hexutil.Uint) (int, int) {
+	if limit == 0 || limit > maxTxPoolPageSize {
+		limit = maxTxPoolPageSize
+	}
+	start, end := int(offset), int(offset)+int(limit)
+	if start > items {
+		start = items
+	}
+	if end > items {
+		end = items
+	}
+	return start, end
+}
+
+// newRPCPoolTransactions returns the pending transactions of an account that will
+// serialize to the RPC representation, keyed by nonce.
+func newRPCPoolTransactions(from common.Address, txs types.Transactions) map[string]*RPCTransaction {
+	dump := make(map[string]*RPCTransaction, len(txs))
+	for _, tx := range txs {
+		dump[strconv.FormatUint(tx.Nonce(), 10)] = newRPCTransactionFrom(tx, from, common.Hash{}, 0, 0)
+	}
+	return dump
+}
+
 // Status returns the number of pending and queued transaction in the pool.
 func (s *PublicTxPoolAPI) Status() map[string]hexutil.Uint {
 	pending, queue := s.b.Stats()
@@ -143,11 +237,12 @@ func (s *PublicTxPoolAPI) Status() map[string]hexutil.Uint {
 // Inspect retrieves the content of the transaction pool and flattens it into an
 // easily inspectable list.
 func (s *PublicTxPoolAPI) Inspect() map[string]map[string]map[string]string {
+	pending, queue := s.b.TxPoolSnapshot().Content()
+
 	content := map[string]map[string]map[string]string{
-		"pending": make(map[string]map[string]string),
-		"queued":  make(map[string]map[string]string),
+		"pending": make(map[string]map[string]string, len(pending)),
+		"queued":  make(map[string]map[string]string, len(queue)),
 	}
-	pending, queue := s.b.TxPoolContent()
 
 	// Define a formatter to flatten a transaction into a string
 	var format = func(tx *types.Transaction) string {
@@ -158,17 +253,17 @@ func (s *PublicTxPoolAPI) Inspect() map[string]map[string]map[string]string {
 	}
 	// Flatten the pending transactions
 	for account, txs := range pending {
-		dump := make(map[string]string)
+		dump := make(map[string]string, len(txs))
 		for _, tx := range txs {
-			dump[fmt.Sprintf("%d", tx.Nonce())] = format(tx)
+			dump[strconv.FormatUint(tx.Nonce(), 10)] = format(tx)
 		}
 		content["pending"][account.Hex()] = dump
 	}
 	// Flatten the queued transactions
 	for account, txs := range queue {
-		dump := make(map[string]string)
+		dump := make(map[string]string, len(txs))
 		for _, tx := range txs {
-			dump[fmt.Sprintf("%d", tx.Nonce())] = format(tx)
+			dump[strconv.FormatUint(tx.Nonce(), 10)] = format(tx)
 		}
 		content["queued"][account.Hex()] = dump
 	}
@@ -813,11 +908,13 @@ type RPCTransaction struct {
 // newRPCTransaction returns a transaction that will serialize to the RPC
 // representation, with the given location metadata set (if available).
 func newRPCTransaction(tx *types.Transaction, blockHash common.Hash, blockNumber uint64, index uint64) *RPCTransaction {
-	var signer types.Signer = types.FrontierSigner{}
-	if tx.Protected() {
-		signer = types.NewEIP155Signer(tx.ChainId())
-	}
-	from, _ := types.Sender(signer, tx)
+	return newRPCTransactionFrom(tx, transactionSender(tx), blockHash, blockNumber, index)
+}
+
+// newRPCTransactionFrom returns a transaction that will serialize to the RPC
+// representation, with its already known sender and the given location metadata
+// set (if available).
+func newRPCTransactionFrom(tx *types.Transaction, from common.Address, blockHash common.Hash, blockNumber uint64, index uint64) *RPCTransaction {
 	v, r, s := tx.RawSignatureValues()
 
 	result := &RPCTransaction{
@@ -975,42 +1072,143 @@ func (s *PublicTransactionPoolAPI) GetRawTransactionByHash(ctx context.Context,
 	return rlp.EncodeToBytes(tx)
 }
 
+// RPCReceipt represents a transaction receipt that will serialize to the RPC
+// representation of a receipt.
+type RPCReceipt struct {
+	Root              hexutil.Bytes   `json:"root"`
+	BlockHash         common.Hash     `json:"blockHash"`
+	BlockNumber       hexutil.Uint64  `json:"blockNumber"`
+	TransactionHash   common.Hash     `json:"transactionHash"`
+	TransactionIndex  hexutil.Uint64  `json:"transactionIndex"`
+	From              common.Address  `json:"from"`
+	To                *common.Address `json:"to"`
+	GasUsed           *hexutil.Big    `json:"gasUsed"`
+	CumulativeGasUsed *hexutil.Big    `json:"cumulativeGasUsed"`
+	ContractAddress   *common.Address `json:"contractAddress"`
+	Logs              []*types.Log    `json:"logs"`
+	LogsBloom         types.Bloom     `json:"logsBloom"`
+}
+
+// newRPCReceipt returns the receipt of a transaction that will serialize to the
+// RPC representation, with the given sender and location metadata set.
+func newRPCReceipt(tx *types.Transaction, receipt *types.Receipt, from common.Address, blockHash common.Hash, blockNumber uint64, index uint64) *RPCReceipt {
+	result := &RPCReceipt{
+		Root:              hexutil.Bytes(receipt.PostState),
+		BlockHash:         blockHash,
+		BlockNumber:       hexutil.Uint64(blockNumber),
+		TransactionHash:   tx.Hash(),
+		TransactionIndex:  hexutil.Uint64(index),
+		From:              from,
+		To:                tx.To(),
+		GasUsed:           (*hexutil.Big)(receipt.GasUsed),
+		CumulativeGasUsed: (*hexutil.Big)(receipt.CumulativeGasUsed),
+		Logs:              receipt.Logs,
+		LogsBloom:         receipt.Bloom,
+	}
+	if receipt.Logs == nil {
+		result.Logs = []*types.Log{}
+	}
+	// If the ContractAddress is 20 0x0 bytes, assume it is not a contract creation
+	if receipt.ContractAddress != (common.Address{}) {
+		addr := receipt.ContractAddress
+		result.ContractAddress = &addr
+	}
+	return result
+}
+
+// transactionSender recovers the sender of a transaction with the signer it was
+// signed with.
+func transactionSender(tx *types.Transaction) common.Address {
+	var signer types.Signer = types.FrontierSigner{}
+	if tx.Protected() {
+		signer = types.NewEIP155Signer(tx.ChainId())
+	}
+	from, _ := types.Sender(signer, tx)
+	return from
+}
+
+// transactionSenders recovers the senders of a list of transactions, spreading
+// the signature recoveries over the available CPUs.
+func transactionSenders(txs types.Transactions) []common.Address {
+	senders := make([]common.Address, len(txs))
+
+	workers := runtime.NumCPU()
+	if workers > len(txs) {
+		workers = len(txs)
+	}
+	var (
+		next int64 = -1
+		pend sync.WaitGroup
+	)
+	pend.Add(workers)
+	for i := 0; i < workers; i++ {
+		go func() {
+			defer pend.Done()
+			for {
+				index := int(atomic.AddInt64(&next, 1))
+				if index >= len(txs) {
+					return
+				}
+				senders[index] = transactionSender(txs[index])
+			}
+		}()
+	}
+	pend.Wait()
+	return senders
+}
+
 // GetTransactionReceipt returns the transaction receipt for the given transaction hash.
-func (s *PublicTransactionPoolAPI) GetTransactionReceipt(hash common.Hash) (map[string]interface{}, error) {
+func (s *PublicTransactionPoolAPI) GetTransactionReceipt(hash common.Hash) (*RPCReceipt, error) {
 	tx, blockHash, blockNumber, index := core.GetTransaction(s.b.ChainDb(), hash)
 	if tx == nil {
 		return nil, nil
 	}
 	receipt, _, _, _ := core.GetReceipt(s.b.ChainDb(), hash) // Old receipts don't have the lookup data available
+	if receipt == nil {
+		return nil, nil
+	}
+	return newRPCReceipt(tx, receipt, transactionSender(tx), blockHash, blockNumber, index), nil
+}
 
-	var signer types.Signer = types.FrontierSigner{}
-	if tx.Protected() {
-		signer = types.NewEIP155Signer(tx.ChainId())
+// GetBlockReceiptsByNumber returns the receipts of all the transactions in the
+// block with the given block number.
+func (s *PublicTransactionPoolAPI) GetBlockReceiptsByNumber(ctx context.Context, blockNr rpc.BlockNumber) ([]*RPCReceipt, error) {
+	block, err := s.b.BlockByNumber(ctx, blockNr)
+	if block == nil {
+		return nil, err
 	}
-	from, _ := types.Sender(signer, tx)
+	return s.blockReceipts(ctx, block)
+}
 
-	fields := map[string]interface{}{
-		"root":              hexutil.Bytes(receipt.PostState),
-		"blockHash":         blockHash,
-		"blockNumber":       hexutil.Uint64(blockNumber),
-		"transactionHash":   hash,
-		"transactionIndex":  hexutil.Uint64(index),
-		"from":              from,
-		"to":                tx.To(),
-		"gasUsed":           (*hexutil.Big)(receipt.GasUsed),
-		"cumulativeGasUsed": (*hexutil.Big)(receipt.CumulativeGasUsed),
-		"contractAddress":   nil,
-		"logs":              receipt.Logs,
-		"logsBloom":         receipt.Bloom,
+// GetBlockReceiptsByHash returns the receipts of all the transactions in the
+// block with the given hash.
+func (s *PublicTransactionPoolAPI) GetBlockReceiptsByHash(ctx context.Context, blockHash common.Hash) ([]*RPCReceipt, error) {
+	block, err := s.b.GetBlock(ctx, blockHash)
+	if block == nil {
+		return nil, err
 	}
-	if receipt.Logs == nil {
-		fields["logs"] = [][]*types.Log{}
+	return s.blockReceipts(ctx, block)
+}
+
+// blockReceipts returns the receipts of all the transactions in a block. Unlike
+// looking them up one by one, the receipts are read and decoded once for the
+// whole block.
+func (s *PublicTransactionPoolAPI) blockReceipts(ctx context.Context, block *types.Block) ([]*RPCReceipt, error) {
+	receipts, err := s.b.GetReceipts(ctx, block.Hash())
+	if err != nil {
+		return nil, err
 	}
-	// If the ContractAddress is 20 0x0 bytes, assume it is not a contract creation
-	if receipt.ContractAddress != (common.Address{}) {
-		fields["contractAddress"] = receipt.ContractAddress
+	txs := block.Transactions()
+	if len(receipts) != len(txs) {
+		return nil, fmt.Errorf("receipts length mismatch: %d receipts, %d transactions", len(receipts), len(txs))
 	}
-	return fields, nil
+	senders := transactionSenders(txs)
+
+	results := make([]*RPCReceipt, len(txs))
+	for i, tx := range txs {
+		results[i] = newRPCReceipt(tx, receipts[i], senders[i], block.Hash(), block.NumberU64(), uint64(i))
+	}
+	return results, nil
 }
 
 // sign is a helper function that signs a transaction with the private key of the given address.
@@ -1211,20 +1409,21 @@ func (s *PublicTransactionPoolAPI) SignTransaction(ctx context.Context, args Sen
 // PendingTransactions returns the transactions that are in the transaction pool and have a from address that is one of
 // the accounts this node manages.
 func (s *PublicTransactionPoolAPI) PendingTransactions() ([]*RPCTransaction, error) {
-	pending, err := s.b.GetPoolTransactions()
-	if err != nil {
-		return nil, err
-	}
+	snap := s.b.TxPoolSnapshot()
 
-	transactions := make([]*RPCTransaction, 0, len(pending))
-	for _, tx := range pending {
-		var signer types.Signer = types.HomesteadSigner{}
-		if tx.Protected() {
-			signer = types.NewEIP155Signer(tx.ChainId())
-		}
-		from, _ := types.Sender(signer, tx)
-		if _, err := s.b.AccountManager().Find(accounts.Account{Address: from}); err == nil {
-			transactions = append(transactions, newRPCPendingTransaction(tx))
+	// Look up the transactions of the local accounts, rather than the local
+	// senders of all the transactions
+	transactions := make([]*RPCTransaction, 0)
+	seen := make(map[common.Address]bool)
+	for _, wallet := range s.b.AccountManager().Wallets() {
+		for _, account := range wallet.Accounts() {
+			if seen[account.Address] {
+				continue
+			}
+			seen[account.Address] = true
+			for _, tx := range snap.Pending(account.Address) {
+				transactions = append(transactions, newRPCTransactionFrom(tx, account.Address, common.Hash{}, 0, 0))
+			}
 		}
 	}
 	return transactions, nil
@@ -0,0 +1,302 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package entrustapi
+
+import (
+	"bytes"
+	"context"
+	"encoding/json"
+	"math/big"
+	"testing"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/common/hexutil"
+	"github.com/trust-tech/go-trustmachine/core"
+	"github.com/trust-tech/go-trustmachine/core/types"
+	"github.com/trust-tech/go-trustmachine/crypto"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+	"github.com/trust-tech/go-trustmachine/params"
+	"github.com/trust-tech/go-trustmachine/rpc"
+)
+
+// chainBackend is a Backend serving the blocks and receipts of a chain database,
+// the rest of the Backend is left unimplemented.
+type chainBackend struct {
+	Backend
+	db entrustdb.Database
+}
+
+func (b *chainBackend) ChainDb() entrustdb.Database {
+	return b.db
+}
+
+func (b *chainBackend) BlockByNumber(ctx context.Context, blockNr rpc.BlockNumber) (*types.Block, error) {
+	number := uint64(blockNr)
+	if blockNr == rpc.LatestBlockNumber {
+		number = core.GetBlockNumber(b.db, core.GetHeadBlockHash(b.db))
+	}
+	return core.GetBlock(b.db, core.GetCanonicalHash(b.db, number), number), nil
+}
+
+func (b *chainBackend) GetBlock(ctx context.Context, blockHash common.Hash) (*types.Block, error) {
+	return core.GetBlock(b.db, blockHash, core.GetBlockNumber(b.db, blockHash)), nil
+}
+
+func (b *chainBackend) GetReceipts(ctx context.Context, blockHash common.Hash) (types.Receipts, error) {
+	return core.GetBlockReceipts(b.db, blockHash, core.GetBlockNumber(b.db, blockHash)), nil
+}
+
+// newReceiptsBackend creates a backend with a single block of txs transactions,
+// made of value transfers signed with and without replay protection and of
+// contract creations emitting a log.
+func newReceiptsBackend(t testing.TB, txs int) (*chainBackend, *types.Block) {
+	var (
+		key, _ = crypto.HexToECDSA("b71c71a67e1177ad4e901695e1b4b9ee17ae16c6668d313eac2f96dbcda3f291")
+		addr   = crypto.PubkeyToAddress(key.PublicKey)
+		db, _  = entrustdb.NewMemDatabase()
+		gspec  = &core.Genesis{
+			Config:   params.TestChainConfig,
+			GasLimit: uint64(txs) * 100000,
+			Alloc:    core.GenesisAlloc{addr: {Balance: big.NewInt(1000000000)}},
+		}
+		genesis = gspec.MustCommit(db)
+		code    = common.FromHex("0x60006000a000") // LOG0 of no data
+	)
+	blocks, receipts := core.GenerateChain(gspec.Config, genesis, db, 1, func(i int, gen *core.BlockGen) {
+		for j := 0; j < txs; j++ {
+			var (
+				tx     *types.Transaction
+				signer types.Signer = types.HomesteadSigner{}
+			)
+			if j%3 == 0 {
+				tx = types.NewContractCreation(gen.TxNonce(addr), new(big.Int), big.NewInt(100000), nil, code)
+			} else {
+				tx = types.NewTransaction(gen.TxNonce(addr), common.Address{byte(j)}, big.NewInt(1), new(big.Int).SetUint64(params.TxGas), nil, nil)
+			}
+			if j%2 == 0 {
+				signer = types.NewEIP155Signer(gspec.Config.ChainId)
+			}
+			tx, _ = types.SignTx(tx, signer, key)
+			gen.AddTx(tx)
+		}
+	})
+	block := blocks[0]
+	if len(block.Transactions()) != txs {
+		t.Fatalf("block transactions mismatch: have %d, want %d", len(block.Transactions()), txs)
+	}
+	if err := core.WriteBlock(db, block); err != nil {
+		t.Fatalf("failed to write block: %v", err)
+	}
+	if err := core.WriteBlockReceipts(db, block.Hash(), block.NumberU64(), receipts[0]); err != nil {
+		t.Fatalf("failed to write receipts: %v", err)
+	}
+	if err := core.WriteTxLookupEntries(db, block); err != nil {
+		t.Fatalf("failed to write lookup entries: %v", err)
+	}
+	if err := core.WriteCanonicalHash(db, block.Hash(), block.NumberU64()); err != nil {
+		t.Fatalf("failed to write canonical hash: %v", err)
+	}
+	if err := core.WriteHeadBlockHash(db, block.Hash()); err != nil {
+		t.Fatalf("failed to write head hash: %v", err)
+	}
+	return &chainBackend{db: db}, block
+}
+
+// Tests that the receipts of a block retrieved at once are the same the ones
+// retrieved for its transactions one by one.
+func TestGetBlockReceipts(t *testing.T) {
+	backend, block := newReceiptsBackend(t, 24)
+	api := NewPublicTransactionPoolAPI(backend, nil)
+
+	byHash, err := api.GetBlockReceiptsByHash(context.Background(), block.Hash())
+	if err != nil {
+		t.Fatalf("failed to get receipts by hash: %v", err)
+	}
+	byNumber, err := api.GetBlockReceiptsByNumber(context.Background(), rpc.LatestBlockNumber)
+	if err != nil {
+		t.Fatalf("failed to get receipts by number: %v", err)
+	}
+	if len(byHash) != len(block.Transactions()) || len(byNumber) != len(byHash) {
+		t.Fatalf("receipts count mismatch: have %d by hash, %d by number, want %d", len(byHash), len(byNumber), len(block.Transactions()))
+	}
+	for i, tx := range block.Transactions() {
+		single, err := api.GetTransactionReceipt(tx.Hash())
+		if err != nil || single == nil {
+			t.Fatalf("tx %d: failed to get receipt: %v", i, err)
+		}
+		want, _ := json.Marshal(single)
+		for _, receipts := range [][]*RPCReceipt{byHash, byNumber} {
+			if have, _ := json.Marshal(receipts[i]); !bytes.Equal(have, want) {
+				t.Fatalf("tx %d: receipt mismatch:\nhave %s\nwant %s", i, have, want)
+			}
+		}
+		if single.From != transactionSender(tx) || single.From == (common.Address{}) {
+			t.Errorf("tx %d: sender mismatch: have %x", i, single.From)
+		}
+		if (single.ContractAddress != nil) != (tx.To() == nil) || (tx.To() == nil) != (len(single.Logs) == 1) {
+			t.Errorf("tx %d: contract creation mismatch: address %v, %d logs", i, single.ContractAddress, len(single.Logs))
+		}
+	}
+	// Unknown blocks have no receipts
+	if receipts, err := api.GetBlockReceiptsByHash(context.Background(), common.Hash{1}); receipts != nil || err != nil {
+		t.Errorf("unknown block: have %v, %v", receipts, err)
+	}
+}
+
+// Tests that receipts serialize to the same fields as before they were typed.
+func TestRPCReceiptFields(t *testing.T) {
+	backend, block := newReceiptsBackend(t, 2)
+	api := NewPublicTransactionPoolAPI(backend, nil)
+
+	for i, tx := range block.Transactions() {
+		receipt, _ := api.GetTransactionReceipt(tx.Hash())
+		blob, _ := json.Marshal(receipt)
+
+		var fields map[string]json.RawMessage
+		if err := json.Unmarshal(blob, &fields); err != nil {
+			t.Fatalf("tx %d: failed to decode receipt: %v", i, err)
+		}
+		for _, field := range []string{"root", "blockHash", "blockNumber", "transactionHash", "transactionIndex", "from", "to", "gasUsed", "cumulativeGasUsed", "contractAddress", "logs", "logsBloom"} {
+			if _, ok := fields[field]; !ok {
+				t.Errorf("tx %d: field %q missing", i, field)
+			}
+		}
+		if len(fields) != 12 {
+			t.Errorf("tx %d: fields count mismatch: have %d, want 12", i, len(fields))
+		}
+		if tx.To() != nil && (string(fields["contractAddress"]) != "null" || string(fields["logs"]) != "[]") {
+			t.Errorf("tx %d: transfer with contract address %s, logs %s", i, fields["contractAddress"], fields["logs"])
+		}
+	}
+}
+
+// Benchmarks an indexer retrieving the receipts of a block one transaction at a
+// time, against retrieving them for the whole block at once.
+func BenchmarkBlockReceipts_200_single(b *testing.B) {
+	benchmarkBlockReceipts(b, 200, false)
+}
+func BenchmarkBlockReceipts_200_block(b *testing.B) {
+	benchmarkBlockReceipts(b, 200, true)
+}
+
+func benchmarkBlockReceipts(b *testing.B, txs int, whole bool) {
+	backend, block := newReceiptsBackend(b, txs)
+	api := NewPublicTransactionPoolAPI(backend, nil)
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if whole {
+			receipts, _ := api.GetBlockReceiptsByNumber(context.Background(), rpc.BlockNumber(block.NumberU64()))
+			json.Marshal(receipts)
+			continue
+		}
+		// Indexers walk the block body and look up each transaction's receipt
+		block, _ := backend.BlockByNumber(context.Background(), rpc.BlockNumber(block.NumberU64()))
+		for _, tx := range block.Transactions() {
+			receipt, _ := api.GetTransactionReceipt(tx.Hash())
+			json.Marshal(receipt)
+		}
+	}
+}
+
+// poolBackend is a Backend serving a snapshot of a transaction pool content, the
+// rest of the Backend is left unimplemented.
+type poolBackend struct {
+	Backend
+	snap *core.TxPoolSnapshot
+}
+
+func (b *poolBackend) TxPoolSnapshot() *core.TxPoolSnapshot {
+	return b.snap
+}
+
+// Tests that the pages of the transaction pool content add up to the whole of it,
+// and that the pending transactions are filtered by price.
+func TestTxPoolPages(t *testing.T) {
+	var (
+		pending = make(map[common.Address]types.Transactions)
+		queued  = make(map[common.Address]types.Transactions)
+		senders = make(map[common.Hash]common.Address)
+		signer  = types.HomesteadSigner{}
+	)
+	for i := 0; i < 10; i++ {
+		key, _ := crypto.GenerateKey()
+		addr := crypto.PubkeyToAddress(key.PublicKey)
+		for j := 0; j < 3; j++ {
+			tx, _ := types.SignTx(types.NewTransaction(uint64(j), common.Address{}, big.NewInt(1), big.NewInt(21000), big.NewInt(int64(i*3+j)), nil), signer, key)
+			senders[tx.Hash()] = addr
+			if i%2 == 0 {
+				pending[addr] = append(pending[addr], tx)
+			} else {
+				queued[addr] = append(queued[addr], tx)
+			}
+		}
+	}
+	api := NewPublicTxPoolAPI(&poolBackend{snap: core.NewTxPoolSnapshot(pending, queued)})
+	content := api.Content()
+
+	// Walk the content in pages, they must make up the whole content
+	var (
+		offset hexutil.Uint
+		pages  int
+		walked = map[string]map[string]map[string]*RPCTransaction{"pending": {}, "queued": {}}
+	)
+	for {
+		page := api.ContentPage(offset, 3)
+		for account, txs := range page.Pending {
+			walked["pending"][account] = txs
+		}
+		for account, txs := range page.Queued {
+			walked["queued"][account] = txs
+		}
+		if pages++; page.Next == nil {
+			break
+		}
+		offset = *page.Next
+	}
+	if pages != 4 {
+		t.Errorf("pages mismatch: have %d, want 4", pages)
+	}
+	have, _ := json.Marshal(walked)
+	want, _ := json.Marshal(content)
+	if !bytes.Equal(have, want) {
+		t.Errorf("paged content mismatch:\nhave %s\nwant %s", have, want)
+	}
+	// Filter an account's transactions
+	for addr := range queued {
+		from := api.ContentFrom(addr)
+		if len(from["pending"]) != 0 || len(from["queued"]) != 3 || from["queued"]["2"].From != addr {
+			t.Errorf("account %x: content mismatch: %v", addr, from)
+		}
+	}
+	// Page the pending transactions paying at least a price, best paying first
+	txs := api.PendingByPrice((*hexutil.Big)(big.NewInt(10)), 1, 4)
+	if len(txs) != 4 {
+		t.Fatalf("priced transactions mismatch: have %d, want 4", len(txs))
+	}
+	for i, price := range []int64{25, 24, 20, 19} {
+		if txs[i].GasPrice.ToInt().Int64() != price {
+			t.Errorf("transaction %d: price mismatch: have %v, want %d", i, txs[i].GasPrice, price)
+		}
+		if sender := senders[txs[i].Hash]; sender != txs[i].From {
+			t.Errorf("transaction %d: sender mismatch: have %x, want %x", i, txs[i].From, sender)
+		}
+	}
+	if txs := api.PendingByPrice((*hexutil.Big)(big.NewInt(10)), 9, 4); len(txs) != 0 {
+		t.Errorf("priced transactions past the last: have %d", len(txs))
+	}
+}
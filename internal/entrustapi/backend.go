@@ -62,6 +62,7 @@ type Backend interface {
 	GetPoolNonce(ctx context.Context, addr common.Address) (uint64, error)
 	Stats() (pending int, queued int)
 	TxPoolContent() (map[common.Address]types.Transactions, map[common.Address]types.Transactions)
+	TxPoolSnapshot() *core.TxPoolSnapshot
 
 	ChainConfig() *params.ChainConfig
 	CurrentBlock() *types.Block
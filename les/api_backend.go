@@ -124,6 +124,12 @@ func (b *LesApiBackend) TxPoolContent() (map[common.Address]types.Transactions,
 	return b.entrust.txPool.Content()
 }
 
+// TxPoolSnapshot returns a snapshot of the light pool content. Light pools only
+// hold the local transactions, so the snapshot is taken on every call.
+func (b *LesApiBackend) TxPoolSnapshot() *core.TxPoolSnapshot {
+	return core.NewTxPoolSnapshot(b.entrust.txPool.Content())
+}
+
 func (b *LesApiBackend) Downloader() *downloader.Downloader {
 	return b.entrust.Downloader()
 }
@@ -33,6 +33,7 @@ type ServerParams struct {
 type ClientNode struct {
 	params   *ServerParams
 	bufValue uint64
+	reserved uint64 // Sum of the maximum costs of reserved, unprocessed requests
 	lastTime mclock.AbsTime
 	lock     sync.Mutex
 	cm       *ClientManager
@@ -66,26 +67,52 @@ func (peer *ClientNode) recalcBV(time mclock.AbsTime) {
 	peer.lastTime = time
 }
 
-func (peer *ClientNode) AcceptRequest() (uint64, bool) {
+// ReserveRequest deducts the maximum cost of an incoming request from the
+// client's buffer if it fits, returning the buffer value before the deduction.
+// Requests are reserved in the order they arrive, so they may be served
+// concurrently afterwards.
+func (peer *ClientNode) ReserveRequest(maxCost uint64) (uint64, bool) {
 	peer.lock.Lock()
 	defer peer.lock.Unlock()
 
-	time := mclock.Now()
-	peer.recalcBV(time)
-	return peer.bufValue, peer.cm.accept(peer.cmNode, time)
+	peer.recalcBV(mclock.Now())
+	if maxCost > peer.bufValue {
+		return peer.bufValue, false
+	}
+	peer.bufValue -= maxCost
+	peer.reserved += maxCost
+	return peer.bufValue + maxCost, true
+}
+
+// AcceptRequest waits until the client manager admits a reserved request for
+// serving. It returns the admitted request to be passed to RequestProcessed, or
+// false if the client has been removed in the meantime.
+func (peer *ClientNode) AcceptRequest() (*ServingRequest, bool) {
+	req := peer.cm.accept(peer.cmNode, mclock.Now())
+	return req, req != nil
 }
 
-func (peer *ClientNode) RequestProcessed(cost uint64) (bv, realCost uint64) {
+// RequestProcessed should be called when an accepted request with the given
+// reserved maximum cost has been served, passing the handle AcceptRequest
+// returned for it. It returns the buffer value to report to the client and the
+// real cost of the request.
+//
+// The buffer is raised to reflect the real cost instead of the reserved one,
+// but the costs reserved by other requests still being served stay deducted.
+func (peer *ClientNode) RequestProcessed(req *ServingRequest, maxCost uint64) (bv, realCost uint64) {
 	peer.lock.Lock()
 	defer peer.lock.Unlock()
 
 	time := mclock.Now()
 	peer.recalcBV(time)
-	peer.bufValue -= cost
-	peer.recalcBV(time)
-	rcValue, rcost := peer.cm.processed(peer.cmNode, time)
-	if rcValue < peer.params.BufLimit {
-		bv := peer.params.BufLimit - rcValue
+	if maxCost > peer.reserved {
+		maxCost = peer.reserved
+	}
+	peer.reserved -= maxCost
+
+	rcValue, rcost := peer.cm.processed(peer.cmNode, req, time)
+	if spent := rcValue + peer.reserved; spent < peer.params.BufLimit {
+		bv := peer.params.BufLimit - spent
 		if bv > peer.bufValue {
 			peer.bufValue = bv
 		}
@@ -18,6 +18,8 @@
 package flowcontrol
 
 import (
+	"container/heap"
+	"math"
 	"sync"
 	"time"
 
@@ -26,64 +28,131 @@ import (
 
 const rcConst = 1000000
 
+// cmNode is the client manager's view of a client. While one of its requests
+// is being served, the node accumulates recharge value, which is then slowly
+// recharged (reduced back to zero) after serving stops. The recharging nodes
+// share the recharge capacity of the server in proportion to their weights.
+//
+// A client may have several requests served at once, each adding to the
+// increase of its recharge value.
 type cmNode struct {
-	node                         *ClientNode
-	lastUpdate                   mclock.AbsTime
-	serving, recharging          bool
-	rcWeight                     uint64
-	rcValue, rcDelta, startValue int64
-	finishRecharge               mclock.AbsTime
-}
-
-func (node *cmNode) update(time mclock.AbsTime) {
-	dt := int64(time - node.lastUpdate)
-	node.rcValue += node.rcDelta * dt / rcConst
-	node.lastUpdate = time
-	if node.recharging && time >= node.finishRecharge {
-		node.recharging = false
-		node.rcDelta = 0
-		node.rcValue = 0
-	}
+	node             *ClientNode
+	lastUpdate       mclock.AbsTime
+	serving          []*ServingRequest // Requests being served, in order of admission
+	recharging       bool
+	rcWeight         uint64
+	rcValue, rcDelta int64   // Recharge value at lastUpdate and its increase (per rcConst) while serving
+	finish           float64 // Virtual time when recharging completes
+	index            int     // Position in the recharge queue
 }
 
-func (node *cmNode) set(serving bool, simReqCnt, sumWeight uint64) {
-	if node.serving && !serving {
-		node.recharging = true
-		sumWeight += node.rcWeight
-	}
-	node.serving = serving
-	if node.recharging && serving {
-		node.recharging = false
-		sumWeight -= node.rcWeight
-	}
+// ServingRequest is a request of a client being served. It is handed out when
+// the request is admitted and identifies it when serving finishes, as requests
+// of a client may finish in any order.
+type ServingRequest struct {
+	delta int64          // Increase of the node's recharge value (per rcConst) due to the request
+	start mclock.AbsTime // Time the request was admitted
+}
 
-	node.rcDelta = 0
-	if serving {
-		node.rcDelta = int64(rcConst / simReqCnt)
-	}
-	if node.recharging {
-		node.rcDelta = -int64(node.node.cm.rcRecharge * node.rcWeight / sumWeight)
-		node.finishRecharge = node.lastUpdate + mclock.AbsTime(node.rcValue*rcConst/(-node.rcDelta))
+// rcQueue is a min-heap of recharging nodes ordered by finish virtual time.
+type rcQueue []*cmNode
+
+func (q rcQueue) Len() int           { return len(q) }
+func (q rcQueue) Less(i, j int) bool { return q[i].finish < q[j].finish }
+func (q rcQueue) Swap(i, j int) {
+	q[i], q[j] = q[j], q[i]
+	q[i].index, q[j].index = i, j
+}
+func (q *rcQueue) Push(x interface{}) {
+	node := x.(*cmNode)
+	node.index = len(*q)
+	*q = append(*q, node)
+}
+func (q *rcQueue) Pop() interface{} {
+	old := *q
+	node := old[len(old)-1]
+	old[len(old)-1] = nil
+	*q = old[:len(old)-1]
+	return node
+}
+
+// cmRequest is a request waiting for the client manager to admit it.
+type cmRequest struct {
+	node     *cmNode
+	priority float64              // Recharge value per weight of the node when queued, lowest first
+	seq      uint64               // Arrival order among requests of equal priority
+	resume   chan *ServingRequest // Receives the admitted request, nil if rejected
+	index    int                  // Position in the admission queue
+}
+
+// cmQueue is a min-heap of requests waiting for admission.
+type cmQueue []*cmRequest
+
+func (q cmQueue) Len() int { return len(q) }
+func (q cmQueue) Less(i, j int) bool {
+	if q[i].priority != q[j].priority {
+		return q[i].priority < q[j].priority
 	}
+	return q[i].seq < q[j].seq
+}
+func (q cmQueue) Swap(i, j int) {
+	q[i], q[j] = q[j], q[i]
+	q[i].index, q[j].index = i, j
+}
+func (q *cmQueue) Push(x interface{}) {
+	req := x.(*cmRequest)
+	req.index = len(*q)
+	*q = append(*q, req)
+}
+func (q *cmQueue) Pop() interface{} {
+	old := *q
+	req := old[len(old)-1]
+	old[len(old)-1] = nil
+	*q = old[:len(old)-1]
+	return req
 }
 
+// ClientManager limits the number of requests served simultaneously and the
+// total recharge value of the clients, queueing requests that would exceed
+// either limit until capacity frees up.
+//
+// Instead of updating every node on each event, recharging is tracked with a
+// virtual time that advances by the recharge value a unit weight node regains.
+// A node's recharge completes at a fixed virtual time, so the recharging nodes
+// are kept in a heap ordered by it, and the sum of their values is derived from
+// maintained aggregates. This also tells when the total value drops below the
+// limit, so queued requests are admitted exactly then, lowest recharge value
+// per weight first.
 type ClientManager struct {
-	lock                             sync.Mutex
-	nodes                            map[*cmNode]struct{}
-	simReqCnt, sumWeight, rcSumValue uint64
-	maxSimReq, maxRcSum              uint64
-	rcRecharge                       uint64
-	resumeQueue                      chan chan bool
-	time                             mclock.AbsTime
+	lock                sync.Mutex
+	nodes               map[*cmNode]struct{}
+	simReqCnt           uint64
+	maxSimReq, maxRcSum uint64
+	rcRecharge          uint64
+	time                mclock.AbsTime
+
+	servingValue int64   // Total recharge value of the nodes being served, at time
+	servingDelta int64   // Total increase of the served nodes' value (per rcConst)
+	recharging   rcQueue // Recharging nodes ordered by finish virtual time
+	sumWeight    uint64  // Total weight of the recharging nodes
+	sumFinish    float64 // Total of the recharging nodes' finish virtual times times their weights
+	vtime        float64 // Virtual recharge time, reset when no node is recharging
+
+	queue cmQueue       // Requests waiting for admission
+	seq   uint64        // Arrival counter of queued requests
+	wake  chan struct{} // Notifies the scheduler that admission may be possible sooner
+	quit  chan struct{}
 }
 
 func NewClientManager(rcTarget, maxSimReq, maxRcSum uint64) *ClientManager {
 	cm := &ClientManager{
-		nodes:       make(map[*cmNode]struct{}),
-		resumeQueue: make(chan chan bool),
-		rcRecharge:  rcConst * rcConst / (100*rcConst/rcTarget - rcConst),
-		maxSimReq:   maxSimReq,
-		maxRcSum:    maxRcSum,
+		nodes:      make(map[*cmNode]struct{}),
+		rcRecharge: rcConst * rcConst / (100*rcConst/rcTarget - rcConst),
+		maxSimReq:  maxSimReq,
+		maxRcSum:   maxRcSum,
+		time:       mclock.Now(),
+		wake:       make(chan struct{}, 1),
+		quit:       make(chan struct{}),
 	}
 	go cm.queueProc()
 	return cm
@@ -95,22 +164,24 @@ func (self *ClientManager) Stop() {
 
 	// signal any waiting accept routines to return false
 	self.nodes = make(map[*cmNode]struct{})
-	close(self.resumeQueue)
+	for _, req := range self.queue {
+		req.resume <- nil
+	}
+	self.queue = nil
+	close(self.quit)
 }
 
 func (self *ClientManager) addNode(cnode *ClientNode) *cmNode {
 	time := mclock.Now()
 	node := &cmNode{
-		node:           cnode,
-		lastUpdate:     time,
-		finishRecharge: time,
-		rcWeight:       1,
+		node:       cnode,
+		lastUpdate: time,
+		rcWeight:   1,
 	}
 	self.lock.Lock()
 	defer self.lock.Unlock()
 
 	self.nodes[node] = struct{}{}
-	self.update(mclock.Now())
 	return node
 }
 
@@ -118,107 +189,265 @@ func (self *ClientManager) removeNode(node *cmNode) {
 	self.lock.Lock()
 	defer self.lock.Unlock()
 
-	time := mclock.Now()
-	self.stop(node, time)
+	for len(node.serving) > 0 {
+		self.stop(node, node.serving[0], mclock.Now())
+	}
+	if node.recharging {
+		self.stopRecharging(node)
+	}
+	for i := 0; i < len(self.queue); i++ {
+		if req := self.queue[i]; req.node == node {
+			heap.Remove(&self.queue, i)
+			req.resume <- nil
+			i--
+		}
+	}
 	delete(self.nodes, node)
-	self.update(time)
 }
 
-// recalc sumWeight
-func (self *ClientManager) updateNodes(time mclock.AbsTime) (rce bool) {
-	var sumWeight, rcSum uint64
-	for node := range self.nodes {
-		rc := node.recharging
-		node.update(time)
-		if rc && !node.recharging {
-			rce = true
-		}
-		if node.recharging {
-			sumWeight += node.rcWeight
+// advance moves the manager's clock forward, completing the recharges that
+// finish in the meantime in order.
+func (self *ClientManager) advance(now mclock.AbsTime) {
+	for len(self.recharging) > 0 {
+		node := self.recharging[0]
+		finish := self.time + self.rechargeTime(node.finish-self.vtime)
+		if finish > now {
+			break
 		}
-		rcSum += uint64(node.rcValue)
+		self.advanceTime(finish)
+		self.stopRecharging(node)
+		node.rcValue = 0
 	}
-	self.sumWeight = sumWeight
-	self.rcSumValue = rcSum
-	return
+	self.advanceTime(now)
 }
 
-func (self *ClientManager) update(time mclock.AbsTime) {
-	for {
-		firstTime := time
-		for node := range self.nodes {
-			if node.recharging && node.finishRecharge < firstTime {
-				firstTime = node.finishRecharge
-			}
-		}
-		if self.updateNodes(firstTime) {
-			for node := range self.nodes {
-				if node.recharging {
-					node.set(node.serving, self.simReqCnt, self.sumWeight)
-				}
-			}
-		} else {
-			self.time = time
-			return
+// advanceTime moves the manager's clock forward, within which the set of
+// recharging nodes doesn't change.
+func (self *ClientManager) advanceTime(now mclock.AbsTime) {
+	if now <= self.time {
+		return
+	}
+	dt := float64(now - self.time)
+	self.servingValue += int64(float64(self.servingDelta) * dt / rcConst)
+	if self.sumWeight > 0 {
+		self.vtime += dt * float64(self.rcRecharge) / float64(rcConst*self.sumWeight)
+	}
+	self.time = now
+}
+
+// rechargeTime returns the time it takes for the virtual time to advance by dv
+// with the current set of recharging nodes.
+func (self *ClientManager) rechargeTime(dv float64) mclock.AbsTime {
+	if dv <= 0 {
+		return 0
+	}
+	return mclock.AbsTime(math.Ceil(dv * float64(rcConst*self.sumWeight) / float64(self.rcRecharge)))
+}
+
+// value returns the current recharge value of a node.
+func (self *ClientManager) value(node *cmNode) int64 {
+	if node.recharging {
+		if value := int64((node.finish - self.vtime) * float64(node.rcWeight)); value > 0 {
+			return value
 		}
+		return 0
+	}
+	return node.rcValue
+}
+
+// rcSum returns the total recharge value of all nodes.
+func (self *ClientManager) rcSum() int64 {
+	sum := self.servingValue + int64(self.sumFinish-self.vtime*float64(self.sumWeight))
+	if sum < 0 {
+		return 0
+	}
+	return sum
+}
+
+// startRecharging queues a node to recharge the given value.
+func (self *ClientManager) startRecharging(node *cmNode, value int64) {
+	node.recharging = true
+	node.finish = self.vtime + float64(value)/float64(node.rcWeight)
+	heap.Push(&self.recharging, node)
+	self.sumWeight += node.rcWeight
+	self.sumFinish += node.finish * float64(node.rcWeight)
+}
+
+// stopRecharging removes a node from the recharge queue, returning the value
+// it still had to recharge.
+func (self *ClientManager) stopRecharging(node *cmNode) int64 {
+	value := self.value(node)
+	heap.Remove(&self.recharging, node.index)
+	node.recharging = false
+	self.sumWeight -= node.rcWeight
+	self.sumFinish -= node.finish * float64(node.rcWeight)
+	if self.sumWeight == 0 {
+		self.vtime, self.sumFinish = 0, 0
 	}
+	return value
 }
 
 func (self *ClientManager) canStartReq() bool {
-	return self.simReqCnt < self.maxSimReq && self.rcSumValue < self.maxRcSum
+	return self.simReqCnt < self.maxSimReq && self.rcSum() < int64(self.maxRcSum)
 }
 
+// nextAdmission returns how long until the first queued request may be
+// admitted, or false if that depends on a request being finished.
+func (self *ClientManager) nextAdmission() (time.Duration, bool) {
+	if len(self.queue) == 0 || self.simReqCnt >= self.maxSimReq || len(self.recharging) == 0 {
+		return 0, false
+	}
+	// Nodes are either served or recharged at a constant total rate until the
+	// next recharge completes
+	wait := self.rechargeTime(self.recharging[0].finish - self.vtime)
+	if slope := int64(self.rcRecharge) - self.servingDelta; slope > 0 {
+		excess := self.rcSum() - int64(self.maxRcSum) + 1
+		if cross := mclock.AbsTime((excess*rcConst + slope - 1) / slope); cross < wait {
+			wait = cross
+		}
+	}
+	return time.Duration(wait), true
+}
+
+// notify wakes the scheduler to reconsider the admission queue.
+func (self *ClientManager) notify() {
+	select {
+	case self.wake <- struct{}{}:
+	default:
+	}
+}
+
+// queueProc admits the queued requests as soon as capacity allows, sleeping
+// until the next time it may rather than polling.
 func (self *ClientManager) queueProc() {
-	for rc := range self.resumeQueue {
-		for {
-			time.Sleep(time.Millisecond * 10)
-			self.lock.Lock()
-			self.update(mclock.Now())
-			cs := self.canStartReq()
-			self.lock.Unlock()
-			if cs {
-				break
+	timer := time.NewTimer(time.Hour)
+	timer.Stop()
+
+	for {
+		self.lock.Lock()
+		self.advance(mclock.Now())
+		for len(self.queue) > 0 && self.canStartReq() {
+			req := heap.Pop(&self.queue).(*cmRequest)
+			req.resume <- self.start(req.node)
+		}
+		wait, timed := self.nextAdmission()
+		self.lock.Unlock()
+
+		var timeout <-chan time.Time
+		if timed {
+			timer.Reset(wait)
+			timeout = timer.C
+		}
+		select {
+		case <-timeout:
+		case <-self.wake:
+			if timed && !timer.Stop() {
+				<-timer.C
 			}
+		case <-self.quit:
+			timer.Stop()
+			return
 		}
-		close(rc)
 	}
 }
 
-func (self *ClientManager) accept(node *cmNode, time mclock.AbsTime) bool {
+// accept waits until a request of the node may be served, returning the
+// admitted request or nil if it was rejected.
+func (self *ClientManager) accept(node *cmNode, time mclock.AbsTime) *ServingRequest {
 	self.lock.Lock()
-	defer self.lock.Unlock()
-
-	self.update(time)
-	if !self.canStartReq() {
-		resume := make(chan bool)
+	if _, ok := self.nodes[node]; !ok {
 		self.lock.Unlock()
-		self.resumeQueue <- resume
-		<-resume
-		self.lock.Lock()
-		if _, ok := self.nodes[node]; !ok {
-			return false // reject if node has been removed or manager has been stopped
+		return nil // reject if node has been removed or manager has been stopped
+	}
+	self.advance(time)
+	if len(self.queue) == 0 && self.canStartReq() {
+		req := self.start(node)
+		self.lock.Unlock()
+		return req
+	}
+	req := &cmRequest{
+		node:     node,
+		priority: float64(self.value(node)) / float64(node.rcWeight),
+		seq:      self.seq,
+		resume:   make(chan *ServingRequest, 1),
+	}
+	self.seq++
+	heap.Push(&self.queue, req)
+	self.notify()
+	self.lock.Unlock()
+
+	return <-req.resume
+}
+
+// start marks a node as being served with one more request.
+func (self *ClientManager) start(node *cmNode) *ServingRequest {
+	if len(node.serving) == 0 {
+		value := node.rcValue
+		if node.recharging {
+			value = self.stopRecharging(node)
 		}
+		node.rcValue = value
+		self.servingValue += value
+	} else {
+		node.rcValue += node.rcDelta * int64(self.time-node.lastUpdate) / rcConst
 	}
+	node.lastUpdate = self.time
+
 	self.simReqCnt++
-	node.set(true, self.simReqCnt, self.sumWeight)
-	node.startValue = node.rcValue
-	self.update(self.time)
-	return true
+	delta := int64(rcConst / self.simReqCnt)
+	req := &ServingRequest{delta: delta, start: self.time}
+	node.serving = append(node.serving, req)
+	node.rcDelta += delta
+	self.servingDelta += delta
+	return req
 }
 
-func (self *ClientManager) stop(node *cmNode, time mclock.AbsTime) {
-	if node.serving {
-		self.update(time)
-		self.simReqCnt--
-		node.set(false, self.simReqCnt, self.sumWeight)
-		self.update(time)
+// stop finishes serving a request of a node, returning the recharge value the
+// request added. The node starts recharging once it has no more requests being
+// served. Requests no longer served (e.g. of removed nodes) are ignored.
+func (self *ClientManager) stop(node *cmNode, req *ServingRequest, time mclock.AbsTime) int64 {
+	index := -1
+	for i, r := range node.serving {
+		if r == req {
+			index = i
+			break
+		}
+	}
+	if index < 0 {
+		return 0
+	}
+	self.advance(time)
+	node.rcValue += node.rcDelta * int64(self.time-node.lastUpdate) / rcConst
+	node.lastUpdate = self.time
+
+	copy(node.serving[index:], node.serving[index+1:])
+	node.serving[len(node.serving)-1] = nil
+	node.serving = node.serving[:len(node.serving)-1]
+	if len(node.serving) == 0 {
+		node.serving = nil
+	}
+	node.rcDelta -= req.delta
+
+	self.simReqCnt--
+	self.servingDelta -= req.delta
+	if len(node.serving) == 0 {
+		self.servingValue -= node.rcValue
+		if node.rcValue > 0 {
+			self.startRecharging(node, node.rcValue)
+		}
+	}
+	if self.simReqCnt == 0 {
+		// drop any accumulated rounding error
+		self.servingValue, self.servingDelta = 0, 0
 	}
+	self.notify()
+	return req.delta * int64(self.time-req.start) / rcConst
 }
 
-func (self *ClientManager) processed(node *cmNode, time mclock.AbsTime) (rcValue, rcCost uint64) {
+func (self *ClientManager) processed(node *cmNode, req *ServingRequest, time mclock.AbsTime) (rcValue, rcCost uint64) {
 	self.lock.Lock()
 	defer self.lock.Unlock()
 
-	self.stop(node, time)
-	return uint64(node.rcValue), uint64(node.rcValue - node.startValue)
+	rcCost = uint64(self.stop(node, req, time))
+	return uint64(node.rcValue), rcCost
 }
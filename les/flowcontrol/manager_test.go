@@ -0,0 +1,280 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package flowcontrol
+
+import (
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/trust-tech/go-trustmachine/common/mclock"
+)
+
+var testServerParams = &ServerParams{BufLimit: 300000000, MinRecharge: 50000}
+
+// rcSumAt returns the total recharge value of the clients at the given time.
+func (self *ClientManager) rcSumAt(time mclock.AbsTime) int64 {
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	self.advance(time)
+	return self.rcSum()
+}
+
+// Tests that recharging clients share the recharge capacity by weight, and that
+// the aggregated recharge value matches the per client values.
+func TestClientManagerRecharge(t *testing.T) {
+	// Recharge 1 unit per nanosecond, at times far enough ahead not to be
+	// disturbed by the scheduler
+	cm := NewClientManager(50, 10, 1000000000)
+	defer cm.Stop()
+	t0 := mclock.Now() + mclock.AbsTime(time.Hour)
+	ms := mclock.AbsTime(time.Millisecond)
+
+	a := NewClientNode(cm, testServerParams)
+	b := NewClientNode(cm, testServerParams)
+	ra, rb := cm.accept(a.cmNode, t0), cm.accept(b.cmNode, t0)
+	if ra == nil || rb == nil {
+		t.Fatalf("requests rejected")
+	}
+	if value, cost := cm.processed(a.cmNode, ra, t0+2*ms); value != 2000000 || cost != 2000000 {
+		t.Fatalf("first value mismatch: have %d/%d, want 2000000/2000000", value, cost)
+	}
+	if value, _ := cm.processed(b.cmNode, rb, t0+2*ms); value != 1000000 {
+		t.Fatalf("second value mismatch: have %d, want 1000000", value)
+	}
+	// Both recharge at half speed until the second is done, then the first
+	// recharges at full speed
+	tests := []struct {
+		time mclock.AbsTime
+		sum  int64
+	}{
+		{t0 + 2*ms, 3000000},
+		{t0 + 3*ms, 2000000},
+		{t0 + 4*ms, 1000000},
+		{t0 + 4*ms + ms/2, 500000},
+		{t0 + 5*ms, 0},
+	}
+	for i, tt := range tests {
+		if sum := cm.rcSumAt(tt.time); sum < tt.sum-1 || sum > tt.sum+1 {
+			t.Errorf("test %d: recharge sum mismatch: have %d, want %d", i, sum, tt.sum)
+		}
+	}
+	if len(cm.recharging) != 0 || cm.sumWeight != 0 {
+		t.Errorf("recharge queue not empty: %d nodes, weight %d", len(cm.recharging), cm.sumWeight)
+	}
+}
+
+// Tests that a client may have several requests served at once, each adding
+// to its recharge value, and that it only starts recharging after the last.
+func TestClientManagerConcurrentRequests(t *testing.T) {
+	cm := NewClientManager(50, 10, 1000000000)
+	defer cm.Stop()
+	t0 := mclock.Now() + mclock.AbsTime(time.Hour)
+	ms := mclock.AbsTime(time.Millisecond)
+
+	a := NewClientNode(cm, testServerParams)
+	r1, r2 := cm.accept(a.cmNode, t0), cm.accept(a.cmNode, t0+ms)
+	if r1 == nil || r2 == nil {
+		t.Fatalf("requests rejected")
+	}
+	// The first request runs alone for a millisecond, then both at half speed
+	if value, cost := cm.processed(a.cmNode, r1, t0+2*ms); value != 2500000 || cost != 2000000 {
+		t.Fatalf("first value mismatch: have %d/%d, want 2500000/2000000", value, cost)
+	}
+	if len(cm.recharging) != 0 || cm.simReqCnt != 1 {
+		t.Fatalf("recharging while still served")
+	}
+	if value, cost := cm.processed(a.cmNode, r2, t0+3*ms); value != 3000000 || cost != 1000000 {
+		t.Fatalf("second value mismatch: have %d/%d, want 3000000/1000000", value, cost)
+	}
+	if sum := cm.rcSumAt(t0 + 3*ms); sum < 2999999 || sum > 3000001 {
+		t.Fatalf("recharge sum mismatch: have %d, want 3000000", sum)
+	}
+}
+
+// Tests that requests of a client finishing out of admission order are each
+// charged their own recharge cost.
+func TestClientManagerOutOfOrderRequests(t *testing.T) {
+	cm := NewClientManager(50, 10, 1000000000)
+	defer cm.Stop()
+	t0 := mclock.Now() + mclock.AbsTime(time.Hour)
+	ms := mclock.AbsTime(time.Millisecond)
+
+	a := NewClientNode(cm, testServerParams)
+	r1, r2 := cm.accept(a.cmNode, t0), cm.accept(a.cmNode, t0+ms)
+	if r1 == nil || r2 == nil {
+		t.Fatalf("requests rejected")
+	}
+	// The later request finishes first, having run at half speed throughout
+	if value, cost := cm.processed(a.cmNode, r2, t0+2*ms); value != 2500000 || cost != 500000 {
+		t.Fatalf("second value mismatch: have %d/%d, want 2500000/500000", value, cost)
+	}
+	if value, cost := cm.processed(a.cmNode, r1, t0+3*ms); value != 3500000 || cost != 3000000 {
+		t.Fatalf("first value mismatch: have %d/%d, want 3500000/3000000", value, cost)
+	}
+	// Finishing a request twice has no effect
+	if _, cost := cm.processed(a.cmNode, r1, t0+4*ms); cost != 0 {
+		t.Fatalf("finished request charged again: cost %d", cost)
+	}
+}
+
+// Tests that when capacity frees up, waiting requests are admitted lowest
+// recharge value first.
+func TestClientManagerAdmissionOrder(t *testing.T) {
+	cm := NewClientManager(50, 1, 1000000000)
+	defer cm.Stop()
+	t0 := mclock.Now() + mclock.AbsTime(time.Hour)
+	ms := mclock.AbsTime(time.Millisecond)
+
+	a := NewClientNode(cm, testServerParams)
+	b := NewClientNode(cm, testServerParams)
+	c := NewClientNode(cm, testServerParams)
+
+	// Let b accumulate some recharge value, then keep a busy
+	cm.processed(b.cmNode, cm.accept(b.cmNode, t0), t0+ms)
+	ra := cm.accept(a.cmNode, t0+ms)
+
+	type admission struct {
+		node *ClientNode
+		req  *ServingRequest
+	}
+	admitted := make(chan admission, 2)
+	for _, node := range []*ClientNode{b, c} {
+		go func(node *ClientNode) {
+			if req := cm.accept(node.cmNode, t0+ms); req != nil {
+				admitted <- admission{node, req}
+			}
+		}(node)
+	}
+	for {
+		cm.lock.Lock()
+		queued := len(cm.queue)
+		cm.lock.Unlock()
+		if queued == 2 {
+			break
+		}
+		time.Sleep(time.Millisecond)
+	}
+	cm.processed(a.cmNode, ra, t0+ms+ms/10)
+	first := <-admitted
+	if first.node != c {
+		t.Fatalf("recharging client admitted before idle one")
+	}
+	select {
+	case <-admitted:
+		t.Fatalf("request admitted over the limit")
+	case <-time.After(10 * time.Millisecond):
+	}
+	cm.processed(c.cmNode, first.req, t0+ms+ms/5)
+	if second := <-admitted; second.node != b {
+		t.Fatalf("second request not admitted")
+	}
+}
+
+// Tests that a request waiting for clients to recharge is admitted as soon as
+// the total recharge value drops below the limit.
+func TestClientManagerRechargeWakeup(t *testing.T) {
+	cm := NewClientManager(50, 10, 10000000)
+	defer cm.Stop()
+
+	a := NewClientNode(cm, testServerParams)
+	b := NewClientNode(cm, testServerParams)
+
+	req := cm.accept(a.cmNode, mclock.Now())
+	time.Sleep(20 * time.Millisecond)
+	value, _ := cm.processed(a.cmNode, req, mclock.Now())
+	start := time.Now()
+	if cm.accept(b.cmNode, mclock.Now()) == nil {
+		t.Fatalf("request rejected")
+	}
+	// The value recharges by a unit per nanosecond
+	want := time.Duration(value) - 10*time.Millisecond
+	if elapsed := time.Since(start); elapsed < want-time.Millisecond || elapsed > want+20*time.Millisecond {
+		t.Fatalf("admission time mismatch: have %v, want %v", elapsed, want)
+	}
+}
+
+// Tests that finishing a request doesn't give back the costs reserved by other
+// requests of the same client that are still being served.
+func TestClientNodeConcurrentRequests(t *testing.T) {
+	cm := NewClientManager(50, 10, 1000000000)
+	defer cm.Stop()
+
+	node := NewClientNode(cm, testServerParams)
+	defer node.Remove(cm)
+
+	cost := testServerParams.BufLimit / 3
+	for i := 0; i < 3; i++ {
+		if _, ok := node.ReserveRequest(cost); !ok {
+			t.Fatalf("request %d: reservation failed", i)
+		}
+	}
+	req, ok := node.AcceptRequest()
+	if !ok {
+		t.Fatalf("request rejected")
+	}
+	// The buffer may only be raised above the costs of the two other requests
+	// (plus some recharge while the test runs)
+	bv, _ := node.RequestProcessed(req, cost)
+	if limit := testServerParams.BufLimit - 2*cost + 10000000; bv > limit {
+		t.Fatalf("buffer value too high: have %d, limit %d", bv, limit)
+	}
+	if _, ok := node.ReserveRequest(2 * cost); ok {
+		t.Fatalf("reservation exceeding the buffer accepted")
+	}
+}
+
+// benchmarkClientManager simulates many clients competing for a server limited
+// in the number of simultaneously served requests and their total cost.
+func benchmarkClientManager(b *testing.B, clients int, maxSimReq, maxRcSum uint64, work time.Duration) {
+	cm := NewClientManager(50, maxSimReq, maxRcSum)
+	defer cm.Stop()
+
+	var (
+		pending = int64(b.N)
+		wg      sync.WaitGroup
+	)
+	b.ResetTimer()
+	for i := 0; i < clients; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			node := NewClientNode(cm, testServerParams)
+			defer node.Remove(cm)
+
+			for atomic.AddInt64(&pending, -1) >= 0 {
+				req, ok := node.AcceptRequest()
+				if !ok {
+					b.Errorf("request rejected")
+					return
+				}
+				time.Sleep(work)
+				node.RequestProcessed(req, 0)
+			}
+		}()
+	}
+	wg.Wait()
+}
+
+func BenchmarkClientManagerSimReq(b *testing.B) {
+	benchmarkClientManager(b, 100, 10, 1000000000, 100*time.Microsecond)
+}
+func BenchmarkClientManagerRecharge(b *testing.B) {
+	benchmarkClientManager(b, 100, 10, 1000000, 100*time.Microsecond)
+}
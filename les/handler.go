@@ -18,7 +18,6 @@
 package les
 
 import (
-	"encoding/binary"
 	"errors"
 	"fmt"
 	"math/big"
@@ -126,6 +125,9 @@ type ProtocolManager struct {
 	// wait group is used for graceful shutdowns during downloading
 	// and processing
 	wg *sync.WaitGroup
+
+	servingPools map[uint64]*servingPool // Request serving threads by message code, nil if not serving
+	servingCache *servingCache           // Encoded headers and CHT proofs served recently, nil if not serving
 }
 
 // NewProtocolManager returns a new trustmachine sub protocol manager. The Trustmachine sub protocol manages peers capable
@@ -209,6 +211,9 @@ func NewProtocolManager(chainConfig *params.ChainConfig, lightSync bool, network
 		manager.downloader = downloader.New(downloader.LightSync, chainDb, manager.eventMux, nil, blockchain, removePeer)
 		manager.peers.notify((*downloaderPeerNotify)(manager))
 		manager.fetcher = newLightFetcher(manager)
+	} else {
+		manager.servingPools = newServingPools(manager.execute)
+		manager.servingCache = newServingCache(chainDb)
 	}
 
 	return manager, nil
@@ -250,6 +255,10 @@ func (pm *ProtocolManager) Stop() {
 	// Wait for any process action
 	pm.wg.Wait()
 
+	for _, pool := range pm.servingPools {
+		pool.stop()
+	}
+
 	log.Info("Light Trustmachine protocol stopped")
 }
 
@@ -297,15 +306,14 @@ func (pm *ProtocolManager) handle(p *peer) error {
 		}
 	}
 
-	stop := make(chan struct{})
-	defer close(stop)
+	defer close(p.quit)
 	go func() {
 		// new block announce loop
 		for {
 			select {
 			case announce := <-p.announceChn:
 				p.SendAnnounce(announce)
-			case <-stop:
+			case <-p.quit:
 				return
 			}
 		}
@@ -333,22 +341,38 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 	p.Log().Trace("Light Trustmachine message arrived", "code", msg.Code, "bytes", msg.Size)
 
 	costs := p.fcCosts[msg.Code]
-	reject := func(reqCnt, maxCnt uint64) bool {
-		if p.fcClient == nil || reqCnt > maxCnt {
-			return true
-		}
-		bufValue, _ := p.fcClient.AcceptRequest()
+	maxCost := func(reqCnt uint64) uint64 {
 		cost := costs.baseCost + reqCnt*costs.reqCost
 		if cost > pm.server.defParams.BufLimit {
 			cost = pm.server.defParams.BufLimit
 		}
-		if cost > bufValue {
+		return cost
+	}
+	reject := func(reqCnt, maxCnt uint64) bool {
+		if p.fcClient == nil || reqCnt > maxCnt {
+			return true
+		}
+		cost := maxCost(reqCnt)
+		if bufValue, ok := p.fcClient.ReserveRequest(cost); !ok {
 			recharge := time.Duration((cost - bufValue) * 1000000 / pm.server.defParams.MinRecharge)
 			p.Log().Error("Request came too early", "recharge", common.PrettyDuration(recharge))
 			return true
 		}
 		return false
 	}
+	// serve schedules a reserved request on the serving pool of its class. If
+	// the peer has as many requests in flight as its send queue holds, reading
+	// further messages waits until one of its replies is sent.
+	serve := func(reqCnt uint64, f func() func(bv uint64) error) {
+		select {
+		case p.serving <- struct{}{}:
+		case <-p.quit:
+			return
+		}
+		if !pm.servingPools[msg.Code].queue(&servingTask{peer: p, msgcode: msg.Code, reqCnt: reqCnt, maxCost: maxCost(reqCnt), serve: f}) {
+			<-p.serving
+		}
+	}
 
 	if msg.Size > ProtocolMaxMsgSize {
 		return errResp(ErrMsgTooLarge, "%v > %v", msg.Size, ProtocolMaxMsgSize)
@@ -392,71 +416,71 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 		if reject(query.Amount, MaxHeaderFetch) {
 			return errResp(ErrRequestRejected, "")
 		}
-
-		hashMode := query.Origin.Hash != (common.Hash{})
-
-		// Gather headers until the fetch or network limits is reached
-		var (
-			bytes   common.StorageSize
-			headers []*types.Header
-			unknown bool
-		)
-		for !unknown && len(headers) < int(query.Amount) && bytes < softResponseLimit {
-			// Retrieve the next header satisfying the query
-			var origin *types.Header
-			if hashMode {
-				origin = pm.blockchain.GetHeaderByHash(query.Origin.Hash)
-			} else {
-				origin = pm.blockchain.GetHeaderByNumber(query.Origin.Number)
-			}
-			if origin == nil {
-				break
-			}
-			number := origin.Number.Uint64()
-			headers = append(headers, origin)
-			bytes += estHeaderRlpSize
-
-			// Advance to the next header of the query
-			switch {
-			case query.Origin.Hash != (common.Hash{}) && query.Reverse:
-				// Hash based traversal towards the genesis block
-				for i := 0; i < int(query.Skip)+1; i++ {
-					if header := pm.blockchain.GetHeader(query.Origin.Hash, number); header != nil {
-						query.Origin.Hash = header.ParentHash
-						number--
+		serve(query.Amount, func() func(uint64) error {
+			hashMode := query.Origin.Hash != (common.Hash{})
+
+			// Gather headers until the fetch or network limits is reached, sending
+			// them as stored in the database
+			var (
+				bytes   common.StorageSize
+				headers []rlp.RawValue
+				unknown bool
+			)
+			for !unknown && len(headers) < int(query.Amount) && bytes < softResponseLimit {
+				// Retrieve the next header satisfying the query
+				var origin *cachedHeader
+				if hashMode {
+					origin = pm.servingCache.headerByHash(query.Origin.Hash)
+				} else {
+					origin = pm.servingCache.headerByNumber(query.Origin.Number)
+				}
+				if origin == nil {
+					break
+				}
+				number := origin.number
+				headers = append(headers, origin.rlp)
+				bytes += estHeaderRlpSize
+
+				// Advance to the next header of the query
+				switch {
+				case query.Origin.Hash != (common.Hash{}) && query.Reverse:
+					// Hash based traversal towards the genesis block
+					for i := 0; i < int(query.Skip)+1; i++ {
+						if header := pm.servingCache.header(query.Origin.Hash, number); header != nil {
+							query.Origin.Hash = header.parent
+							number--
+						} else {
+							unknown = true
+							break
+						}
+					}
+				case query.Origin.Hash != (common.Hash{}) && !query.Reverse:
+					// Hash based traversal towards the leaf block, only possible
+					// along the canonical chain
+					next := core.GetCanonicalHash(pm.chainDb, number+query.Skip+1)
+					if next != (common.Hash{}) && core.GetCanonicalHash(pm.chainDb, number) == query.Origin.Hash {
+						query.Origin.Hash = next
 					} else {
 						unknown = true
-						break
 					}
-				}
-			case query.Origin.Hash != (common.Hash{}) && !query.Reverse:
-				// Hash based traversal towards the leaf block
-				if header := pm.blockchain.GetHeaderByNumber(origin.Number.Uint64() + query.Skip + 1); header != nil {
-					if pm.blockchain.GetBlockHashesFromHash(header.Hash(), query.Skip+1)[query.Skip] == query.Origin.Hash {
-						query.Origin.Hash = header.Hash()
+				case query.Reverse:
+					// Number based traversal towards the genesis block
+					if query.Origin.Number >= query.Skip+1 {
+						query.Origin.Number -= (query.Skip + 1)
 					} else {
 						unknown = true
 					}
-				} else {
-					unknown = true
-				}
-			case query.Reverse:
-				// Number based traversal towards the genesis block
-				if query.Origin.Number >= query.Skip+1 {
-					query.Origin.Number -= (query.Skip + 1)
-				} else {
-					unknown = true
-				}
 
-			case !query.Reverse:
-				// Number based traversal towards the leaf block
-				query.Origin.Number += (query.Skip + 1)
+				case !query.Reverse:
+					// Number based traversal towards the leaf block
+					query.Origin.Number += (query.Skip + 1)
+				}
 			}
-		}
 
-		bv, rcost := p.fcClient.RequestProcessed(costs.baseCost + query.Amount*costs.reqCost)
-		pm.server.fcCostStats.update(msg.Code, query.Amount, rcost)
-		return p.SendBlockHeaders(req.ReqID, bv, headers)
+			return func(bv uint64) error {
+				return p.SendBlockHeadersRLP(req.ReqID, bv, headers)
+			}
+		})
 
 	case BlockHeadersMsg:
 		if pm.downloader == nil {
@@ -492,28 +516,30 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 		if err := msg.Decode(&req); err != nil {
 			return errResp(ErrDecode, "msg %v: %v", msg, err)
 		}
-		// Gather blocks until the fetch or network limits is reached
-		var (
-			bytes  int
-			bodies []rlp.RawValue
-		)
 		reqCnt := len(req.Hashes)
 		if reject(uint64(reqCnt), MaxBodyFetch) {
 			return errResp(ErrRequestRejected, "")
 		}
-		for _, hash := range req.Hashes {
-			if bytes >= softResponseLimit {
-				break
+		serve(uint64(reqCnt), func() func(uint64) error {
+			// Gather blocks until the fetch or network limits is reached
+			var (
+				bytes  int
+				bodies []rlp.RawValue
+			)
+			for _, hash := range req.Hashes {
+				if bytes >= softResponseLimit {
+					break
+				}
+				// Retrieve the requested block body, stopping if enough was found
+				if data := core.GetBodyRLP(pm.chainDb, hash, core.GetBlockNumber(pm.chainDb, hash)); len(data) != 0 {
+					bodies = append(bodies, data)
+					bytes += len(data)
+				}
 			}
-			// Retrieve the requested block body, stopping if enough was found
-			if data := core.GetBodyRLP(pm.chainDb, hash, core.GetBlockNumber(pm.chainDb, hash)); len(data) != 0 {
-				bodies = append(bodies, data)
-				bytes += len(data)
+			return func(bv uint64) error {
+				return p.SendBlockBodiesRLP(req.ReqID, bv, bodies)
 			}
-		}
-		bv, rcost := p.fcClient.RequestProcessed(costs.baseCost + uint64(reqCnt)*costs.reqCost)
-		pm.server.fcCostStats.update(msg.Code, uint64(reqCnt), rcost)
-		return p.SendBlockBodiesRLP(req.ReqID, bv, bodies)
+		})
 
 	case BlockBodiesMsg:
 		if pm.odr == nil {
@@ -546,35 +572,37 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 		if err := msg.Decode(&req); err != nil {
 			return errResp(ErrDecode, "msg %v: %v", msg, err)
 		}
-		// Gather state data until the fetch or network limits is reached
-		var (
-			bytes int
-			data  [][]byte
-		)
 		reqCnt := len(req.Reqs)
 		if reject(uint64(reqCnt), MaxCodeFetch) {
 			return errResp(ErrRequestRejected, "")
 		}
-		for _, req := range req.Reqs {
-			// Retrieve the requested state entry, stopping if enough was found
-			if header := core.GetHeader(pm.chainDb, req.BHash, core.GetBlockNumber(pm.chainDb, req.BHash)); header != nil {
-				if trie, _ := trie.New(header.Root, pm.chainDb); trie != nil {
-					sdata := trie.Get(req.AccKey)
-					var acc state.Account
-					if err := rlp.DecodeBytes(sdata, &acc); err == nil {
-						entry, _ := pm.chainDb.Get(acc.CodeHash)
-						if bytes+len(entry) >= softResponseLimit {
-							break
+		serve(uint64(reqCnt), func() func(uint64) error {
+			// Gather state data until the fetch or network limits is reached
+			var (
+				bytes int
+				data  [][]byte
+			)
+			for _, req := range req.Reqs {
+				// Retrieve the requested state entry, stopping if enough was found
+				if header := core.GetHeader(pm.chainDb, req.BHash, core.GetBlockNumber(pm.chainDb, req.BHash)); header != nil {
+					if trie, _ := trie.New(header.Root, pm.chainDb); trie != nil {
+						sdata := trie.Get(req.AccKey)
+						var acc state.Account
+						if err := rlp.DecodeBytes(sdata, &acc); err == nil {
+							entry, _ := pm.chainDb.Get(acc.CodeHash)
+							if bytes+len(entry) >= softResponseLimit {
+								break
+							}
+							data = append(data, entry)
+							bytes += len(entry)
 						}
-						data = append(data, entry)
-						bytes += len(entry)
 					}
 				}
 			}
-		}
-		bv, rcost := p.fcClient.RequestProcessed(costs.baseCost + uint64(reqCnt)*costs.reqCost)
-		pm.server.fcCostStats.update(msg.Code, uint64(reqCnt), rcost)
-		return p.SendCode(req.ReqID, bv, data)
+			return func(bv uint64) error {
+				return p.SendCode(req.ReqID, bv, data)
+			}
+		})
 
 	case CodeMsg:
 		if pm.odr == nil {
@@ -607,37 +635,39 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 		if err := msg.Decode(&req); err != nil {
 			return errResp(ErrDecode, "msg %v: %v", msg, err)
 		}
-		// Gather state data until the fetch or network limits is reached
-		var (
-			bytes    int
-			receipts []rlp.RawValue
-		)
 		reqCnt := len(req.Hashes)
 		if reject(uint64(reqCnt), MaxReceiptFetch) {
 			return errResp(ErrRequestRejected, "")
 		}
-		for _, hash := range req.Hashes {
-			if bytes >= softResponseLimit {
-				break
-			}
-			// Retrieve the requested block's receipts, skipping if unknown to us
-			results := core.GetBlockReceipts(pm.chainDb, hash, core.GetBlockNumber(pm.chainDb, hash))
-			if results == nil {
-				if header := pm.blockchain.GetHeaderByHash(hash); header == nil || header.ReceiptHash != types.EmptyRootHash {
-					continue
+		serve(uint64(reqCnt), func() func(uint64) error {
+			// Gather state data until the fetch or network limits is reached
+			var (
+				bytes    int
+				receipts []rlp.RawValue
+			)
+			for _, hash := range req.Hashes {
+				if bytes >= softResponseLimit {
+					break
+				}
+				// Retrieve the requested block's receipts, skipping if unknown to us
+				results := core.GetBlockReceipts(pm.chainDb, hash, core.GetBlockNumber(pm.chainDb, hash))
+				if results == nil {
+					if header := pm.blockchain.GetHeaderByHash(hash); header == nil || header.ReceiptHash != types.EmptyRootHash {
+						continue
+					}
+				}
+				// If known, encode and queue for response packet
+				if encoded, err := rlp.EncodeToBytes(results); err != nil {
+					log.Error("Failed to encode receipt", "err", err)
+				} else {
+					receipts = append(receipts, encoded)
+					bytes += len(encoded)
 				}
 			}
-			// If known, encode and queue for response packet
-			if encoded, err := rlp.EncodeToBytes(results); err != nil {
-				log.Error("Failed to encode receipt", "err", err)
-			} else {
-				receipts = append(receipts, encoded)
-				bytes += len(encoded)
+			return func(bv uint64) error {
+				return p.SendReceiptsRLP(req.ReqID, bv, receipts)
 			}
-		}
-		bv, rcost := p.fcClient.RequestProcessed(costs.baseCost + uint64(reqCnt)*costs.reqCost)
-		pm.server.fcCostStats.update(msg.Code, uint64(reqCnt), rcost)
-		return p.SendReceiptsRLP(req.ReqID, bv, receipts)
+		})
 
 	case ReceiptsMsg:
 		if pm.odr == nil {
@@ -670,41 +700,43 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 		if err := msg.Decode(&req); err != nil {
 			return errResp(ErrDecode, "msg %v: %v", msg, err)
 		}
-		// Gather state data until the fetch or network limits is reached
-		var (
-			bytes  int
-			proofs proofsData
-		)
 		reqCnt := len(req.Reqs)
 		if reject(uint64(reqCnt), MaxProofsFetch) {
 			return errResp(ErrRequestRejected, "")
 		}
-		for _, req := range req.Reqs {
-			if bytes >= softResponseLimit {
-				break
-			}
-			// Retrieve the requested state entry, stopping if enough was found
-			if header := core.GetHeader(pm.chainDb, req.BHash, core.GetBlockNumber(pm.chainDb, req.BHash)); header != nil {
-				if tr, _ := trie.New(header.Root, pm.chainDb); tr != nil {
-					if len(req.AccKey) > 0 {
-						sdata := tr.Get(req.AccKey)
-						tr = nil
-						var acc state.Account
-						if err := rlp.DecodeBytes(sdata, &acc); err == nil {
-							tr, _ = trie.New(acc.Root, pm.chainDb)
+		serve(uint64(reqCnt), func() func(uint64) error {
+			// Gather state data until the fetch or network limits is reached
+			var (
+				bytes  int
+				proofs proofsData
+			)
+			for _, req := range req.Reqs {
+				if bytes >= softResponseLimit {
+					break
+				}
+				// Retrieve the requested state entry, stopping if enough was found
+				if header := core.GetHeader(pm.chainDb, req.BHash, core.GetBlockNumber(pm.chainDb, req.BHash)); header != nil {
+					if tr, _ := trie.New(header.Root, pm.chainDb); tr != nil {
+						if len(req.AccKey) > 0 {
+							sdata := tr.Get(req.AccKey)
+							tr = nil
+							var acc state.Account
+							if err := rlp.DecodeBytes(sdata, &acc); err == nil {
+								tr, _ = trie.New(acc.Root, pm.chainDb)
+							}
+						}
+						if tr != nil {
+							proof := tr.Prove(req.Key)
+							proofs = append(proofs, proof)
+							bytes += len(proof)
 						}
-					}
-					if tr != nil {
-						proof := tr.Prove(req.Key)
-						proofs = append(proofs, proof)
-						bytes += len(proof)
 					}
 				}
 			}
-		}
-		bv, rcost := p.fcClient.RequestProcessed(costs.baseCost + uint64(reqCnt)*costs.reqCost)
-		pm.server.fcCostStats.update(msg.Code, uint64(reqCnt), rcost)
-		return p.SendProofs(req.ReqID, bv, proofs)
+			return func(bv uint64) error {
+				return p.SendProofs(req.ReqID, bv, proofs)
+			}
+		})
 
 	case ProofsMsg:
 		if pm.odr == nil {
@@ -737,35 +769,32 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 		if err := msg.Decode(&req); err != nil {
 			return errResp(ErrDecode, "msg %v: %v", msg, err)
 		}
-		// Gather state data until the fetch or network limits is reached
-		var (
-			bytes  int
-			proofs []ChtResp
-		)
 		reqCnt := len(req.Reqs)
 		if reject(uint64(reqCnt), MaxHeaderProofsFetch) {
 			return errResp(ErrRequestRejected, "")
 		}
-		for _, req := range req.Reqs {
-			if bytes >= softResponseLimit {
-				break
-			}
+		serve(uint64(reqCnt), func() func(uint64) error {
+			// Gather state data until the fetch or network limits is reached
+			var (
+				bytes  int
+				proofs []chtRespRLP
+			)
+			for _, req := range req.Reqs {
+				if bytes >= softResponseLimit {
+					break
+				}
 
-			if header := pm.blockchain.GetHeaderByNumber(req.BlockNum); header != nil {
-				if root := getChtRoot(pm.chainDb, req.ChtNum); root != (common.Hash{}) {
-					if tr, _ := trie.New(root, pm.chainDb); tr != nil {
-						var encNumber [8]byte
-						binary.BigEndian.PutUint64(encNumber[:], req.BlockNum)
-						proof := tr.Prove(encNumber[:])
-						proofs = append(proofs, ChtResp{Header: header, Proof: proof})
+				if header := pm.servingCache.headerByNumber(req.BlockNum); header != nil {
+					if proof, ok := pm.servingCache.chtProof(req.ChtNum, req.BlockNum); ok {
+						proofs = append(proofs, chtRespRLP{Header: header.rlp, Proof: proof})
 						bytes += len(proof) + estHeaderRlpSize
 					}
 				}
 			}
-		}
-		bv, rcost := p.fcClient.RequestProcessed(costs.baseCost + uint64(reqCnt)*costs.reqCost)
-		pm.server.fcCostStats.update(msg.Code, uint64(reqCnt), rcost)
-		return p.SendHeaderProofs(req.ReqID, bv, proofs)
+			return func(bv uint64) error {
+				return p.SendHeaderProofsRLP(req.ReqID, bv, proofs)
+			}
+		})
 
 	case HeaderProofsMsg:
 		if pm.odr == nil {
@@ -801,11 +830,16 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 			return errResp(ErrRequestRejected, "")
 		}
 
+		req, ok := p.fcClient.AcceptRequest()
+		if !ok {
+			return errResp(ErrRequestRejected, "")
+		}
 		if err := pm.txpool.AddRemotes(txs); err != nil {
+			p.fcClient.RequestProcessed(req, maxCost(uint64(reqCnt)))
 			return errResp(ErrUnexpectedResponse, "msg: %v", err)
 		}
 
-		_, rcost := p.fcClient.RequestProcessed(costs.baseCost + uint64(reqCnt)*costs.reqCost)
+		_, rcost := p.fcClient.RequestProcessed(req, maxCost(uint64(reqCnt)))
 		pm.server.fcCostStats.update(msg.Code, uint64(reqCnt), rcost)
 
 	default:
@@ -825,6 +859,49 @@ func (pm *ProtocolManager) handleMsg(p *peer) error {
 	return nil
 }
 
+// execute serves a request on one of the serving threads and queues the reply
+// for sending, unless the peer disconnects in the meantime. Replies of a peer
+// are sent in the order their requests finish, the client matches them by
+// request ID. The serving slot of the request is released once its reply is
+// sent or dropped.
+func (pm *ProtocolManager) execute(task *servingTask) {
+	p := task.peer
+	select {
+	case <-p.quit:
+		<-p.serving
+		return
+	default:
+	}
+	req, ok := p.fcClient.AcceptRequest()
+	if !ok {
+		<-p.serving
+		return
+	}
+	reply := task.serve()
+	bv, rcost := p.fcClient.RequestProcessed(req, task.maxCost)
+	pm.server.fcCostStats.update(task.msgcode, task.reqCnt, rcost)
+
+	select {
+	case <-p.quit:
+		<-p.serving
+		return
+	default:
+	}
+	send := func() {
+		defer func() { <-p.serving }()
+		if err := reply(bv); err != nil {
+			p.Log().Debug("Failed to send reply", "code", task.msgcode, "err", err)
+		}
+	}
+	// Slow peers mustn't hold up the serving threads, so replies are only sent
+	// from the peer's queue. Servers only queue replies there, and the serving
+	// slots keep their number within the queue's capacity, so this only fails
+	// once the peer is gone.
+	if !p.sendQueue.queue(send) {
+		<-p.serving
+	}
+}
+
 // NodeInfo retrieves some protocol metadata about the running host node.
 func (self *ProtocolManager) NodeInfo() *entrust.EntrustNodeInfo {
 	return &entrust.EntrustNodeInfo{
@@ -289,6 +289,13 @@ type ChtResp struct {
 	Proof  []rlp.RawValue
 }
 
+// chtRespRLP is the wire equivalent of ChtResp with the header already RLP
+// encoded, used when serving headers straight from the database.
+type chtRespRLP struct {
+	Header rlp.RawValue
+	Proof  []rlp.RawValue
+}
+
 // ODR request type for requesting headers by Canonical Hash Trie, see LesOdrRequest interface
 type ChtRequest light.ChtRequest
 
@@ -40,7 +40,8 @@ var (
 
 const (
 	maxHeadInfoLen    = 20
-	maxResponseErrors = 50 // number of invalid responses tolerated (makes the protocol less brittle but still avoids spam)
+	maxResponseErrors = 50  // number of invalid responses tolerated (makes the protocol less brittle but still avoids spam)
+	sendQueueSize     = 100 // number of requests or replies that may wait for sending to a peer
 )
 
 type peer struct {
@@ -58,6 +59,8 @@ type peer struct {
 
 	announceChn chan announceData
 	sendQueue   *execQueue
+	serving     chan struct{} // Slots of the requests being served, until their replies are sent
+	quit        chan struct{} // Closed when the peer disconnects, cancelling its requests
 
 	poolEntry      *poolEntry
 	hasBlock       func(common.Hash, uint64) bool
@@ -79,6 +82,8 @@ func newPeer(version int, network uint64, p *p2p.Peer, rw p2p.MsgReadWriter) *pe
 		network:     network,
 		id:          fmt.Sprintf("%x", id[:8]),
 		announceChn: make(chan announceData, 20),
+		serving:     make(chan struct{}, sendQueueSize-1), // the send queue still counts a reply while sending it
+		quit:        make(chan struct{}),
 	}
 }
 
@@ -182,6 +187,12 @@ func (p *peer) SendBlockHeaders(reqID, bv uint64, headers []*types.Header) error
 	return sendResponse(p.rw, BlockHeadersMsg, reqID, bv, headers)
 }
 
+// SendBlockHeadersRLP sends a batch of block headers to the remote peer from
+// an already RLP encoded format.
+func (p *peer) SendBlockHeadersRLP(reqID, bv uint64, headers []rlp.RawValue) error {
+	return sendResponse(p.rw, BlockHeadersMsg, reqID, bv, headers)
+}
+
 // SendBlockBodiesRLP sends a batch of block contents to the remote peer from
 // an already RLP encoded format.
 func (p *peer) SendBlockBodiesRLP(reqID, bv uint64, bodies []rlp.RawValue) error {
@@ -210,6 +221,12 @@ func (p *peer) SendHeaderProofs(reqID, bv uint64, proofs []ChtResp) error {
 	return sendResponse(p.rw, HeaderProofsMsg, reqID, bv, proofs)
 }
 
+// SendHeaderProofsRLP sends a batch of CHT proofs, with the headers already RLP
+// encoded, to the remote peer.
+func (p *peer) SendHeaderProofsRLP(reqID, bv uint64, proofs []chtRespRLP) error {
+	return sendResponse(p.rw, HeaderProofsMsg, reqID, bv, proofs)
+}
+
 // RequestHeadersByHash fetches a batch of blocks' headers corresponding to the
 // specified header query, based on the hash of an origin block.
 func (p *peer) RequestHeadersByHash(reqID, cost uint64, origin common.Hash, amount int, skip int, reverse bool) error {
@@ -480,7 +497,7 @@ func (ps *peerSet) Register(p *peer) error {
 		return errAlreadyRegistered
 	}
 	ps.peers[p.id] = p
-	p.sendQueue = newExecQueue(100)
+	p.sendQueue = newExecQueue(sendQueueSize)
 	for _, n := range ps.notifyList {
 		go n.registerPeer(p)
 	}
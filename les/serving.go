@@ -0,0 +1,104 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package les
+
+import (
+	"runtime"
+	"sync"
+)
+
+// servingQueueSize is the number of accepted requests of a class that may wait
+// for a serving thread before the peers sending them are held back.
+const servingQueueSize = 64
+
+// servingTask is a client request accepted for serving. The serve function
+// gathers the reply and returns a function sending it with the given buffer
+// value.
+type servingTask struct {
+	peer    *peer
+	msgcode uint64
+	reqCnt  uint64
+	maxCost uint64 // Flow control cost reserved for the request
+	serve   func() (reply func(bv uint64) error)
+}
+
+// servingPool serves the requests of a class on a bounded number of threads,
+// so expensive requests (e.g. state proofs) can't starve cheap ones, and
+// requests of a peer don't wait for each other.
+type servingPool struct {
+	tasks chan *servingTask
+	quit  chan struct{}
+	wg    sync.WaitGroup
+}
+
+// newServingPool starts a pool serving requests on the given number of threads.
+func newServingPool(threads int, execute func(*servingTask)) *servingPool {
+	pool := &servingPool{
+		tasks: make(chan *servingTask, servingQueueSize),
+		quit:  make(chan struct{}),
+	}
+	pool.wg.Add(threads)
+	for i := 0; i < threads; i++ {
+		go func() {
+			defer pool.wg.Done()
+			for {
+				select {
+				case task := <-pool.tasks:
+					execute(task)
+				case <-pool.quit:
+					return
+				}
+			}
+		}()
+	}
+	return pool
+}
+
+// queue schedules a task for serving, waiting for room in the queue. It returns
+// false if the pool or the peer of the task quit in the meantime.
+func (pool *servingPool) queue(task *servingTask) bool {
+	select {
+	case pool.tasks <- task:
+		return true
+	case <-task.peer.quit:
+		return false
+	case <-pool.quit:
+		return false
+	}
+}
+
+// stop terminates the serving threads, waiting for the current requests to
+// finish.
+func (pool *servingPool) stop() {
+	close(pool.quit)
+	pool.wg.Wait()
+}
+
+// newServingPools creates the serving pools for the request classes of the
+// protocol. Request classes differ in their database access patterns, so each
+// one is served by its own set of threads.
+func newServingPools(execute func(*servingTask)) map[uint64]*servingPool {
+	threads := runtime.NumCPU()
+	if threads < 2 {
+		threads = 2
+	}
+	pools := make(map[uint64]*servingPool)
+	for _, msgcode := range []uint64{GetBlockHeadersMsg, GetBlockBodiesMsg, GetReceiptsMsg, GetCodeMsg, GetProofsMsg, GetHeaderProofsMsg} {
+		pools[msgcode] = newServingPool(threads, execute)
+	}
+	return pools
+}
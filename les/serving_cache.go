@@ -0,0 +1,133 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package les
+
+import (
+	"encoding/binary"
+
+	"github.com/hashicorp/golang-lru"
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/core"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+	"github.com/trust-tech/go-trustmachine/rlp"
+	"github.com/trust-tech/go-trustmachine/trie"
+)
+
+const (
+	headerCacheLimit   = 4096 // Number of encoded headers kept for serving
+	chtProofCacheLimit = 1024 // Number of CHT proofs kept for serving
+)
+
+// cachedHeader is a header as stored in the database, along with the fields
+// needed to traverse the chain without decoding it.
+type cachedHeader struct {
+	number uint64
+	parent common.Hash
+	rlp    rlp.RawValue
+}
+
+// chtProofKey identifies a proof of a block in a given CHT.
+type chtProofKey struct {
+	root   common.Hash
+	number uint64
+}
+
+// servingCache keeps the encoded headers and CHT proofs last served to clients.
+// Headers are sent exactly as stored, without a decode/encode round trip, and
+// popular items (typically the recent headers and the proofs of the latest CHT
+// sections) are read and built once instead of for every client asking.
+//
+// Entries are keyed by hash and CHT root, so they never go stale. The mapping
+// from numbers to canonical hashes is always read from the database.
+type servingCache struct {
+	db      entrustdb.Database
+	headers *lru.Cache // Encoded headers by hash
+	proofs  *lru.Cache // CHT proofs by root and block number
+}
+
+// newServingCache creates a serving cache on top of the chain database.
+func newServingCache(db entrustdb.Database) *servingCache {
+	headers, _ := lru.New(headerCacheLimit)
+	proofs, _ := lru.New(chtProofCacheLimit)
+	return &servingCache{db: db, headers: headers, proofs: proofs}
+}
+
+// header retrieves the encoded header with the given hash and number, or nil
+// if it's not found.
+func (c *servingCache) header(hash common.Hash, number uint64) *cachedHeader {
+	if cached, ok := c.headers.Get(hash); ok {
+		return cached.(*cachedHeader)
+	}
+	data := core.GetHeaderRLP(c.db, hash, number)
+	if len(data) == 0 {
+		return nil
+	}
+	// The parent hash is the first field of the header
+	fields, _, err := rlp.SplitList(data)
+	if err != nil {
+		return nil
+	}
+	parent, _, err := rlp.SplitString(fields)
+	if err != nil {
+		return nil
+	}
+	header := &cachedHeader{number: number, parent: common.BytesToHash(parent), rlp: data}
+	c.headers.Add(hash, header)
+	return header
+}
+
+// headerByHash retrieves the encoded header with the given hash, or nil if it's
+// not found.
+func (c *servingCache) headerByHash(hash common.Hash) *cachedHeader {
+	if cached, ok := c.headers.Get(hash); ok {
+		return cached.(*cachedHeader)
+	}
+	return c.header(hash, core.GetBlockNumber(c.db, hash))
+}
+
+// headerByNumber retrieves the encoded canonical header with the given number,
+// or nil if it's not found.
+func (c *servingCache) headerByNumber(number uint64) *cachedHeader {
+	hash := core.GetCanonicalHash(c.db, number)
+	if hash == (common.Hash{}) {
+		return nil
+	}
+	return c.header(hash, number)
+}
+
+// chtProof retrieves the proof of a block in the given CHT section, or false if
+// the section or its trie is not available.
+func (c *servingCache) chtProof(chtNum, number uint64) ([]rlp.RawValue, bool) {
+	root := getChtRoot(c.db, chtNum)
+	if root == (common.Hash{}) {
+		return nil, false
+	}
+	key := chtProofKey{root, number}
+	if cached, ok := c.proofs.Get(key); ok {
+		return cached.([]rlp.RawValue), true
+	}
+	tr, _ := trie.New(root, c.db)
+	if tr == nil {
+		return nil, false
+	}
+	var encNumber [8]byte
+	binary.BigEndian.PutUint64(encNumber[:], number)
+	proof := tr.Prove(encNumber[:])
+
+	c.proofs.Add(key, proof)
+	return proof, true
+}
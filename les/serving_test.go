@@ -0,0 +1,282 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package les
+
+import (
+	"encoding/binary"
+	"fmt"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/core"
+	"github.com/trust-tech/go-trustmachine/core/types"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+	"github.com/trust-tech/go-trustmachine/light"
+	"github.com/trust-tech/go-trustmachine/p2p"
+	"github.com/trust-tech/go-trustmachine/rlp"
+	"github.com/trust-tech/go-trustmachine/trie"
+)
+
+// Tests that a peer may have many requests in flight, all of which are served
+// and matched to their replies by request ID.
+func TestServingPipelinedRequests(t *testing.T) {
+	db, _ := entrustdb.NewMemDatabase()
+	pm := newTestProtocolManagerMust(t, false, 64, nil, nil, nil, db)
+	bc := pm.blockchain.(*core.BlockChain)
+	peer, _ := newTestPeer(t, "peer", 1, pm, true)
+	defer peer.close()
+
+	// Request every header separately without waiting for the replies
+	go func() {
+		for i := uint64(0); i <= 64; i++ {
+			sendRequest(peer.app, GetBlockHeadersMsg, i, 0, &getBlockHeadersData{Origin: hashOrNumber{Number: i}, Amount: 1})
+		}
+	}()
+	seen := make(map[uint64]bool)
+	for len(seen) <= 64 {
+		msg, err := peer.app.ReadMsg()
+		if err != nil {
+			t.Fatalf("failed to read reply: %v", err)
+		}
+		var reply struct {
+			ReqID, BV uint64
+			Headers   []*types.Header
+		}
+		if err := msg.Decode(&reply); err != nil || msg.Code != BlockHeadersMsg || len(reply.Headers) != 1 {
+			t.Fatalf("invalid reply: %v", err)
+		}
+		if seen[reply.ReqID] {
+			t.Fatalf("duplicate reply to request %d", reply.ReqID)
+		}
+		seen[reply.ReqID] = true
+		if reply.Headers[0].Hash() != bc.GetHeaderByNumber(reply.ReqID).Hash() {
+			t.Errorf("request %d: header mismatch", reply.ReqID)
+		}
+	}
+}
+
+// Tests that a peer sending requests faster than it reads the replies is held
+// back instead of being disconnected.
+func TestServingBackpressure(t *testing.T) {
+	db, _ := entrustdb.NewMemDatabase()
+	pm := newTestProtocolManagerMust(t, false, 4, nil, nil, nil, db)
+	peer, _ := newTestPeer(t, "peer", 1, pm, true)
+	defer peer.close()
+
+	// Send more requests than the send queue holds before reading any replies
+	requests := uint64(300)
+	go func() {
+		for i := uint64(0); i < requests; i++ {
+			sendRequest(peer.app, GetBlockHeadersMsg, i, 0, &getBlockHeadersData{Origin: hashOrNumber{Number: 1}, Amount: 1})
+		}
+	}()
+	time.Sleep(100 * time.Millisecond)
+
+	// All replies must arrive, a dropped peer never gets them
+	errc := make(chan error, 1)
+	go func() {
+		for i := uint64(0); i < requests; i++ {
+			msg, err := peer.app.ReadMsg()
+			if err != nil {
+				errc <- err
+				return
+			}
+			msg.Discard()
+			if msg.Code != BlockHeadersMsg {
+				errc <- fmt.Errorf("message code mismatch: have %d, want %d", msg.Code, BlockHeadersMsg)
+				return
+			}
+		}
+		errc <- nil
+	}()
+	select {
+	case err := <-errc:
+		if err != nil {
+			t.Fatalf("failed to read replies: %v", err)
+		}
+	case <-time.After(5 * time.Second):
+		t.Fatalf("replies not delivered")
+	}
+}
+
+// Tests that requests still waiting to be served are dropped when their peer
+// disconnects.
+func TestServingCancelled(t *testing.T) {
+	db, _ := entrustdb.NewMemDatabase()
+	pm := newTestProtocolManagerMust(t, false, 4, nil, nil, nil, db)
+	peer, errc := newTestPeer(t, "peer", 1, pm, true)
+	peer.close()
+	<-errc
+
+	var served int32
+	task := &servingTask{
+		peer:    peer.peer,
+		msgcode: GetBlockHeadersMsg,
+		serve: func() func(uint64) error {
+			atomic.AddInt32(&served, 1)
+			return func(uint64) error { return nil }
+		},
+	}
+	peer.peer.serving <- struct{}{}
+	pm.execute(task)
+	if atomic.LoadInt32(&served) != 0 {
+		t.Fatalf("request of disconnected peer served")
+	}
+}
+
+// makeTestCht builds a CHT over the canonical chain up to the given number and
+// stores it as the first section.
+func makeTestCht(db entrustdb.Database, blocks uint64) common.Hash {
+	tr, _ := trie.New(common.Hash{}, db)
+	for num := uint64(0); num < blocks; num++ {
+		hash := core.GetCanonicalHash(db, num)
+		data, _ := rlp.EncodeToBytes(light.ChtNode{Hash: hash, Td: core.GetTd(db, hash, num)})
+
+		var encNumber [8]byte
+		binary.BigEndian.PutUint64(encNumber[:], num)
+		tr.Update(encNumber[:], data)
+	}
+	root, _ := tr.Commit()
+	storeChtRoot(db, 1, root)
+	return root
+}
+
+// Tests that header proofs are served from the stored CHTs, and that repeated
+// requests are answered from the proof cache.
+func TestServingHeaderProofs(t *testing.T) {
+	db, _ := entrustdb.NewMemDatabase()
+	pm := newTestProtocolManagerMust(t, false, 32, nil, nil, nil, db)
+	root := makeTestCht(db, 32)
+	peer, _ := newTestPeer(t, "peer", 1, pm, true)
+	defer peer.close()
+
+	// Request proofs twice, including ones of unknown sections and blocks
+	reqs := []ChtReq{{ChtNum: 1, BlockNum: 0}, {ChtNum: 1, BlockNum: 17}, {ChtNum: 2, BlockNum: 1}, {ChtNum: 1, BlockNum: 100}, {ChtNum: 1, BlockNum: 31}}
+	for i := uint64(0); i < 2; i++ {
+		sendRequest(peer.app, GetHeaderProofsMsg, i, 0, reqs)
+
+		msg, err := peer.app.ReadMsg()
+		if err != nil {
+			t.Fatalf("failed to read reply: %v", err)
+		}
+		var reply struct {
+			ReqID, BV uint64
+			Data      []ChtResp
+		}
+		if err := msg.Decode(&reply); err != nil || msg.Code != HeaderProofsMsg {
+			t.Fatalf("invalid reply: %v", err)
+		}
+		if len(reply.Data) != 3 {
+			t.Fatalf("proof count mismatch: have %d, want 3", len(reply.Data))
+		}
+		for j, number := range []uint64{0, 17, 31} {
+			header, proof := reply.Data[j].Header, reply.Data[j].Proof
+			if hash := core.GetCanonicalHash(db, number); header.Hash() != hash {
+				t.Fatalf("proof %d: header mismatch: have %x, want %x", number, header.Hash(), hash)
+			}
+			var encNumber [8]byte
+			binary.BigEndian.PutUint64(encNumber[:], number)
+			value, err := trie.VerifyProof(root, encNumber[:], proof)
+			if err != nil {
+				t.Fatalf("proof %d: invalid proof: %v", number, err)
+			}
+			var node light.ChtNode
+			if err := rlp.DecodeBytes(value, &node); err != nil || node.Hash != header.Hash() {
+				t.Fatalf("proof %d: proven hash mismatch", number)
+			}
+		}
+	}
+	if n := pm.servingCache.proofs.Len(); n != 3 {
+		t.Errorf("proof cache size mismatch: have %d, want 3", n)
+	}
+}
+
+// benchmarkServing measures the throughput of a server with many clients, each
+// keeping a number of requests in flight.
+func benchmarkServing(b *testing.B, clients, inflight int, request func(pm *ProtocolManager, rw p2p.MsgWriter, reqID uint64)) {
+	db, _ := entrustdb.NewMemDatabase()
+	pm := newTestProtocolManagerMust(b, false, 256, testChainGen, nil, nil, db)
+	makeTestCht(db, 256)
+
+	peers := make([]*testPeer, clients)
+	for i := range peers {
+		peers[i], _ = newTestPeer(b, "peer", 1, pm, true)
+		defer peers[i].close()
+	}
+	var (
+		pending = int64(b.N)
+		wg      sync.WaitGroup
+	)
+	b.ResetTimer()
+	for _, peer := range peers {
+		wg.Add(1)
+		go func(peer *testPeer) {
+			defer wg.Done()
+
+			// Keep the requests flowing while collecting the replies
+			slots := make(chan struct{}, inflight)
+			go func() {
+				for reqID := uint64(0); atomic.AddInt64(&pending, -1) >= 0; reqID++ {
+					slots <- struct{}{}
+					request(pm, peer.app, reqID)
+				}
+				close(slots)
+			}()
+			for range slots {
+				msg, err := peer.app.ReadMsg()
+				if err != nil {
+					b.Errorf("failed to read reply: %v", err)
+					return
+				}
+				msg.Discard()
+			}
+		}(peer)
+	}
+	wg.Wait()
+}
+
+func BenchmarkServingHeaders(b *testing.B) {
+	benchmarkServing(b, 50, 8, func(pm *ProtocolManager, rw p2p.MsgWriter, reqID uint64) {
+		query := &getBlockHeadersData{Origin: hashOrNumber{Number: reqID % 192}, Amount: 64}
+		sendRequest(rw, GetBlockHeadersMsg, reqID, 0, query)
+	})
+}
+
+func BenchmarkServingProofs(b *testing.B) {
+	benchmarkServing(b, 50, 8, func(pm *ProtocolManager, rw p2p.MsgWriter, reqID uint64) {
+		head := pm.blockchain.CurrentHeader().Hash()
+
+		var reqs []ProofReq
+		for _, acc := range []common.Address{testBankAddress, acc1Addr, acc2Addr, testContractAddr} {
+			reqs = append(reqs, ProofReq{BHash: head, Key: acc[:]})
+		}
+		sendRequest(rw, GetProofsMsg, reqID, 0, reqs)
+	})
+}
+
+func BenchmarkServingHeaderProofs(b *testing.B) {
+	benchmarkServing(b, 50, 8, func(pm *ProtocolManager, rw p2p.MsgWriter, reqID uint64) {
+		reqs := make([]ChtReq, 16)
+		for i := range reqs {
+			reqs[i] = ChtReq{ChtNum: 1, BlockNum: (reqID + uint64(i)*16) % 256}
+		}
+		sendRequest(rw, GetHeaderProofsMsg, reqID, 0, reqs)
+	})
+}
@@ -19,6 +19,7 @@ package miner
 import (
 	"errors"
 	"math/big"
+	"runtime"
 	"sync"
 	"sync/atomic"
 	"time"
@@ -27,14 +28,33 @@ import (
 	"github.com/trust-tech/go-trustmachine/consensus"
 	"github.com/trust-tech/go-trustmachine/consensus/entrustash"
 	"github.com/trust-tech/go-trustmachine/core/types"
+	"github.com/trust-tech/go-trustmachine/event"
 	"github.com/trust-tech/go-trustmachine/log"
 )
 
+// maxWorkSeals is the maximum number of solutions remembered per work to reject
+// duplicates without verifying them again.
+const maxWorkSeals = 1024
+
 type hashrate struct {
 	ping time.Time
 	rate uint64
 }
 
+// remoteSeal is a proof-of-work solution submitted by a remote miner.
+type remoteSeal struct {
+	nonce     types.BlockNonce
+	mixDigest common.Hash
+}
+
+// remoteWork is a work handed out to remote miners, along with its package
+// precomputed for GetWork and the solutions already submitted for it.
+type remoteWork struct {
+	*Work
+	pkg   [3]string
+	seals map[remoteSeal]struct{}
+}
+
 type RemoteAgent struct {
 	mu sync.Mutex
 
@@ -44,8 +64,12 @@ type RemoteAgent struct {
 
 	chain       consensus.ChainReader
 	engine      consensus.Engine
-	currentWork *Work
-	work        map[common.Hash]*Work
+	currentWork atomic.Value // Latest *remoteWork, read by GetWork without locking
+	work        map[common.Hash]*remoteWork
+	verifySem   chan struct{} // Semaphore bounding the concurrent seal verifications
+
+	workSubMu sync.Mutex
+	workSubs  map[chan [3]string]struct{} // Subscribers to the work packages, as returned by GetWork
 
 	hashrateMu sync.RWMutex
 	hashrate   map[common.Hash]hashrate
@@ -55,10 +79,12 @@ type RemoteAgent struct {
 
 func NewRemoteAgent(chain consensus.ChainReader, engine consensus.Engine) *RemoteAgent {
 	return &RemoteAgent{
-		chain:    chain,
-		engine:   engine,
-		work:     make(map[common.Hash]*Work),
-		hashrate: make(map[common.Hash]hashrate),
+		chain:     chain,
+		engine:    engine,
+		work:      make(map[common.Hash]*remoteWork),
+		verifySem: make(chan struct{}, runtime.NumCPU()),
+		workSubs:  make(map[chan [3]string]struct{}),
+		hashrate:  make(map[common.Hash]hashrate),
 	}
 }
 
@@ -106,59 +132,127 @@ func (a *RemoteAgent) GetHashRate() (tot int64) {
 	return
 }
 
-func (a *RemoteAgent) GetWork() ([3]string, error) {
-	a.mu.Lock()
-	defer a.mu.Unlock()
+// SubscribeWork registers a subscription for the work packages of new works, in
+// the format returned by GetWork. The agent never waits for subscribers: if the
+// channel is full, the stale package waiting in it is replaced by the new one,
+// so the channel should be buffered.
+func (a *RemoteAgent) SubscribeWork(ch chan [3]string) event.Subscription {
+	a.workSubMu.Lock()
+	a.workSubs[ch] = struct{}{}
+	a.workSubMu.Unlock()
 
-	var res [3]string
+	return event.NewSubscription(func(quit <-chan struct{}) error {
+		<-quit
+		a.workSubMu.Lock()
+		delete(a.workSubs, ch)
+		a.workSubMu.Unlock()
+		return nil
+	})
+}
 
-	if a.currentWork != nil {
-		block := a.currentWork.Block
+// notifyWork hands a new work package to the subscribers without blocking,
+// dropping the stale packages they haven't received yet.
+func (a *RemoteAgent) notifyWork(pkg [3]string) {
+	a.workSubMu.Lock()
+	defer a.workSubMu.Unlock()
 
-		res[0] = block.HashNoNonce().Hex()
-		seedHash := entrustash.SeedHash(block.NumberU64())
-		res[1] = common.BytesToHash(seedHash).Hex()
-		// Calculate the "target" to be returned to the external miner
-		n := big.NewInt(1)
-		n.Lsh(n, 255)
-		n.Div(n, block.Difficulty())
-		n.Lsh(n, 1)
-		res[2] = common.BytesToHash(n.Bytes()).Hex()
+	for ch := range a.workSubs {
+		select {
+		case ch <- pkg:
+			continue
+		default:
+		}
+		select {
+		case <-ch:
+		default:
+		}
+		select {
+		case ch <- pkg:
+		default:
+		}
+	}
+}
 
-		a.work[block.HashNoNonce()] = a.currentWork
-		return res, nil
+// GetWork returns the package of the current work. It's computed once when the
+// work arrives, so polling miners don't contend on the agent.
+func (a *RemoteAgent) GetWork() ([3]string, error) {
+	if work, ok := a.currentWork.Load().(*remoteWork); ok {
+		return work.pkg, nil
 	}
-	return res, errors.New("No work available yet, don't panic.")
+	return [3]string{}, errors.New("No work available yet, don't panic.")
+}
+
+// newRemoteWork precomputes the package of a work for remote miners.
+func newRemoteWork(work *Work) *remoteWork {
+	block := work.Block
+
+	var pkg [3]string
+	pkg[0] = block.HashNoNonce().Hex()
+	seedHash := entrustash.SeedHash(block.NumberU64())
+	pkg[1] = common.BytesToHash(seedHash).Hex()
+	// Calculate the "target" to be returned to the external miner
+	n := big.NewInt(1)
+	n.Lsh(n, 255)
+	n.Div(n, block.Difficulty())
+	n.Lsh(n, 1)
+	pkg[2] = common.BytesToHash(n.Bytes()).Hex()
+
+	return &remoteWork{Work: work, pkg: pkg, seals: make(map[remoteSeal]struct{})}
 }
 
 // SubmitWork tries to inject a pow solution into the remote agent, returning
 // whether the solution was accepted or not (not can be both a bad pow as well as
 // any other error, like no work pending).
+//
+// Solutions are verified outside of the agent lock, at most as many at once as
+// there are CPUs, and each solution of a work is only verified once.
 func (a *RemoteAgent) SubmitWork(nonce types.BlockNonce, mixDigest, hash common.Hash) bool {
+	// Make sure the work submitted is present and the solution is new
 	a.mu.Lock()
-	defer a.mu.Unlock()
-
-	// Make sure the work submitted is present
 	work := a.work[hash]
 	if work == nil {
+		a.mu.Unlock()
 		log.Info("Work submitted but none pending", "hash", hash)
 		return false
 	}
+	seal := remoteSeal{nonce, mixDigest}
+	if _, ok := work.seals[seal]; ok {
+		a.mu.Unlock()
+		log.Debug("Duplicate work submitted", "hash", hash, "nonce", nonce)
+		return false
+	}
+	if len(work.seals) >= maxWorkSeals {
+		// Duplicates of forgotten solutions are verified again, but can't be
+		// accepted twice as the work is removed upon acceptance
+		work.seals = make(map[remoteSeal]struct{})
+	}
+	work.seals[seal] = struct{}{}
+	a.mu.Unlock()
+
 	// Make sure the Engine solutions is indeed valid
 	result := work.Block.Header()
 	result.Nonce = nonce
 	result.MixDigest = mixDigest
 
-	if err := a.engine.VerifySeal(a.chain, result); err != nil {
+	a.verifySem <- struct{}{}
+	err := a.engine.VerifySeal(a.chain, result)
+	<-a.verifySem
+	if err != nil {
 		log.Warn("Invalid proof-of-work submitted", "hash", hash, "err", err)
 		return false
 	}
-	block := work.Block.WithSeal(result)
-
-	// Solutions seems to be valid, return to the miner and notify acceptance
-	a.returnCh <- &Result{work, block}
+	// Solutions seems to be valid, unless another one was accepted meanwhile
+	a.mu.Lock()
+	if a.work[hash] != work {
+		a.mu.Unlock()
+		log.Debug("Work submitted but already sealed", "hash", hash)
+		return false
+	}
 	delete(a.work, hash)
+	a.mu.Unlock()
 
+	// Return to the miner and notify acceptance
+	a.returnCh <- &Result{work.Work, work.Block.WithSeal(result)}
 	return true
 }
 
@@ -176,14 +270,21 @@ func (a *RemoteAgent) loop(workCh chan *Work, quitCh chan struct{}) {
 		case <-quitCh:
 			return
 		case work := <-workCh:
+			remote := newRemoteWork(work)
+
 			a.mu.Lock()
-			a.currentWork = work
+			a.work[work.Block.HashNoNonce()] = remote
 			a.mu.Unlock()
+
+			a.currentWork.Store(remote)
+			a.notifyWork(remote.pkg)
 		case <-ticker:
 			// cleanup
+			current, _ := a.currentWork.Load().(*remoteWork)
+
 			a.mu.Lock()
 			for hash, work := range a.work {
-				if time.Since(work.createdAt) > 7*(12*time.Second) {
+				if work != current && time.Since(work.createdAt) > 7*(12*time.Second) {
 					delete(a.work, hash)
 				}
 			}
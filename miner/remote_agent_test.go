@@ -0,0 +1,206 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package miner
+
+import (
+	"errors"
+	"math/big"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/consensus"
+	"github.com/trust-tech/go-trustmachine/consensus/entrustash"
+	"github.com/trust-tech/go-trustmachine/core/types"
+)
+
+// slowSealEngine is a consensus engine taking a while to verify seals, only
+// accepting the ones with a nonce of zero.
+type slowSealEngine struct {
+	consensus.Engine
+	delay time.Duration
+}
+
+func (e *slowSealEngine) VerifySeal(chain consensus.ChainReader, header *types.Header) error {
+	time.Sleep(e.delay)
+	if header.Nonce.Uint64() != 0 {
+		return errors.New("invalid seal")
+	}
+	return nil
+}
+
+// startRemoteAgent creates a remote agent handing out a work at the given block
+// number, returning it along with the channel of its results.
+func startRemoteAgent(t testing.TB, engine consensus.Engine, number int64) (*RemoteAgent, chan *Result, *Work) {
+	agent := NewRemoteAgent(nil, engine)
+	results := make(chan *Result, 16)
+	agent.SetReturnCh(results)
+	agent.Start()
+
+	work := &Work{
+		Block:     types.NewBlockWithHeader(&types.Header{Number: big.NewInt(number), Difficulty: big.NewInt(131072)}),
+		createdAt: time.Now(),
+	}
+	agent.Work() <- work
+	for i := 0; ; i++ {
+		if pkg, err := agent.GetWork(); err == nil {
+			if pkg[0] != work.Block.HashNoNonce().Hex() {
+				t.Fatalf("work hash mismatch: have %s, want %s", pkg[0], work.Block.HashNoNonce().Hex())
+			}
+			break
+		}
+		if i == 100 {
+			t.Fatalf("work not available")
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	return agent, results, work
+}
+
+// Tests that submitted solutions are verified, that only the first valid one of
+// a work is returned to the miner, and that duplicates are rejected.
+func TestRemoteAgentSubmitWork(t *testing.T) {
+	agent, results, work := startRemoteAgent(t, &slowSealEngine{delay: 10 * time.Millisecond}, 1)
+	defer agent.Stop()
+
+	hash := work.Block.HashNoNonce()
+	if agent.SubmitWork(types.EncodeNonce(1), common.Hash{}, common.Hash{1}) {
+		t.Fatalf("solution of unknown work accepted")
+	}
+	if agent.SubmitWork(types.EncodeNonce(1), common.Hash{}, hash) {
+		t.Fatalf("invalid solution accepted")
+	}
+	if agent.SubmitWork(types.EncodeNonce(1), common.Hash{}, hash) {
+		t.Fatalf("duplicate solution accepted")
+	}
+	// Race two valid solutions, only one may be accepted
+	accepted := make(chan bool, 2)
+	for i := 0; i < 2; i++ {
+		go func(mix common.Hash) {
+			accepted <- agent.SubmitWork(types.EncodeNonce(0), mix, hash)
+		}(common.Hash{byte(i)})
+	}
+	if a, b := <-accepted, <-accepted; a == b {
+		t.Fatalf("acceptance mismatch: have %v/%v, want exactly one", a, b)
+	}
+	select {
+	case result := <-results:
+		if result.Block.Nonce() != 0 || result.Block.HashNoNonce() != hash {
+			t.Fatalf("sealed block mismatch")
+		}
+	default:
+		t.Fatalf("no result returned")
+	}
+	if len(results) != 0 {
+		t.Fatalf("%d extra results returned", len(results))
+	}
+}
+
+// Tests that new works are pushed to the subscribers in the GetWork format.
+func TestRemoteAgentSubscribeWork(t *testing.T) {
+	agent, _, _ := startRemoteAgent(t, entrustash.NewFaker(), 1)
+	defer agent.Stop()
+
+	works := make(chan [3]string, 1)
+	sub := agent.SubscribeWork(works)
+	defer sub.Unsubscribe()
+
+	work := &Work{Block: types.NewBlockWithHeader(&types.Header{Number: big.NewInt(2), Difficulty: big.NewInt(131072)})}
+	agent.Work() <- work
+
+	select {
+	case pkg := <-works:
+		if pkg[0] != work.Block.HashNoNonce().Hex() {
+			t.Fatalf("work hash mismatch: have %s, want %s", pkg[0], work.Block.HashNoNonce().Hex())
+		}
+		if cur, _ := agent.GetWork(); cur != pkg {
+			t.Fatalf("current work mismatch: have %v, want %v", cur, pkg)
+		}
+	case <-time.After(time.Second):
+		t.Fatalf("new work not notified")
+	}
+}
+
+// Tests that subscribers not receiving their work packages don't hold up the
+// agent, and that they find the latest package once they do.
+func TestRemoteAgentSlowSubscriber(t *testing.T) {
+	agent, _, _ := startRemoteAgent(t, entrustash.NewFaker(), 1)
+	defer agent.Stop()
+
+	works := make(chan [3]string, 1)
+	sub := agent.SubscribeWork(works)
+	defer sub.Unsubscribe()
+
+	var last *Work
+	for i := int64(2); i < 5; i++ {
+		last = &Work{Block: types.NewBlockWithHeader(&types.Header{Number: big.NewInt(i), Difficulty: big.NewInt(131072)})}
+		agent.Work() <- last
+	}
+	want := last.Block.HashNoNonce().Hex()
+	for i := 0; ; i++ {
+		if pkg, _ := agent.GetWork(); pkg[0] == want {
+			break
+		}
+		if i == 100 {
+			t.Fatalf("agent stalled by subscriber")
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	if pkg := <-works; pkg[0] != want {
+		t.Fatalf("stale work notified: have %s, want %s", pkg[0], want)
+	}
+}
+
+// Tests that the solutions remembered per work are capped.
+func TestRemoteAgentSealLimit(t *testing.T) {
+	agent, _, work := startRemoteAgent(t, &slowSealEngine{}, 1)
+	defer agent.Stop()
+
+	hash := work.Block.HashNoNonce()
+	for i := 1; i <= 2*maxWorkSeals; i++ {
+		agent.SubmitWork(types.EncodeNonce(uint64(i)), common.Hash{}, hash)
+	}
+	agent.mu.Lock()
+	defer agent.mu.Unlock()
+	if seals := len(agent.work[hash].seals); seals > maxWorkSeals {
+		t.Fatalf("remembered solutions exceed limit: have %d, want at most %d", seals, maxWorkSeals)
+	}
+}
+
+// Benchmarks many remote miners polling for work, every 16th poll submitting an
+// invalid solution taking a millisecond to verify.
+func BenchmarkRemoteAgentGetSubmitWork(b *testing.B) {
+	agent, _, work := startRemoteAgent(b, &slowSealEngine{delay: time.Millisecond}, 1)
+	defer agent.Stop()
+
+	hash := work.Block.HashNoNonce()
+	nonce := uint64(0)
+
+	b.SetParallelism(64)
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		for i := 0; pb.Next(); i++ {
+			if _, err := agent.GetWork(); err != nil {
+				b.Fatalf("failed to get work: %v", err)
+			}
+			if i%16 == 0 {
+				agent.SubmitWork(types.EncodeNonce(atomic.AddUint64(&nonce, 1)), common.Hash{}, hash)
+			}
+		}
+	})
+}
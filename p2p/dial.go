@@ -21,9 +21,12 @@ import (
 	"crypto/rand"
 	"errors"
 	"fmt"
+	"math"
 	"net"
+	"sort"
 	"time"
 
+	"github.com/hashicorp/golang-lru"
 	"github.com/trust-tech/go-trustmachine/log"
 	"github.com/trust-tech/go-trustmachine/p2p/discover"
 	"github.com/trust-tech/go-trustmachine/p2p/netutil"
@@ -45,6 +48,28 @@ const (
 	// Endpoint resolution is throttled with bounded backoff.
 	initialResolveDelay = 60 * time.Second
 	maxResolveDelay     = time.Hour
+
+	// Dynamic dials use at least this many concurrent slots. When dials fail
+	// often, more are started at once (up to maxActiveDialTasks), so the peer
+	// slots still fill up quickly.
+	minDialSlots = 16
+
+	// The dial success rate is a moving average, weighing each dial this much.
+	// The rate used for scheduling never drops below minDialRate, bounding the
+	// number of dials started per free peer slot.
+	dialRateWeight = 0.1
+	minDialRate    = 0.25
+
+	// Dial outcomes are remembered for this many nodes.
+	dialStatsLimit = 4096
+
+	// Dial latency lowers a node's score by a tenth at this value, by a fifth
+	// at most.
+	dialLatencyScale = 2 * time.Second
+
+	// Peers dropped by a subprotocol within this time after connecting count as
+	// useless, just like those without matching protocols.
+	uselessPeerTime = time.Minute
 )
 
 // dialstate schedules dials and discovery lookups.
@@ -57,10 +82,12 @@ type dialstate struct {
 
 	lookupRunning bool
 	dialing       map[discover.NodeID]connFlag
-	lookupBuf     []*discover.Node // current discovery lookup results
+	candidates    *dialCandidates  // current discovery lookup results
 	randomNodes   []*discover.Node // filled from Table
 	static        map[discover.NodeID]*dialTask
 	hist          *dialHistory
+	stats         *lru.Cache // outcome of past dials, *dialStats by node ID
+	rate          float64    // moving average of the dial success rate
 
 	start     time.Time        // time when the dialer was first used
 	bootnodes []*discover.Node // default dials when there are no peers
@@ -74,15 +101,48 @@ type discoverTable interface {
 	ReadRandomNodes([]*discover.Node) int
 }
 
-// the dial history remembers recent dials.
-type dialHistory []pastDial
+// the dial history remembers recent dials, indexed by node ID.
+type dialHistory struct {
+	queue pastDialQueue // past dials ordered by expiry
+	index map[discover.NodeID]*pastDial
+}
 
 // pastDial is an entry in the dial history.
 type pastDial struct {
-	id  discover.NodeID
-	exp time.Time
+	id    discover.NodeID
+	exp   time.Time
+	index int // position in the expiry queue
+}
+
+// pastDialQueue is a min-heap of past dials ordered by expiry.
+type pastDialQueue []*pastDial
+
+// dialStats is the outcome of past dials to a node.
+type dialStats struct {
+	success, fail int
+	useless       bool          // no matching protocols, or dropped by one soon after connecting
+	latency       time.Duration // time taken by the last successful dial
+}
+
+// dialCandidates is a pool of dynamic dial candidates learned from discovery,
+// indexed by node ID and ordered by score.
+type dialCandidates struct {
+	queue candidateQueue
+	index map[discover.NodeID]*dialCandidate
+	seq   uint64
 }
 
+// dialCandidate is an entry in the candidate pool.
+type dialCandidate struct {
+	node  *discover.Node
+	score float64
+	seq   uint64 // arrival order among candidates of equal score
+	index int    // position in the candidate queue
+}
+
+// candidateQueue is a max-heap of candidates ordered by score, then arrival.
+type candidateQueue []*dialCandidate
+
 type task interface {
 	Do(*Server)
 }
@@ -94,6 +154,11 @@ type dialTask struct {
 	dest         *discover.Node
 	lastResolved time.Time
 	resolveDelay time.Duration
+
+	// outcome of the last attempt, used to score the destination
+	dialed  bool
+	err     error
+	latency time.Duration
 }
 
 // discoverTask runs discovery table operations.
@@ -118,8 +183,11 @@ func newDialState(static []*discover.Node, bootnodes []*discover.Node, ntab disc
 		dialing:     make(map[discover.NodeID]connFlag),
 		bootnodes:   make([]*discover.Node, len(bootnodes)),
 		randomNodes: make([]*discover.Node, maxdyn/2),
-		hist:        new(dialHistory),
+		candidates:  newDialCandidates(),
+		hist:        newDialHistory(),
+		rate:        1,
 	}
+	s.stats, _ = lru.New(dialStatsLimit)
 	copy(s.bootnodes, bootnodes)
 	for _, n := range static {
 		s.addStatic(n)
@@ -154,18 +222,28 @@ func (s *dialstate) newTasks(nRunning int, peers map[discover.NodeID]*Peer, now
 		return true
 	}
 
-	// Compute number of dynamic dials necessary at this point.
-	needDynDials := s.maxDynDials
+	// Compute number of dynamic dials necessary at this point. As not all dials
+	// succeed, more are started than there are free slots, according to the
+	// current success rate.
+	freeSlots := s.maxDynDials
 	for _, p := range peers {
 		if p.rw.is(dynDialedConn) {
-			needDynDials--
+			freeSlots--
 		}
 	}
+	dynDialing := 0
 	for _, flag := range s.dialing {
 		if flag&dynDialedConn != 0 {
-			needDynDials--
+			dynDialing++
 		}
 	}
+	needDynDials := 0
+	if freeSlots > 0 {
+		needDynDials = int(math.Ceil(float64(freeSlots)/s.dialRate())) - dynDialing
+	}
+	if slots := s.dialSlots() - nRunning; needDynDials > slots {
+		needDynDials = slots
+	}
 
 	// Expire the dial history on every invocation.
 	s.hist.expire(now)
@@ -195,27 +273,33 @@ func (s *dialstate) newTasks(nRunning int, peers map[discover.NodeID]*Peer, now
 		}
 	}
 	// Use random nodes from the table for half of the necessary
-	// dynamic dials.
+	// dynamic dials, trying the best scored ones first.
 	randomCandidates := needDynDials / 2
 	if randomCandidates > 0 {
 		n := s.ntab.ReadRandomNodes(s.randomNodes)
+		if n > len(s.randomNodes) {
+			n = len(s.randomNodes)
+		}
+		random := scoredNodes{nodes: s.randomNodes[:n], scores: make([]float64, n)}
+		for i, node := range random.nodes {
+			random.scores[i] = s.score(node.ID)
+		}
+		sort.Stable(random)
 		for i := 0; i < randomCandidates && i < n; i++ {
-			if addDial(dynDialedConn, s.randomNodes[i]) {
+			if addDial(dynDialedConn, random.nodes[i]) {
 				needDynDials--
 			}
 		}
 	}
-	// Create dynamic dials from random lookup results, removing tried
-	// items from the result buffer.
-	i := 0
-	for ; i < len(s.lookupBuf) && needDynDials > 0; i++ {
-		if addDial(dynDialedConn, s.lookupBuf[i]) {
+	// Create dynamic dials from random lookup results, best scored first,
+	// removing tried candidates from the pool.
+	for s.candidates.len() > 0 && needDynDials > 0 {
+		if addDial(dynDialedConn, s.candidates.pop()) {
 			needDynDials--
 		}
 	}
-	s.lookupBuf = s.lookupBuf[:copy(s.lookupBuf, s.lookupBuf[i:])]
 	// Launch a discovery lookup if more candidates are needed.
-	if len(s.lookupBuf) < needDynDials && !s.lookupRunning {
+	if s.candidates.len() < needDynDials && !s.lookupRunning {
 		s.lookupRunning = true
 		newtasks = append(newtasks, &discoverTask{})
 	}
@@ -261,21 +345,116 @@ func (s *dialstate) taskDone(t task, now time.Time) {
 	case *dialTask:
 		s.hist.add(t.dest.ID, now.Add(dialHistoryExpiration))
 		delete(s.dialing, t.dest.ID)
+		if t.dialed {
+			s.recordDial(t.dest.ID, t.err, t.latency)
+		}
 	case *discoverTask:
 		s.lookupRunning = false
-		s.lookupBuf = append(s.lookupBuf, t.results...)
+		for _, n := range t.results {
+			s.candidates.add(n, s.score(n.ID))
+		}
+	}
+}
+
+// recordDial updates the dial statistics with the outcome of a dial. Rejections
+// due to the peer count or connections of either node, or a stopping server,
+// say nothing about the remote node's quality and don't count against it.
+func (s *dialstate) recordDial(id discover.NodeID, err error, latency time.Duration) {
+	if err == DiscTooManyPeers || err == DiscAlreadyConnected || err == errServerStopped {
+		return
+	}
+	st := s.nodeStats(id)
+	success := 0.0
+	switch err {
+	case nil:
+		st.success++
+		st.useless, st.latency = false, latency
+		success = 1
+	case DiscUselessPeer:
+		st.useless = true
+	default:
+		st.fail++
+	}
+	s.stats.Add(id, st)
+	s.candidates.update(id, s.score(id))
+	s.rate += dialRateWeight * (success - s.rate)
+}
+
+// peerRemoved records why a peer was dropped. The devp2p handshake only tells
+// whether any protocols match, so peers we reject for a protocol error soon
+// after connecting (e.g. on a network or genesis mismatch) are marked useless
+// here. Network errors and drops requested by the remote side don't count.
+func (s *dialstate) peerRemoved(id discover.NodeID, reason DiscReason, requested bool, connected time.Duration) {
+	if requested || connected > uselessPeerTime {
+		return
+	}
+	switch reason {
+	case DiscUselessPeer, DiscProtocolError, DiscSubprotocolError:
+	default:
+		return
+	}
+	st := s.nodeStats(id)
+	st.useless = true
+	s.stats.Add(id, st)
+	s.candidates.update(id, s.score(id))
+}
+
+// nodeStats returns the dial statistics of a node, empty ones if it's unknown.
+func (s *dialstate) nodeStats(id discover.NodeID) *dialStats {
+	if v, ok := s.stats.Get(id); ok {
+		return v.(*dialStats)
+	}
+	return new(dialStats)
+}
+
+// score rates how promising a dial to the node is, between 0 and 1. Nodes that
+// haven't been dialed rate 1/2. Successful dials raise the score and failures
+// lower it, slow connections rank below fast ones and nodes without matching
+// protocols are only dialed as a last resort.
+func (s *dialstate) score(id discover.NodeID) float64 {
+	v, ok := s.stats.Get(id)
+	if !ok {
+		return 0.5
+	}
+	st := v.(*dialStats)
+	score := float64(st.success+1) / float64(st.success+st.fail+2)
+	if st.success > 0 {
+		score *= 1 - 0.2*float64(st.latency)/float64(st.latency+dialLatencyScale)
+	}
+	if st.useless {
+		score /= 10
+	}
+	return score
+}
+
+// dialRate returns the dial success rate used for scheduling.
+func (s *dialstate) dialRate() float64 {
+	if s.rate < minDialRate {
+		return minDialRate
 	}
+	return s.rate
+}
+
+// dialSlots returns the number of tasks that may run concurrently, which grows
+// as the dial success rate drops.
+func (s *dialstate) dialSlots() int {
+	slots := int(math.Ceil(minDialSlots / s.dialRate()))
+	if slots > maxActiveDialTasks {
+		slots = maxActiveDialTasks
+	}
+	return slots
 }
 
 func (t *dialTask) Do(srv *Server) {
+	t.dialed, t.err, t.latency = false, nil, 0
 	if t.dest.Incomplete() {
 		if !t.resolve(srv) {
 			return
 		}
 	}
-	success := t.dial(srv, t.dest)
+	err := t.dial(srv, t.dest)
 	// Try resolving the ID of static nodes if dialing failed.
-	if !success && t.flags&staticDialedConn != 0 {
+	if err != nil && t.flags&staticDialedConn != 0 {
 		if t.resolve(srv) {
 			t.dial(srv, t.dest)
 		}
@@ -316,17 +495,23 @@ func (t *dialTask) resolve(srv *Server) bool {
 	return true
 }
 
-// dial performs the actual connection attempt.
-func (t *dialTask) dial(srv *Server, dest *discover.Node) bool {
+// dial performs the actual connection attempt, recording its outcome. The
+// returned error is only set if the connection could not be established.
+func (t *dialTask) dial(srv *Server, dest *discover.Node) error {
+	start := time.Now()
+	defer func() { t.latency = time.Since(start) }()
+	t.dialed = true
+
 	addr := &net.TCPAddr{IP: dest.IP, Port: int(dest.TCP)}
 	fd, err := srv.Dialer.Dial("tcp", addr.String())
 	if err != nil {
 		log.Trace("Dial error", "task", t, "err", err)
-		return false
+		t.err = err
+		return err
 	}
 	mfd := newMeteredConn(fd, false)
-	srv.setupConn(mfd, t.flags, dest)
-	return true
+	t.err = srv.setupConn(mfd, t.flags, dest)
+	return nil
 }
 
 func (t *dialTask) String() string {
@@ -362,38 +547,130 @@ func (t waitExpireTask) String() string {
 	return fmt.Sprintf("wait for dial hist expire (%v)", t.Duration)
 }
 
+func newDialHistory() *dialHistory {
+	return &dialHistory{index: make(map[discover.NodeID]*pastDial)}
+}
+
 // Use only these methods to access or modify dialHistory.
-func (h dialHistory) min() pastDial {
-	return h[0]
+func (h *dialHistory) min() *pastDial {
+	return h.queue[0]
 }
 func (h *dialHistory) add(id discover.NodeID, exp time.Time) {
-	heap.Push(h, pastDial{id, exp})
-}
-func (h dialHistory) contains(id discover.NodeID) bool {
-	for _, v := range h {
-		if v.id == id {
-			return true
-		}
+	if pd, ok := h.index[id]; ok {
+		pd.exp = exp
+		heap.Fix(&h.queue, pd.index)
+		return
 	}
-	return false
+	pd := &pastDial{id: id, exp: exp}
+	heap.Push(&h.queue, pd)
+	h.index[id] = pd
+}
+func (h *dialHistory) contains(id discover.NodeID) bool {
+	_, ok := h.index[id]
+	return ok
 }
 func (h *dialHistory) expire(now time.Time) {
 	for h.Len() > 0 && h.min().exp.Before(now) {
-		heap.Pop(h)
+		delete(h.index, heap.Pop(&h.queue).(*pastDial).id)
 	}
 }
+func (h *dialHistory) Len() int {
+	return len(h.queue)
+}
 
 // heap.Interface boilerplate
-func (h dialHistory) Len() int           { return len(h) }
-func (h dialHistory) Less(i, j int) bool { return h[i].exp.Before(h[j].exp) }
-func (h dialHistory) Swap(i, j int)      { h[i], h[j] = h[j], h[i] }
-func (h *dialHistory) Push(x interface{}) {
-	*h = append(*h, x.(pastDial))
-}
-func (h *dialHistory) Pop() interface{} {
-	old := *h
+func (q pastDialQueue) Len() int           { return len(q) }
+func (q pastDialQueue) Less(i, j int) bool { return q[i].exp.Before(q[j].exp) }
+func (q pastDialQueue) Swap(i, j int) {
+	q[i], q[j] = q[j], q[i]
+	q[i].index, q[j].index = i, j
+}
+func (q *pastDialQueue) Push(x interface{}) {
+	pd := x.(*pastDial)
+	pd.index = len(*q)
+	*q = append(*q, pd)
+}
+func (q *pastDialQueue) Pop() interface{} {
+	old := *q
+	n := len(old)
+	x := old[n-1]
+	old[n-1] = nil
+	*q = old[0 : n-1]
+	return x
+}
+
+// scoredNodes sorts a list of nodes by descending dial score.
+type scoredNodes struct {
+	nodes  []*discover.Node
+	scores []float64
+}
+
+func (s scoredNodes) Len() int           { return len(s.nodes) }
+func (s scoredNodes) Less(i, j int) bool { return s.scores[i] > s.scores[j] }
+func (s scoredNodes) Swap(i, j int) {
+	s.nodes[i], s.nodes[j] = s.nodes[j], s.nodes[i]
+	s.scores[i], s.scores[j] = s.scores[j], s.scores[i]
+}
+
+func newDialCandidates() *dialCandidates {
+	return &dialCandidates{index: make(map[discover.NodeID]*dialCandidate)}
+}
+
+// add inserts a node into the candidate pool. Known candidates keep their place
+// in arrival order, but take the latest endpoint and score.
+func (c *dialCandidates) add(n *discover.Node, score float64) {
+	if cand, ok := c.index[n.ID]; ok {
+		cand.node = n
+		c.update(n.ID, score)
+		return
+	}
+	cand := &dialCandidate{node: n, score: score, seq: c.seq}
+	c.seq++
+	heap.Push(&c.queue, cand)
+	c.index[n.ID] = cand
+}
+
+// update changes the score of a pooled candidate, if the node is in the pool.
+func (c *dialCandidates) update(id discover.NodeID, score float64) {
+	if cand, ok := c.index[id]; ok && cand.score != score {
+		cand.score = score
+		heap.Fix(&c.queue, cand.index)
+	}
+}
+
+// pop removes the best scored candidate from the pool.
+func (c *dialCandidates) pop() *discover.Node {
+	cand := heap.Pop(&c.queue).(*dialCandidate)
+	delete(c.index, cand.node.ID)
+	return cand.node
+}
+
+func (c *dialCandidates) len() int {
+	return len(c.queue)
+}
+
+// heap.Interface boilerplate
+func (q candidateQueue) Len() int { return len(q) }
+func (q candidateQueue) Less(i, j int) bool {
+	if q[i].score != q[j].score {
+		return q[i].score > q[j].score
+	}
+	return q[i].seq < q[j].seq
+}
+func (q candidateQueue) Swap(i, j int) {
+	q[i], q[j] = q[j], q[i]
+	q[i].index, q[j].index = i, j
+}
+func (q *candidateQueue) Push(x interface{}) {
+	cand := x.(*dialCandidate)
+	cand.index = len(*q)
+	*q = append(*q, cand)
+}
+func (q *candidateQueue) Pop() interface{} {
+	old := *q
 	n := len(old)
 	x := old[n-1]
-	*h = old[0 : n-1]
+	old[n-1] = nil
+	*q = old[0 : n-1]
 	return x
 }
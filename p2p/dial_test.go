@@ -18,6 +18,8 @@ package p2p
 
 import (
 	"encoding/binary"
+	"errors"
+	mrand "math/rand"
 	"net"
 	"reflect"
 	"testing"
@@ -583,6 +585,147 @@ func TestDialStateCache(t *testing.T) {
 	})
 }
 
+// This test checks that lookup results are dialed in the order of their score,
+// derived from the outcome of past dials.
+func TestDialStateScoring(t *testing.T) {
+	state := newDialState(nil, nil, fakeTable{}, 1, nil)
+	now := time.Time{}
+
+	// Node 1 fails to connect, node 2 has no matching protocols, node 3 connects
+	// but slowly and node 4 quickly
+	outcomes := []struct {
+		err     error
+		latency time.Duration
+	}{
+		{errors.New("timeout"), 15 * time.Second},
+		{DiscUselessPeer, 100 * time.Millisecond},
+		{nil, 3 * time.Second},
+		{nil, 100 * time.Millisecond},
+	}
+	for i, outcome := range outcomes {
+		task := &dialTask{flags: dynDialedConn, dest: &discover.Node{ID: uintID(uint32(i + 1))}}
+		task.dialed, task.err, task.latency = true, outcome.err, outcome.latency
+		state.taskDone(task, now)
+	}
+	// Once the dial history expired, the nodes should be redialed best first,
+	// with unknown node 5 ranking between the connected and failed ones
+	now = now.Add(dialHistoryExpiration + time.Second)
+	state.taskDone(&discoverTask{results: []*discover.Node{
+		{ID: uintID(1)}, {ID: uintID(2)}, {ID: uintID(3)}, {ID: uintID(4)}, {ID: uintID(5)},
+	}}, now)
+
+	var order []discover.NodeID
+	for state.candidates.len() > 0 {
+		order = append(order, state.candidates.pop().ID)
+	}
+	want := []discover.NodeID{uintID(4), uintID(3), uintID(5), uintID(1), uintID(2)}
+	if !reflect.DeepEqual(order, want) {
+		t.Fatalf("dial order mismatch:\ngot  %v\nwant %v", order, want)
+	}
+}
+
+// This test checks that peers dropped for a protocol error soon after connecting
+// are marked useless, and that the candidate pool picks up the changed scores.
+func TestDialStatePeerRemoved(t *testing.T) {
+	state := newDialState(nil, nil, fakeTable{}, 1, nil)
+	state.taskDone(&discoverTask{results: []*discover.Node{
+		{ID: uintID(1)}, {ID: uintID(2)}, {ID: uintID(3)}, {ID: uintID(4)},
+		{ID: uintID(5)}, {ID: uintID(6)}, {ID: uintID(7)},
+	}}, time.Time{})
+
+	// Node 1 fails the subprotocol handshake and node 2 is dropped as useless.
+	// Node 3 is dropped as useless after a long session, node 4 disconnects as
+	// we shut down, node 5 loses its connection and node 6 asks to disconnect.
+	state.peerRemoved(uintID(1), DiscSubprotocolError, false, time.Second)
+	state.peerRemoved(uintID(2), DiscUselessPeer, false, 5*time.Second)
+	state.peerRemoved(uintID(3), DiscUselessPeer, false, time.Hour)
+	state.peerRemoved(uintID(4), DiscQuitting, false, time.Second)
+	state.peerRemoved(uintID(5), DiscNetworkError, false, time.Second)
+	state.peerRemoved(uintID(6), DiscUselessPeer, true, time.Second)
+
+	var order []discover.NodeID
+	for state.candidates.len() > 0 {
+		order = append(order, state.candidates.pop().ID)
+	}
+	want := []discover.NodeID{uintID(3), uintID(4), uintID(5), uintID(6), uintID(7), uintID(1), uintID(2)}
+	if !reflect.DeepEqual(order, want) {
+		t.Fatalf("dial order mismatch:\ngot  %v\nwant %v", order, want)
+	}
+}
+
+// This test checks that more dials are started than there are free peer slots
+// when dials tend to fail.
+func TestDialStateOverprovision(t *testing.T) {
+	table := make(fakeTable, 40)
+	for i := range table {
+		table[i] = &discover.Node{ID: uintID(uint32(i + 1))}
+	}
+	state := newDialState(nil, nil, table, 10, nil)
+	if slots := state.dialSlots(); slots != minDialSlots {
+		t.Fatalf("initial dial slots mismatch: have %d, want %d", slots, minDialSlots)
+	}
+	// Fail lots of dials, dropping the success rate to the minimum
+	for i := 0; i < 100; i++ {
+		task := &dialTask{flags: dynDialedConn, dest: &discover.Node{ID: uintID(uint32(1000 + i))}}
+		task.dialed, task.err = true, errors.New("timeout")
+		state.taskDone(task, time.Time{})
+	}
+	if rate := state.dialRate(); rate != minDialRate {
+		t.Fatalf("dial rate mismatch: have %f, want %f", rate, minDialRate)
+	}
+	if slots := state.dialSlots(); slots != minDialSlots/minDialRate {
+		t.Fatalf("dial slots mismatch: have %d, want %d", slots, int(minDialSlots/minDialRate))
+	}
+	// The dials for the 10 free slots come from the table and lookup results
+	var results []*discover.Node
+	for i := 0; i < 40; i++ {
+		results = append(results, &discover.Node{ID: uintID(uint32(100 + i))})
+	}
+	state.taskDone(&discoverTask{results: results}, time.Time{})
+
+	dials := 0
+	for _, task := range state.newTasks(0, nil, time.Time{}) {
+		if _, ok := task.(*dialTask); ok {
+			dials++
+		}
+	}
+	if want := int(10 / minDialRate); dials != want {
+		t.Fatalf("dial count mismatch: have %d, want %d", dials, want)
+	}
+}
+
+// overfillTable mimics discover.Table, which reports one more node than it
+// wrote when the buffer fills up.
+type overfillTable struct{ fakeTable }
+
+func (t overfillTable) ReadRandomNodes(buf []*discover.Node) int {
+	n := copy(buf, t.fakeTable)
+	if n == len(buf) {
+		n++
+	}
+	return n
+}
+
+// This test checks that an overreported random node count from the table
+// doesn't crash the dialer.
+func TestDialStateRandomNodesOverfill(t *testing.T) {
+	table := make(fakeTable, 20)
+	for i := range table {
+		table[i] = &discover.Node{ID: uintID(uint32(i + 1))}
+	}
+	state := newDialState(nil, nil, overfillTable{table}, 10, nil)
+
+	dials := 0
+	for _, task := range state.newTasks(0, nil, time.Time{}) {
+		if _, ok := task.(*dialTask); ok {
+			dials++
+		}
+	}
+	if want := len(state.randomNodes); dials != want {
+		t.Fatalf("dial count mismatch: have %d, want %d", dials, want)
+	}
+}
+
 func TestDialResolve(t *testing.T) {
 	resolved := discover.NewNode(uintID(1), net.IP{127, 0, 55, 234}, 3333, 4444)
 	table := &resolveMock{answer: resolved}
@@ -650,3 +793,196 @@ func (t *resolveMock) Close()                                   {}
 func (t *resolveMock) Bootstrap([]*discover.Node)               {}
 func (t *resolveMock) Lookup(discover.NodeID) []*discover.Node  { return nil }
 func (t *resolveMock) ReadRandomNodes(buf []*discover.Node) int { return 0 }
+
+// simNode is a node of a simulated network.
+type simNode struct {
+	node      *discover.Node
+	reachable bool          // whether dials to the node connect at all
+	useless   bool          // whether the node runs none of our protocols
+	latency   time.Duration // time it takes to connect to the node
+}
+
+// simTable is a discovery table over a simulated network.
+type simTable struct {
+	nodes []*simNode
+	byID  map[discover.NodeID]*simNode
+	rand  *mrand.Rand
+}
+
+// newSimTable creates a network of the given size. A quarter of the nodes can
+// be connected to, of which half run matching protocols.
+func newSimTable(size int, seed int64) *simTable {
+	t := &simTable{byID: make(map[discover.NodeID]*simNode), rand: mrand.New(mrand.NewSource(seed))}
+	for i := 0; i < size; i++ {
+		n := &simNode{
+			node:      &discover.Node{ID: uintID(uint32(i + 1))},
+			reachable: t.rand.Intn(4) == 0,
+			useless:   t.rand.Intn(2) == 0,
+			latency:   100*time.Millisecond + time.Duration(t.rand.Int63n(int64(2*time.Second))),
+		}
+		t.nodes = append(t.nodes, n)
+		t.byID[n.node.ID] = n
+	}
+	return t
+}
+
+func (t *simTable) Self() *discover.Node                   { return new(discover.Node) }
+func (t *simTable) Close()                                 {}
+func (t *simTable) Resolve(discover.NodeID) *discover.Node { return nil }
+func (t *simTable) Lookup(discover.NodeID) []*discover.Node {
+	buf := make([]*discover.Node, 16)
+	return buf[:t.ReadRandomNodes(buf)]
+}
+func (t *simTable) ReadRandomNodes(buf []*discover.Node) int {
+	for i := range buf {
+		buf[i] = t.nodes[t.rand.Intn(len(t.nodes))].node
+	}
+	return len(buf)
+}
+
+// dialSim drives a dialer against a simulated network in virtual time, the
+// way Server.run would.
+type dialSim struct {
+	table    *simTable
+	dialer   *dialstate
+	maxPeers int
+	peers    map[discover.NodeID]*Peer
+	now      time.Time
+	running  map[task]time.Time // running tasks with their completion time
+	queued   []task
+	lookup   time.Time // time of the last lookup
+}
+
+func newDialSim(table *simTable, maxPeers int) *dialSim {
+	return &dialSim{
+		table:    table,
+		dialer:   newDialState(nil, nil, table, maxPeers, nil),
+		maxPeers: maxPeers,
+		peers:    make(map[discover.NodeID]*Peer),
+		now:      time.Unix(0, 0),
+		running:  make(map[task]time.Time),
+	}
+}
+
+// start launches a task, scheduling its completion.
+func (sim *dialSim) start(t task) {
+	switch t := t.(type) {
+	case *dialTask:
+		node := sim.table.byID[t.dest.ID]
+		sim.running[t] = sim.now.Add(node.latency)
+		if !node.reachable {
+			sim.running[t] = sim.now.Add(defaultDialTimeout)
+		}
+	case *discoverTask:
+		next := sim.lookup.Add(lookupInterval)
+		if next.Before(sim.now) {
+			next = sim.now
+		}
+		sim.lookup = next
+		sim.running[t] = next.Add(500 * time.Millisecond)
+	case *waitExpireTask:
+		sim.running[t] = sim.now.Add(t.Duration)
+	}
+}
+
+// complete finishes a task, connecting the dialed node if possible.
+func (sim *dialSim) complete(t task) {
+	switch t := t.(type) {
+	case *dialTask:
+		node := sim.table.byID[t.dest.ID]
+		var (
+			err     error
+			latency = node.latency
+		)
+		switch {
+		case !node.reachable:
+			err, latency = errors.New("dial timeout"), defaultDialTimeout
+		case node.useless:
+			err = DiscUselessPeer
+		case len(sim.peers) >= sim.maxPeers:
+			err = DiscTooManyPeers
+		default:
+			sim.peers[t.dest.ID] = &Peer{rw: &conn{flags: dynDialedConn, id: t.dest.ID}}
+		}
+		t.dialed, t.err, t.latency = true, err, latency
+	case *discoverTask:
+		t.results = sim.table.Lookup(discover.NodeID{})
+	}
+}
+
+// fill runs the simulation until all peer slots are taken, returning the
+// virtual time it took.
+func (sim *dialSim) fill() time.Duration {
+	start := sim.now
+	for len(sim.peers) < sim.maxPeers {
+		// Start tasks up to the limit, like Server.run
+		rest := sim.queued[:0]
+		for _, t := range sim.queued {
+			if len(sim.running) < maxActiveDialTasks {
+				sim.start(t)
+			} else {
+				rest = append(rest, t)
+			}
+		}
+		sim.queued = rest
+		if len(sim.running) < maxActiveDialTasks {
+			for _, t := range sim.dialer.newTasks(len(sim.running)+len(sim.queued), sim.peers, sim.now) {
+				if len(sim.running) < maxActiveDialTasks {
+					sim.start(t)
+				} else {
+					sim.queued = append(sim.queued, t)
+				}
+			}
+		}
+		// Advance to the earliest task completion
+		var (
+			next task
+			done time.Time
+		)
+		for t, end := range sim.running {
+			if next == nil || end.Before(done) {
+				next, done = t, end
+			}
+		}
+		if next == nil {
+			panic("dial simulation stalled")
+		}
+		sim.now = done
+		sim.complete(next)
+		delete(sim.running, next)
+		sim.dialer.taskDone(next, sim.now)
+	}
+	return sim.now.Sub(start)
+}
+
+// drop disconnects the given fraction of the peers.
+func (sim *dialSim) drop(fraction float64) {
+	for id := range sim.peers {
+		if sim.table.rand.Float64() < fraction {
+			delete(sim.peers, id)
+		}
+	}
+}
+
+// Benchmarks the time it takes to fill all peer slots of a freshly started node.
+func BenchmarkDialFill(b *testing.B) {
+	var total time.Duration
+	for i := 0; i < b.N; i++ {
+		total += newDialSim(newSimTable(5000, int64(i)), 100).fill()
+	}
+	b.Logf("average time to full peers: %v", total/time.Duration(b.N))
+}
+
+// Benchmarks the time it takes to refill the peer slots after losing half of
+// the peers.
+func BenchmarkDialRefill(b *testing.B) {
+	var total time.Duration
+	for i := 0; i < b.N; i++ {
+		sim := newDialSim(newSimTable(5000, int64(i)), 100)
+		sim.fill()
+		sim.now = sim.now.Add(10 * time.Minute)
+		sim.drop(0.5)
+		total += sim.fill()
+	}
+	b.Logf("average time to full peers: %v", total/time.Duration(b.N))
+}
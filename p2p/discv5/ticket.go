@@ -18,6 +18,7 @@ package discv5
 
 import (
 	"bytes"
+	"container/heap"
 	"encoding/binary"
 	"fmt"
 	"math"
@@ -110,6 +111,46 @@ func pongToTicket(localTime mclock.AbsTime, topics []Topic, node *Node, p *ingre
 	return t, nil
 }
 
+// queuedTicketRef tracks a ticket reference in the registration queue and in
+// the time bucket of its topic.
+type queuedTicketRef struct {
+	ref   ticketRef
+	index int // position in ticketStore.queue
+	pos   int // position in the time bucket
+}
+
+// ticketQueue is a min-heap of ticket references ordered by the time they can
+// be used to register.
+type ticketQueue []*queuedTicketRef
+
+func (q ticketQueue) Len() int { return len(q) }
+
+func (q ticketQueue) Less(i, j int) bool {
+	return q[i].ref.topicRegTime() < q[j].ref.topicRegTime()
+}
+
+func (q ticketQueue) Swap(i, j int) {
+	q[i], q[j] = q[j], q[i]
+	q[i].index = i
+	q[j].index = j
+}
+
+func (q *ticketQueue) Push(x interface{}) {
+	item := x.(*queuedTicketRef)
+	item.index = len(*q)
+	*q = append(*q, item)
+}
+
+func (q *ticketQueue) Pop() interface{} {
+	old := *q
+	n := len(old)
+	item := old[n-1]
+	old[n-1] = nil
+	item.index = -1
+	*q = old[0 : n-1]
+	return item
+}
+
 func ticketToPong(t *ticket, pong *pong) {
 	pong.Expiration = uint64(t.issueTime / mclock.AbsTime(time.Second))
 	pong.TopicHash = rlpHash(t.topics)
@@ -133,6 +174,11 @@ type ticketStore struct {
 	nodes       map[*Node]*ticket
 	nodeLastReq map[*Node]reqInfo
 
+	// All ticket references of the registered topics, ordered by
+	// registration time and indexed for removal.
+	queue  ticketQueue
+	queued map[ticketRef]*queuedTicketRef
+
 	lastBucketFetched timeBucket
 	nextTicketCached  *ticketRef
 	nextTicketReg     mclock.AbsTime
@@ -162,6 +208,7 @@ func newTicketStore() *ticketStore {
 		tickets:        make(map[Topic]topicTickets),
 		nodes:          make(map[*Node]*ticket),
 		nodeLastReq:    make(map[*Node]reqInfo),
+		queued:         make(map[ticketRef]*queuedTicketRef),
 		searchTopicMap: make(map[Topic]searchTopic),
 		queriesSent:    make(map[*Node]map[common.Hash]sentQuery),
 	}
@@ -197,6 +244,9 @@ func (s *ticketStore) removeRegisterTopic(topic Topic) {
 	debugLog(fmt.Sprintf(" removeRegisterTopic(%v)", topic))
 	for _, list := range s.tickets[topic].buckets {
 		for _, ref := range list {
+			heap.Remove(&s.queue, s.queued[ref].index)
+			delete(s.queued, ref)
+
 			ref.t.refCnt--
 			if ref.t.refCnt == 0 {
 				delete(s.nodes, ref.t.node)
@@ -205,6 +255,7 @@ func (s *ticketStore) removeRegisterTopic(topic Topic) {
 		}
 	}
 	delete(s.tickets, topic)
+	s.nextTicketCached = nil
 }
 
 func (s *ticketStore) regTopicSet() []Topic {
@@ -325,6 +376,10 @@ func (s *ticketStore) addTicketRef(r ticketRef) {
 	t.buckets[bucket] = append(t.buckets[bucket], r)
 	r.t.refCnt++
 
+	item := &queuedTicketRef{ref: r, pos: len(t.buckets[bucket]) - 1}
+	heap.Push(&s.queue, item)
+	s.queued[r] = item
+
 	min := mclock.Now() - mclock.AbsTime(collectFrequency)*maxCollectDebt
 	if t.nextLookup < min {
 		t.nextLookup = min
@@ -389,35 +444,17 @@ func (s *ticketStore) nextRegisterableTicket() (t *ticketRef, wait time.Duration
 		return s.nextTicketCached, time.Duration(s.nextTicketCached.topicRegTime() - now)
 	}
 
-	for bucket := s.lastBucketFetched; ; bucket++ {
-		var (
-			empty      = true    // true if there are no tickets
-			nextTicket ticketRef // uninitialized if this bucket is empty
-		)
-		for _, tickets := range s.tickets {
-			//s.removeExcessTickets(topic)
-			if len(tickets.buckets) != 0 {
-				empty = false
-				if list := tickets.buckets[bucket]; list != nil {
-					for _, ref := range list {
-						//debugLog(fmt.Sprintf(" nrt bucket = %d node = %x sn = %v wait = %v", bucket, ref.t.node.ID[:8], ref.t.serial, time.Duration(ref.topicRegTime()-now)))
-						if nextTicket.t == nil || ref.topicRegTime() < nextTicket.topicRegTime() {
-							nextTicket = ref
-						}
-					}
-				}
-			}
-		}
-		if empty {
-			return nil, 0
-		}
-		if nextTicket.t != nil {
-			wait = time.Duration(nextTicket.topicRegTime() - now)
-			s.nextTicketCached = &nextTicket
-			return &nextTicket, wait
-		}
+	if len(s.queue) == 0 {
+		return nil, 0
+	}
+	// The earliest ticket is at the head of the queue. Skip the registration
+	// window past the empty buckets before it, like a bucket scan would.
+	nextTicket := s.queue[0].ref
+	if bucket := timeBucket(nextTicket.topicRegTime()/mclock.AbsTime(ticketTimeBucketLen)) - 1; bucket > s.lastBucketFetched {
 		s.lastBucketFetched = bucket
 	}
+	s.nextTicketCached = &nextTicket
+	return &nextTicket, time.Duration(nextTicket.topicRegTime() - now)
 }
 
 // removeTicket removes a ticket from the ticket store
@@ -428,19 +465,23 @@ func (s *ticketStore) removeTicketRef(ref ticketRef) {
 	if tickets == nil {
 		return
 	}
+	item := s.queued[ref]
+	if item == nil {
+		panic(nil)
+	}
+	heap.Remove(&s.queue, item.index)
+	delete(s.queued, ref)
+
+	// Move the last ticket of the bucket into the freed slot
 	bucket := timeBucket(ref.t.regTime[ref.idx] / mclock.AbsTime(ticketTimeBucketLen))
 	list := tickets[bucket]
-	idx := -1
-	for i, bt := range list {
-		if bt.t == ref.t {
-			idx = i
-			break
-		}
-	}
-	if idx == -1 {
-		panic(nil)
+	last := len(list) - 1
+	if item.pos != last {
+		list[item.pos] = list[last]
+		s.queued[list[item.pos]].pos = item.pos
 	}
-	list = append(list[:idx], list[idx+1:]...)
+	list[last] = ticketRef{}
+	list = list[:last]
 	if len(list) != 0 {
 		tickets[bucket] = list
 	} else {
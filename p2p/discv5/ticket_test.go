@@ -0,0 +1,133 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package discv5
+
+import (
+	"fmt"
+	"math/rand"
+	"testing"
+	"time"
+
+	"github.com/trust-tech/go-trustmachine/common/mclock"
+)
+
+// testTopics returns n distinct topic names.
+func testTopics(n int) []Topic {
+	topics := make([]Topic, n)
+	for i := range topics {
+		topics[i] = Topic(fmt.Sprintf("topic-%d", i))
+	}
+	return topics
+}
+
+// testNodes returns n nodes with random IDs.
+func testNodes(n int) []*Node {
+	nodes := make([]*Node, n)
+	for i := range nodes {
+		var id NodeID
+		rand.Read(id[:])
+		nodes[i] = NewNode(id, nil, 0, 0)
+	}
+	return nodes
+}
+
+// addTestTicket adds a single topic ticket of the given node to the store, as
+// if it had been received for a registration lookup.
+func addTestTicket(s *ticketStore, node *Node, topic Topic, regTime mclock.AbsTime) ticketRef {
+	t := &ticket{
+		topics:  []Topic{topic},
+		regTime: []mclock.AbsTime{regTime},
+		node:    node,
+	}
+	ref := ticketRef{t, 0}
+	s.addTicketRef(ref)
+	s.nextTicketCached = nil
+	s.nodes[node] = t
+	return ref
+}
+
+// Tests that tickets are handed out for registration in the order of their
+// registration times across all topics, and that removed tickets and topics
+// are skipped.
+func TestTicketStoreOrder(t *testing.T) {
+	s := newTicketStore()
+	topics := testTopics(3)
+	for _, topic := range topics {
+		s.addTopic(topic, true)
+	}
+	nodes := testNodes(6)
+	now := mclock.Now()
+	min := mclock.AbsTime(time.Minute)
+
+	var refs []ticketRef
+	for i, offset := range []mclock.AbsTime{30 * min, 2 * min, 15 * min, min, 7 * min, 3 * min} {
+		refs = append(refs, addTestTicket(s, nodes[i], topics[i%3], now+offset))
+	}
+	// Drop a ticket from the middle of the queue and a whole topic
+	s.removeTicketRef(refs[4])
+	s.removeRegisterTopic(topics[2])
+
+	for _, want := range []int{3, 1, 0} {
+		ref, wait := s.nextRegisterableTicket()
+		if ref == nil || *ref != refs[want] {
+			t.Fatalf("next ticket mismatch: have %v, want ticket %d", ref, want)
+		}
+		if wait <= 0 {
+			t.Fatalf("ticket %d: non-positive wait time %v", want, wait)
+		}
+		s.ticketRegistered(*ref)
+	}
+	if ref, _ := s.nextRegisterableTicket(); ref != nil {
+		t.Fatalf("ticket returned from empty store: %v", ref)
+	}
+	if len(s.queued) != 0 || len(s.nodes) != 0 {
+		t.Fatalf("store not empty: %d queued, %d nodes", len(s.queued), len(s.nodes))
+	}
+	for _, topic := range topics[:2] {
+		if len(s.tickets[topic].buckets) != 0 {
+			t.Errorf("topic %v: %d buckets left", topic, len(s.tickets[topic].buckets))
+		}
+	}
+}
+
+// Benchmarks registering the next ticket of a store filled with tickets for
+// many topics, replacing it with a newly received one.
+func BenchmarkTicketStore(b *testing.B) {
+	const ticketsPerTopic = 10
+
+	s := newTicketStore()
+	topics := testTopics(1000)
+	for _, topic := range topics {
+		s.addTopic(topic, true)
+	}
+	nodes := testNodes(len(topics) * ticketsPerTopic)
+	now := mclock.Now()
+	regTime := func() mclock.AbsTime {
+		return now + mclock.AbsTime(rand.Int63n(int64(time.Hour)))
+	}
+	for i, node := range nodes {
+		addTestTicket(s, node, topics[i%len(topics)], regTime())
+	}
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		ref, _ := s.nextRegisterableTicket()
+		s.ticketRegistered(*ref)
+		now = ref.topicRegTime()
+		addTestTicket(s, ref.t.node, ref.topic(), regTime())
+	}
+}
@@ -40,6 +40,7 @@ type topicEntry struct {
 	fifoIdx uint64
 	node    *Node
 	expire  mclock.AbsTime
+	index   int // position in topicTable.expiring
 }
 
 type topicInfo struct {
@@ -75,6 +76,12 @@ type topicTable struct {
 	requested             topicRequestQueue
 	requestCnt            uint64
 	lastGarbageCollection mclock.AbsTime
+
+	// Entries ordered by expiry time, and the nodes and topics left without
+	// entries which are kept until their registration timeouts pass.
+	expiring   topicEntryQueue
+	idleNodes  map[*Node]struct{}
+	idleTopics map[Topic]struct{}
 }
 
 func newTopicTable(db *nodeDB, self *Node) *topicTable {
@@ -82,10 +89,12 @@ func newTopicTable(db *nodeDB, self *Node) *topicTable {
 		fmt.Printf("*N %016x\n", self.sha[:8])
 	}
 	return &topicTable{
-		db:     db,
-		nodes:  make(map[*Node]*nodeInfo),
-		topics: make(map[Topic]*topicInfo),
-		self:   self,
+		db:         db,
+		nodes:      make(map[*Node]*nodeInfo),
+		topics:     make(map[Topic]*topicInfo),
+		self:       self,
+		idleNodes:  make(map[*Node]struct{}),
+		idleTopics: make(map[Topic]struct{}),
 	}
 }
 
@@ -111,9 +120,15 @@ func (t *topicTable) checkDeleteTopic(topic Topic) {
 	if ti == nil {
 		return
 	}
-	if len(ti.entries) == 0 && ti.wcl.hasMinimumWaitPeriod() {
+	if len(ti.entries) != 0 {
+		return
+	}
+	if ti.wcl.hasMinimumWaitPeriod() {
 		delete(t.topics, topic)
+		delete(t.idleTopics, topic)
 		heap.Remove(&t.requested, ti.rqItem.index)
+	} else {
+		t.idleTopics[topic] = struct{}{}
 	}
 }
 
@@ -131,14 +146,20 @@ func (t *topicTable) getOrNewNode(node *Node) *nodeInfo {
 			lastUsedTicket:   used,
 		}
 		t.nodes[node] = n
+		t.idleNodes[node] = struct{}{}
 	}
 	return n
 }
 
 func (t *topicTable) checkDeleteNode(node *Node) {
-	if n, ok := t.nodes[node]; ok && len(n.entries) == 0 && n.noRegUntil < mclock.Now() {
-		//fmt.Printf("deleteNode %016x %016x\n", t.self.sha[:8], node.sha[:8])
-		delete(t.nodes, node)
+	if n, ok := t.nodes[node]; ok && len(n.entries) == 0 {
+		if n.noRegUntil < mclock.Now() {
+			//fmt.Printf("deleteNode %016x %016x\n", t.self.sha[:8], node.sha[:8])
+			delete(t.nodes, node)
+			delete(t.idleNodes, node)
+		} else {
+			t.idleNodes[node] = struct{}{}
+		}
 	}
 }
 
@@ -200,6 +221,9 @@ func (t *topicTable) addEntry(node *Node, topic Topic) {
 	}
 	te.entries[fifoIdx] = entry
 	n.entries[topic] = entry
+	heap.Push(&t.expiring, entry)
+	delete(t.idleNodes, node)
+	delete(t.idleTopics, topic)
 	t.globalEntries++
 	te.wcl.registered(tm)
 }
@@ -227,6 +251,7 @@ func (t *topicTable) deleteEntry(e *topicEntry) {
 	}
 	te := t.topics[e.topic]
 	delete(te.entries, e.fifoIdx)
+	heap.Remove(&t.expiring, e.index)
 	if len(te.entries) == 0 {
 		t.checkDeleteTopic(e.topic)
 	}
@@ -263,6 +288,7 @@ func (t *topicTable) useTicket(node *Node, serialNo uint32, topics []Topic, idx
 		} else {
 			// if there is an active entry, don't move to the front of the FIFO but prolong expire time
 			e.expire = tm + mclock.AbsTime(fallbackRegistrationExpiry)
+			heap.Fix(&t.expiring, e.index)
 		}
 		return true
 	}
@@ -299,24 +325,22 @@ func (topictab *topicTable) getTicket(node *Node, topics []Topic) *ticket {
 
 const gcInterval = time.Minute
 
+// collectGarbage drops the expired entries, and every gcInterval the nodes and
+// topics without entries whose registration timeouts passed.
 func (t *topicTable) collectGarbage() {
 	tm := mclock.Now()
+	for len(t.expiring) > 0 && t.expiring[0].expire <= tm {
+		t.deleteEntry(t.expiring[0])
+	}
 	if time.Duration(tm-t.lastGarbageCollection) < gcInterval {
 		return
 	}
 	t.lastGarbageCollection = tm
 
-	for node, n := range t.nodes {
-		for _, e := range n.entries {
-			if e.expire <= tm {
-				t.deleteEntry(e)
-			}
-		}
-
+	for node := range t.idleNodes {
 		t.checkDeleteNode(node)
 	}
-
-	for topic := range t.topics {
+	for topic := range t.idleTopics {
 		t.checkDeleteTopic(topic)
 	}
 }
@@ -363,6 +387,37 @@ func noRegTimeout() time.Duration {
 	return time.Duration(float64(avgnoRegTimeout) * e)
 }
 
+// topicEntryQueue is a min-heap of topic entries ordered by expiry time.
+type topicEntryQueue []*topicEntry
+
+func (eq topicEntryQueue) Len() int { return len(eq) }
+
+func (eq topicEntryQueue) Less(i, j int) bool {
+	return eq[i].expire < eq[j].expire
+}
+
+func (eq topicEntryQueue) Swap(i, j int) {
+	eq[i], eq[j] = eq[j], eq[i]
+	eq[i].index = i
+	eq[j].index = j
+}
+
+func (eq *topicEntryQueue) Push(x interface{}) {
+	item := x.(*topicEntry)
+	item.index = len(*eq)
+	*eq = append(*eq, item)
+}
+
+func (eq *topicEntryQueue) Pop() interface{} {
+	old := *eq
+	n := len(old)
+	item := old[n-1]
+	old[n-1] = nil
+	item.index = -1
+	*eq = old[0 : n-1]
+	return item
+}
+
 type topicRequestQueueItem struct {
 	topic    Topic
 	priority uint64
@@ -18,6 +18,7 @@ package discv5
 
 import (
 	"encoding/binary"
+	"math/rand"
 	"testing"
 	"time"
 
@@ -69,3 +70,81 @@ func TestTopicRadius(t *testing.T) {
 		t.Errorf("Average/target ratio is too far from 1 (%v)", avgRel)
 	}
 }
+
+// Tests that expired entries are dropped from the topic table, along with the
+// nodes and topics left empty once their timeouts pass.
+func TestTopicTableExpiry(t *testing.T) {
+	tab := newTopicTable(nil, testNodes(1)[0])
+	topics := testTopics(2)
+	nodes := testNodes(3)
+
+	tab.addEntry(nodes[0], topics[0])
+	tab.addEntry(nodes[1], topics[0])
+	tab.addEntry(nodes[2], topics[1])
+
+	// Expire the entry of the first node and the sole entry of the second topic
+	for _, node := range []*Node{nodes[0], nodes[2]} {
+		for _, e := range tab.nodes[node].entries {
+			e.expire = mclock.Now() - 1
+		}
+	}
+	tab.nodes[nodes[2]].noRegUntil = mclock.Now() + mclock.AbsTime(time.Hour)
+	tab.topics[topics[1]].wcl = waitControlLoop{}
+
+	if entries := tab.getEntries(topics[0]); len(entries) != 1 || entries[0] != nodes[1] {
+		t.Fatalf("entries mismatch: have %v, want [%v]", entries, nodes[1])
+	}
+	if _, ok := tab.nodes[nodes[0]]; ok {
+		t.Errorf("expired node not dropped")
+	}
+	if _, ok := tab.nodes[nodes[2]]; !ok {
+		t.Errorf("node dropped before its registration timeout")
+	}
+	if _, ok := tab.topics[topics[1]]; ok {
+		t.Errorf("empty topic not dropped")
+	}
+	if tab.globalEntries != 1 || len(tab.expiring) != 1 {
+		t.Errorf("entry count mismatch: have %d/%d, want 1", tab.globalEntries, len(tab.expiring))
+	}
+	// Once the registration timeout passes, the idle node is dropped too
+	tab.nodes[nodes[2]].noRegUntil = 0
+	tab.lastGarbageCollection = 0
+	tab.collectGarbage()
+	if _, ok := tab.nodes[nodes[2]]; ok || len(tab.idleNodes) != 0 {
+		t.Errorf("idle node not dropped")
+	}
+}
+
+// newBenchTopicTable creates a topic table with each of the given nodes
+// registered for a topic.
+func newBenchTopicTable(topics []Topic, nodes []*Node) *topicTable {
+	tab := newTopicTable(nil, testNodes(1)[0])
+	for i, node := range nodes {
+		tab.addEntry(node, topics[i%len(topics)])
+	}
+	return tab
+}
+
+// Benchmarks registrations and topic queries on a full topic table.
+func BenchmarkTopicTableRegister(b *testing.B) {
+	topics := testTopics(1000)
+	nodes := testNodes(maxEntries)
+	tab := newBenchTopicTable(topics, nodes)
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		tab.addEntry(nodes[rand.Intn(len(nodes))], topics[rand.Intn(len(topics))])
+		tab.getEntries(topics[rand.Intn(len(topics))])
+	}
+}
+
+// Benchmarks the periodic garbage collection of a full topic table.
+func BenchmarkTopicTableCollect(b *testing.B) {
+	tab := newBenchTopicTable(testTopics(1000), testNodes(maxEntries))
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		tab.lastGarbageCollection = 0
+		tab.collectGarbage()
+	}
+}
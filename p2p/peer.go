@@ -129,7 +129,7 @@ func newPeer(conn *conn, protocols []Protocol) *Peer {
 		running:  protomap,
 		created:  mclock.Now(),
 		disc:     make(chan DiscReason),
-		protoErr: make(chan error, len(protomap)+1), // protocols + pingLoop
+		protoErr: make(chan error, len(protomap)), // protocols
 		closed:   make(chan struct{}),
 		log:      log.New("id", conn.id, "conn", conn.flags),
 	}
@@ -140,16 +140,17 @@ func (p *Peer) Log() log.Logger {
 	return p.log
 }
 
-func (p *Peer) run() (remoteRequested bool, err error) {
+// run runs the peer until it disconnects. It returns whether the remote side
+// requested the disconnect, the reason for it and the error that ended the run.
+func (p *Peer) run() (remoteRequested bool, reason DiscReason, err error) {
 	var (
 		writeStart = make(chan struct{}, 1)
 		writeErr   = make(chan error, 1)
 		readErr    = make(chan error, 1)
-		reason     DiscReason // sent to the peer
 	)
 	p.wg.Add(2)
 	go p.readLoop(readErr)
-	go p.pingLoop()
+	go p.pingLoop(readErr)
 
 	// Start all protocol handlers.
 	writeStart <- struct{}{}
@@ -179,6 +180,7 @@ loop:
 			reason = discReasonForError(err)
 			break loop
 		case err = <-p.disc:
+			reason = discReasonForError(err)
 			break loop
 		}
 	}
@@ -186,10 +188,12 @@ loop:
 	close(p.closed)
 	p.rw.close(reason)
 	p.wg.Wait()
-	return remoteRequested, err
+	return remoteRequested, reason, err
 }
 
-func (p *Peer) pingLoop() {
+// pingLoop pings the peer periodically. Failures are reported on errc like
+// read errors, as they are network errors too.
+func (p *Peer) pingLoop(errc chan<- error) {
 	ping := time.NewTicker(pingInterval)
 	defer p.wg.Done()
 	defer ping.Stop()
@@ -197,7 +201,10 @@ func (p *Peer) pingLoop() {
 		select {
 		case <-ping.C:
 			if err := SendItems(p.rw, pingMsg); err != nil {
-				p.protoErr <- err
+				select {
+				case errc <- err:
+				case <-p.closed:
+				}
 				return
 			}
 		case <-p.closed:
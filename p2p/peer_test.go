@@ -55,7 +55,7 @@ func testPeer(protos []Protocol) (func(), *conn, *Peer, <-chan error) {
 	peer := newPeer(c1, protos)
 	errc := make(chan error, 1)
 	go func() {
-		_, err := peer.run()
+		_, _, err := peer.run()
 		errc <- err
 	}()
 
@@ -147,6 +147,37 @@ func TestPeerDisconnect(t *testing.T) {
 	}
 }
 
+// This test checks that run returns the reason of a local disconnect.
+func TestPeerDisconnectReason(t *testing.T) {
+	fd1, fd2 := net.Pipe()
+	proto := Protocol{
+		Name:   "useless",
+		Length: 1,
+		Run:    func(p *Peer, rw MsgReadWriter) error { p.Disconnect(DiscUselessPeer); return nil },
+	}
+	c1 := &conn{fd: fd1, transport: newTestTransport(randomID(), fd1), caps: []Cap{proto.cap()}}
+	c2 := &conn{fd: fd2, transport: newTestTransport(randomID(), fd2), caps: []Cap{proto.cap()}}
+	defer c2.close(errors.New("test done"))
+
+	type result struct {
+		requested bool
+		reason    DiscReason
+	}
+	done := make(chan result, 1)
+	go func() {
+		requested, reason, _ := newPeer(c1, []Protocol{proto}).run()
+		done <- result{requested, reason}
+	}()
+	select {
+	case res := <-done:
+		if res.requested || res.reason != DiscUselessPeer {
+			t.Errorf("run result mismatch: have requested %v, reason %v; want false, %v", res.requested, res.reason, DiscUselessPeer)
+		}
+	case <-time.After(time.Second):
+		t.Fatal("peer did not return")
+	}
+}
+
 // This test is supposed to verify that Peer can reliably handle
 // multiple causes of disconnection occurring at the same time.
 func TestPeerDisconnectRace(t *testing.T) {
@@ -42,8 +42,9 @@ const (
 	// Maximum number of concurrently handshaking inbound connections.
 	maxAcceptConns = 50
 
-	// Maximum number of concurrently dialing outbound connections.
-	maxActiveDialTasks = 16
+	// Maximum number of concurrently dialing outbound connections. How many
+	// are used depends on the dial success rate, see dialstate.dialSlots.
+	maxActiveDialTasks = 64
 
 	// Maximum time allowed for reading a complete message.
 	// This is effectively the amount of time a connection can be idle.
@@ -173,7 +174,8 @@ type peerOpFunc func(map[discover.NodeID]*Peer)
 type peerDrop struct {
 	*Peer
 	err       error
-	requested bool // true if signaled by the peer
+	reason    DiscReason // sent by the peer if requested, to it otherwise
+	requested bool       // true if signaled by the peer
 }
 
 type connFlag int
@@ -444,6 +446,7 @@ func (srv *Server) startListening() error {
 type dialer interface {
 	newTasks(running int, peers map[discover.NodeID]*Peer, now time.Time) []task
 	taskDone(task, time.Time)
+	peerRemoved(id discover.NodeID, reason DiscReason, requested bool, connected time.Duration)
 	addStatic(*discover.Node)
 	removeStatic(*discover.Node)
 }
@@ -555,9 +558,10 @@ running:
 			c.cont <- err
 		case pd := <-srv.delpeer:
 			// A peer disconnected.
-			d := common.PrettyDuration(mclock.Now() - pd.created)
-			pd.log.Debug("Removing p2p peer", "duration", d, "peers", len(peers)-1, "req", pd.requested, "err", pd.err)
+			d := time.Duration(mclock.Now() - pd.created)
+			pd.log.Debug("Removing p2p peer", "duration", common.PrettyDuration(d), "peers", len(peers)-1, "req", pd.requested, "err", pd.err)
 			delete(peers, pd.ID())
+			dialstate.peerRemoved(pd.ID(), pd.reason, pd.requested, d)
 		}
 	}
 
@@ -673,8 +677,8 @@ func (srv *Server) listenLoop() {
 
 // setupConn runs the handshakes and attempts to add the connection
 // as a peer. It returns when the connection has been added as a peer
-// or the handshakes have failed.
-func (srv *Server) setupConn(fd net.Conn, flags connFlag, dialDest *discover.Node) {
+// or the handshakes have failed, along with the reason of the failure.
+func (srv *Server) setupConn(fd net.Conn, flags connFlag, dialDest *discover.Node) error {
 	// Prevent leftover pending conns from entering the handshake.
 	srv.lock.Lock()
 	running := srv.running
@@ -682,47 +686,48 @@ func (srv *Server) setupConn(fd net.Conn, flags connFlag, dialDest *discover.Nod
 	c := &conn{fd: fd, transport: srv.newTransport(fd), flags: flags, cont: make(chan error)}
 	if !running {
 		c.close(errServerStopped)
-		return
+		return errServerStopped
 	}
 	// Run the encryption handshake.
 	var err error
 	if c.id, err = c.doEncHandshake(srv.PrivateKey, dialDest); err != nil {
 		log.Trace("Failed RLPx handshake", "addr", c.fd.RemoteAddr(), "conn", c.flags, "err", err)
 		c.close(err)
-		return
+		return err
 	}
 	clog := log.New("id", c.id, "addr", c.fd.RemoteAddr(), "conn", c.flags)
 	// For dialed connections, check that the remote public key matches.
 	if dialDest != nil && c.id != dialDest.ID {
 		c.close(DiscUnexpectedIdentity)
 		clog.Trace("Dialed identity mismatch", "want", c, dialDest.ID)
-		return
+		return DiscUnexpectedIdentity
 	}
 	if err := srv.checkpoint(c, srv.posthandshake); err != nil {
 		clog.Trace("Rejected peer before protocol handshake", "err", err)
 		c.close(err)
-		return
+		return err
 	}
 	// Run the protocol handshake
 	phs, err := c.doProtoHandshake(srv.ourHandshake)
 	if err != nil {
 		clog.Trace("Failed proto handshake", "err", err)
 		c.close(err)
-		return
+		return err
 	}
 	if phs.ID != c.id {
 		clog.Trace("Wrong devp2p handshake identity", "err", phs.ID)
 		c.close(DiscUnexpectedIdentity)
-		return
+		return DiscUnexpectedIdentity
 	}
 	c.caps, c.name = phs.Caps, phs.Name
 	if err := srv.checkpoint(c, srv.addpeer); err != nil {
 		clog.Trace("Rejected peer", "err", err)
 		c.close(err)
-		return
+		return err
 	}
 	// If the checks completed successfully, runPeer has now been
 	// launched by run.
+	return nil
 }
 
 func truncateName(s string) string {
@@ -755,10 +760,10 @@ func (srv *Server) runPeer(p *Peer) {
 	if srv.newPeerHook != nil {
 		srv.newPeerHook(p)
 	}
-	remoteRequested, err := p.run()
+	remoteRequested, reason, err := p.run()
 	// Note: run waits for existing peers to be sent on srv.delpeer
 	// before returning, so this send should not select on srv.quit.
-	srv.delpeer <- peerDrop{p, err, remoteRequested}
+	srv.delpeer <- peerDrop{p, err, reason, remoteRequested}
 }
 
 // NodeInfo represents a short summary of the information known about the host.
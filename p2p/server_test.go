@@ -298,6 +298,8 @@ func (tg taskgen) newTasks(running int, peers map[discover.NodeID]*Peer, now tim
 func (tg taskgen) taskDone(t task, now time.Time) {
 	tg.doneFunc(t)
 }
+func (tg taskgen) peerRemoved(discover.NodeID, DiscReason, bool, time.Duration) {
+}
 func (tg taskgen) addStatic(*discover.Node) {
 }
 func (tg taskgen) removeStatic(*discover.Node) {
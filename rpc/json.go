@@ -64,7 +64,7 @@ type jsonErrResponse struct {
 
 type jsonSubscription struct {
 	Subscription string      `json:"subscription"`
-	Result       interface{} `json:"result,omitempty"`
+	Result       interface{} `json:"result"`
 }
 
 type jsonNotification struct {
@@ -322,8 +322,27 @@ func (c *jsonCodec) CreateErrorResponseWithInfo(id interface{}, err Error, info
 		Error: jsonError{Code: err.ErrorCode(), Message: err.Error(), Data: info}}
 }
 
+// rawNotification is a fully serialized JSON-RPC notification, including the
+// trailing newline, which is written to the connection as is.
+type rawNotification []byte
+
 // CreateNotification will create a JSON-RPC notification with the given subscription id and event as params.
+// Pre-encoded payloads are spliced into the notification envelope without re-encoding them.
 func (c *jsonCodec) CreateNotification(subid, namespace string, event interface{}) interface{} {
+	if payload, ok := event.(*Payload); ok {
+		if result, err := payload.MarshalJSON(); err == nil {
+			// Method and subscription ids are plain ASCII, Go quoting equals JSON's
+			msg := make(rawNotification, 0, len(result)+len(namespace)+len(subid)+96)
+			msg = append(msg, `{"jsonrpc":"`+jsonrpcVersion+`","method":`...)
+			msg = strconv.AppendQuote(msg, namespace+notificationMethodSuffix)
+			msg = append(msg, `,"params":{"subscription":`...)
+			msg = strconv.AppendQuote(msg, subid)
+			msg = append(msg, `,"result":`...)
+			msg = append(msg, result...)
+			msg = append(msg, "}}\n"...)
+			return msg
+		}
+	}
 	if isHexNum(reflect.TypeOf(event)) {
 		return &jsonNotification{Version: jsonrpcVersion, Method: namespace + notificationMethodSuffix,
 			Params: jsonSubscription{Subscription: subid, Result: fmt.Sprintf(`%#x`, event)}}
@@ -338,6 +357,10 @@ func (c *jsonCodec) Write(res interface{}) error {
 	c.encMu.Lock()
 	defer c.encMu.Unlock()
 
+	if raw, ok := res.(rawNotification); ok {
+		_, err := c.rw.Write(raw)
+		return err
+	}
 	return c.e.Encode(res)
 }
 
@@ -18,8 +18,23 @@ package rpc
 
 import (
 	"context"
+	"encoding/json"
 	"errors"
+	"fmt"
+	"reflect"
 	"sync"
+
+	"github.com/trust-tech/go-trustmachine/log"
+)
+
+const (
+	// notificationQueueLimit is the maximum number of notifications buffered for
+	// a single connection. Clients falling further behind are disconnected.
+	notificationQueueLimit = 10000
+
+	// pacedQueueLimit is the maximum number of notifications of paced producers
+	// (see NotifyWait) buffered for a single connection, on top of the others.
+	pacedQueueLimit = 1000
 )
 
 var (
@@ -37,7 +52,8 @@ type ID string
 type Subscription struct {
 	ID        ID
 	namespace string
-	err       chan error // closed on unsubscribe
+	err       chan error    // closed on unsubscribe
+	activated chan struct{} // closed once notifications are delivered
 }
 
 // Err returns a channel that is closed when the client send an unsubscribe request.
@@ -48,6 +64,33 @@ func (s *Subscription) Err() <-chan error {
 // notifierKey is used to store a notifier within the connection context.
 type notifierKey struct{}
 
+// Payload is a notification result that is serialized at most once, regardless
+// of how many subscriptions it is sent to. Producers fanning the same event out
+// to many subscribers should wrap it with NewPayload and notify the wrapper.
+type Payload struct {
+	data interface{}
+	once sync.Once
+	enc  json.RawMessage
+	err  error
+}
+
+// NewPayload wraps a notification result for shared, lazy serialization.
+func NewPayload(data interface{}) *Payload {
+	return &Payload{data: data}
+}
+
+// MarshalJSON implements json.Marshaler, returning the cached encoding.
+func (p *Payload) MarshalJSON() ([]byte, error) {
+	p.once.Do(func() {
+		if isHexNum(reflect.TypeOf(p.data)) {
+			p.enc, p.err = json.Marshal(fmt.Sprintf(`%#x`, p.data))
+		} else {
+			p.enc, p.err = json.Marshal(p.data)
+		}
+	})
+	return p.enc, p.err
+}
+
 // Notifier is tight to a RPC connection that supports subscriptions.
 // Server callbacks use the notifier to send notifications.
 type Notifier struct {
@@ -56,15 +99,47 @@ type Notifier struct {
 	stopped  bool
 	active   map[ID]*Subscription
 	inactive map[ID]*Subscription
+
+	queue chan interface{} // notifications waiting to be written to the connection
+	paced chan struct{}    // slots of the paced notifications in the queue
+}
+
+// pacedNotification is a queued notification holding a paced producer slot.
+type pacedNotification struct {
+	msg interface{}
 }
 
 // newNotifier creates a new notifier that can be used to send subscription
 // notifications to the client.
 func newNotifier(codec ServerCodec) *Notifier {
-	return &Notifier{
+	n := &Notifier{
 		codec:    codec,
 		active:   make(map[ID]*Subscription),
 		inactive: make(map[ID]*Subscription),
+		queue:    make(chan interface{}, notificationQueueLimit+pacedQueueLimit),
+		paced:    make(chan struct{}, pacedQueueLimit),
+	}
+	go n.writeLoop()
+	return n
+}
+
+// writeLoop writes the queued notifications to the connection until it closes,
+// so that a slow client never blocks the producers of notifications.
+func (n *Notifier) writeLoop() {
+	for {
+		select {
+		case notification := <-n.queue:
+			if paced, ok := notification.(pacedNotification); ok {
+				notification = paced.msg
+				<-n.paced
+			}
+			if err := n.codec.Write(notification); err != nil {
+				n.codec.Close()
+				return
+			}
+		case <-n.codec.Closed():
+			return
+		}
 	}
 }
 
@@ -79,28 +154,89 @@ func NotifierFromContext(ctx context.Context) (*Notifier, bool) {
 // are dropped until the subscription is marked as active. This is done
 // by the RPC server after the subscription ID is send to the client.
 func (n *Notifier) CreateSubscription() *Subscription {
-	s := &Subscription{ID: NewID(), err: make(chan error)}
+	s := &Subscription{ID: NewID(), err: make(chan error), activated: make(chan struct{})}
 	n.subMu.Lock()
 	n.inactive[s.ID] = s
 	n.subMu.Unlock()
 	return s
 }
 
-// Notify sends a notification to the client with the given data as payload.
-// If an error occurs the RPC connection is closed and the error is returned.
+// Notify queues a notification to the client with the given data as payload.
+// The notification is written asynchronously. If the client doesn't keep up
+// with its notifications the RPC connection is closed and an error returned.
 func (n *Notifier) Notify(id ID, data interface{}) error {
 	n.subMu.RLock()
-	defer n.subMu.RUnlock()
-
 	sub, active := n.active[id]
-	if active {
-		notification := n.codec.CreateNotification(string(id), sub.namespace, data)
-		if err := n.codec.Write(notification); err != nil {
-			n.codec.Close()
-			return err
-		}
+	n.subMu.RUnlock()
+
+	if !active {
+		return nil
+	}
+	select {
+	case <-n.codec.Closed():
+		return ErrClientQuit
+	default:
+	}
+	notification := n.codec.CreateNotification(string(id), sub.namespace, data)
+	select {
+	case n.queue <- notification:
+		return nil
+	default:
+		log.Warn("Dropping slow RPC subscriber", "queued", notificationQueueLimit)
+		n.codec.Close()
+		return ErrSubscriptionQueueOverflow
+	}
+}
+
+// NotifyWait queues a notification like Notify, but waits for the subscription
+// to become active and for room in the queue instead of dropping it, so that
+// producers of many notifications at once (e.g. a stream of historical data) are
+// paced by the client. Paced notifications have their own share of the queue,
+// so they never make the notifications of other subscriptions overflow it. It
+// returns early if the client unsubscribes or quits.
+func (n *Notifier) NotifyWait(sub *Subscription, data interface{}) error {
+	select {
+	case <-sub.activated:
+	case <-sub.err:
+		return ErrSubscriptionNotFound
+	case <-n.codec.Closed():
+		return ErrClientQuit
+	}
+	select {
+	case n.paced <- struct{}{}:
+	case <-sub.err:
+		return ErrSubscriptionNotFound
+	case <-n.codec.Closed():
+		return ErrClientQuit
+	}
+	notification := pacedNotification{n.codec.CreateNotification(string(sub.ID), sub.namespace, data)}
+	select {
+	case n.queue <- notification:
+		return nil
+	case <-sub.err:
+	case <-n.codec.Closed():
+	}
+	<-n.paced
+	select {
+	case <-sub.err:
+		return ErrSubscriptionNotFound
+	default:
+		return ErrClientQuit
+	}
+}
+
+// Done removes a subscription whose producer sent its last notification (e.g.
+// the end of a finite stream), as if the client unsubscribed. The notifications
+// already queued are still delivered.
+func (n *Notifier) Done(sub *Subscription) {
+	n.subMu.Lock()
+	defer n.subMu.Unlock()
+
+	if _, found := n.active[sub.ID]; found {
+		close(sub.err)
+		delete(n.active, sub.ID)
 	}
-	return nil
+	delete(n.inactive, sub.ID)
 }
 
 // Closed returns a channel that is closed when the RPC connection is closed.
@@ -132,5 +268,6 @@ func (n *Notifier) activate(id ID, namespace string) {
 		sub.namespace = namespace
 		n.active[id] = sub
 		delete(n.inactive, id)
+		close(sub.activated)
 	}
 }
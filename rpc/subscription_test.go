@@ -20,10 +20,13 @@ import (
 	"context"
 	"encoding/json"
 	"fmt"
+	"math/big"
 	"net"
 	"sync"
 	"testing"
 	"time"
+
+	"github.com/trust-tech/go-trustmachine/common/hexutil"
 )
 
 type NotificationTestService struct {
@@ -322,3 +325,202 @@ func TestSubscriptionMultipleNamespaces(t *testing.T) {
 		}
 	}
 }
+
+// notificationBenchObject resembles a block header in its JSON form.
+type notificationBenchObject struct {
+	ParentHash  hexutil.Bytes  `json:"parentHash"`
+	UncleHash   hexutil.Bytes  `json:"sha3Uncles"`
+	Coinbase    hexutil.Bytes  `json:"miner"`
+	Root        hexutil.Bytes  `json:"stateRoot"`
+	TxHash      hexutil.Bytes  `json:"transactionsRoot"`
+	ReceiptHash hexutil.Bytes  `json:"receiptsRoot"`
+	Bloom       hexutil.Bytes  `json:"logsBloom"`
+	Difficulty  *hexutil.Big   `json:"difficulty"`
+	Number      *hexutil.Big   `json:"number"`
+	GasLimit    *hexutil.Big   `json:"gasLimit"`
+	GasUsed     *hexutil.Big   `json:"gasUsed"`
+	Time        *hexutil.Big   `json:"timestamp"`
+	Extra       hexutil.Bytes  `json:"extraData"`
+	MixDigest   hexutil.Bytes  `json:"mixHash"`
+	Nonce       hexutil.Uint64 `json:"nonce"`
+}
+
+func newNotificationBenchObject(n int) *notificationBenchObject {
+	hash := make(hexutil.Bytes, 32)
+	return &notificationBenchObject{
+		ParentHash: hash, UncleHash: hash, Coinbase: hash[:20], Root: hash, TxHash: hash, ReceiptHash: hash,
+		Bloom: make(hexutil.Bytes, 256), Difficulty: (*hexutil.Big)(big.NewInt(131072)), Number: (*hexutil.Big)(big.NewInt(int64(n))),
+		GasLimit: (*hexutil.Big)(big.NewInt(4712388)), GasUsed: (*hexutil.Big)(big.NewInt(21000)), Time: (*hexutil.Big)(big.NewInt(1500000000)),
+		Extra: hash, MixDigest: hash, Nonce: hexutil.Uint64(n),
+	}
+}
+
+// countingConn is a connection discarding all writes, signalling each of them.
+type countingConn struct {
+	written *sync.WaitGroup
+}
+
+func (c *countingConn) Read(p []byte) (int, error)  { select {} }
+func (c *countingConn) Write(p []byte) (int, error) { c.written.Done(); return len(p), nil }
+func (c *countingConn) Close() error                { return nil }
+
+// TestPayloadNotification tests that pre-encoded payloads produce the same
+// notifications as regularly encoded ones.
+func TestPayloadNotification(t *testing.T) {
+	var (
+		codec = NewJSONCodec(&countingConn{new(sync.WaitGroup)}).(*jsonCodec)
+		obj   = newNotificationBenchObject(1)
+	)
+	for _, data := range []interface{}{obj, 42} {
+		want, _ := json.Marshal(codec.CreateNotification("0xabc", "entrust", data))
+		have := codec.CreateNotification("0xabc", "entrust", NewPayload(data)).(rawNotification)
+		if string(have) != string(want)+"\n" {
+			t.Errorf("notification mismatch:\nhave %s\nwant %s", have, want)
+		}
+	}
+}
+
+// gatedConn is a connection discarding writes, each of which waits for a gate.
+type gatedConn struct {
+	gate    chan struct{}
+	written *sync.WaitGroup
+}
+
+func (c *gatedConn) Read(p []byte) (int, error) { select {} }
+func (c *gatedConn) Write(p []byte) (int, error) {
+	<-c.gate
+	c.written.Done()
+	return len(p), nil
+}
+func (c *gatedConn) Close() error { return nil }
+
+// Tests that NotifyWait holds notifications back until the subscription is
+// active, and waits for a slow client instead of dropping it.
+func TestNotifyWait(t *testing.T) {
+	var (
+		conn     = &gatedConn{make(chan struct{}), new(sync.WaitGroup)}
+		notifier = newNotifier(NewJSONCodec(conn))
+		sub      = notifier.CreateSubscription()
+		count    = 2 * notificationQueueLimit
+		errc     = make(chan error, 1)
+	)
+	defer notifier.codec.Close()
+
+	conn.written.Add(count)
+	go func() {
+		for i := 0; i < count; i++ {
+			if err := notifier.NotifyWait(sub, i); err != nil {
+				errc <- err
+				return
+			}
+		}
+		errc <- nil
+	}()
+	time.Sleep(10 * time.Millisecond)
+	if queued := len(notifier.queue); queued != 0 {
+		t.Fatalf("notifications queued before activation: %d", queued)
+	}
+	notifier.activate(sub.ID, "entrust")
+
+	// Let the producer fill the queue, it must wait instead of overflowing it
+	time.Sleep(50 * time.Millisecond)
+	select {
+	case err := <-errc:
+		t.Fatalf("producer finished against a stalled client: %v", err)
+	case <-notifier.Closed():
+		t.Fatalf("slow client dropped")
+	default:
+	}
+	close(conn.gate)
+	if err := <-errc; err != nil {
+		t.Fatalf("notification failed: %v", err)
+	}
+	conn.written.Wait()
+}
+
+// Tests that notifications paced by NotifyWait leave the queue to the plain ones
+// of other subscriptions, and that a finished subscription is unregistered.
+func TestNotifyWaitShare(t *testing.T) {
+	var (
+		conn     = &gatedConn{make(chan struct{}), new(sync.WaitGroup)}
+		notifier = newNotifier(NewJSONCodec(conn))
+		stream   = notifier.CreateSubscription()
+		live     = notifier.CreateSubscription()
+		errc     = make(chan error, 1)
+	)
+	defer notifier.codec.Close()
+	notifier.activate(stream.ID, "entrust")
+	notifier.activate(live.ID, "entrust")
+
+	conn.written.Add(2*pacedQueueLimit + notificationQueueLimit)
+	go func() {
+		for i := 0; i < 2*pacedQueueLimit; i++ {
+			if err := notifier.NotifyWait(stream, i); err != nil {
+				errc <- err
+				return
+			}
+		}
+		notifier.Done(stream)
+		errc <- nil
+	}()
+	// Wait for the stream to fill its share of the stalled queue
+	for len(notifier.paced) < pacedQueueLimit {
+		time.Sleep(time.Millisecond)
+	}
+	for i := 0; i < notificationQueueLimit; i++ {
+		if err := notifier.Notify(live.ID, i); err != nil {
+			t.Fatalf("notification %d failed: %v", i, err)
+		}
+	}
+	close(conn.gate)
+	if err := <-errc; err != nil {
+		t.Fatalf("stream failed: %v", err)
+	}
+	conn.written.Wait()
+
+	if err := notifier.unsubscribe(stream.ID); err != ErrSubscriptionNotFound {
+		t.Fatalf("finished subscription still registered, unsubscribe error %v", err)
+	}
+	if err := notifier.unsubscribe(live.ID); err != nil {
+		t.Fatalf("failed to unsubscribe live subscription: %v", err)
+	}
+}
+
+func BenchmarkNotify10k(b *testing.B)        { benchmarkNotify(b, 10000, false) }
+func BenchmarkNotify10kPayload(b *testing.B) { benchmarkNotify(b, 10000, true) }
+
+// benchmarkNotify measures fanning a single event out to many subscribers, each
+// on its own connection.
+func benchmarkNotify(b *testing.B, subscribers int, shared bool) {
+	var (
+		written   = new(sync.WaitGroup)
+		notifiers = make([]*Notifier, subscribers)
+		ids       = make([]ID, subscribers)
+	)
+	for i := range notifiers {
+		notifiers[i] = newNotifier(NewJSONCodec(&countingConn{written}))
+		ids[i] = notifiers[i].CreateSubscription().ID
+		notifiers[i].activate(ids[i], "entrust")
+	}
+	defer func() {
+		for _, n := range notifiers {
+			n.codec.Close()
+		}
+	}()
+	b.ReportAllocs()
+	b.ResetTimer()
+
+	for i := 0; i < b.N; i++ {
+		var data interface{} = newNotificationBenchObject(i)
+		if shared {
+			data = NewPayload(data)
+		}
+		written.Add(subscribers)
+		for j, n := range notifiers {
+			if err := n.Notify(ids[j], data); err != nil {
+				b.Fatalf("notification failed: %v", err)
+			}
+		}
+		written.Wait()
+	}
+}
@@ -25,6 +25,7 @@ import (
 	"sync"
 	"time"
 
+	"github.com/hashicorp/golang-lru"
 	"github.com/trust-tech/go-trustmachine/common"
 	"github.com/trust-tech/go-trustmachine/log"
 	"github.com/trust-tech/go-trustmachine/swarm/storage"
@@ -32,8 +33,16 @@ import (
 
 const (
 	ManifestType = "application/bzz-manifest+json"
+
+	manifestCacheSize   = 1024 // Number of decoded manifests kept in memory
+	manifestPrefetchers = 8    // Number of submanifests loaded concurrently when listing or walking
 )
 
+// manifestCache holds the entries of recently loaded and stored manifests by
+// hash. Manifests are content addressed, so it is shared by all tries, each
+// of which builds its own nodes from the cached entries.
+var manifestCache, _ = lru.New(manifestCacheSize)
+
 // Manifest represents a swarm manifest
 type Manifest struct {
 	Entries []ManifestEntry `json:"entries,omitempty"`
@@ -101,7 +110,8 @@ func (m *ManifestWriter) RemoveEntry(path string) error {
 
 // Store stores the manifest, returning the resulting storage key
 func (m *ManifestWriter) Store() (storage.Key, error) {
-	return m.trie.hash, m.trie.recalcAndStore()
+	err := m.trie.recalcAndStore()
+	return m.trie.hash, err
 }
 
 // ManifestWalker is used to recursively walk the entries in the manifest and
@@ -135,7 +145,10 @@ func (m *ManifestWalker) Walk(walkFn WalkFn) error {
 }
 
 func (m *ManifestWalker) walk(trie *manifestTrie, prefix string, walkFn WalkFn) error {
-	for _, entry := range trie.entries {
+	wait, cancel := trie.prefetch(trie.entries[:], m.quitC)
+	defer cancel()
+
+	for i, entry := range trie.entries {
 		if entry == nil {
 			continue
 		}
@@ -150,6 +163,9 @@ func (m *ManifestWalker) walk(trie *manifestTrie, prefix string, walkFn WalkFn)
 		if entry.ContentType != ManifestType {
 			continue
 		}
+		if err := wait(i); err != nil {
+			return err
+		}
 		if err := trie.loadSubTrie(entry, nil); err != nil {
 			return err
 		}
@@ -182,12 +198,32 @@ type manifestTrieEntry struct {
 func loadManifest(dpa *storage.DPA, hash storage.Key, quitC chan bool) (trie *manifestTrie, err error) { // non-recursive, subtrees are downloaded on-demand
 
 	log.Trace(fmt.Sprintf("manifest lookup key: '%v'.", hash.Log()))
-	// retrieve manifest via DPA
-	manifestReader := dpa.Retrieve(hash)
-	return readManifest(manifestReader, hash, dpa, quitC)
+	if entries, ok := manifestCache.Get(string(hash)); ok {
+		trie = newManifestTrie(dpa, entries.([]ManifestEntry), quitC)
+	} else {
+		// retrieve manifest via DPA
+		manifestReader := dpa.Retrieve(hash)
+		entries, err := decodeManifest(manifestReader, hash, quitC)
+		if err != nil {
+			return nil, err
+		}
+		manifestCache.Add(string(hash), entries)
+		trie = newManifestTrie(dpa, entries, quitC)
+	}
+	// the trie is unmodified, there's no need to store it again
+	trie.hash = hash
+	return trie, nil
 }
 
 func readManifest(manifestReader storage.LazySectionReader, hash storage.Key, dpa *storage.DPA, quitC chan bool) (trie *manifestTrie, err error) { // non-recursive, subtrees are downloaded on-demand
+	entries, err := decodeManifest(manifestReader, hash, quitC)
+	if err != nil {
+		return nil, err
+	}
+	return newManifestTrie(dpa, entries, quitC), nil
+}
+
+func decodeManifest(manifestReader storage.LazySectionReader, hash storage.Key, quitC chan bool) (entries []ManifestEntry, err error) {
 
 	// TODO check size for oversized manifests
 	size, err := manifestReader.Size(quitC)
@@ -208,7 +244,7 @@ func readManifest(manifestReader storage.LazySectionReader, hash storage.Key, dp
 
 	log.Trace(fmt.Sprintf("Manifest %v retrieved", hash.Log()))
 	var man struct {
-		Entries []*manifestTrieEntry `json:"entries"`
+		Entries []ManifestEntry `json:"entries"`
 	}
 	err = json.Unmarshal(manifestData, &man)
 	if err != nil {
@@ -218,14 +254,19 @@ func readManifest(manifestReader storage.LazySectionReader, hash storage.Key, dp
 	}
 
 	log.Trace(fmt.Sprintf("Manifest %v has %d entries.", hash.Log(), len(man.Entries)))
+	return man.Entries, nil
+}
 
-	trie = &manifestTrie{
+// newManifestTrie builds a trie out of the entries of a manifest. The entries
+// are copied, so they may be shared between tries.
+func newManifestTrie(dpa *storage.DPA, entries []ManifestEntry, quitC chan bool) *manifestTrie {
+	trie := &manifestTrie{
 		dpa: dpa,
 	}
-	for _, entry := range man.Entries {
-		trie.addEntry(entry, quitC)
+	for i := range entries {
+		trie.addEntry(newManifestTrieEntry(&entries[i], nil), quitC)
 	}
-	return
+	return trie
 }
 
 func (self *manifestTrie) addEntry(entry *manifestTrieEntry, quitC chan bool) {
@@ -331,7 +372,8 @@ func (self *manifestTrie) recalcAndStore() error {
 	list := &Manifest{}
 	for _, entry := range self.entries {
 		if entry != nil {
-			if entry.Hash == "" { // TODO: paralellize
+			// only modified submanifests need storing, the others still have their hash
+			if entry.Hash == "" {
 				err := entry.subtrie.recalcAndStore()
 				if err != nil {
 					return err
@@ -340,7 +382,6 @@ func (self *manifestTrie) recalcAndStore() error {
 			}
 			list.Entries = append(list.Entries, entry.ManifestEntry)
 		}
-
 	}
 
 	manifest, err := json.Marshal(list)
@@ -353,6 +394,9 @@ func (self *manifestTrie) recalcAndStore() error {
 	key, err2 := self.dpa.Store(sr, int64(len(manifest)), wg, nil)
 	wg.Wait()
 	self.hash = key
+	if err2 == nil {
+		manifestCache.Add(string(key), list.Entries)
+	}
 	return err2
 }
 
@@ -360,11 +404,92 @@ func (self *manifestTrie) loadSubTrie(entry *manifestTrieEntry, quitC chan bool)
 	if entry.subtrie == nil {
 		hash := common.Hex2Bytes(entry.Hash)
 		entry.subtrie, err = loadManifest(self.dpa, hash, quitC)
-		entry.Hash = "" // might not match, should be recalculated
 	}
 	return
 }
 
+// manifestLoads feeds the workers loading submanifests ahead of time. They are
+// shared by all listings and walks, and reused so their stacks only grow once.
+var (
+	manifestLoads       = make(chan func())
+	manifestLoadersOnce sync.Once
+)
+
+// prefetch starts loading the submanifests among the given entries in the
+// background, in order and at most manifestPrefetchers at a time. The returned
+// wait function blocks until the subtrie of the i-th entry is loaded, cancel
+// abandons the loads not started yet and waits for the running ones, so that
+// none of them touches the entries afterwards.
+func (self *manifestTrie) prefetch(entries []*manifestTrieEntry, quitC chan bool) (wait func(i int) error, cancel func()) {
+	manifestLoadersOnce.Do(func() {
+		for i := 0; i < manifestPrefetchers; i++ {
+			go func() {
+				for load := range manifestLoads {
+					load()
+				}
+			}()
+		}
+	})
+	var done []chan error
+	for i, entry := range entries {
+		if entry != nil && entry.ContentType == ManifestType && entry.subtrie == nil {
+			if done == nil {
+				done = make([]chan error, len(entries))
+			}
+			done[i] = make(chan error, 1)
+		}
+	}
+	if done == nil {
+		return func(int) error { return nil }, func() {}
+	}
+	var (
+		abort   = make(chan struct{})
+		fed     = make(chan struct{})
+		loading sync.WaitGroup
+	)
+	go func() {
+		defer close(fed)
+		for i, entry := range entries {
+			if done[i] == nil {
+				continue
+			}
+			entry, done := entry, done[i]
+			load := func() {
+				defer loading.Done()
+				done <- self.loadSubTrie(entry, quitC)
+			}
+			loading.Add(1)
+			select {
+			case manifestLoads <- load:
+			case <-abort:
+				loading.Done()
+				return
+			case <-quitC:
+				loading.Done()
+				return
+			}
+		}
+	}()
+	wait = func(i int) error {
+		if done[i] == nil {
+			return nil
+		}
+		select {
+		case err := <-done[i]:
+			done[i] = nil
+			return err
+		case <-quitC:
+			return fmt.Errorf("aborted")
+		}
+	}
+	cancel = func() {
+		close(abort)
+		<-fed
+		loading.Wait()
+	}
+	return wait, cancel
+}
+
 func (self *manifestTrie) listWithPrefixInt(prefix, rp string, quitC chan bool, cb func(entry *manifestTrieEntry, suffix string)) error {
 	plen := len(prefix)
 	var start, stop int
@@ -376,6 +501,13 @@ func (self *manifestTrie) listWithPrefixInt(prefix, rp string, quitC chan bool,
 		stop = start
 	}
 
+	// when listing everything, load the submanifests ahead of time
+	wait := func(int) error { return nil }
+	if plen == 0 {
+		var cancel func()
+		wait, cancel = self.prefetch(self.entries[:], quitC)
+		defer cancel()
+	}
 	for i := start; i <= stop; i++ {
 		select {
 		case <-quitC:
@@ -391,6 +523,9 @@ func (self *manifestTrie) listWithPrefixInt(prefix, rp string, quitC chan bool,
 					l = epl
 				}
 				if prefix[:l] == entry.Path[:l] {
+					if err := wait(i); err != nil {
+						return err
+					}
 					err := self.loadSubTrie(entry, quitC)
 					if err != nil {
 						return err
@@ -22,8 +22,12 @@ import (
 	"encoding/json"
 	"fmt"
 	"io"
+	"io/ioutil"
+	"math/rand"
+	"os"
 	"strings"
 	"testing"
+	"time"
 
 	"github.com/trust-tech/go-trustmachine/swarm/storage"
 )
@@ -111,3 +115,259 @@ func TestAddFileWithManifestPath(t *testing.T) {
 	checkEntry(t, "ac", "ac", trie)
 	checkEntry(t, "a", "a", trie)
 }
+
+// makeTestManifest stores a manifest of n entries spread over nested
+// directories, returning its key.
+func makeTestManifest(t testing.TB, api *Api, n int) storage.Key {
+	trie := &manifestTrie{
+		dpa: api.dpa,
+	}
+	for i := 0; i < n; i++ {
+		entry := newManifestTrieEntry(&ManifestEntry{
+			Path:        testManifestPath(i),
+			ContentType: "text/html",
+		}, nil)
+		entry.Hash = fmt.Sprintf("%064x", i)
+		trie.addEntry(entry, nil)
+	}
+	if err := trie.recalcAndStore(); err != nil {
+		t.Fatalf("failed to store manifest: %v", err)
+	}
+	return trie.hash
+}
+
+func testManifestPath(i int) string {
+	return fmt.Sprintf("site/%03d/page%05d.html", i/1000, i)
+}
+
+// Tests that listing a manifest returns all the entries in order, whether its
+// submanifests are prefetched from the store or served from the cache.
+func TestManifestList(t *testing.T) {
+	testApi(t, func(api *Api) {
+		key := makeTestManifest(t, api, 3000)
+		for _, cached := range []bool{false, true} {
+			if !cached {
+				manifestCache.Purge()
+			}
+			trie, err := loadManifest(api.dpa, key, nil)
+			if err != nil {
+				t.Fatalf("failed to load manifest: %v", err)
+			}
+			var paths []string
+			err = trie.listWithPrefix("site/", nil, func(entry *manifestTrieEntry, suffix string) {
+				paths = append(paths, suffix)
+			})
+			if err != nil {
+				t.Fatalf("cached %v: failed to list manifest: %v", cached, err)
+			}
+			if len(paths) != 3000 {
+				t.Fatalf("cached %v: entry count mismatch: have %d, want 3000", cached, len(paths))
+			}
+			for i, path := range paths {
+				if want := testManifestPath(i)[len("site/"):]; path != want {
+					t.Fatalf("cached %v: entry %d mismatch: have %s, want %s", cached, i, path, want)
+				}
+			}
+		}
+		// Walking should prefetch too and visit the entries in order
+		manifestCache.Purge()
+		walker, err := api.NewManifestWalker(key, nil)
+		if err != nil {
+			t.Fatalf("failed to create walker: %v", err)
+		}
+		var count int
+		err = walker.Walk(func(entry *ManifestEntry) error {
+			if entry.ContentType != ManifestType {
+				if want := testManifestPath(count); entry.Path != want {
+					return fmt.Errorf("entry %d mismatch: have %s, want %s", count, entry.Path, want)
+				}
+				count++
+			}
+			return nil
+		})
+		if err != nil || count != 3000 {
+			t.Fatalf("walk failed: %v, visited %d entries", err, count)
+		}
+	})
+}
+
+// countLoaded returns the number of submanifests loaded into a trie.
+func countLoaded(trie *manifestTrie) int {
+	count := 0
+	for _, entry := range trie.entries {
+		if entry != nil && entry.subtrie != nil {
+			count += 1 + countLoaded(entry.subtrie)
+		}
+	}
+	return count
+}
+
+// Tests that an aborted walk doesn't leave submanifest loads running behind.
+func TestManifestWalkAbort(t *testing.T) {
+	testApi(t, func(api *Api) {
+		key := makeTestManifest(t, api, 3000)
+		manifestCache.Purge()
+
+		walker, err := api.NewManifestWalker(key, nil)
+		if err != nil {
+			t.Fatalf("failed to create walker: %v", err)
+		}
+		errAbort := fmt.Errorf("abort")
+		err = walker.Walk(func(entry *ManifestEntry) error {
+			if entry.ContentType != ManifestType {
+				return errAbort
+			}
+			return nil
+		})
+		if err != errAbort {
+			t.Fatalf("walk error mismatch: have %v, want %v", err, errAbort)
+		}
+		loaded := countLoaded(walker.trie)
+		time.Sleep(50 * time.Millisecond)
+		if now := countLoaded(walker.trie); now != loaded {
+			t.Fatalf("submanifests loaded after the walk: have %d, had %d", now, loaded)
+		}
+	})
+}
+
+// Tests that storing a loaded manifest only rebuilds the modified paths.
+func TestManifestStoreModified(t *testing.T) {
+	testApi(t, func(api *Api) {
+		key := makeTestManifest(t, api, 3000)
+
+		writer, err := api.NewManifestWriter(key, nil)
+		if err != nil {
+			t.Fatalf("failed to create writer: %v", err)
+		}
+		if stored, err := writer.Store(); err != nil || stored.String() != key.String() {
+			t.Fatalf("unmodified manifest changed: have %v (%v), want %v", stored, err, key)
+		}
+		// Add and remove a batch of entries in one directory, restoring the original
+		for i := 0; i < 100; i++ {
+			entry := newManifestTrieEntry(&ManifestEntry{Path: fmt.Sprintf("site/001/extra%03d", i)}, nil)
+			entry.Hash = fmt.Sprintf("%064x", i)
+			writer.trie.addEntry(entry, nil)
+		}
+		for i := 0; i < 100; i++ {
+			writer.RemoveEntry(fmt.Sprintf("site/001/extra%03d", i))
+		}
+		stored, err := writer.Store()
+		if err != nil {
+			t.Fatalf("failed to store manifest: %v", err)
+		}
+		if stored.String() != key.String() {
+			t.Fatalf("manifest mismatch after undoing changes: have %v, want %v", stored, key)
+		}
+		// Only the submanifests on the modified path should have been loaded
+		if loaded := countLoadedSubTries(writer.trie); loaded > 4 {
+			t.Fatalf("too many submanifests loaded: have %d, want <= 4", loaded)
+		}
+	})
+}
+
+func countLoadedSubTries(trie *manifestTrie) (count int) {
+	for _, entry := range trie.entries {
+		if entry != nil && entry.subtrie != nil {
+			count += 1 + countLoadedSubTries(entry.subtrie)
+		}
+	}
+	return count
+}
+
+// latencyStore is a chunk store simulating network retrieval latency.
+type latencyStore struct {
+	storage.ChunkStore
+	delay time.Duration
+}
+
+func (s *latencyStore) Get(key storage.Key) (*storage.Chunk, error) {
+	time.Sleep(s.delay)
+	return s.ChunkStore.Get(key)
+}
+
+// benchmarkManifest runs a benchmark against a stored manifest of n entries,
+// each chunk retrieval taking the given time. The chunks are kept in a memory
+// store big enough to hold all of them.
+func benchmarkManifest(b *testing.B, n int, latency time.Duration, f func(b *testing.B, api *Api, key storage.Key)) {
+	datadir, err := ioutil.TempDir("", "bzz-bench")
+	if err != nil {
+		b.Fatalf("unable to create temp dir: %v", err)
+	}
+	defer os.RemoveAll(datadir)
+
+	dbStore, err := storage.NewDbStore(datadir, storage.MakeHashFunc("SHA256"), uint64(n), 0)
+	if err != nil {
+		b.Fatalf("unable to create db store: %v", err)
+	}
+	store := &latencyStore{ChunkStore: storage.NewMemStore(dbStore, uint(n))}
+	dpa := storage.NewDPA(store, storage.NewChunkerParams())
+	dpa.Start()
+	defer dpa.Stop()
+
+	api := NewApi(dpa, nil)
+	key := makeTestManifest(b, api, n)
+	store.delay = latency
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	f(b, api, key)
+}
+
+// benchmarkManifestList lists all entries of a big manifest not yet cached in
+// memory.
+func benchmarkManifestList(b *testing.B, latency time.Duration) {
+	benchmarkManifest(b, 100000, latency, func(b *testing.B, api *Api, key storage.Key) {
+		for i := 0; i < b.N; i++ {
+			manifestCache.Purge()
+			trie, err := loadManifest(api.dpa, key, nil)
+			if err != nil {
+				b.Fatalf("failed to load manifest: %v", err)
+			}
+			count := 0
+			if err := trie.listWithPrefix("", nil, func(entry *manifestTrieEntry, suffix string) { count++ }); err != nil {
+				b.Fatalf("failed to list manifest: %v", err)
+			}
+			if count != 100000 {
+				b.Fatalf("entry count mismatch: have %d, want 100000", count)
+			}
+		}
+	})
+}
+
+func BenchmarkManifestList_100k(b *testing.B)       { benchmarkManifestList(b, 0) }
+func BenchmarkManifestList_100kRemote(b *testing.B) { benchmarkManifestList(b, time.Millisecond) }
+
+// Benchmarks resolving random paths of a big manifest, as serving a website does.
+func BenchmarkManifestGet_100k(b *testing.B) {
+	benchmarkManifest(b, 100000, 0, func(b *testing.B, api *Api, key storage.Key) {
+		for i := 0; i < b.N; i++ {
+			trie, err := loadManifest(api.dpa, key, nil)
+			if err != nil {
+				b.Fatalf("failed to load manifest: %v", err)
+			}
+			if entry, _ := trie.getEntry(testManifestPath(rand.Intn(100000))); entry == nil {
+				b.Fatalf("entry not found")
+			}
+		}
+	})
+}
+
+// Benchmarks adding a batch of entries to a big manifest and storing it.
+func BenchmarkManifestUpdate_100k(b *testing.B) {
+	benchmarkManifest(b, 100000, 0, func(b *testing.B, api *Api, key storage.Key) {
+		for i := 0; i < b.N; i++ {
+			writer, err := api.NewManifestWriter(key, nil)
+			if err != nil {
+				b.Fatalf("failed to create writer: %v", err)
+			}
+			for j := 0; j < 100; j++ {
+				entry := newManifestTrieEntry(&ManifestEntry{Path: testManifestPath(rand.Intn(100000)) + ".bak"}, nil)
+				entry.Hash = fmt.Sprintf("%064x", j)
+				writer.trie.addEntry(entry, nil)
+			}
+			if _, err := writer.Store(); err != nil {
+				b.Fatalf("failed to store manifest: %v", err)
+			}
+		}
+	})
+}
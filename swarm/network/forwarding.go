@@ -19,13 +19,22 @@ package network
 import (
 	"fmt"
 	"math/rand"
+	"sync"
+	"sync/atomic"
 	"time"
 
+	"github.com/hashicorp/golang-lru"
 	"github.com/trust-tech/go-trustmachine/log"
+	"github.com/trust-tech/go-trustmachine/swarm/network/kademlia"
 	"github.com/trust-tech/go-trustmachine/swarm/storage"
 )
 
-const requesterCount = 3
+const (
+	requesterCount = 3
+
+	// number of peers whose delivery latencies are tracked
+	latencyCacheLimit = 1024
+)
 
 /*
 forwarder implements the CloudStore interface (use by storage.NetStore)
@@ -37,50 +46,214 @@ which uses an MSB logarithmic distance-based semi-permanent Kademlia table for
 */
 
 type forwarder struct {
-	hive *Hive
+	hive      *Hive
+	getPeers  func(storage.Key) []retrievePeer // peers closest to a key, closest first
+	latencies *lru.Cache                       // delivery latency estimates by peer address
+	lock      sync.Mutex                       // protects the latency estimates
+
+	searchTimeout time.Duration // time after which a retrieval is given up
+	fanout        int           // maximum number of peers a retrieval is raced to
+	minDeadline   time.Duration // shortest time a peer is given to deliver
+}
+
+// retrievePeer is a peer retrieve requests can be forwarded to.
+type retrievePeer interface {
+	Addr() kademlia.Address
+	requestChunk(req *retrieveRequestMsgData) error
+}
+
+// requestChunk charges the peer for a retrieve request (swap) and sends it.
+func (self *peer) requestChunk(req *retrieveRequestMsgData) error {
+	if self.swap != nil {
+		if err := self.swap.Add(-1); err != nil {
+			return err
+		}
+	}
+	return self.retrieve(req)
 }
 
 func NewForwarder(hive *Hive) *forwarder {
-	return &forwarder{hive: hive}
+	fwd := newForwarder(func(key storage.Key) []retrievePeer {
+		peers := hive.getPeers(key, 0)
+		rps := make([]retrievePeer, len(peers))
+		for i, p := range peers {
+			rps[i] = p
+		}
+		return rps
+	})
+	fwd.hive = hive
+	return fwd
 }
 
+func newForwarder(getPeers func(storage.Key) []retrievePeer) *forwarder {
+	latencies, _ := lru.New(latencyCacheLimit)
+	return &forwarder{
+		getPeers:      getPeers,
+		latencies:     latencies,
+		searchTimeout: searchTimeout,
+		fanout:        retrieveFanout,
+		minDeadline:   minRetrieveDeadline,
+	}
+}
+
+// lastId is the id of the last retrieve request sent. It starts from a random
+// offset so that the ids of different nodes are unlikely to collide.
+var lastId = uint64(rand.New(rand.NewSource(time.Now().UnixNano())).Int63())
+
 // generate a unique id uint64
 func generateId() uint64 {
-	r := rand.New(rand.NewSource(time.Now().UnixNano()))
-	return uint64(r.Int63())
+	return atomic.AddUint64(&lastId, 1)
 }
 
-var searchTimeout = 3 * time.Second
+var (
+	searchTimeout = 3 * time.Second
+
+	// maximum number of peers a retrieve request is raced to, and the shortest
+	// time a peer is given to deliver before asking the next one
+	retrieveFanout      = 3
+	minRetrieveDeadline = 100 * time.Millisecond
+)
+
+// retrieveLatency estimates the time a peer takes to deliver a chunk, the way
+// TCP estimates its retransmission timeout (RFC 6298), and counts the deadlines
+// it missed since its last delivery.
+type retrieveLatency struct {
+	srtt, rttvar time.Duration
+	misses       uint
+}
+
+func (self *retrieveLatency) add(rtt time.Duration) {
+	self.misses = 0
+	if self.srtt == 0 {
+		self.srtt, self.rttvar = rtt, rtt/2
+		return
+	}
+	diff := self.srtt - rtt
+	if diff < 0 {
+		diff = -diff
+	}
+	self.rttvar = (3*self.rttvar + diff) / 4
+	self.srtt = (7*self.srtt + rtt) / 8
+}
+
+// deadline returns how long to wait for a delivery from a peer before racing
+// the request to the next one. Unknown peers get an even share of the search,
+// and the deadline halves with every one missed, so unresponsive peers don't
+// hold up retrievals.
+func (self *forwarder) deadline(addr kademlia.Address) time.Duration {
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	deadline := self.searchTimeout / time.Duration(self.fanout)
+	if l, ok := self.latencies.Get(addr); ok {
+		l := l.(*retrieveLatency)
+		if l.srtt != 0 {
+			deadline = l.srtt + 4*l.rttvar
+		}
+		deadline >>= l.misses
+	}
+	if deadline < self.minDeadline {
+		deadline = self.minDeadline
+	}
+	if deadline > self.searchTimeout/time.Duration(self.fanout) {
+		deadline = self.searchTimeout / time.Duration(self.fanout)
+	}
+	return deadline
+}
+
+// latency returns the latency estimate of a peer, creating it if unknown.
+func (self *forwarder) latency(addr kademlia.Address) *retrieveLatency {
+	l, ok := self.latencies.Get(addr)
+	if !ok {
+		l = new(retrieveLatency)
+		self.latencies.Add(addr, l)
+	}
+	return l.(*retrieveLatency)
+}
+
+// observe adds a delivery latency sample of a peer.
+func (self *forwarder) observe(addr kademlia.Address, rtt time.Duration) {
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	self.latency(addr).add(rtt)
+}
+
+// missed records a peer not delivering within its deadline.
+func (self *forwarder) missed(addr kademlia.Address) {
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	if l := self.latency(addr); l.misses < 16 {
+		l.misses++
+	}
+}
 
 // forwarding logic
 // logic propagating retrieve requests to peers given by the kademlia hive
+//
+// The request is sent to the closest peer first. Whenever a peer does not
+// deliver within its deadline, it is raced to the next one, up to
+// retrieveFanout peers. Retrieve returns once the chunk is delivered (by any
+// of them) or the search times out.
 func (self *forwarder) Retrieve(chunk *storage.Chunk) {
-	peers := self.hive.getPeers(chunk.Key, 0)
+	peers := self.getPeers(chunk.Key)
 	log.Trace(fmt.Sprintf("forwarder.Retrieve: %v - received %d peers from KΛÐΞMLIΛ...", chunk.Key.Log(), len(peers)))
-OUT:
+
+	giveUp := time.NewTimer(self.searchTimeout)
+	defer giveUp.Stop()
+
+	sent := make(map[kademlia.Address]time.Time)
 	for _, p := range peers {
-		log.Trace(fmt.Sprintf("forwarder.Retrieve: sending retrieveRequest %v to peer [%v]", chunk.Key.Log(), p))
-		for _, recipients := range chunk.Req.Requesters {
-			for _, recipient := range recipients {
-				req := recipient.(*retrieveRequestMsgData)
-				if req.from.Addr() == p.Addr() {
-					continue OUT
-				}
-			}
+		if len(sent) >= self.fanout {
+			break
+		}
+		addr := p.Addr()
+		if chunk.Req.RequestedBy(func(r interface{}) bool {
+			return r.(*retrieveRequestMsgData).from.Addr() == addr
+		}) {
+			continue
 		}
+		log.Trace(fmt.Sprintf("forwarder.Retrieve: sending retrieveRequest %v to peer [%v]", chunk.Key.Log(), p))
 		req := &retrieveRequestMsgData{
 			Key: chunk.Key,
 			Id:  generateId(),
 		}
-		var err error
-		if p.swap != nil {
-			err = p.swap.Add(-1)
+		if err := p.requestChunk(req); err != nil {
+			log.Warn(fmt.Sprintf("forwarder.Retrieve: unable to send retrieveRequest to peer [%v]: %v", chunk.Key.Log(), err))
+			continue
 		}
-		if err == nil {
-			p.retrieve(req)
-			break OUT
+		sent[addr] = time.Now()
+
+		deadline := self.deadline(addr)
+		timer := time.NewTimer(deadline)
+		select {
+		case <-chunk.Req.C:
+			timer.Stop()
+			self.delivered(chunk, sent)
+			return
+		case <-giveUp.C:
+			timer.Stop()
+			return
+		case <-timer.C:
+			log.Trace(fmt.Sprintf("forwarder.Retrieve: %v - peer [%v] overdue after %v", chunk.Key.Log(), p, deadline))
+			self.missed(addr)
+		}
+	}
+	// All the peers asked, wait for any of them to deliver
+	select {
+	case <-chunk.Req.C:
+		self.delivered(chunk, sent)
+	case <-giveUp.C:
+	}
+}
+
+// delivered records the latency of the peer that delivered a retrieved chunk.
+func (self *forwarder) delivered(chunk *storage.Chunk, sent map[kademlia.Address]time.Time) {
+	if source, ok := chunk.Source.(retrievePeer); ok {
+		if start, ok := sent[source.Addr()]; ok {
+			self.observe(source.Addr(), time.Since(start))
 		}
-		log.Warn(fmt.Sprintf("forwarder.Retrieve: unable to send retrieveRequest to peer [%v]: %v", chunk.Key.Log(), err))
 	}
 }
 
@@ -109,28 +282,33 @@ func (self *forwarder) Store(chunk *storage.Chunk) {
 }
 
 // once a chunk is found deliver it to its requesters unless timed out
+// each requesting peer gets the chunk once, even if it asked several times
 func (self *forwarder) Deliver(chunk *storage.Chunk) {
+	now := time.Now()
+	served := make(map[kademlia.Address]bool)
 	// iterate over request entries
-	for id, requesters := range chunk.Req.Requesters {
+	for id, requesters := range chunk.Req.TakeRequesters() {
 		counter := requesterCount
-		msg := &storeRequestMsgData{
-			Key:   chunk.Key,
-			SData: chunk.SData,
-		}
 		var n int
-		var req *retrieveRequestMsgData
 		// iterate over requesters with the same id
-		for id, r := range requesters {
-			req = r.(*retrieveRequestMsgData)
-			if req.timeout == nil || req.timeout.After(time.Now()) {
-				log.Trace(fmt.Sprintf("forwarder.Deliver: %v -> %v", req.Id, req.from))
-				msg.Id = uint64(id)
-				Deliver(req.from, msg, DeliverReq)
-				n++
-				counter--
-				if counter <= 0 {
-					break
-				}
+		for _, r := range requesters {
+			req := r.(*retrieveRequestMsgData)
+			if served[req.from.Addr()] || (req.timeout != nil && !req.timeout.After(now)) {
+				continue
+			}
+			served[req.from.Addr()] = true
+
+			log.Trace(fmt.Sprintf("forwarder.Deliver: %v -> %v", req.Id, req.from))
+			msg := &storeRequestMsgData{
+				Id:    id,
+				Key:   chunk.Key,
+				SData: chunk.SData,
+			}
+			Deliver(req.from, msg, DeliverReq)
+			n++
+			counter--
+			if counter <= 0 {
+				break
 			}
 		}
 		log.Trace(fmt.Sprintf("forwarder.Deliver: submit chunk %v (request id %v) for delivery to %v peers", chunk.Key.Log(), id, n))
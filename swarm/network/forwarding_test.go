@@ -0,0 +1,247 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package network
+
+import (
+	"encoding/binary"
+	"io/ioutil"
+	"math/rand"
+	"os"
+	"sort"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/trust-tech/go-trustmachine/swarm/network/kademlia"
+	"github.com/trust-tech/go-trustmachine/swarm/storage"
+)
+
+// simNode is a remote node of an in-process retrieval simulation. It delivers
+// the chunks asked from it after its latency, unless it's unresponsive.
+type simNode struct {
+	addr     kademlia.Address
+	latency  time.Duration
+	drop     bool
+	chunks   map[string][]byte
+	local    *simLocal
+	requests int32
+}
+
+func (self *simNode) Addr() kademlia.Address { return self.addr }
+
+// String implements fmt.Stringer, so logging a node doesn't read its counters.
+func (self *simNode) String() string { return self.addr.String() }
+
+func (self *simNode) requestChunk(req *retrieveRequestMsgData) error {
+	atomic.AddInt32(&self.requests, 1)
+	if self.drop {
+		return nil
+	}
+	data := self.chunks[string(req.Key)]
+	go func() {
+		time.Sleep(self.latency/2 + time.Duration(rand.Int63n(int64(self.latency))))
+		self.local.deliver(req.Key, data, self)
+	}()
+	return nil
+}
+
+// simLocal is the requesting node of a retrieval simulation, backed by a real
+// net store and forwarder.
+type simLocal struct {
+	lstore   *storage.LocalStore
+	netStore *storage.NetStore
+	fwd      *forwarder
+	lock     sync.Mutex
+}
+
+func newSimLocal(t *testing.T, dir string, peers func(storage.Key) []retrievePeer) *simLocal {
+	hasher := storage.MakeHashFunc("SHA3")
+	params := storage.NewStoreParams(dir)
+	lstore, err := storage.NewLocalStore(hasher, params)
+	if err != nil {
+		t.Fatalf("failed to create local store: %v", err)
+	}
+	fwd := newForwarder(peers)
+	return &simLocal{
+		lstore:   lstore,
+		netStore: storage.NewNetStore(hasher, lstore, fwd, params),
+		fwd:      fwd,
+	}
+}
+
+// deliver mimics Depo.HandleStoreRequestMsg for a chunk arriving from a peer.
+func (self *simLocal) deliver(key storage.Key, data []byte, from *simNode) {
+	self.lock.Lock()
+	chunk, err := self.lstore.Get(key)
+	if err != nil || chunk.SData != nil {
+		self.lock.Unlock()
+		return
+	}
+	chunk.SData = data
+	chunk.Size = int64(binary.LittleEndian.Uint64(data[0:8]))
+	chunk.Source = from
+	self.lock.Unlock()
+
+	self.netStore.Put(chunk)
+}
+
+// fetch retrieves a chunk the way the DPA does, returning false if it's not
+// delivered within the search timeout. The chunk data is checked under the lock
+// deliveries fill it in with.
+func (self *simLocal) fetch(key storage.Key) bool {
+	self.lock.Lock()
+	chunk, _ := self.netStore.Get(key)
+	found := chunk.SData != nil
+	self.lock.Unlock()
+
+	if found {
+		return true
+	}
+	select {
+	case <-chunk.Req.C:
+		return true
+	case <-time.After(self.fwd.searchTimeout):
+		return false
+	}
+}
+
+// makeSimChunks creates random chunks, returning their keys and data.
+func makeSimChunks(n int) ([]storage.Key, map[string][]byte) {
+	hasher := storage.MakeHashFunc("SHA3")
+	keys := make([]storage.Key, n)
+	chunks := make(map[string][]byte)
+	for i := range keys {
+		data := make([]byte, 8+256)
+		binary.LittleEndian.PutUint64(data, 256)
+		rand.Read(data[8:])
+
+		h := hasher()
+		h.Write(data)
+		keys[i] = h.Sum(nil)
+		chunks[string(keys[i])] = data
+	}
+	return keys, chunks
+}
+
+// simulateRetrieval fetches chunks through a set of remote nodes, some slow and
+// some unresponsive, returning the fetch latencies and the number of failures.
+func simulateRetrieval(t *testing.T, fanout int) ([]time.Duration, int) {
+	dir, err := ioutil.TempDir("", "swarm-retrieve-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	keys, chunks := makeSimChunks(200)
+	nodes := make([]*simNode, 8)
+	peers := func(key storage.Key) []retrievePeer {
+		// Rotate the node list by key, standing in for kademlia proximity
+		rps := make([]retrievePeer, len(nodes))
+		for i := range rps {
+			rps[i] = nodes[(int(key[0])+i)%len(nodes)]
+		}
+		return rps
+	}
+	local := newSimLocal(t, dir, peers)
+	local.fwd.searchTimeout, local.fwd.minDeadline, local.fwd.fanout = time.Second, 10*time.Millisecond, fanout
+	for i, spec := range []struct {
+		latency time.Duration
+		drop    bool
+	}{
+		{0, true}, {5 * time.Millisecond, false}, {60 * time.Millisecond, false}, {0, true},
+		{5 * time.Millisecond, false}, {5 * time.Millisecond, false}, {60 * time.Millisecond, false}, {5 * time.Millisecond, false},
+	} {
+		nodes[i] = &simNode{latency: spec.latency, drop: spec.drop, chunks: chunks, local: local}
+		nodes[i].addr[0] = byte(i)
+	}
+	// Fetch the chunks with a few concurrent workers
+	var (
+		latencies = make([]time.Duration, len(keys))
+		failures  int32
+		next      int32 = -1
+		wg        sync.WaitGroup
+	)
+	for w := 0; w < 10; w++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for i := int(atomic.AddInt32(&next, 1)); i < len(keys); i = int(atomic.AddInt32(&next, 1)) {
+				start := time.Now()
+				if !local.fetch(keys[i]) {
+					atomic.AddInt32(&failures, 1)
+				}
+				latencies[i] = time.Since(start)
+			}
+		}()
+	}
+	wg.Wait()
+	sort.Slice(latencies, func(i, j int) bool { return latencies[i] < latencies[j] })
+	return latencies, int(failures)
+}
+
+// percentile returns the given percentile of sorted latencies.
+func percentile(latencies []time.Duration, p float64) time.Duration {
+	return latencies[int(p*float64(len(latencies)-1))]
+}
+
+// Tests that racing retrieve requests to several peers with adaptive deadlines
+// gets around unresponsive and slow peers, and reports the fetch latency
+// percentiles compared to asking a single peer.
+func TestRetrieveLatency(t *testing.T) {
+	single, singleFailed := simulateRetrieval(t, 1)
+	raced, racedFailed := simulateRetrieval(t, 3)
+
+	t.Logf("single peer: p50 %v, p90 %v, p99 %v, %d/%d failed", percentile(single, 0.5), percentile(single, 0.9), percentile(single, 0.99), singleFailed, len(single))
+	t.Logf("raced peers: p50 %v, p90 %v, p99 %v, %d/%d failed", percentile(raced, 0.5), percentile(raced, 0.9), percentile(raced, 0.99), racedFailed, len(raced))
+
+	if racedFailed != 0 {
+		t.Errorf("%d chunks not retrieved with a responsive peer among the closest", racedFailed)
+	}
+	if singleFailed == 0 {
+		t.Errorf("no chunks lost asking single unresponsive peers")
+	}
+}
+
+// Tests that concurrent requests for the same chunk share a single search.
+func TestRetrieveCoalescing(t *testing.T) {
+	dir, err := ioutil.TempDir("", "swarm-retrieve-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	keys, chunks := makeSimChunks(1)
+	node := &simNode{latency: 20 * time.Millisecond, chunks: chunks}
+	local := newSimLocal(t, dir, func(storage.Key) []retrievePeer { return []retrievePeer{node} })
+	node.local = local
+
+	var wg sync.WaitGroup
+	for i := 0; i < 10; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			if !local.fetch(keys[0]) {
+				t.Errorf("chunk not retrieved")
+			}
+		}()
+	}
+	wg.Wait()
+	if n := atomic.LoadInt32(&node.requests); n != 1 {
+		t.Errorf("retrieve request count mismatch: have %d, want 1", n)
+	}
+}
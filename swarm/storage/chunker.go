@@ -23,6 +23,7 @@ import (
 	"hash"
 	"io"
 	"sync"
+	"sync/atomic"
 )
 
 /*
@@ -82,9 +83,9 @@ type TreeChunker struct {
 	branches int64
 	hashFunc Hasher
 	// calculated
-	hashSize    int64 // self.hashFunc.New().Size()
-	chunkSize   int64 // hashSize* branches
-	workerCount int
+	hashSize  int64     // self.hashFunc.New().Size()
+	chunkSize int64     // hashSize* branches
+	leaves    sync.Pool // reusable leaf chunk buffers, for splits not retaining chunks
 }
 
 func NewTreeChunker(params *ChunkerParams) (self *TreeChunker) {
@@ -93,7 +94,9 @@ func NewTreeChunker(params *ChunkerParams) (self *TreeChunker) {
 	self.branches = params.Branches
 	self.hashSize = int64(self.hashFunc().Size())
 	self.chunkSize = self.hashSize * self.branches
-	self.workerCount = 1
+	self.leaves.New = func() interface{} {
+		return make([]byte, self.chunkSize+8)
+	}
 	return
 }
 
@@ -106,13 +109,25 @@ func (self *Chunk) String() string {
 	return fmt.Sprintf("Key: %v TreeSize: %v Chunksize: %v", self.Key.Log(), self.Size, len(self.SData))
 }
 
+var errSplitAborted = errors.New("split aborted")
+
+// hashJob is a node of the chunk tree being built. Leaves are queued for hashing
+// as soon as their data is read, intermediate nodes once the last of their
+// children is hashed, by whichever worker hashed it.
 type hashJob struct {
-	key      Key
-	chunk    []byte
-	size     int64
-	parentWg *sync.WaitGroup
+	key     Key             // slot the hash of this node is reported into
+	chunk   []byte          // size prefixed content or child keys
+	size    int64           // size of the data covered by the subtree
+	parent  *hashJob        // intermediate node waiting for this hash, nil for the root
+	pending int32           // children not yet hashed, plus one until all of them are scheduled
+	pooled  bool            // whether the chunk buffer can be reused once hashed
+	wg      *sync.WaitGroup // released once the root is hashed
 }
 
+// Split reads the data sequentially, walking the chunk tree in order, while a
+// fixed pool of workers hashes the leaves concurrently. Read-ahead is bounded by
+// the job queue capacity. Intermediate nodes don't wait for the reader to finish
+// their subtree in order, they are hashed as soon as their last child is.
 func (self *TreeChunker) Split(data io.Reader, size int64, chunkC chan *Chunk, swg, wwg *sync.WaitGroup) (Key, error) {
 
 	if self.chunkSize <= 0 {
@@ -124,11 +139,21 @@ func (self *TreeChunker) Split(data io.Reader, size int64, chunkC chan *Chunk, s
 	errC := make(chan error)
 	quitC := make(chan bool)
 
+	// start as many hash workers as there are leaves to hash, up to the limit
+	workers := (size + self.chunkSize - 1) / self.chunkSize
+	if workers > processors {
+		workers = processors
+	}
+	if workers < 1 {
+		workers = 1
+	}
 	// wwg = workers waitgroup keeps track of hashworkers spawned by this split call
-	if wwg != nil {
-		wwg.Add(1)
+	for i := int64(0); i < workers; i++ {
+		if wwg != nil {
+			wwg.Add(1)
+		}
+		go self.hashWorker(jobC, chunkC, quitC, swg, wwg)
 	}
-	go self.hashWorker(jobC, chunkC, errC, quitC, swg, wwg)
 
 	depth := 0
 	treeSize := self.chunkSize
@@ -142,8 +167,16 @@ func (self *TreeChunker) Split(data io.Reader, size int64, chunkC chan *Chunk, s
 	key := make([]byte, self.hashFunc().Size())
 	// this waitgroup member is released after the root hash is calculated
 	wg.Add(1)
-	//launch actual recursive function passing the waitgroups
-	go self.split(depth, treeSize/self.branches, key, data, size, jobC, chunkC, errC, quitC, wg, swg, wwg)
+	//launch actual recursive function reading the data and scheduling the leaves
+	go func() {
+		defer close(jobC)
+		if err := self.split(depth, treeSize/self.branches, key, nil, data, size, jobC, chunkC == nil, quitC, wg); err != nil {
+			select {
+			case errC <- err:
+			case <-quitC:
+			}
+		}
+	}()
 
 	// closes internal error channel if all subprocesses in the workgroup finished
 	go func() {
@@ -167,7 +200,7 @@ func (self *TreeChunker) Split(data io.Reader, size int64, chunkC chan *Chunk, s
 	return key, nil
 }
 
-func (self *TreeChunker) split(depth int, treeSize int64, key Key, data io.Reader, size int64, jobC chan *hashJob, chunkC chan *Chunk, errC chan error, quitC chan bool, parentWg, swg, wwg *sync.WaitGroup) {
+func (self *TreeChunker) split(depth int, treeSize int64, key Key, parent *hashJob, data io.Reader, size int64, jobC chan *hashJob, pooled bool, quitC chan bool, wg *sync.WaitGroup) error {
 
 	for depth > 0 && size < treeSize {
 		treeSize /= self.branches
@@ -176,22 +209,22 @@ func (self *TreeChunker) split(depth int, treeSize int64, key Key, data io.Reade
 
 	if depth == 0 {
 		// leaf nodes -> content chunks
-		chunkData := make([]byte, size+8)
+		var chunkData []byte
+		if pooled {
+			chunkData = self.leaves.Get().([]byte)[:size+8]
+		} else {
+			chunkData = make([]byte, size+8)
+		}
 		binary.LittleEndian.PutUint64(chunkData[0:8], uint64(size))
 		var readBytes int64
 		for readBytes < size {
 			n, err := data.Read(chunkData[8+readBytes:])
 			readBytes += int64(n)
 			if err != nil && !(err == io.EOF && readBytes == size) {
-				errC <- err
-				return
+				return err
 			}
 		}
-		select {
-		case jobC <- &hashJob{key, chunkData, size, parentWg}:
-		case <-quitC:
-		}
-		return
+		return self.schedule(&hashJob{key: key, chunk: chunkData, size: size, parent: parent, pooled: pooled, wg: wg}, jobC, quitC)
 	}
 	// dept > 0
 	// intermediate chunk containing child nodes hashes
@@ -202,7 +235,10 @@ func (self *TreeChunker) split(depth int, treeSize int64, key Key, data io.Reade
 
 	binary.LittleEndian.PutUint64(chunk[0:8], uint64(size))
 
-	childrenWg := &sync.WaitGroup{}
+	// the extra pending count keeps the node from being hashed while its
+	// children are still being scheduled
+	node := &hashJob{key: key, chunk: chunk, size: size, parent: parent, pending: int32(branchCnt) + 1, wg: wg}
+
 	var secSize int64
 	for i < branchCnt {
 		// the last item can have shorter data
@@ -214,30 +250,30 @@ func (self *TreeChunker) split(depth int, treeSize int64, key Key, data io.Reade
 		// the hash of that data
 		subTreeKey := chunk[8+i*self.hashSize : 8+(i+1)*self.hashSize]
 
-		childrenWg.Add(1)
-		self.split(depth-1, treeSize/self.branches, subTreeKey, data, secSize, jobC, chunkC, errC, quitC, childrenWg, swg, wwg)
-
+		if err := self.split(depth-1, treeSize/self.branches, subTreeKey, node, data, secSize, jobC, pooled, quitC, wg); err != nil {
+			return err
+		}
 		i++
 		pos += treeSize
 	}
-	// wait for all the children to complete calculating their hashes and copying them onto sections of the chunk
-	// parentWg.Add(1)
-	// go func() {
-	childrenWg.Wait()
-	if len(jobC) > self.workerCount && self.workerCount < processors {
-		if wwg != nil {
-			wwg.Add(1)
-		}
-		self.workerCount++
-		go self.hashWorker(jobC, chunkC, errC, quitC, swg, wwg)
+	// if all the children were hashed already, nobody else will queue the node
+	if atomic.AddInt32(&node.pending, -1) == 0 {
+		return self.schedule(node, jobC, quitC)
 	}
+	return nil
+}
+
+// schedule queues a node for hashing, blocking while the workers are busy.
+func (self *TreeChunker) schedule(job *hashJob, jobC chan *hashJob, quitC chan bool) error {
 	select {
-	case jobC <- &hashJob{key, chunk, size, parentWg}:
+	case jobC <- job:
+		return nil
 	case <-quitC:
+		return errSplitAborted
 	}
 }
 
-func (self *TreeChunker) hashWorker(jobC chan *hashJob, chunkC chan *Chunk, errC chan error, quitC chan bool, swg, wwg *sync.WaitGroup) {
+func (self *TreeChunker) hashWorker(jobC chan *hashJob, chunkC chan *Chunk, quitC chan bool, swg, wwg *sync.WaitGroup) {
 	hasher := self.hashFunc()
 	if wwg != nil {
 		defer wwg.Done()
@@ -249,9 +285,11 @@ func (self *TreeChunker) hashWorker(jobC chan *hashJob, chunkC chan *Chunk, errC
 			if !ok {
 				return
 			}
-			// now we got the hashes in the chunk, then hash the chunks
-			hasher.Reset()
-			self.hashChunk(hasher, job, chunkC, swg)
+			// hash the chunk, and then any ancestors it was the last missing child of
+			for job != nil {
+				hasher.Reset()
+				job = self.hashChunk(hasher, job, chunkC, swg)
+			}
 		case <-quitC:
 			return
 		}
@@ -261,29 +299,43 @@ func (self *TreeChunker) hashWorker(jobC chan *hashJob, chunkC chan *Chunk, errC
 // The treeChunkers own Hash hashes togotruster
 // - the size (of the subtree encoded in the Chunk)
 // - the Chunk, ie. the contents read from the input reader
-func (self *TreeChunker) hashChunk(hasher hash.Hash, job *hashJob, chunkC chan *Chunk, swg *sync.WaitGroup) {
+//
+// It returns the parent node if this was its last child left to hash.
+func (self *TreeChunker) hashChunk(hasher hash.Hash, job *hashJob, chunkC chan *Chunk, swg *sync.WaitGroup) *hashJob {
 	hasher.Write(job.chunk)
-	h := hasher.Sum(nil)
-	newChunk := &Chunk{
-		Key:   h,
-		SData: job.chunk,
-		Size:  job.size,
-		wg:    swg,
-	}
 
 	// report hash of this chunk one level up (keys corresponds to the proper subslice of the parent chunk)
-	copy(job.key, h)
-	// send off new chunk to storage
+	var newChunk *Chunk
 	if chunkC != nil {
+		h := hasher.Sum(nil)
+		copy(job.key, h)
+
+		newChunk = &Chunk{
+			Key:   h,
+			SData: job.chunk,
+			Size:  job.size,
+			wg:    swg,
+		}
+		// send off new chunk to storage
 		if swg != nil {
 			swg.Add(1)
 		}
+	} else {
+		hasher.Sum(job.key[:0])
+		if job.pooled {
+			self.leaves.Put(job.chunk[:cap(job.chunk)])
+		}
+	}
+	var next *hashJob
+	if job.parent == nil {
+		job.wg.Done()
+	} else if atomic.AddInt32(&job.parent.pending, -1) == 0 {
+		next = job.parent
 	}
-	job.parentWg.Done()
-
 	if chunkC != nil {
 		chunkC <- newChunk
 	}
+	return next
 }
 
 // LazyChunkReader implements LazySectionReader
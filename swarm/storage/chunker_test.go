@@ -209,6 +209,43 @@ func TestRandomBrokenData(t *testing.T) {
 	}
 }
 
+// Tests that the tree chunker produces the same keys regardless of the order
+// in which its workers complete, both when storing chunks and when not.
+func TestSplitKeys(t *testing.T) {
+	tests := []struct {
+		size int
+		key  string
+	}{
+		{1, "d5e2006c11805f4d03093d36d8773498f15193e519912544451e1a51e7535c99"},
+		{4095, "1a614a1cc17974f7f1a17e0bf36a73d50c77ff19c2ac1186118b7699904e10be"},
+		{4096, "944a2a85d898c5d9c6c61669d418d36f6cbbf3a323a2d2f3e39441f550d4d86a"},
+		{4097, "858226f47f4e0bf5c5baa06b58e1d4e64f4a0abc1776a73a8257e7ef603d3a77"},
+		{524288, "3801969a5b1a04b2336cac16a0d5c5dbf23255b74b2c964d4d6ad8561edfe1ef"},
+		{524289, "be0402637213c7a82e2cd79be042e6ea844d8a8d3ac94b89764b8e31e0ff2c00"},
+		{2345678, "7235af9090dd72c3a200c48779423706f8382cd3f61b1c6df1b63ed245c05328"},
+	}
+	chunker := NewTreeChunker(NewChunkerParams())
+	for _, tt := range tests {
+		data := make([]byte, tt.size)
+		for i := range data {
+			data[i] = byte(i % 251)
+		}
+		key, err := chunker.Split(bytes.NewReader(data), int64(tt.size), nil, nil, nil)
+		if err != nil {
+			t.Fatalf("size %d: split failed: %v", tt.size, err)
+		}
+		if key.String() != tt.key {
+			t.Errorf("size %d: key mismatch: have %v, want %v", tt.size, key, tt.key)
+		}
+		tester := &chunkerTester{t: t}
+		chunkC := make(chan *Chunk, 1000)
+		key = tester.Split(chunker, bytes.NewReader(data), int64(tt.size), chunkC, &sync.WaitGroup{}, nil)
+		if key.String() != tt.key {
+			t.Errorf("size %d: stored key mismatch: have %v, want %v", tt.size, key, tt.key)
+		}
+	}
+}
+
 func readAll(reader LazySectionReader, result []byte) {
 	size := int64(len(result))
 
@@ -313,3 +350,55 @@ func BenchmarkSplitPyramid_7(t *testing.B)  { benchmarkSplitPyramid(10000000, t)
 func BenchmarkSplitPyramid_8(t *testing.B)  { benchmarkSplitPyramid(100000000, t) }
 
 // godep go test -bench ./swarm/storage -cpuprofile cpu.out -memprofile mem.out
+
+// repeatReader is a cheap endless data source for benchmarking big uploads
+// without measuring the random generator.
+type repeatReader struct {
+	pattern []byte
+	off     int
+}
+
+func (r *repeatReader) Read(b []byte) (int, error) {
+	n := 0
+	for n < len(b) {
+		c := copy(b[n:], r.pattern[r.off:])
+		r.off = (r.off + c) % len(r.pattern)
+		n += c
+	}
+	return n, nil
+}
+
+// benchmarkSplitTreeUpload measures the throughput of splitting a big input,
+// optionally passing the chunks on to a consumer as uploads to a store do.
+func benchmarkSplitTreeUpload(n int64, store bool, b *testing.B) {
+	pattern := make([]byte, 1<<20+7)
+	rand.Read(pattern)
+
+	chunker := NewTreeChunker(NewChunkerParams())
+	b.SetBytes(n)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		data := io.LimitReader(&repeatReader{pattern: pattern}, n)
+		if !store {
+			if _, err := chunker.Split(data, n, nil, nil, nil); err != nil {
+				b.Fatalf("split failed: %v", err)
+			}
+			continue
+		}
+		chunkC := make(chan *Chunk, 1000)
+		swg := &sync.WaitGroup{}
+		go func() {
+			for chunk := range chunkC {
+				chunk.wg.Done()
+			}
+		}()
+		if _, err := chunker.Split(data, n, chunkC, swg, nil); err != nil {
+			b.Fatalf("split failed: %v", err)
+		}
+		close(chunkC)
+	}
+}
+
+func BenchmarkSplitTreeUpload_1G(b *testing.B)      { benchmarkSplitTreeUpload(1<<30, false, b) }
+func BenchmarkSplitTreeUpload_1GStore(b *testing.B) { benchmarkSplitTreeUpload(1<<30, true, b) }
@@ -40,12 +40,15 @@ type NetStore struct {
 	hashfunc   Hasher
 	localStore *LocalStore
 	cloud      CloudStore
-	lock       sync.Mutex
+	requests   map[string]*Chunk // Chunks currently searched for in the cloud
+	lock       sync.Mutex        // protects requests
 }
 
 // backend engine for cloud store
 // It can be aggregate dispatching to several parallel implementations:
 // bzz/network/forwarder. forwarder or IPFS or IPΞS
+//
+// Retrieve blocks until the chunk is delivered or the search is given up.
 type CloudStore interface {
 	Store(*Chunk)
 	Deliver(*Chunk)
@@ -76,6 +79,7 @@ func NewNetStore(hash Hasher, lstore *LocalStore, cloud CloudStore, params *Stor
 		hashfunc:   hash,
 		localStore: lstore,
 		cloud:      cloud,
+		requests:   make(map[string]*Chunk),
 	}
 }
 
@@ -96,8 +100,16 @@ var (
 func (self *NetStore) Put(entry *Chunk) {
 	self.localStore.Put(entry)
 
-	// handle deliveries
+	// handle deliveries, only the first one if the chunk was asked from several peers
 	if entry.Req != nil {
+		if !entry.Req.markDelivered() {
+			log.Trace(fmt.Sprintf("NetStore.Put: %v already delivered", entry.Key.Log()))
+			return
+		}
+		self.lock.Lock()
+		delete(self.requests, string(entry.Key))
+		self.lock.Unlock()
+
 		log.Trace(fmt.Sprintf("NetStore.Put: localStore.Put %v hit existing request...delivering", entry.Key.Log()))
 		// closing C signals to other routines (local requests)
 		// that the chunk is has been retrieved
@@ -114,26 +126,54 @@ func (self *NetStore) Put(entry *Chunk) {
 
 // retrieve logic common for local and network chunk retrieval requests
 func (self *NetStore) Get(key Key) (*Chunk, error) {
-	var err error
+	// Join the search if the chunk is already being retrieved
+	self.lock.Lock()
+	chunk, ok := self.requests[string(key)]
+	self.lock.Unlock()
+	if ok {
+		log.Trace(fmt.Sprintf("NetStore.Get: %v hit on an existing request", key))
+		return chunk, nil
+	}
 	chunk, err := self.localStore.Get(key)
-	if err == nil {
-		if chunk.Req == nil {
-			log.Trace(fmt.Sprintf("NetStore.Get: %v found locally", key))
-		} else {
-			log.Trace(fmt.Sprintf("NetStore.Get: %v hit on an existing request", key))
-			// no need to launch again
-		}
-		return chunk, err
+	if err == nil && (chunk.Req == nil || chunk.SData != nil) {
+		log.Trace(fmt.Sprintf("NetStore.Get: %v found locally", key))
+		return chunk, nil
+	}
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	// Concurrent requests for the same key share a single search
+	if pending, ok := self.requests[string(key)]; ok {
+		log.Trace(fmt.Sprintf("NetStore.Get: %v hit on an existing request", key))
+		return pending, nil
 	}
-	// no data and no request status
-	log.Trace(fmt.Sprintf("NetStore.Get: %v not found locally. open new request", key))
-	chunk = NewChunk(key, newRequestStatus(key))
-	self.localStore.memStore.Put(chunk)
-	go self.cloud.Retrieve(chunk)
+	if err != nil {
+		// no data and no request status
+		log.Trace(fmt.Sprintf("NetStore.Get: %v not found locally. open new request", key))
+		chunk = NewChunk(key, newRequestStatus(key))
+		self.localStore.memStore.Put(chunk)
+	} else {
+		// request entry of an earlier search that was given up, search again
+		log.Trace(fmt.Sprintf("NetStore.Get: %v found expired request. search again", key))
+	}
+	self.requests[string(key)] = chunk
+	go self.retrieve(chunk)
 	return chunk, nil
 }
 
-// Close netstore
+// retrieve searches the cloud for a chunk, dropping the open request if the
+// search is given up so that the next Get starts a new one.
+func (self *NetStore) retrieve(chunk *Chunk) {
+	self.cloud.Retrieve(chunk)
+
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	if self.requests[string(chunk.Key)] == chunk {
+		delete(self.requests, string(chunk.Key))
+	}
+}
+
 func (self *NetStore) Close() {
 	return
 }
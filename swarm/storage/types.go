@@ -120,11 +120,17 @@ func (key *Key) UnmarshalJSON(value []byte) error {
 // peers and has a channel that is closed when the chunk is retrieved. Multiple
 // local callers can wait on this channel (or combined with a timeout, block with a
 // select).
+//
+// Once shared, the requesters are accessed through the methods below, since
+// peers add to them concurrently with the chunk being delivered.
 type RequestStatus struct {
 	Key        Key
 	Source     Peer
 	C          chan bool
 	Requesters map[uint64][]interface{}
+
+	delivered bool       // whether C was closed
+	lock      sync.Mutex // protects Requesters and delivered
 }
 
 func newRequestStatus(key Key) *RequestStatus {
@@ -135,6 +141,53 @@ func newRequestStatus(key Key) *RequestStatus {
 	}
 }
 
+// AddRequester records a request for the chunk under the given request id.
+func (self *RequestStatus) AddRequester(id uint64, req interface{}) {
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	self.Requesters[id] = append(self.Requesters[id], req)
+}
+
+// RequestedBy reports whether any of the recorded requests matches.
+func (self *RequestStatus) RequestedBy(match func(req interface{}) bool) bool {
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	for _, reqs := range self.Requesters {
+		for _, req := range reqs {
+			if match(req) {
+				return true
+			}
+		}
+	}
+	return false
+}
+
+// TakeRequesters returns the recorded requests and forgets them, so that each
+// is served only once.
+func (self *RequestStatus) TakeRequesters() map[uint64][]interface{} {
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	reqs := self.Requesters
+	self.Requesters = make(map[uint64][]interface{})
+	return reqs
+}
+
+// markDelivered flags the request as satisfied, reporting false if it already
+// was (e.g. when the chunk arrives from several of the peers asked).
+func (self *RequestStatus) markDelivered() bool {
+	self.lock.Lock()
+	defer self.lock.Unlock()
+
+	if self.delivered {
+		return false
+	}
+	self.delivered = true
+	return true
+}
+
 // Chunk also serves as a request object passed to ChunkStores
 // in case it is a retrieval request, Data is nil and Size is 0
 // Note that Size is not the size of the data chunk, which is Data.Size()
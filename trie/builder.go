@@ -0,0 +1,175 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package trie
+
+import (
+	"bytes"
+	"errors"
+
+	"github.com/trust-tech/go-trustmachine/common"
+)
+
+var (
+	// ErrBuilderKeyOrder is returned by the trie builder if a key is not strictly
+	// greater than the one inserted before it.
+	ErrBuilderKeyOrder = errors.New("trie builder: keys not in ascending order")
+
+	// ErrBuilderKeyLength is returned by the trie builder if keys of different
+	// lengths are inserted.
+	ErrBuilderKeyLength = errors.New("trie builder: keys of different length")
+)
+
+// builderFrame is a branch node under construction at a given nibble depth.
+type builderFrame struct {
+	depth int
+	node  *fullNode
+}
+
+// Builder constructs a trie bottom-up from keys inserted in ascending order,
+// writing every node to the database as soon as its subtree is complete. Only
+// the nodes along the path of the most recent key are held in memory, so even
+// huge tries can be built with a small, constant footprint.
+//
+// All keys must be of the same length, which is always the case for secure
+// tries (where keys are hashes). The resulting trie is identical to the one
+// produced by inserting the same entries into a Trie and committing it.
+type Builder struct {
+	db     DatabaseWriter
+	hasher *hasher
+
+	stack []*builderFrame // Open branch nodes along the path of the pending key
+	key   []byte          // Pending key (hex, without terminator), nil if none
+	value []byte          // Value of the pending key
+	lcp   int             // Common prefix length of the pending key and its predecessor
+	root  node            // Root node once all the keys are placed
+}
+
+// NewBuilder creates a sorted-insertion trie builder persisting into db.
+func NewBuilder(db DatabaseWriter) *Builder {
+	return &Builder{db: db, hasher: newHasher(0, 0), lcp: -1}
+}
+
+// Add inserts the next key/value pair into the trie. Keys must be inserted in
+// strictly ascending order. Empty values are ignored, just as Trie.Update would
+// treat them as deletions of nonexistent keys.
+func (b *Builder) Add(key, value []byte) error {
+	if len(value) == 0 {
+		return nil
+	}
+	hex := keybytesToHex(key)
+	hex = hex[:len(hex)-1]
+
+	if b.key == nil {
+		b.key, b.value = hex, common.CopyBytes(value)
+		return nil
+	}
+	if len(hex) != len(b.key) {
+		return ErrBuilderKeyLength
+	}
+	if bytes.Compare(hex, b.key) <= 0 {
+		return ErrBuilderKeyOrder
+	}
+	next := prefixLen(b.key, hex)
+	if err := b.place(next); err != nil {
+		return err
+	}
+	b.key, b.value, b.lcp = hex, common.CopyBytes(value), next
+	return nil
+}
+
+// Commit places the last pending key, writes the remaining nodes to the database
+// and returns the root hash of the trie. The builder may not be used afterwards.
+func (b *Builder) Commit() (common.Hash, error) {
+	defer returnHasherToPool(b.hasher)
+
+	if b.key == nil {
+		return emptyRoot, nil
+	}
+	if err := b.place(-1); err != nil {
+		return common.Hash{}, err
+	}
+	hashed, _, err := b.hasher.hash(b.root, b.db, true)
+	if err != nil {
+		return common.Hash{}, err
+	}
+	return common.BytesToHash(hashed.(hashNode)), nil
+}
+
+// place inserts the pending key as a leaf into the branch it belongs to, then
+// finalizes every branch that no subsequent key can extend. The next parameter
+// is the common prefix length with the following key, or -1 if there is none.
+func (b *Builder) place(next int) error {
+	depth := b.lcp
+	if next > depth {
+		depth = next
+	}
+	if depth < 0 {
+		// Single key in the whole trie, it's a leaf right at the root
+		b.root = &shortNode{Key: append(b.key, 16), Val: valueNode(b.value), flags: nodeFlag{dirty: true}}
+		return nil
+	}
+	if len(b.stack) == 0 || b.stack[len(b.stack)-1].depth < depth {
+		b.stack = append(b.stack, &builderFrame{depth: depth, node: &fullNode{flags: nodeFlag{dirty: true}}})
+	}
+	leaf := &shortNode{
+		Key:   append(common.CopyBytes(b.key[depth+1:]), 16),
+		Val:   valueNode(b.value),
+		flags: nodeFlag{dirty: true},
+	}
+	b.stack[len(b.stack)-1].node.Children[b.key[depth]] = leaf
+
+	return b.close(next)
+}
+
+// close finalizes all open branches deeper than the given depth, hashing and
+// storing them and linking them into their parents. Parent branches that do not
+// exist yet are opened on the fly; a depth of -1 collapses everything into the
+// root node.
+func (b *Builder) close(depth int) error {
+	for len(b.stack) > 0 && b.stack[len(b.stack)-1].depth > depth {
+		frame := b.stack[len(b.stack)-1]
+		b.stack = b.stack[:len(b.stack)-1]
+
+		// Find (or create) the branch the completed one hangs off
+		parent := -1
+		switch {
+		case len(b.stack) > 0 && b.stack[len(b.stack)-1].depth >= depth:
+			parent = b.stack[len(b.stack)-1].depth
+		case depth >= 0:
+			b.stack = append(b.stack, &builderFrame{depth: depth, node: &fullNode{flags: nodeFlag{dirty: true}}})
+			parent = depth
+		}
+		// Bridge any nibbles between the two with an extension node
+		var n node = frame.node
+		if frame.depth > parent+1 {
+			n = &shortNode{Key: common.CopyBytes(b.key[parent+1 : frame.depth]), Val: n, flags: nodeFlag{dirty: true}}
+		}
+		if parent < 0 {
+			b.root = n
+			return nil
+		}
+		hashed, cached, err := b.hasher.hash(n, b.db, false)
+		if err != nil {
+			return err
+		}
+		if _, ok := hashed.(hashNode); ok {
+			cached = hashed
+		}
+		b.stack[len(b.stack)-1].node.Children[b.key[parent]] = cached
+	}
+	return nil
+}
@@ -0,0 +1,101 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package trie
+
+import (
+	"bytes"
+	"math/rand"
+	"sort"
+	"testing"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+)
+
+// Tests that the sorted trie builder produces the same root hash and the same
+// set of database nodes as a regular trie filled with the same content.
+func TestBuilder(t *testing.T) {
+	for _, n := range []int{0, 1, 2, 3, 16, 17, 100, 1000, 5000} {
+		testBuilder(t, n, 32, 32)
+		testBuilder(t, n, 32, 1) // tiny values for embedded nodes
+		testBuilder(t, n, 2, 1)  // short keys for dense branches
+	}
+}
+
+func testBuilder(t *testing.T, n, keylen, vallen int) {
+	entries := make(map[string][]byte)
+	for len(entries) < n && len(entries) < 1<<uint(8*keylen-1) {
+		k, v := make([]byte, keylen), make([]byte, 1+rand.Intn(vallen))
+		rand.Read(k)
+		rand.Read(v)
+		entries[string(k)] = v
+	}
+	keys := make([]string, 0, len(entries))
+	for k := range entries {
+		keys = append(keys, k)
+	}
+	sort.Strings(keys)
+
+	refdb, _ := entrustdb.NewMemDatabase()
+	ref, _ := New(common.Hash{}, refdb)
+	for _, k := range keys {
+		ref.Update([]byte(k), entries[k])
+	}
+	want, _ := ref.Commit()
+
+	db, _ := entrustdb.NewMemDatabase()
+	builder := NewBuilder(db)
+	for _, k := range keys {
+		if err := builder.Add([]byte(k), entries[k]); err != nil {
+			t.Fatalf("n=%d: failed to add key: %v", n, err)
+		}
+	}
+	root, err := builder.Commit()
+	if err != nil {
+		t.Fatalf("n=%d: failed to commit: %v", n, err)
+	}
+	if root != want {
+		t.Fatalf("n=%d keylen=%d vallen=%d: root mismatch: have %x, want %x", n, keylen, vallen, root, want)
+	}
+	if have, want := len(db.Keys()), len(refdb.Keys()); have != want {
+		t.Fatalf("n=%d: node count mismatch: have %d, want %d", n, have, want)
+	}
+	for _, key := range refdb.Keys() {
+		have, _ := db.Get(key)
+		want, _ := refdb.Get(key)
+		if !bytes.Equal(have, want) {
+			t.Fatalf("n=%d: node %x mismatch", n, key)
+		}
+	}
+}
+
+// Tests that the builder rejects unordered and mismatching keys.
+func TestBuilderInvalidKeys(t *testing.T) {
+	db, _ := entrustdb.NewMemDatabase()
+
+	builder := NewBuilder(db)
+	builder.Add([]byte{0x02}, []byte{1})
+	if err := builder.Add([]byte{0x01}, []byte{1}); err != ErrBuilderKeyOrder {
+		t.Errorf("descending key: have %v, want %v", err, ErrBuilderKeyOrder)
+	}
+	if err := builder.Add([]byte{0x02}, []byte{1}); err != ErrBuilderKeyOrder {
+		t.Errorf("duplicate key: have %v, want %v", err, ErrBuilderKeyOrder)
+	}
+	if err := builder.Add([]byte{0x03, 0x00}, []byte{1}); err != ErrBuilderKeyLength {
+		t.Errorf("longer key: have %v, want %v", err, ErrBuilderKeyLength)
+	}
+}
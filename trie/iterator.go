@@ -93,10 +93,11 @@ type nodeIteratorState struct {
 }
 
 type nodeIterator struct {
-	trie  *Trie                // Trie being iterated
-	stack []*nodeIteratorState // Hierarchy of trie nodes persisting the iteration state
-	path  []byte               // Path to the current node
-	err   error                // Failure set in case of an internal error in the iterator
+	trie     *Trie                // Trie being iterated
+	stack    []*nodeIteratorState // Hierarchy of trie nodes persisting the iteration state
+	path     []byte               // Path to the current node
+	err      error                // Failure set in case of an internal error in the iterator
+	prefetch *prefetcher          // Read-ahead resolver of upcoming nodes (nil if disabled)
 }
 
 // iteratorEnd is stored in nodeIterator.err when iteration is done.
@@ -121,6 +122,18 @@ func newNodeIterator(trie *Trie, start []byte) NodeIterator {
 	return it
 }
 
+// newPrefetchNodeIterator creates a node iterator that resolves the upcoming hash
+// nodes of the traversal concurrently in the background. Iteration order and
+// error reporting are identical to those of a plain node iterator.
+func newPrefetchNodeIterator(trie *Trie, start []byte) NodeIterator {
+	if trie.Hash() == emptyState {
+		return new(nodeIterator)
+	}
+	it := &nodeIterator{trie: trie, prefetch: newPrefetcher(trie)}
+	it.err = it.seek(start)
+	return it
+}
+
 func (it *nodeIterator) Hash() common.Hash {
 	if len(it.stack) == 0 {
 		return common.Hash{}
@@ -221,7 +234,7 @@ func (it *nodeIterator) peek(descend bool) (*nodeIteratorState, *int, []byte, er
 		if root != emptyRoot {
 			state.hash = root
 		}
-		err := state.resolve(it.trie, nil)
+		err := state.resolve(it, nil)
 		return state, nil, nil, err
 	}
 	if !descend {
@@ -238,7 +251,7 @@ func (it *nodeIterator) peek(descend bool) (*nodeIteratorState, *int, []byte, er
 		}
 		state, path, ok := it.nextChild(parent, ancestor)
 		if ok {
-			if err := state.resolve(it.trie, path); err != nil {
+			if err := state.resolve(it, path); err != nil {
 				return parent, &parent.index, path, err
 			}
 			return state, &parent.index, path, nil
@@ -249,9 +262,9 @@ func (it *nodeIterator) peek(descend bool) (*nodeIteratorState, *int, []byte, er
 	return nil, nil, nil, iteratorEnd
 }
 
-func (st *nodeIteratorState) resolve(tr *Trie, path []byte) error {
+func (st *nodeIteratorState) resolve(it *nodeIterator, path []byte) error {
 	if hash, ok := st.node.(hashNode); ok {
-		resolved, err := tr.resolveHash(hash, path)
+		resolved, err := it.resolveHash(hash, path)
 		if err != nil {
 			return err
 		}
@@ -261,6 +274,19 @@ func (st *nodeIteratorState) resolve(tr *Trie, path []byte) error {
 	return nil
 }
 
+// resolveHash loads a node from the read-ahead cache if it was already fetched
+// in the background, or from the database otherwise. Only the nodes actually
+// consumed count as cache misses, speculative reads don't.
+func (it *nodeIterator) resolveHash(hash hashNode, path []byte) (node, error) {
+	if it.prefetch != nil {
+		if n := it.prefetch.take(hash); n != nil {
+			cacheMissCounter.Inc(1)
+			return n, nil
+		}
+	}
+	return it.trie.resolveHash(hash, path)
+}
+
 func (it *nodeIterator) nextChild(parent *nodeIteratorState, ancestor common.Hash) (*nodeIteratorState, []byte, bool) {
 	switch node := parent.node.(type) {
 	case *fullNode:
@@ -305,6 +331,9 @@ func (it *nodeIterator) push(state *nodeIteratorState, parentIndex *int, path []
 	if parentIndex != nil {
 		*parentIndex += 1
 	}
+	if it.prefetch != nil {
+		it.prefetch.schedule(state.node)
+	}
 }
 
 func (it *nodeIterator) pop() {
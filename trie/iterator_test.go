@@ -18,11 +18,15 @@ package trie
 
 import (
 	"bytes"
+	"encoding/binary"
 	"fmt"
 	"math/rand"
+	"os"
 	"testing"
+	"time"
 
 	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/crypto"
 	"github.com/trust-tech/go-trustmachine/entrustdb"
 )
 
@@ -372,3 +376,104 @@ func checkIteratorNoDups(t *testing.T, it NodeIterator, seen map[string]bool) in
 	}
 	return len(seen)
 }
+
+// Tests that the read-ahead node iterator visits exactly the same nodes in the
+// same order as the plain one, and fails at the same node if one is missing.
+func TestPrefetchIterator(t *testing.T) {
+	db, _ := entrustdb.NewMemDatabase()
+	tr, _ := New(common.Hash{}, db)
+	for i := 0; i < 2000; i++ {
+		k, v := make([]byte, 32), make([]byte, 20)
+		rand.Read(k)
+		rand.Read(v)
+		tr.Update(k, v)
+	}
+	root, _ := tr.Commit()
+
+	walk := func(it NodeIterator) []string {
+		var visited []string
+		for i := 0; it.Next(i%7 != 0); i++ {
+			visited = append(visited, fmt.Sprintf("%x:%x", it.Path(), it.Hash()))
+		}
+		return visited
+	}
+	for _, start := range [][]byte{nil, {0x40}, {0xa0, 0x01}} {
+		plain, _ := New(root, db)
+		fetch, _ := New(root, db)
+
+		misses := CacheMisses()
+		want := walk(plain.NodeIterator(start))
+		plainMisses, misses := CacheMisses()-misses, CacheMisses()
+		got := walk(fetch.PrefetchNodeIterator(start))
+		// Reads ahead of the iterator may not count as misses, wait for them
+		time.Sleep(10 * time.Millisecond)
+		if fetchMisses := CacheMisses() - misses; fetchMisses != plainMisses {
+			t.Errorf("start %x: cache miss count mismatch: have %d, want %d", start, fetchMisses, plainMisses)
+		}
+		if len(got) != len(want) {
+			t.Fatalf("start %x: node count mismatch: have %d, want %d", start, len(got), len(want))
+		}
+		for i := range want {
+			if got[i] != want[i] {
+				t.Fatalf("start %x: node %d mismatch: have %s, want %s", start, i, got[i], want[i])
+			}
+		}
+	}
+	// Remove a node and check that the error surfaces identically
+	keys := db.Keys()
+	for i := 0; i < 10; i++ {
+		rkey := keys[rand.Intn(len(keys))]
+		if bytes.Equal(rkey, root[:]) {
+			continue
+		}
+		rval, _ := db.Get(rkey)
+		db.Delete(rkey)
+
+		plain, _ := New(root, db)
+		fetch, _ := New(root, db)
+		pit, fit := plain.NodeIterator(nil), fetch.PrefetchNodeIterator(nil)
+		checkIteratorNoDups(t, pit, nil)
+		checkIteratorNoDups(t, fit, nil)
+
+		pmiss, _ := pit.Error().(*MissingNodeError)
+		fmiss, ok := fit.Error().(*MissingNodeError)
+		if !ok || pmiss == nil || fmiss.NodeHash != pmiss.NodeHash || !bytes.Equal(fmiss.Path, pmiss.Path) {
+			t.Fatalf("error mismatch: have %v, want %v", fit.Error(), pit.Error())
+		}
+		db.Put(rkey, rval)
+	}
+}
+
+func BenchmarkIterateDB(b *testing.B)         { benchIterate(b, false) }
+func BenchmarkIterateDBPrefetch(b *testing.B) { benchIterate(b, true) }
+
+func benchIterate(b *testing.B, prefetch bool) {
+	dir, db := tempDB()
+	defer os.RemoveAll(dir)
+	defer db.(*entrustdb.LDBDatabase).Close()
+
+	tr, _ := New(common.Hash{}, db)
+	k := make([]byte, 32)
+	for i := 0; i < benchElemCount; i++ {
+		binary.LittleEndian.PutUint64(k, uint64(i))
+		tr.Update(crypto.Keccak256(k), k)
+	}
+	root, _ := tr.Commit()
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		tr, _ := New(root, db)
+
+		var it NodeIterator
+		if prefetch {
+			it = tr.PrefetchNodeIterator(nil)
+		} else {
+			it = tr.NodeIterator(nil)
+		}
+		for it.Next(true) {
+		}
+		if it.Error() != nil {
+			b.Fatal(it.Error())
+		}
+	}
+}
@@ -0,0 +1,134 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package trie
+
+import (
+	"sync"
+
+	lru "github.com/hashicorp/golang-lru"
+	"github.com/trust-tech/go-trustmachine/common"
+)
+
+const (
+	prefetchWorkers = 16  // Number of concurrent database readers per iterator
+	prefetchWindow  = 256 // Number of upcoming hash nodes to resolve ahead of the iterator
+)
+
+// prefetcher speculatively resolves the hash nodes a node iterator is about to
+// visit, so that a traversal is not bound by one database read at a time.
+//
+// Pending hashes are kept on a stack: the children of the most recently visited
+// node are pushed last (first child on top), so workers pick them up in the same
+// depth-first order the iterator will request them. Resolved nodes are parked in
+// a bounded cache until consumed; anything the iterator skips simply ages out.
+//
+// Failures are never cached. If a speculative read fails, the iterator resolves
+// the node synchronously and reports the error exactly as it would without
+// prefetching.
+type prefetcher struct {
+	db       DatabaseReader
+	cachegen uint16
+
+	tasks   []hashNode // Stack of hashes to resolve, next one on top
+	running int        // Number of live worker goroutines
+	lock    sync.Mutex // Protects tasks and running
+
+	nodes *lru.Cache // Resolved nodes waiting to be consumed by the iterator
+}
+
+// newPrefetcher creates a read-ahead resolver for the nodes of the given trie.
+func newPrefetcher(trie *Trie) *prefetcher {
+	nodes, _ := lru.New(prefetchWindow)
+	return &prefetcher{
+		db:       trie.db,
+		cachegen: trie.cachegen,
+		nodes:    nodes,
+	}
+}
+
+// schedule queues the unresolved children of a node for background retrieval.
+// Workers are started on demand and exit once the queue runs dry, so an
+// abandoned iterator does not leak goroutines.
+func (p *prefetcher) schedule(n node) {
+	var children []hashNode
+	switch n := n.(type) {
+	case *fullNode:
+		for i := len(n.Children) - 1; i >= 0; i-- {
+			if hash, ok := n.Children[i].(hashNode); ok {
+				children = append(children, hash)
+			}
+		}
+	case *shortNode:
+		if hash, ok := n.Val.(hashNode); ok {
+			children = append(children, hash)
+		}
+	}
+	if len(children) == 0 {
+		return
+	}
+	p.lock.Lock()
+	defer p.lock.Unlock()
+
+	p.tasks = append(p.tasks, children...)
+	if drop := len(p.tasks) - prefetchWindow; drop > 0 {
+		// The bottom of the stack is the furthest away, forget about it.
+		p.tasks = append(p.tasks[:0], p.tasks[drop:]...)
+	}
+	for ; p.running < prefetchWorkers && p.running < len(p.tasks); p.running++ {
+		go p.loop()
+	}
+}
+
+// loop resolves queued hashes until there is nothing left to do.
+func (p *prefetcher) loop() {
+	for {
+		p.lock.Lock()
+		if len(p.tasks) == 0 {
+			p.running--
+			p.lock.Unlock()
+			return
+		}
+		hash := p.tasks[len(p.tasks)-1]
+		p.tasks = p.tasks[:len(p.tasks)-1]
+		p.lock.Unlock()
+
+		key := common.BytesToHash(hash)
+		if p.nodes.Contains(key) {
+			continue
+		}
+		enc, err := p.db.Get(hash)
+		if err != nil || enc == nil {
+			continue
+		}
+		n, err := decodeNode(hash, enc, p.cachegen)
+		if err != nil {
+			continue
+		}
+		p.nodes.Add(key, n)
+	}
+}
+
+// take retrieves and evicts a prefetched node, or returns nil if the node has
+// not (yet) been resolved in the background.
+func (p *prefetcher) take(hash hashNode) node {
+	key := common.BytesToHash(hash)
+	if n, ok := p.nodes.Get(key); ok {
+		p.nodes.Remove(key)
+		return n.(node)
+	}
+	return nil
+}
@@ -0,0 +1,154 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package trie
+
+import (
+	"fmt"
+	"sync"
+
+	lru "github.com/hashicorp/golang-lru"
+	"github.com/trust-tech/go-trustmachine/common"
+)
+
+// PreimageMode selects the keys of secure tries whose preimages are recorded.
+type PreimageMode uint8
+
+const (
+	PreimagesAll     PreimageMode = iota // Record the preimages of all keys
+	PreimagesNone                        // Record no preimages
+	PreimagesSampled                     // Record the preimages of 1/16 of the keys, chosen by hash
+)
+
+// Number of preimages known to be in the database, not written again.
+const preimageWrittenLimit = 65536
+
+func (mode PreimageMode) String() string {
+	switch mode {
+	case PreimagesAll:
+		return "all"
+	case PreimagesNone:
+		return "none"
+	case PreimagesSampled:
+		return "sampled"
+	default:
+		return fmt.Sprintf("unknown(%d)", uint8(mode))
+	}
+}
+
+// ParsePreimageMode parses the name of a preimage recording mode.
+func ParsePreimageMode(name string) (PreimageMode, error) {
+	for _, mode := range []PreimageMode{PreimagesAll, PreimagesNone, PreimagesSampled} {
+		if mode.String() == name {
+			return mode, nil
+		}
+	}
+	return PreimagesAll, fmt.Errorf("unknown preimage mode %q", name)
+}
+
+// records reports whether the preimage of a hashed key is to be recorded.
+func (mode PreimageMode) records(hash []byte) bool {
+	switch mode {
+	case PreimagesAll:
+		return true
+	case PreimagesSampled:
+		return hash[0] < 16
+	default:
+		return false
+	}
+}
+
+// Preimages collects the preimages of the keys of secure tries when they are
+// committed, until they are flushed to the database together. The preimages
+// already flushed recently are skipped, as tries commit all the keys updated,
+// even if they were already in.
+//
+// Preimages is safe for concurrent use.
+type Preimages struct {
+	mode    PreimageMode
+	lock    sync.RWMutex
+	pending map[common.Hash][]byte
+	written *lru.Cache
+}
+
+// NewPreimages creates a preimage collector recording in the given mode.
+func NewPreimages(mode PreimageMode) *Preimages {
+	written, _ := lru.New(preimageWrittenLimit)
+	return &Preimages{mode: mode, pending: make(map[common.Hash][]byte), written: written}
+}
+
+// Mode returns the recording mode of the collector.
+func (p *Preimages) Mode() PreimageMode {
+	return p.mode
+}
+
+// insert adds the preimage of a hashed key, unless it's already written.
+func (p *Preimages) insert(hash []byte, key []byte) {
+	h := common.BytesToHash(hash)
+	if p.written.Contains(h) {
+		return
+	}
+	p.lock.Lock()
+	p.pending[h] = key
+	p.lock.Unlock()
+}
+
+// get returns the pending preimage of a hashed key.
+func (p *Preimages) get(hash []byte) []byte {
+	p.lock.RLock()
+	defer p.lock.RUnlock()
+
+	return p.pending[common.BytesToHash(hash)]
+}
+
+// Len returns the number of pending preimages.
+func (p *Preimages) Len() int {
+	p.lock.RLock()
+	defer p.lock.RUnlock()
+
+	return len(p.pending)
+}
+
+// batchWriter is a database writer only persisting its data once written out,
+// such as an entrustdb.Batch.
+type batchWriter interface {
+	DatabaseWriter
+	Write() error
+}
+
+// Flush writes the pending preimages to db, at the same location WritePreimage
+// does. Use a batch to write them at once, Flush writes it out itself. The
+// preimages stay pending until the write succeeds, so failed ones are retried.
+func (p *Preimages) Flush(db DatabaseWriter) error {
+	p.lock.Lock()
+	defer p.lock.Unlock()
+
+	for hash, key := range p.pending {
+		if err := WritePreimage(db, hash[:], key); err != nil {
+			return err
+		}
+	}
+	if batch, ok := db.(batchWriter); ok {
+		if err := batch.Write(); err != nil {
+			return err
+		}
+	}
+	for hash := range p.pending {
+		p.written.Add(hash, struct{}{})
+	}
+	p.pending = make(map[common.Hash][]byte)
+	return nil
+}
@@ -0,0 +1,141 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package trie
+
+import (
+	"bytes"
+	"errors"
+	"testing"
+
+	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/crypto"
+	"github.com/trust-tech/go-trustmachine/entrustdb"
+)
+
+// Tests that the preimages handed to a collector are recorded according to its
+// mode, only reach the database when flushed, and are flushed once.
+func TestSecurePreimages(t *testing.T) {
+	for _, mode := range []PreimageMode{PreimagesAll, PreimagesSampled, PreimagesNone} {
+		db, _ := entrustdb.NewMemDatabase()
+		trie, _ := NewSecure(common.Hash{}, db, 0)
+		preimages := NewPreimages(mode)
+		trie.SetPreimages(preimages)
+
+		keys := make([][]byte, 256)
+		for i := range keys {
+			keys[i] = common.LeftPadBytes([]byte{byte(i)}, 32)
+			trie.Update(keys[i], []byte{byte(i) + 1})
+		}
+		trie.Commit()
+		for _, key := range db.Keys() {
+			if bytes.HasPrefix(key, secureKeyPrefix) {
+				t.Fatalf("%v: preimage written on commit: %x", mode, key)
+			}
+		}
+		recorded := 0
+		for _, key := range keys {
+			hash := crypto.Keccak256(key)
+			if preimage := trie.GetKey(hash); preimage != nil {
+				if !bytes.Equal(preimage, key) {
+					t.Fatalf("%v: preimage mismatch: have %x, want %x", mode, preimage, key)
+				}
+				recorded++
+			}
+			if want := mode.records(hash); (trie.GetKey(hash) != nil) != want {
+				t.Fatalf("%v: key %x recorded mismatch: want %v", mode, key, want)
+			}
+		}
+		if preimages.Len() != recorded {
+			t.Fatalf("%v: pending preimages mismatch: have %d, want %d", mode, preimages.Len(), recorded)
+		}
+		switch mode {
+		case PreimagesAll:
+			if recorded != len(keys) {
+				t.Fatalf("%v: %d preimages recorded, want %d", mode, recorded, len(keys))
+			}
+		case PreimagesSampled:
+			if recorded == 0 || recorded > len(keys)/4 {
+				t.Fatalf("%v: %d preimages recorded, want about %d", mode, recorded, len(keys)/16)
+			}
+		case PreimagesNone:
+			if recorded != 0 {
+				t.Fatalf("%v: %d preimages recorded, want none", mode, recorded)
+			}
+		}
+		// Flush them, they must be in the database and not be written again
+		if err := preimages.Flush(db); err != nil {
+			t.Fatalf("%v: failed to flush preimages: %v", mode, err)
+		}
+		fresh, _ := NewSecure(trie.Hash(), db, 0)
+		for _, key := range keys {
+			hash := crypto.Keccak256(key)
+			if (fresh.GetKey(hash) != nil) != mode.records(hash) {
+				t.Fatalf("%v: key %x flushed mismatch", mode, key)
+			}
+		}
+		for _, key := range keys {
+			trie.Update(key, []byte{0xff})
+		}
+		trie.Commit()
+		if preimages.Len() != 0 {
+			t.Fatalf("%v: %d flushed preimages pending again", mode, preimages.Len())
+		}
+	}
+}
+
+// failingBatch is a batch that fails to write out its content.
+type failingBatch struct{ entrustdb.Batch }
+
+func (b failingBatch) Write() error { return errors.New("write failed") }
+
+// Tests that preimages whose batch fails to be written stay pending, so they are
+// written by the next flush.
+func TestPreimagesFlushFailure(t *testing.T) {
+	db, _ := entrustdb.NewMemDatabase()
+	trie, _ := NewSecure(common.Hash{}, db, 0)
+	preimages := NewPreimages(PreimagesAll)
+	trie.SetPreimages(preimages)
+
+	key := common.LeftPadBytes([]byte{1}, 32)
+	trie.Update(key, []byte{1})
+	trie.Commit()
+
+	if err := preimages.Flush(failingBatch{db.NewBatch()}); err == nil {
+		t.Fatalf("failed batch write not reported")
+	}
+	if preimages.Len() != 1 {
+		t.Fatalf("preimage dropped after failed write")
+	}
+	if err := preimages.Flush(db.NewBatch()); err != nil {
+		t.Fatalf("failed to flush preimages: %v", err)
+	}
+	if fresh, _ := NewSecure(trie.Hash(), db, 0); !bytes.Equal(fresh.GetKey(crypto.Keccak256(key)), key) {
+		t.Fatalf("preimage not written on retry")
+	}
+}
+
+// Tests that preimage modes round trip through their names.
+func TestParsePreimageMode(t *testing.T) {
+	for _, mode := range []PreimageMode{PreimagesAll, PreimagesSampled, PreimagesNone} {
+		if parsed, err := ParsePreimageMode(mode.String()); err != nil || parsed != mode {
+			t.Errorf("mode %v: parsed as %v, %v", mode, parsed, err)
+		}
+	}
+	if _, err := ParsePreimageMode("some"); err == nil {
+		t.Errorf("unknown mode parsed")
+	}
+}
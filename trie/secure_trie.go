@@ -18,8 +18,10 @@ package trie
 
 import (
 	"fmt"
+	"hash"
 
 	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/crypto/sha3"
 	"github.com/trust-tech/go-trustmachine/log"
 )
 
@@ -34,15 +36,19 @@ const secureKeyLength = 11 + 32 // Length of the above prefix + 32byte hash
 //
 // Contrary to a regular trie, a SecureTrie can only be created with
 // New and must have an attached database. The database also stores
-// the preimage of each key.
+// the preimage of each key, unless the trie hands them to a preimage
+// collector.
 //
 // SecureTrie is not safe for concurrent use.
 type SecureTrie struct {
 	trie             Trie
+	hashKeySha       hash.Hash   // Keccak state of the key hashing
+	hashKeyShaOwner  *SecureTrie // Pointer to self, replace the keccak state on mismatch
 	hashKeyBuf       [secureKeyLength]byte
 	secKeyBuf        [200]byte
 	secKeyCache      map[string][]byte
 	secKeyCacheOwner *SecureTrie // Pointer to self, replace the key cache on mismatch
+	preimages        *Preimages  // Preimage collector, preimages are written on commit if nil
 }
 
 // NewSecure creates a trie with an existing root node from db.
@@ -110,7 +116,9 @@ func (t *SecureTrie) TryUpdate(key, value []byte) error {
 	if err != nil {
 		return err
 	}
-	t.getSecKeyCache()[string(hk)] = common.CopyBytes(key)
+	if t.preimages == nil || t.preimages.mode.records(hk) {
+		t.getSecKeyCache()[string(hk)] = common.CopyBytes(key)
+	}
 	return nil
 }
 
@@ -135,6 +143,11 @@ func (t *SecureTrie) GetKey(shaKey []byte) []byte {
 	if key, ok := t.getSecKeyCache()[string(shaKey)]; ok {
 		return key
 	}
+	if t.preimages != nil {
+		if key := t.preimages.get(shaKey); key != nil {
+			return key
+		}
+	}
 	key, _ := t.trie.db.Get(t.secKey(shaKey))
 	return key
 }
@@ -161,12 +174,26 @@ func (t *SecureTrie) Copy() *SecureTrie {
 	return &cpy
 }
 
+// SetPreimages sets the collector the preimages of the keys are handed to on
+// commit, instead of being written to the database. The collector's mode also
+// selects the keys whose preimages are kept.
+func (t *SecureTrie) SetPreimages(preimages *Preimages) {
+	t.preimages = preimages
+}
+
 // NodeIterator returns an iterator that returns nodes of the underlying trie. Iteration
 // starts at the key after the given start key.
 func (t *SecureTrie) NodeIterator(start []byte) NodeIterator {
 	return t.trie.NodeIterator(start)
 }
 
+// PrefetchNodeIterator returns an iterator that returns nodes of the underlying trie,
+// resolving upcoming nodes concurrently. Iteration starts at the key after the given
+// start key.
+func (t *SecureTrie) PrefetchNodeIterator(start []byte) NodeIterator {
+	return t.trie.PrefetchNodeIterator(start)
+}
+
 // CommitTo writes all nodes and the secure hash pre-images to the given database.
 // Nodes are stored with their sha3 hash as the key.
 //
@@ -176,6 +203,10 @@ func (t *SecureTrie) NodeIterator(start []byte) NodeIterator {
 func (t *SecureTrie) CommitTo(db DatabaseWriter) (root common.Hash, err error) {
 	if len(t.getSecKeyCache()) > 0 {
 		for hk, key := range t.secKeyCache {
+			if t.preimages != nil {
+				t.preimages.insert([]byte(hk), key)
+				continue
+			}
 			if err := db.Put(t.secKey([]byte(hk)), key); err != nil {
 				return common.Hash{}, err
 			}
@@ -185,6 +216,12 @@ func (t *SecureTrie) CommitTo(db DatabaseWriter) (root common.Hash, err error) {
 	return t.trie.CommitTo(db)
 }
 
+// WritePreimage stores the preimage of a hashed secure trie key into db, at the
+// same location SecureTrie records the preimages of its keys when committing.
+func WritePreimage(db DatabaseWriter, hash, key []byte) error {
+	return db.Put(append(append([]byte{}, secureKeyPrefix...), hash...), key)
+}
+
 // secKey returns the database key for the preimage of key, as an ephemeral buffer.
 // The caller must not hold onto the return value because it will become
 // invalid on the next call to hashKey or secKey.
@@ -198,12 +235,13 @@ func (t *SecureTrie) secKey(key []byte) []byte {
 // The caller must not hold onto the return value because it will become
 // invalid on the next call to hashKey or secKey.
 func (t *SecureTrie) hashKey(key []byte) []byte {
-	h := newHasher(0, 0)
-	h.sha.Reset()
-	h.sha.Write(key)
-	buf := h.sha.Sum(t.hashKeyBuf[:0])
-	returnHasherToPool(h)
-	return buf
+	if t != t.hashKeyShaOwner {
+		t.hashKeyShaOwner = t
+		t.hashKeySha = sha3.NewKeccak256()
+	}
+	t.hashKeySha.Reset()
+	t.hashKeySha.Write(key)
+	return t.hashKeySha.Sum(t.hashKeyBuf[:0])
 }
 
 // getSecKeyCache returns the current secure key cache, creating a new one if
@@ -19,6 +19,8 @@ package trie
 import (
 	"errors"
 	"fmt"
+	"runtime"
+	"sync"
 
 	"github.com/trust-tech/go-trustmachine/common"
 	"gopkg.in/karalabe/cookiejar.v2/collections/prque"
@@ -32,6 +34,10 @@ var ErrNotRequested = errors.New("not requested")
 // node it already processed previously.
 var ErrAlreadyProcessed = errors.New("already processed")
 
+// syncDecodeMinItems is the minimum number of delivered nodes per thread needed
+// to make it worthwhile to decode a batch concurrently.
+const syncDecodeMinItems = 16
+
 // request represents a scheduled or already in-flight state retrieval request.
 type request struct {
 	hash common.Hash // Hash of the node data content to retrieve
@@ -80,15 +86,19 @@ type TrieSync struct {
 	membatch *syncMemBatch            // Memory buffer to avoid frequest database writes
 	requests map[common.Hash]*request // Pending requests pertaining to a key hash
 	queue    *prque.Prque             // Priority queue with the pending requests
+	bloom    *SyncBloom               // Filter of locally known nodes to avoid database lookups (optional)
 }
 
-// NewTrieSync creates a new trie data download scheduler.
-func NewTrieSync(root common.Hash, database DatabaseReader, callback TrieSyncLeafCallback) *TrieSync {
+// NewTrieSync creates a new trie data download scheduler. If a bloom filter is
+// given, nodes it doesn't contain are assumed missing without consulting the
+// database, and all committed nodes are added to it.
+func NewTrieSync(root common.Hash, database DatabaseReader, callback TrieSyncLeafCallback, bloom *SyncBloom) *TrieSync {
 	ts := &TrieSync{
 		database: database,
 		membatch: newSyncMemBatch(),
 		requests: make(map[common.Hash]*request),
 		queue:    prque.New(),
+		bloom:    bloom,
 	}
 	ts.AddSubTrie(root, 0, common.Hash{}, callback)
 	return ts
@@ -100,12 +110,7 @@ func (s *TrieSync) AddSubTrie(root common.Hash, depth int, parent common.Hash, c
 	if root == emptyRoot {
 		return
 	}
-	if _, ok := s.membatch.batch[root]; ok {
-		return
-	}
-	key := root.Bytes()
-	blob, _ := s.database.Get(key)
-	if local, err := decodeNode(key, blob, 0); local != nil && err == nil {
+	if s.known(root, false) {
 		return
 	}
 	// Assemble the new sub-trie sync request
@@ -135,10 +140,7 @@ func (s *TrieSync) AddRawEntry(hash common.Hash, depth int, parent common.Hash)
 	if hash == emptyState {
 		return
 	}
-	if _, ok := s.membatch.batch[hash]; ok {
-		return
-	}
-	if blob, _ := s.database.Get(hash.Bytes()); blob != nil {
+	if s.known(hash, true) {
 		return
 	}
 	// Assemble the new sub-trie sync request
@@ -172,16 +174,40 @@ func (s *TrieSync) Missing(max int) []common.Hash {
 // was committed to the database and also the index of an entry if processing of
 // it failed.
 func (s *TrieSync) Process(results []SyncResult) (bool, int, error) {
-	committed := false
+	committed, _, _, index, err := s.process(results, false)
+	return committed, index, err
+}
+
+// ProcessBatch injects a batch of retrieved trie nodes data like Process, but
+// skips the entries that were not requested or are already processed instead of
+// stopping at them, returning their numbers. Processing only stops at an invalid
+// entry. The batch is decoded once, however many entries are skipped.
+func (s *TrieSync) ProcessBatch(results []SyncResult) (committed bool, unexpected int, duplicate int, index int, err error) {
+	return s.process(results, true)
+}
+
+// process injects a batch of retrieved trie nodes data, either skipping or
+// stopping at unrequested and already processed entries.
+func (s *TrieSync) process(results []SyncResult, skip bool) (committed bool, unexpected int, duplicate int, index int, err error) {
+	// Decode all the delivered trie nodes concurrently, scheduling remains serial
+	nodes, errs := s.decode(results)
 
 	for i, item := range results {
-		// If the item was not requested, bail out
+		// If the item was not requested, skip it or bail out
 		request := s.requests[item.Hash]
 		if request == nil {
-			return committed, i, ErrNotRequested
+			if skip {
+				unexpected++
+				continue
+			}
+			return committed, unexpected, duplicate, i, ErrNotRequested
 		}
 		if request.data != nil {
-			return committed, i, ErrAlreadyProcessed
+			if skip {
+				duplicate++
+				continue
+			}
+			return committed, unexpected, duplicate, i, ErrAlreadyProcessed
 		}
 		// If the item is a raw entry request, commit directly
 		if request.raw {
@@ -190,17 +216,21 @@ func (s *TrieSync) Process(results []SyncResult) (bool, int, error) {
 			committed = true
 			continue
 		}
-		// Decode the node data content and update the request
-		node, err := decodeNode(item.Hash[:], item.Data, 0)
+		// Update the request with the decoded node data content
+		node, err := nodes[i], errs[i]
+		if node == nil && err == nil {
+			// Requested by an earlier item of the same batch, decode it now
+			node, err = decodeNode(item.Hash[:], item.Data, 0)
+		}
 		if err != nil {
-			return committed, i, err
+			return committed, unexpected, duplicate, i, err
 		}
 		request.data = item.Data
 
 		// Create and schedule a request for all the children nodes
 		requests, err := s.children(request, node)
 		if err != nil {
-			return committed, i, err
+			return committed, unexpected, duplicate, i, err
 		}
 		if len(requests) == 0 && request.deps == 0 {
 			s.commit(request)
@@ -212,7 +242,7 @@ func (s *TrieSync) Process(results []SyncResult) (bool, int, error) {
 			s.schedule(child)
 		}
 	}
-	return committed, 0, nil
+	return committed, unexpected, duplicate, 0, nil
 }
 
 // Commit flushes the data stored in the internal membatch out to persistent
@@ -223,6 +253,9 @@ func (s *TrieSync) Commit(dbw DatabaseWriter) (int, error) {
 		if err := dbw.Put(key[:], s.membatch.batch[key]); err != nil {
 			return i, err
 		}
+		if s.bloom != nil {
+			s.bloom.Add(key[:])
+		}
 	}
 	written := len(s.membatch.order)
 
@@ -250,6 +283,59 @@ func (s *TrieSync) schedule(req *request) {
 	s.requests[req.hash] = req
 }
 
+// known checks whether a trie node (or raw entry) is already available locally,
+// either in the membatch waiting to be flushed, or in the database. If the bloom
+// filter rules the hash out, the database lookup is skipped altogether.
+func (s *TrieSync) known(hash common.Hash, raw bool) bool {
+	if _, ok := s.membatch.batch[hash]; ok {
+		return true
+	}
+	if s.bloom != nil && !s.bloom.Contains(hash[:]) {
+		return false
+	}
+	blob, _ := s.database.Get(hash[:])
+	if raw {
+		return blob != nil
+	}
+	local, err := decodeNode(hash[:], blob, 0)
+	return local != nil && err == nil
+}
+
+// decode parses the requested trie nodes of a delivery batch on multiple threads.
+// Entries that were not requested, or are raw data, are left nil.
+func (s *TrieSync) decode(results []SyncResult) ([]node, []error) {
+	nodes := make([]node, len(results))
+	errs := make([]error, len(results))
+
+	decode := func(i int) {
+		if req := s.requests[results[i].Hash]; req != nil && !req.raw && req.data == nil {
+			nodes[i], errs[i] = decodeNode(results[i].Hash[:], results[i].Data, 0)
+		}
+	}
+	threads := runtime.NumCPU()
+	if threads > len(results)/syncDecodeMinItems {
+		threads = len(results) / syncDecodeMinItems
+	}
+	if threads <= 1 {
+		for i := range results {
+			decode(i)
+		}
+		return nodes, errs
+	}
+	var pend sync.WaitGroup
+	pend.Add(threads)
+	for t := 0; t < threads; t++ {
+		go func(t int) {
+			defer pend.Done()
+			for i := t; i < len(results); i += threads {
+				decode(i)
+			}
+		}(t)
+	}
+	pend.Wait()
+	return nodes, errs
+}
+
 // children retrieves all the missing children of a state trie entry for future
 // retrieval scheduling.
 func (s *TrieSync) children(req *request, object node) ([]*request, error) {
@@ -293,11 +379,7 @@ func (s *TrieSync) children(req *request, object node) ([]*request, error) {
 		if node, ok := (child.node).(hashNode); ok {
 			// Try to resolve the node from the local database
 			hash := common.BytesToHash(node)
-			if _, ok := s.membatch.batch[hash]; ok {
-				continue
-			}
-			blob, _ := s.database.Get(node)
-			if local, err := decodeNode(node[:], blob, 0); local != nil && err == nil {
+			if s.known(hash, false) {
 				continue
 			}
 			// Locally unknown node, schedule for retrieval
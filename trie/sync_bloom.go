@@ -0,0 +1,142 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package trie
+
+import (
+	"encoding/binary"
+	"sync"
+
+	"github.com/rcrowley/go-metrics"
+)
+
+// syncBloomKey is the database key under which the sync bloom filter is persisted.
+var syncBloomKey = []byte("TrieSyncBloom")
+
+// syncBloomHashes is the number of bit positions set for each inserted item.
+const syncBloomHashes = 4
+
+var (
+	syncBloomMissCounter = metrics.NewRegisteredCounter("trie/sync/bloom/miss", nil)
+	syncBloomHitCounter  = metrics.NewRegisteredCounter("trie/sync/bloom/hit", nil)
+)
+
+// SyncBloom is a bloom filter of the node hashes written to the database by a
+// trie sync, used to avoid database lookups for nodes that are definitely not
+// yet known locally. A negative answer is authoritative only for data that was
+// stored through a sync using the same filter; nodes written by other means are
+// merely downloaded again, which costs bandwidth but not correctness.
+//
+// The persisted filter is marked stale as soon as a sync commits nodes without
+// it, and only becomes valid again once stored at the end of the sync. A filter
+// missing some of the synced nodes is thus never loaded after a crash.
+//
+// Since the inserted keys are Keccak256 hashes, the bit positions are taken
+// directly from the key bytes instead of rehashing them.
+type SyncBloom struct {
+	bits []uint64     // Bit vector of the filter, a power of two in length
+	mask uint64       // Mask to convert a 64 bit value into a bit position
+	lock sync.RWMutex // Protects the bit vector from concurrent access
+}
+
+// NewSyncBloom creates an empty sync bloom filter of (at least) the given size
+// in bits, rounded up to the next power of two.
+func NewSyncBloom(size uint64) *SyncBloom {
+	bits := uint64(64)
+	for bits < size {
+		bits <<= 1
+	}
+	return &SyncBloom{
+		bits: make([]uint64, bits/64),
+		mask: bits - 1,
+	}
+}
+
+// LoadSyncBloom retrieves a sync bloom filter previously persisted into the
+// database. If none is found, a new empty filter is returned for a fresh database
+// and nil otherwise, since the nodes already on disk would be unknown to it. Nil
+// is also returned if the persisted filter is stale or of a different size.
+func LoadSyncBloom(db DatabaseReader, size uint64, fresh bool) *SyncBloom {
+	bloom := NewSyncBloom(size)
+
+	blob, err := db.Get(syncBloomKey)
+	if err != nil {
+		if fresh {
+			return bloom
+		}
+		return nil
+	}
+	if len(blob) != 8*len(bloom.bits) {
+		return nil
+	}
+	for i := range bloom.bits {
+		bloom.bits[i] = binary.BigEndian.Uint64(blob[8*i:])
+	}
+	return bloom
+}
+
+// Store persists the bloom filter into the database, so that an interrupted sync
+// can be resumed without losing the existence information.
+func (b *SyncBloom) Store(db DatabaseWriter) error {
+	b.lock.RLock()
+	blob := make([]byte, 8*len(b.bits))
+	for i, word := range b.bits {
+		binary.BigEndian.PutUint64(blob[8*i:], word)
+	}
+	b.lock.RUnlock()
+
+	return db.Put(syncBloomKey, blob)
+}
+
+// MarkStale invalidates the persisted filter until the next Store. It must be
+// written along with the first nodes synced after loading the filter.
+func (b *SyncBloom) MarkStale(db DatabaseWriter) error {
+	return db.Put(syncBloomKey, []byte{0})
+}
+
+// Add inserts a node hash into the filter.
+func (b *SyncBloom) Add(hash []byte) {
+	if len(hash) < 8*syncBloomHashes {
+		return
+	}
+	b.lock.Lock()
+	defer b.lock.Unlock()
+
+	for i := 0; i < syncBloomHashes; i++ {
+		bit := binary.BigEndian.Uint64(hash[8*i:]) & b.mask
+		b.bits[bit/64] |= 1 << (bit % 64)
+	}
+}
+
+// Contains reports whether a node hash might have been inserted into the filter.
+// Short keys that can't be indexed are always reported as possibly present.
+func (b *SyncBloom) Contains(hash []byte) bool {
+	if len(hash) < 8*syncBloomHashes {
+		return true
+	}
+	b.lock.RLock()
+	defer b.lock.RUnlock()
+
+	for i := 0; i < syncBloomHashes; i++ {
+		bit := binary.BigEndian.Uint64(hash[8*i:]) & b.mask
+		if b.bits[bit/64]&(1<<(bit%64)) == 0 {
+			syncBloomMissCounter.Inc(1)
+			return false
+		}
+	}
+	syncBloomHitCounter.Inc(1)
+	return true
+}
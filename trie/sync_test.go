@@ -18,9 +18,12 @@ package trie
 
 import (
 	"bytes"
+	"encoding/binary"
+	"os"
 	"testing"
 
 	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/crypto"
 	"github.com/trust-tech/go-trustmachine/entrustdb"
 )
 
@@ -93,7 +96,7 @@ func TestEmptyTrieSync(t *testing.T) {
 
 	for i, trie := range []*Trie{emptyA, emptyB} {
 		db, _ := entrustdb.NewMemDatabase()
-		if req := NewTrieSync(common.BytesToHash(trie.Root()), db, nil).Missing(1); len(req) != 0 {
+		if req := NewTrieSync(common.BytesToHash(trie.Root()), db, nil, nil).Missing(1); len(req) != 0 {
 			t.Errorf("test %d: content requested for empty trie: %v", i, req)
 		}
 	}
@@ -110,7 +113,7 @@ func testIterativeTrieSync(t *testing.T, batch int) {
 
 	// Create a destination trie and sync with the scheduler
 	dstDb, _ := entrustdb.NewMemDatabase()
-	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil)
+	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, nil)
 
 	queue := append([]common.Hash{}, sched.Missing(batch)...)
 	for len(queue) > 0 {
@@ -142,7 +145,7 @@ func TestIterativeDelayedTrieSync(t *testing.T) {
 
 	// Create a destination trie and sync with the scheduler
 	dstDb, _ := entrustdb.NewMemDatabase()
-	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil)
+	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, nil)
 
 	queue := append([]common.Hash{}, sched.Missing(10000)...)
 	for len(queue) > 0 {
@@ -179,7 +182,7 @@ func testIterativeRandomTrieSync(t *testing.T, batch int) {
 
 	// Create a destination trie and sync with the scheduler
 	dstDb, _ := entrustdb.NewMemDatabase()
-	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil)
+	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, nil)
 
 	queue := make(map[common.Hash]struct{})
 	for _, hash := range sched.Missing(batch) {
@@ -219,7 +222,7 @@ func TestIterativeRandomDelayedTrieSync(t *testing.T) {
 
 	// Create a destination trie and sync with the scheduler
 	dstDb, _ := entrustdb.NewMemDatabase()
-	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil)
+	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, nil)
 
 	queue := make(map[common.Hash]struct{})
 	for _, hash := range sched.Missing(10000) {
@@ -265,7 +268,7 @@ func TestDuplicateAvoidanceTrieSync(t *testing.T) {
 
 	// Create a destination trie and sync with the scheduler
 	dstDb, _ := entrustdb.NewMemDatabase()
-	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil)
+	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, nil)
 
 	queue := append([]common.Hash{}, sched.Missing(0)...)
 	requested := make(map[common.Hash]struct{})
@@ -296,6 +299,46 @@ func TestDuplicateAvoidanceTrieSync(t *testing.T) {
 	checkTrieContents(t, dstDb, srcTrie.Root(), srcData)
 }
 
+// Tests that a batch injection skips over unrequested and duplicate entries in
+// the middle of a batch, counting them, and still processes the rest.
+func TestBatchTrieSyncSkipping(t *testing.T) {
+	// Create a random trie to copy
+	srcDb, srcTrie, srcData := makeTestTrie()
+
+	// Create a destination trie and sync with the scheduler
+	dstDb, _ := entrustdb.NewMemDatabase()
+	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, nil)
+
+	junk := SyncResult{common.Hash{0x01}, []byte{0x01}}
+	queue := append([]common.Hash{}, sched.Missing(0)...)
+	for len(queue) > 0 {
+		var results []SyncResult
+		for _, hash := range queue {
+			data, err := srcDb.Get(hash.Bytes())
+			if err != nil {
+				t.Fatalf("failed to retrieve node data for %x: %v", hash, err)
+			}
+			// Deliver every node twice, with junk in between
+			results = append(results, SyncResult{hash, data}, junk, SyncResult{hash, data})
+		}
+		_, unexpected, duplicate, index, err := sched.ProcessBatch(results)
+		if err != nil {
+			t.Fatalf("failed to process result #%d: %v", index, err)
+		}
+		// A node without children is committed straight away, so its second copy
+		// is unexpected instead of a duplicate
+		if unexpected+duplicate != 2*len(queue) || unexpected < len(queue) {
+			t.Fatalf("skipped entries mismatch: have %d unexpected, %d duplicate, want %d in total", unexpected, duplicate, 2*len(queue))
+		}
+		if index, err := sched.Commit(dstDb); err != nil {
+			t.Fatalf("failed to commit data #%d: %v", index, err)
+		}
+		queue = append(queue[:0], sched.Missing(0)...)
+	}
+	// Cross check that the two tries are in sync
+	checkTrieContents(t, dstDb, srcTrie.Root(), srcData)
+}
+
 // Tests that at any point in time during a sync, only complete sub-tries are in
 // the database.
 func TestIncompleteTrieSync(t *testing.T) {
@@ -304,7 +347,7 @@ func TestIncompleteTrieSync(t *testing.T) {
 
 	// Create a destination trie and sync with the scheduler
 	dstDb, _ := entrustdb.NewMemDatabase()
-	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil)
+	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, nil)
 
 	added := []common.Hash{}
 	queue := append([]common.Hash{}, sched.Missing(1)...)
@@ -349,3 +392,111 @@ func TestIncompleteTrieSync(t *testing.T) {
 		dstDb.Put(key, value)
 	}
 }
+
+// Tests that a trie sync using an existence filter reconstructs the trie, and
+// that the filter survives a round trip through the database.
+func TestIterativeTrieSyncBloom(t *testing.T) {
+	srcDb, srcTrie, srcData := makeTestTrie()
+
+	dstDb, _ := entrustdb.NewMemDatabase()
+	bloom := NewSyncBloom(1 << 16)
+	sched := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, bloom)
+
+	for queue := sched.Missing(100); len(queue) > 0; queue = sched.Missing(100) {
+		results := make([]SyncResult, len(queue))
+		for i, hash := range queue {
+			data, err := srcDb.Get(hash.Bytes())
+			if err != nil {
+				t.Fatalf("failed to retrieve node data for %x: %v", hash, err)
+			}
+			results[i] = SyncResult{hash, data}
+		}
+		if _, index, err := sched.Process(results); err != nil {
+			t.Fatalf("failed to process result #%d: %v", index, err)
+		}
+		if index, err := sched.Commit(dstDb); err != nil {
+			t.Fatalf("failed to commit data #%d: %v", index, err)
+		}
+	}
+	checkTrieContents(t, dstDb, srcTrie.Root(), srcData)
+
+	// Persist the filter and check that it still reports every synced node
+	if err := bloom.Store(dstDb); err != nil {
+		t.Fatalf("failed to store bloom: %v", err)
+	}
+	loaded := LoadSyncBloom(dstDb, 1<<16, false)
+	for _, key := range srcDb.(*entrustdb.MemDatabase).Keys() {
+		if !loaded.Contains(key) {
+			t.Fatalf("synced node %x missing from loaded bloom", key)
+		}
+	}
+	// A resync against the filled database must not need anything
+	if req := NewTrieSync(common.BytesToHash(srcTrie.Root()), dstDb, nil, loaded).Missing(1); len(req) != 0 {
+		t.Fatalf("content requested for synced trie: %v", req)
+	}
+	// A stale filter, or a missing one on a used database, must not be trusted
+	if err := loaded.MarkStale(dstDb); err != nil {
+		t.Fatalf("failed to mark bloom stale: %v", err)
+	}
+	if LoadSyncBloom(dstDb, 1<<16, false) != nil {
+		t.Fatalf("stale bloom loaded")
+	}
+	emptyDb, _ := entrustdb.NewMemDatabase()
+	if LoadSyncBloom(emptyDb, 1<<16, false) != nil {
+		t.Fatalf("empty bloom trusted on a used database")
+	}
+	if LoadSyncBloom(emptyDb, 1<<16, true) == nil {
+		t.Fatalf("no bloom for a fresh database")
+	}
+}
+
+func BenchmarkTrieSync(b *testing.B)      { benchTrieSync(b, false) }
+func BenchmarkTrieSyncBloom(b *testing.B) { benchTrieSync(b, true) }
+
+// benchTrieSync measures the throughput of reconstructing a trie into a disk
+// backed database, feeding the scheduler batches of 384 nodes at a time.
+func benchTrieSync(b *testing.B, filter bool) {
+	srcDb, _ := entrustdb.NewMemDatabase()
+	srcTrie, _ := New(common.Hash{}, srcDb)
+
+	k := make([]byte, 32)
+	for i := 0; i < benchElemCount; i++ {
+		binary.LittleEndian.PutUint64(k, uint64(i))
+		srcTrie.Update(crypto.Keccak256(k), k)
+	}
+	root, _ := srcTrie.Commit()
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		b.StopTimer()
+		dir, dstDb := tempDB()
+		var bloom *SyncBloom
+		if filter {
+			bloom = NewSyncBloom(1 << 20)
+		}
+		b.StartTimer()
+
+		sched := NewTrieSync(root, dstDb, nil, bloom)
+		for queue := sched.Missing(384); len(queue) > 0; queue = sched.Missing(384) {
+			results := make([]SyncResult, len(queue))
+			for j, hash := range queue {
+				data, _ := srcDb.Get(hash.Bytes())
+				results[j] = SyncResult{hash, data}
+			}
+			if _, index, err := sched.Process(results); err != nil {
+				b.Fatalf("failed to process result #%d: %v", index, err)
+			}
+			batch := dstDb.(*entrustdb.LDBDatabase).NewBatch()
+			if _, err := sched.Commit(batch); err != nil {
+				b.Fatalf("failed to commit data: %v", err)
+			}
+			if err := batch.Write(); err != nil {
+				b.Fatalf("failed to write batch: %v", err)
+			}
+		}
+		b.StopTimer()
+		dstDb.(*entrustdb.LDBDatabase).Close()
+		os.RemoveAll(dir)
+		b.StartTimer()
+	}
+}
@@ -131,6 +131,13 @@ func (t *Trie) NodeIterator(start []byte) NodeIterator {
 	return newNodeIterator(t, start)
 }
 
+// PrefetchNodeIterator returns a node iterator like NodeIterator, which in addition
+// resolves the nodes ahead of the current position concurrently. It is meant for
+// full traversals of database backed tries.
+func (t *Trie) PrefetchNodeIterator(start []byte) NodeIterator {
+	return newPrefetchNodeIterator(t, start)
+}
+
 // Get returns the value for key stored in the trie.
 // The value bytes must not be modified by the caller.
 func (t *Trie) Get(key []byte) []byte {
@@ -17,7 +17,10 @@
 package whisperv5
 
 import (
+	"fmt"
+	mrand "math/rand"
 	"testing"
+	"time"
 
 	"github.com/trust-tech/go-trustmachine/crypto"
 )
@@ -204,3 +207,73 @@ func BenchmarkPoW(b *testing.B) {
 		}
 	}
 }
+
+// makeIngressEnvelopes creates a batch of distinct envelopes, all encrypted with
+// the same symmetric key and topic.
+func makeIngressEnvelopes(b testing.TB, n int) ([]*Envelope, *MessageParams) {
+	InitSingleTest()
+
+	params, err := generateMessageParams()
+	if err != nil {
+		b.Fatalf("failed generateMessageParams with seed %d: %s.", seed, err)
+	}
+	params.TTL = 1000
+	params.PoW = 0.000001
+
+	envelopes := make([]*Envelope, n)
+	for i := range envelopes {
+		params.Payload = []byte(fmt.Sprintf("message %d", i))
+		msg, _ := NewSentMessage(params)
+		if envelopes[i], err = msg.Wrap(params); err != nil {
+			b.Fatalf("failed Wrap with seed %d: %s.", seed, err)
+		}
+	}
+	return envelopes, params
+}
+
+func BenchmarkIngressValidate(b *testing.B) {
+	envelopes, _ := makeIngressEnvelopes(b, 1024)
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		b.StopTimer()
+		w := New(&Config{MaxMessageSize: DefaultMaxMessageSize, MinimumAcceptedPOW: 0.000001})
+		w.Start(nil)
+		b.StartTimer()
+
+		if err := deliverEnvelopes(w, envelopes); err != nil {
+			b.Fatalf("failed to deliver envelopes: %v", err)
+		}
+		b.StopTimer()
+		w.Stop()
+		b.StartTimer()
+	}
+}
+
+func BenchmarkIngressDelivery(b *testing.B) {
+	envelopes, params := makeIngressEnvelopes(b, 1024)
+
+	w := New(&Config{MaxMessageSize: DefaultMaxMessageSize, MinimumAcceptedPOW: 0.000001})
+	w.Start(nil)
+	defer w.Stop()
+
+	// Install a few non-matching filters and a matching one
+	for i := 0; i < 8; i++ {
+		key := make([]byte, aesKeyLength)
+		mrand.Read(key)
+		w.filters.Install(&Filter{KeySym: key, Topics: [][]byte{params.Topic[:]}})
+	}
+	filter := &Filter{KeySym: params.KeySym, Topics: [][]byte{params.Topic[:]}}
+	w.filters.Install(filter)
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		for _, envelope := range envelopes {
+			w.postEvent(envelope, false)
+		}
+		for received := 0; received < len(envelopes); {
+			received += len(filter.Retrieve())
+			time.Sleep(time.Millisecond)
+		}
+	}
+}
@@ -44,8 +44,11 @@ const (
 	messagesCode         = 1 // normal whisper message
 	p2pCode              = 2 // peer-to-peer message (to be consumed by the peer, but not forwarded any further)
 	p2pRequestCode       = 3 // peer-to-peer message, used by Dapp protocol
+	capabilitiesCode     = 4 // optional protocol features supported by the peer, ignored by older nodes
 	NumberOfMessageCodes = 64
 
+	capBatching = uint64(1) // capability flag: several envelopes may be bundled into one messages packet
+
 	paddingMask   = byte(3)
 	signatureFlag = byte(4)
 
@@ -61,9 +64,10 @@ const (
 
 	padSizeLimit      = 256 // just an arbitrary number, could be changed without breaking the protocol (must not exceed 2^24)
 	messageQueueLimit = 1024
+	ingressQueueLimit = 64   // maximum number of envelopes of a peer waiting for validation before reading from it stops
+	egressQueueLimit  = 1024 // maximum number of envelopes waiting for transmission to a peer, further ones are dropped
 
-	expirationCycle   = time.Second
-	transmissionCycle = 300 * time.Millisecond
+	expirationCycle = time.Second
 
 	DefaultTTL     = 50 // seconds
 	SynchAllowance = 10 // seconds
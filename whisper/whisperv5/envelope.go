@@ -194,8 +194,13 @@ func (e *Envelope) DecodeRLP(s *rlp.Stream) error {
 
 // OpenAsymmetric tries to decrypt an envelope, potentially encrypted with a particular key.
 func (e *Envelope) OpenAsymmetric(key *ecdsa.PrivateKey) (*ReceivedMessage, error) {
+	return e.openAsymmetric(ecies.NewSession(ecies.ImportECDSA(key)))
+}
+
+// openAsymmetric tries to decrypt an envelope using a reusable decryption session.
+func (e *Envelope) openAsymmetric(session *ecies.Session) (*ReceivedMessage, error) {
 	message := &ReceivedMessage{Raw: e.Data}
-	err := message.decryptAsymmetric(key)
+	err := message.decryptAsymmetric(session)
 	switch err {
 	case nil:
 		return message, nil
@@ -219,7 +224,7 @@ func (e *Envelope) OpenSymmetric(key []byte) (msg *ReceivedMessage, err error) {
 // Open tries to decrypt an envelope, and populates the message fields in case of success.
 func (e *Envelope) Open(watcher *Filter) (msg *ReceivedMessage) {
 	if e.isAsymmetric() {
-		msg, _ = e.OpenAsymmetric(watcher.KeyAsym)
+		msg, _ = e.openAsymmetric(watcher.asymSession())
 		if msg != nil {
 			msg.Dst = &watcher.KeyAsym.PublicKey
 		}
@@ -22,6 +22,7 @@ import (
 	"sync"
 
 	"github.com/trust-tech/go-trustmachine/common"
+	"github.com/trust-tech/go-trustmachine/crypto/ecies"
 	"github.com/trust-tech/go-trustmachine/log"
 )
 
@@ -35,7 +36,25 @@ type Filter struct {
 	SymKeyHash common.Hash       // The Keccak256Hash of the symmetric key, needed for optimization
 
 	Messages map[common.Hash]*ReceivedMessage
+	order    []common.Hash // Hashes of the pending messages in arrival order
 	mutex    sync.RWMutex
+
+	session     *ecies.Session // Decryption context of KeyAsym, reused across envelopes
+	sessionOnce sync.Once      // Ensures the decryption context is created only once
+}
+
+// filterMatch is a message decrypted for a particular filter.
+type filterMatch struct {
+	filter *Filter
+	msg    *ReceivedMessage
+}
+
+// delivery is an envelope queued for matching against the installed filters.
+type delivery struct {
+	envelope *Envelope
+	p2p      bool
+	matches  []filterMatch // Filters matching the envelope, valid once done is closed
+	done     chan struct{} // Closed when the envelope has been processed
 }
 
 type Filters struct {
@@ -88,9 +107,21 @@ func (fs *Filters) Get(id string) *Filter {
 	return fs.watchers[id]
 }
 
+// NotifyWatchers matches an envelope against all the installed filters and
+// triggers the ones it is addressed to.
 func (fs *Filters) NotifyWatchers(env *Envelope, p2pMessage bool) {
-	var msg *ReceivedMessage
+	for _, m := range fs.match(env, p2pMessage) {
+		m.filter.Trigger(m.msg)
+	}
+}
 
+// match finds all the installed filters an envelope is addressed to, and returns
+// the decrypted message for each of them.
+func (fs *Filters) match(env *Envelope, p2pMessage bool) []filterMatch {
+	var (
+		msg     *ReceivedMessage
+		matches []filterMatch
+	)
 	fs.mutex.RLock()
 	defer fs.mutex.RUnlock()
 
@@ -119,9 +150,10 @@ func (fs *Filters) NotifyWatchers(env *Envelope, p2pMessage bool) {
 
 		if match && msg != nil {
 			log.Trace("processing message: decrypted", "hash", env.Hash().Hex())
-			watcher.Trigger(msg)
+			matches = append(matches, filterMatch{watcher, msg})
 		}
 	}
+	return matches
 }
 
 func (f *Filter) processEnvelope(env *Envelope) *ReceivedMessage {
@@ -138,6 +170,15 @@ func (f *Filter) processEnvelope(env *Envelope) *ReceivedMessage {
 	return nil
 }
 
+// asymSession returns the reusable ECIES decryption session of the filter's
+// private key, creating it on first use.
+func (f *Filter) asymSession() *ecies.Session {
+	f.sessionOnce.Do(func() {
+		f.session = ecies.NewSession(ecies.ImportECDSA(f.KeyAsym))
+	})
+	return f.session
+}
+
 func (f *Filter) expectsAsymmetricEncryption() bool {
 	return f.KeyAsym != nil
 }
@@ -152,19 +193,29 @@ func (f *Filter) Trigger(msg *ReceivedMessage) {
 
 	if _, exist := f.Messages[msg.EnvelopeHash]; !exist {
 		f.Messages[msg.EnvelopeHash] = msg
+		f.order = append(f.order, msg.EnvelopeHash)
 	}
 }
 
+// Retrieve returns all the pending messages of the filter in arrival order, and
+// removes them from the filter.
 func (f *Filter) Retrieve() (all []*ReceivedMessage) {
 	f.mutex.Lock()
 	defer f.mutex.Unlock()
 
 	all = make([]*ReceivedMessage, 0, len(f.Messages))
+	for _, hash := range f.order {
+		if msg, ok := f.Messages[hash]; ok {
+			all = append(all, msg)
+			delete(f.Messages, hash)
+		}
+	}
 	for _, msg := range f.Messages {
-		all = append(all, msg)
+		all = append(all, msg) // inserted directly, without ordering info
 	}
 
 	f.Messages = make(map[common.Hash]*ReceivedMessage) // delete old messages
+	f.order = nil
 	return all
 }
 
@@ -275,9 +275,10 @@ func (msg *ReceivedMessage) decryptSymmetric(key []byte, nonce []byte) error {
 	return nil
 }
 
-// decryptAsymmetric decrypts an encrypted payload with a private key.
-func (msg *ReceivedMessage) decryptAsymmetric(key *ecdsa.PrivateKey) error {
-	decrypted, err := ecies.ImportECDSA(key).Decrypt(crand.Reader, msg.Raw, nil, nil)
+// decryptAsymmetric decrypts an encrypted payload with the private key of an
+// ECIES decryption session.
+func (msg *ReceivedMessage) decryptAsymmetric(session *ecies.Session) error {
+	decrypted, err := session.Decrypt(msg.Raw, nil, nil)
 	if err == nil {
 		msg.Raw = decrypted
 	}
@@ -18,15 +18,20 @@ package whisperv5
 
 import (
 	"fmt"
+	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/trust-tech/go-trustmachine/common"
 	"github.com/trust-tech/go-trustmachine/log"
 	"github.com/trust-tech/go-trustmachine/p2p"
 	"github.com/trust-tech/go-trustmachine/rlp"
-	set "gopkg.in/fatih/set.v0"
 )
 
+// envelopeFraming is an upper bound on the RLP encoding overhead of an envelope
+// on top of its size, used to keep message bundles within the size limit.
+const envelopeFraming = 64
+
 // peer represents a whisper protocol peer connection.
 type Peer struct {
 	host    *Whisper
@@ -34,26 +39,37 @@ type Peer struct {
 	ws      p2p.MsgReadWriter
 	trusted bool
 
-	known *set.Set // Messages already known by the peer to avoid wasting bandwidth
+	batching int32 // Set atomically once the remote advertised accepting envelope bundles
+
+	known    map[common.Hash]struct{} // Messages already known by the peer to avoid wasting bandwidth
+	expiries map[uint32][]common.Hash // Known message hashes bucketed by envelope expiry, for cheap cleanup
+	queue    []*Envelope              // Envelopes waiting to be transmitted to the peer
+	lock     sync.Mutex               // Mutex protecting the known set and the outbound queue
 
-	quit chan struct{}
+	notify chan struct{} // Notification channel for newly queued envelopes
+	quit   chan struct{}
 }
 
 // newPeer creates a new whisper peer object, but does not run the handshake itself.
 func newPeer(host *Whisper, remote *p2p.Peer, rw p2p.MsgReadWriter) *Peer {
 	return &Peer{
-		host:    host,
-		peer:    remote,
-		ws:      rw,
-		trusted: false,
-		known:   set.New(),
-		quit:    make(chan struct{}),
+		host:     host,
+		peer:     remote,
+		ws:       rw,
+		trusted:  false,
+		known:    make(map[common.Hash]struct{}),
+		expiries: make(map[uint32][]common.Hash),
+		notify:   make(chan struct{}, 1),
+		quit:     make(chan struct{}),
 	}
 }
 
-// start initiates the peer updater, periodically broadcasting the whisper packets
-// into the network.
+// start initiates the peer updater, queueing up the current contents of the
+// pool and then forwarding new envelopes as they arrive.
 func (p *Peer) start() {
+	for _, envelope := range p.host.Envelopes() {
+		p.enqueue(envelope)
+	}
 	go p.update()
 	log.Trace("start", "peer", p.ID())
 }
@@ -95,12 +111,17 @@ func (p *Peer) handshake() error {
 	return nil
 }
 
-// update executes periodic operations on the peer, including message transmission
-// and expiration.
+// update executes the operations on the peer, transmitting queued envelopes as
+// soon as they are available and periodically expiring the known set.
 func (p *Peer) update() {
-	// Start the tickers for the updates
 	expire := time.NewTicker(expirationCycle)
-	transmit := time.NewTicker(transmissionCycle)
+	defer expire.Stop()
+
+	// Advertise the optional features supported locally. Older nodes ignore it.
+	if err := p2p.Send(p.ws, capabilitiesCode, capBatching); err != nil {
+		log.Trace("capabilities failed", "reason", err, "peer", p.ID())
+		return
+	}
 
 	// Loop and transmit until termination is requested
 	for {
@@ -108,7 +129,7 @@ func (p *Peer) update() {
 		case <-expire.C:
 			p.expire()
 
-		case <-transmit.C:
+		case <-p.notify:
 			if err := p.broadcast(); err != nil {
 				log.Trace("broadcast failed", "reason", err, "peer", p.ID())
 				return
@@ -120,46 +141,120 @@ func (p *Peer) update() {
 	}
 }
 
+// setCapabilities records the optional features advertised by the remote peer.
+func (p *Peer) setCapabilities(caps uint64) {
+	if caps&capBatching != 0 {
+		atomic.StoreInt32(&p.batching, 1)
+	}
+}
+
 // mark marks an envelope known to the peer so that it won't be sent back.
 func (peer *Peer) mark(envelope *Envelope) {
-	peer.known.Add(envelope.Hash())
+	peer.lock.Lock()
+	defer peer.lock.Unlock()
+
+	peer.markLocked(envelope)
+}
+
+// markLocked marks an envelope known to the peer, reporting whether it wasn't
+// known before. The peer lock must be held.
+func (peer *Peer) markLocked(envelope *Envelope) bool {
+	hash := envelope.Hash()
+	if _, ok := peer.known[hash]; ok {
+		return false
+	}
+	peer.known[hash] = struct{}{}
+	peer.expiries[envelope.Expiry] = append(peer.expiries[envelope.Expiry], hash)
+	return true
 }
 
 // marked checks if an envelope is already known to the remote peer.
 func (peer *Peer) marked(envelope *Envelope) bool {
-	return peer.known.Has(envelope.Hash())
+	peer.lock.Lock()
+	defer peer.lock.Unlock()
+
+	_, ok := peer.known[envelope.Hash()]
+	return ok
+}
+
+// enqueue schedules an envelope for transmission, unless the peer already
+// knows about it. If the peer's queue is full the envelope is dropped without
+// marking it known.
+func (peer *Peer) enqueue(envelope *Envelope) {
+	peer.lock.Lock()
+	queued := len(peer.queue) < egressQueueLimit && peer.markLocked(envelope)
+	if queued {
+		peer.queue = append(peer.queue, envelope)
+	}
+	peer.lock.Unlock()
+
+	if queued {
+		select {
+		case peer.notify <- struct{}{}:
+		default:
+		}
+	}
 }
 
-// expire iterates over all the known envelopes in the host and removes all
-// expired (unknown) ones from the known list.
+// expire removes all the envelopes from the known set that have expired, and
+// are thus dropped from the pool too. Only the expired buckets are visited.
 func (peer *Peer) expire() {
-	unmark := make(map[common.Hash]struct{})
-	peer.known.Each(func(v interface{}) bool {
-		if !peer.host.isEnvelopeCached(v.(common.Hash)) {
-			unmark[v.(common.Hash)] = struct{}{}
+	now := uint32(time.Now().Unix())
+
+	peer.lock.Lock()
+	defer peer.lock.Unlock()
+
+	for expiry, hashes := range peer.expiries {
+		if expiry < now {
+			for _, hash := range hashes {
+				delete(peer.known, hash)
+			}
+			delete(peer.expiries, expiry)
 		}
-		return true
-	})
-	// Dump all known but no longer cached
-	for hash := range unmark {
-		peer.known.Remove(hash)
 	}
 }
 
-// broadcast iterates over the collection of envelopes and transmits yet unknown
-// ones over the network.
+// broadcast transmits all the queued envelopes that haven't expired yet. Peers
+// that advertised support for it get them bundled into as few messages as the
+// maximum message size allows, others (e.g. older version 5 nodes, which decode
+// a single envelope per packet) one envelope per message.
 func (p *Peer) broadcast() error {
-	var cnt int
-	envelopes := p.host.Envelopes()
-	for _, envelope := range envelopes {
-		if !p.marked(envelope) {
-			err := p2p.Send(p.ws, messagesCode, envelope)
-			if err != nil {
+	p.lock.Lock()
+	queue := p.queue
+	p.queue = nil
+	p.lock.Unlock()
+
+	var (
+		now    = uint32(time.Now().Unix())
+		limit  = int(p.host.MaxMessageSize())
+		batch  = atomic.LoadInt32(&p.batching) == 1
+		bundle []*Envelope
+		size   int
+		cnt    int
+	)
+	for _, envelope := range queue {
+		if envelope.Expiry < now {
+			continue
+		}
+		cnt++
+		if !batch {
+			if err := p2p.Send(p.ws, messagesCode, envelope); err != nil {
 				return err
-			} else {
-				p.mark(envelope)
-				cnt++
 			}
+			continue
+		}
+		if len(bundle) > 0 && size+envelope.size()+envelopeFraming > limit {
+			if err := p2p.Send(p.ws, messagesCode, bundle); err != nil {
+				return err
+			}
+			bundle, size = nil, 0
+		}
+		bundle = append(bundle, envelope)
+		size += envelope.size() + envelopeFraming
+	}
+	if len(bundle) > 0 {
+		if err := p2p.Send(p.ws, messagesCode, bundle); err != nil {
+			return err
 		}
 	}
 	if cnt > 0 {
@@ -19,9 +19,13 @@ package whisperv5
 import (
 	"bytes"
 	"crypto/ecdsa"
+	"encoding/binary"
+	"errors"
 	"fmt"
 	"net"
+	"runtime"
 	"sync"
+	"sync/atomic"
 	"testing"
 	"time"
 
@@ -30,6 +34,7 @@ import (
 	"github.com/trust-tech/go-trustmachine/p2p"
 	"github.com/trust-tech/go-trustmachine/p2p/discover"
 	"github.com/trust-tech/go-trustmachine/p2p/nat"
+	"github.com/trust-tech/go-trustmachine/rlp"
 )
 
 var keys []string = []string{
@@ -304,3 +309,243 @@ func TestPeerBasic(t *testing.T) {
 		t.Fatalf("failed mark with seed %d.", seed)
 	}
 }
+
+// countingRW is a message writer counting and discarding all outbound messages.
+type countingRW struct {
+	msgs int32
+}
+
+func (rw *countingRW) ReadMsg() (p2p.Msg, error) { select {} }
+func (rw *countingRW) WriteMsg(msg p2p.Msg) error {
+	atomic.AddInt32(&rw.msgs, 1)
+	return msg.Discard()
+}
+
+// makeTestEnvelope creates a distinct unsealed envelope expiring after ttl seconds.
+func makeTestEnvelope(i int, ttl uint32) *Envelope {
+	data := make([]byte, 64)
+	binary.BigEndian.PutUint64(data, uint64(i))
+	return &Envelope{
+		Version:  []byte{byte(EnvelopeVersion)},
+		Expiry:   uint32(time.Now().Unix()) + ttl,
+		TTL:      ttl,
+		Data:     data,
+		EnvNonce: uint64(i),
+	}
+}
+
+// Tests that queued envelopes are only bundled for peers advertising support
+// for it, older peers get a message per envelope.
+func TestPeerBroadcastBatching(t *testing.T) {
+	rw := new(countingRW)
+	p := newPeer(New(&DefaultConfig), nil, rw)
+
+	for _, batching := range []bool{false, true} {
+		if batching {
+			p.setCapabilities(capBatching)
+		}
+		atomic.StoreInt32(&rw.msgs, 0)
+		for i := 0; i < 3; i++ {
+			p.enqueue(makeTestEnvelope(i+len(p.known), 100))
+		}
+		if err := p.broadcast(); err != nil {
+			t.Fatalf("batching %v: broadcast failed: %v", batching, err)
+		}
+		want := int32(3)
+		if batching {
+			want = 1
+		}
+		if msgs := atomic.LoadInt32(&rw.msgs); msgs != want {
+			t.Errorf("batching %v: message count mismatch: have %d, want %d", batching, msgs, want)
+		}
+	}
+}
+
+// Tests that envelopes read from a peer are stored in order after validation,
+// and that the first invalid one gets the peer dropped.
+func TestMessageLoopValidation(t *testing.T) {
+	w := New(&Config{MaxMessageSize: DefaultMaxMessageSize, MinimumAcceptedPOW: 0})
+	w.Start(nil)
+	defer w.Stop()
+
+	local, remote := p2p.MsgPipe()
+	defer remote.Close()
+	p := newPeer(w, p2p.NewPeer(discover.NodeID{1}, "test", nil), local)
+
+	errc := make(chan error, 1)
+	go func() { errc <- w.runMessageLoop(p, local) }()
+
+	valid := []*Envelope{makeTestEnvelope(0, 100), makeTestEnvelope(1, 100)}
+	future := makeTestEnvelope(2, 100)
+	future.Expiry += 2 * SynchAllowance
+
+	// The envelope after the invalid one only makes the loop notice the error
+	for _, envelope := range []*Envelope{valid[0], valid[1], future, makeTestEnvelope(3, 100)} {
+		if err := p2p.Send(remote, messagesCode, envelope); err != nil {
+			t.Fatalf("failed to send envelope: %v", err)
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+	select {
+	case err := <-errc:
+		if err == nil {
+			t.Fatalf("invalid envelope accepted")
+		}
+	case <-time.After(5 * time.Second):
+		t.Fatalf("peer not dropped")
+	}
+	for i, envelope := range valid {
+		if !w.pool.has(envelope.Hash()) {
+			t.Errorf("valid envelope %d not pooled", i)
+		}
+	}
+	if w.pool.has(future.Hash()) {
+		t.Errorf("invalid envelope pooled")
+	}
+}
+
+// deliverEnvelopes sends envelopes to whisper in a single bundle through the
+// message loop of a test peer, and waits until all of them are pooled.
+func deliverEnvelopes(w *Whisper, envelopes []*Envelope) error {
+	local, remote := p2p.MsgPipe()
+	defer remote.Close()
+	p := newPeer(w, p2p.NewPeer(discover.NodeID{1}, "test", nil), local)
+
+	errc := make(chan error, 1)
+	go func() { errc <- w.runMessageLoop(p, local) }()
+
+	if err := p2p.Send(remote, messagesCode, envelopes); err != nil {
+		return err
+	}
+	// Envelopes are stored in order, so the last one is pooled after the others
+	last, deadline := envelopes[len(envelopes)-1].Hash(), time.Now().Add(5*time.Second)
+	for !w.pool.has(last) {
+		select {
+		case err := <-errc:
+			return err
+		default:
+		}
+		if time.Now().After(deadline) {
+			return errors.New("envelopes not pooled")
+		}
+		runtime.Gosched()
+	}
+	return nil
+}
+
+// Tests that the queue of envelopes waiting for transmission is capped, and
+// that dropped envelopes aren't marked known to the peer.
+func TestPeerQueueLimit(t *testing.T) {
+	p := newPeer(nil, nil, nil)
+	for i := 0; i < egressQueueLimit+10; i++ {
+		p.enqueue(makeTestEnvelope(i, 100))
+	}
+	if len(p.queue) != egressQueueLimit {
+		t.Fatalf("queue length mismatch: have %d, want %d", len(p.queue), egressQueueLimit)
+	}
+	if dropped := makeTestEnvelope(egressQueueLimit, 100); p.marked(dropped) {
+		t.Fatalf("dropped envelope marked known")
+	}
+}
+
+func TestPeerExpire(t *testing.T) {
+	p := newPeer(nil, nil, nil)
+
+	stale := makeTestEnvelope(0, 0)
+	stale.Expiry -= 2
+	fresh := makeTestEnvelope(1, 100)
+	p.mark(stale)
+	p.enqueue(fresh)
+
+	p.expire()
+	if p.marked(stale) {
+		t.Fatalf("expired envelope still marked")
+	}
+	if !p.marked(fresh) {
+		t.Fatalf("live envelope unmarked")
+	}
+	if len(p.expiries) != 1 {
+		t.Fatalf("expiry bucket count mismatch: have %d, want 1", len(p.expiries))
+	}
+	// Enqueueing a known envelope again must not duplicate it
+	p.enqueue(fresh)
+	if len(p.queue) != 1 {
+		t.Fatalf("queue length mismatch: have %d, want 1", len(p.queue))
+	}
+}
+
+func TestDecodeEnvelopes(t *testing.T) {
+	envelopes := []*Envelope{makeTestEnvelope(0, 100), makeTestEnvelope(1, 100), makeTestEnvelope(2, 100)}
+
+	// Both envelope bundles and legacy single envelopes must be accepted
+	for i, payload := range []interface{}{envelopes, envelopes[0]} {
+		size, r, err := rlp.EncodeToReader(payload)
+		if err != nil {
+			t.Fatalf("test %d: failed to encode envelopes: %v", i, err)
+		}
+		decoded, err := decodeEnvelopes(p2p.Msg{Code: messagesCode, Size: uint32(size), Payload: r})
+		if err != nil {
+			t.Fatalf("test %d: failed to decode envelopes: %v", i, err)
+		}
+		want := envelopes
+		if i == 1 {
+			want = envelopes[:1]
+		}
+		if len(decoded) != len(want) {
+			t.Fatalf("test %d: envelope count mismatch: have %d, want %d", i, len(decoded), len(want))
+		}
+		for j := range decoded {
+			if decoded[j].Hash() != want[j].Hash() {
+				t.Errorf("test %d, envelope %d: hash mismatch", i, j)
+			}
+		}
+	}
+}
+
+// Benchmarks propagating new envelopes to 100 peers on top of a 50K envelope
+// pool. Every envelope must reach every peer exactly once.
+func BenchmarkPeerPropagation(b *testing.B) {
+	const peers, pool = 100, 50000
+
+	w := New(&Config{MaxMessageSize: DefaultMaxMessageSize, MinimumAcceptedPOW: 0.000001})
+	w.Start(nil)
+	defer w.Stop()
+
+	for i := 0; i < pool; i++ {
+		if _, err := w.add(makeTestEnvelope(i, 1000), nil); err != nil {
+			b.Fatalf("failed to pool envelope %d: %v", i, err)
+		}
+	}
+	rws := make([]*countingRW, peers)
+	for i := range rws {
+		rws[i] = new(countingRW)
+
+		p := newPeer(w, p2p.NewPeer(discover.NodeID{byte(i)}, "bench", nil), rws[i])
+		w.peers[p] = struct{}{}
+		p.start()
+		defer p.stop()
+	}
+	envelopes := make([]*Envelope, b.N)
+	for i := range envelopes {
+		envelopes[i] = makeTestEnvelope(pool+i, 1000)
+	}
+	b.ResetTimer()
+
+	for _, envelope := range envelopes {
+		if _, err := w.add(envelope, nil); err != nil {
+			b.Fatalf("failed to add envelope: %v", err)
+		}
+	}
+	// Wait until all the peers drained their queues
+	for p := range w.peers {
+		for {
+			p.lock.Lock()
+			pending := len(p.queue)
+			p.lock.Unlock()
+			if pending == 0 {
+				break
+			}
+			time.Sleep(time.Millisecond)
+		}
+	}
+}
@@ -0,0 +1,119 @@
+// Copyright 2017 The go-trustmachine Authors
+// This file is part of the go-trustmachine library.
+//
+// The go-trustmachine library is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The go-trustmachine library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with the go-trustmachine library. If not, see <http://www.gnu.org/licenses/>.
+
+package whisperv5
+
+import (
+	"sync"
+
+	"github.com/trust-tech/go-trustmachine/common"
+)
+
+// poolShards is the number of independently locked partitions of the envelope pool.
+const poolShards = 16
+
+// poolShard is a partition of the envelope pool, holding the envelopes whose
+// hash starts with a given byte modulo the number of shards.
+type poolShard struct {
+	envelopes   map[common.Hash]*Envelope // Envelopes currently tracked in this shard
+	expirations map[uint32][]common.Hash  // Envelope hashes bucketed by expiry time
+	lock        sync.RWMutex              // Mutex to sync the envelopes and expirations
+}
+
+// envelopePool is the set of envelopes tracked by a whisper node. It is split
+// into shards by hash, so that peers inserting envelopes concurrently (and the
+// periodic expiration) rarely contend on the same lock.
+type envelopePool struct {
+	shards [poolShards]*poolShard
+}
+
+// newEnvelopePool creates an empty envelope pool.
+func newEnvelopePool() *envelopePool {
+	pool := new(envelopePool)
+	for i := range pool.shards {
+		pool.shards[i] = &poolShard{
+			envelopes:   make(map[common.Hash]*Envelope),
+			expirations: make(map[uint32][]common.Hash),
+		}
+	}
+	return pool
+}
+
+// shard returns the partition an envelope hash belongs to.
+func (pool *envelopePool) shard(hash common.Hash) *poolShard {
+	return pool.shards[hash[0]%poolShards]
+}
+
+// insert adds an envelope to the pool, reporting whether it was not yet tracked.
+func (pool *envelopePool) insert(envelope *Envelope) bool {
+	hash := envelope.Hash()
+	shard := pool.shard(hash)
+
+	shard.lock.Lock()
+	defer shard.lock.Unlock()
+
+	if _, ok := shard.envelopes[hash]; ok {
+		return false
+	}
+	shard.envelopes[hash] = envelope
+	shard.expirations[envelope.Expiry] = append(shard.expirations[envelope.Expiry], hash)
+	return true
+}
+
+// has checks whether an envelope with the given hash is tracked.
+func (pool *envelopePool) has(hash common.Hash) bool {
+	shard := pool.shard(hash)
+
+	shard.lock.RLock()
+	defer shard.lock.RUnlock()
+
+	_, ok := shard.envelopes[hash]
+	return ok
+}
+
+// all retrieves all the envelopes currently tracked.
+func (pool *envelopePool) all() []*Envelope {
+	var all []*Envelope
+	for _, shard := range pool.shards {
+		shard.lock.RLock()
+		for _, envelope := range shard.envelopes {
+			all = append(all, envelope)
+		}
+		shard.lock.RUnlock()
+	}
+	return all
+}
+
+// expire drops all the envelopes that expired before the given time, one shard
+// at a time, returning the number and total size of the dropped envelopes.
+func (pool *envelopePool) expire(now uint32) (count int, size int) {
+	for _, shard := range pool.shards {
+		shard.lock.Lock()
+		for expiry, hashes := range shard.expirations {
+			if expiry >= now {
+				continue
+			}
+			for _, hash := range hashes {
+				size += shard.envelopes[hash].size()
+				delete(shard.envelopes, hash)
+				count++
+			}
+			delete(shard.expirations, expiry)
+		}
+		shard.lock.Unlock()
+	}
+	return count, size
+}
@@ -22,6 +22,7 @@ import (
 	crand "crypto/rand"
 	"crypto/sha256"
 	"fmt"
+	"io"
 	"runtime"
 	"sync"
 	"time"
@@ -30,11 +31,11 @@ import (
 	"github.com/trust-tech/go-trustmachine/crypto"
 	"github.com/trust-tech/go-trustmachine/log"
 	"github.com/trust-tech/go-trustmachine/p2p"
+	"github.com/trust-tech/go-trustmachine/rlp"
 	"github.com/trust-tech/go-trustmachine/rpc"
 	"github.com/syndtr/goleveldb/leveldb/errors"
 	"golang.org/x/crypto/pbkdf2"
 	"golang.org/x/sync/syncmap"
-	set "gopkg.in/fatih/set.v0"
 )
 
 type Statistics struct {
@@ -61,16 +62,16 @@ type Whisper struct {
 	symKeys     map[string][]byte            // Symmetric key storage
 	keyMu       sync.RWMutex                 // Mutex associated with key storages
 
-	poolMu      sync.RWMutex              // Mutex to sync the message and expiration pools
-	envelopes   map[common.Hash]*Envelope // Pool of envelopes currently tracked by this node
-	expirations map[uint32]*set.SetNonTS  // Message expiration pool
+	pool *envelopePool // Pool of envelopes currently tracked by this node
 
 	peerMu sync.RWMutex       // Mutex to sync the active peer set
 	peers  map[*Peer]struct{} // Set of currently active peers
 
-	messageQueue chan *Envelope // Message queue for normal whisper messages
-	p2pMsgQueue  chan *Envelope // Message queue for peer-to-peer messages (not to be forwarded any further)
-	quit         chan struct{}  // Channel used for graceful exit
+	validations   chan *validation // Envelopes received from any peer, waiting for the validation workers
+	messageQueue  chan *delivery   // Message queue for normal whisper messages
+	p2pMsgQueue   chan *delivery   // Message queue for peer-to-peer messages (not to be forwarded any further)
+	deliveryQueue chan *delivery   // All queued messages in arrival order, to trigger the filters in
+	quit          chan struct{}    // Channel used for graceful exit
 
 	settings syncmap.Map // holds configuration settings that can be dynamically changed
 
@@ -87,14 +88,15 @@ func New(cfg *Config) *Whisper {
 	}
 
 	whisper := &Whisper{
-		privateKeys:  make(map[string]*ecdsa.PrivateKey),
-		symKeys:      make(map[string][]byte),
-		envelopes:    make(map[common.Hash]*Envelope),
-		expirations:  make(map[uint32]*set.SetNonTS),
-		peers:        make(map[*Peer]struct{}),
-		messageQueue: make(chan *Envelope, messageQueueLimit),
-		p2pMsgQueue:  make(chan *Envelope, messageQueueLimit),
-		quit:         make(chan struct{}),
+		privateKeys:   make(map[string]*ecdsa.PrivateKey),
+		symKeys:       make(map[string][]byte),
+		pool:          newEnvelopePool(),
+		peers:         make(map[*Peer]struct{}),
+		validations:   make(chan *validation, messageQueueLimit),
+		messageQueue:  make(chan *delivery, messageQueueLimit),
+		p2pMsgQueue:   make(chan *delivery, messageQueueLimit),
+		deliveryQueue: make(chan *delivery, 2*messageQueueLimit),
+		quit:          make(chan struct{}),
 	}
 
 	whisper.filters = NewFilters(whisper)
@@ -435,7 +437,7 @@ func (w *Whisper) Unsubscribe(id string) error {
 // Send injects a message into the whisper send queue, to be distributed in the
 // network in the coming cycles.
 func (w *Whisper) Send(envelope *Envelope) error {
-	ok, err := w.add(envelope)
+	ok, err := w.add(envelope, nil)
 	if err != nil {
 		return err
 	}
@@ -450,10 +452,12 @@ func (w *Whisper) Send(envelope *Envelope) error {
 func (w *Whisper) Start(*p2p.Server) error {
 	log.Info("started whisper v." + ProtocolVersionStr)
 	go w.update()
+	go w.deliver()
 
 	numCPU := runtime.NumCPU()
 	for i := 0; i < numCPU; i++ {
 		go w.processQueue()
+		go w.processValidations()
 	}
 
 	return nil
@@ -494,7 +498,18 @@ func (wh *Whisper) HandlePeer(peer *p2p.Peer, rw p2p.MsgReadWriter) error {
 }
 
 // runMessageLoop reads and processes inbound messages directly to merge into client-global state.
+//
+// Received envelopes are handed to the validation workers shared by all peers,
+// so reading goes on while they are checked. A separate goroutine stores them
+// in their original order as their validations complete.
 func (wh *Whisper) runMessageLoop(p *Peer, rw p2p.MsgReadWriter) error {
+	var (
+		pending = make(chan *validation, ingressQueueLimit)
+		errc    = make(chan error, 1)
+	)
+	go wh.storeValidated(p, pending, errc)
+	defer close(pending)
+
 	for {
 		// fetch the next packet
 		packet, err := rw.ReadMsg()
@@ -513,19 +528,35 @@ func (wh *Whisper) runMessageLoop(p *Peer, rw p2p.MsgReadWriter) error {
 			log.Warn("unxepected status message received", "peer", p.peer.ID())
 		case messagesCode:
 			// decode the contained envelopes
-			var envelope Envelope
-			if err := packet.Decode(&envelope); err != nil {
+			envelopes, err := decodeEnvelopes(packet)
+			if err != nil {
 				log.Warn("failed to decode envelope, peer will be disconnected", "peer", p.peer.ID(), "err", err)
 				return errors.New("invalid envelope")
 			}
-			cached, err := wh.add(&envelope)
-			if err != nil {
-				log.Warn("bad envelope received, peer will be disconnected", "peer", p.peer.ID(), "err", err)
-				return errors.New("invalid envelope")
+			for _, envelope := range envelopes {
+				// don't queue anything more after a bad envelope
+				select {
+				case err := <-errc:
+					log.Warn("bad envelope received, peer will be disconnected", "peer", p.peer.ID(), "err", err)
+					return errors.New("invalid envelope")
+				default:
+				}
+				select {
+				case pending <- wh.validateAsync(envelope):
+				case err := <-errc:
+					log.Warn("bad envelope received, peer will be disconnected", "peer", p.peer.ID(), "err", err)
+					return errors.New("invalid envelope")
+				case <-wh.quit:
+					return nil
+				}
 			}
-			if cached {
-				p.mark(&envelope)
+		case capabilitiesCode:
+			var caps uint64
+			if err := packet.Decode(&caps); err != nil {
+				log.Warn("failed to decode capabilities, peer will be disconnected", "peer", p.peer.ID(), "err", err)
+				return errors.New("invalid capabilities")
 			}
+			p.setCapabilities(caps)
 		case p2pCode:
 			// peer-to-peer message, sent directly to peer bypassing PoW checks, etc.
 			// this message is not supposed to be forwarded to other peers, and
@@ -558,10 +589,120 @@ func (wh *Whisper) runMessageLoop(p *Peer, rw p2p.MsgReadWriter) error {
 	}
 }
 
+// storeValidated stores the envelopes received from a peer in the order they
+// arrived, once they are validated. Upon the first invalid envelope the error
+// is reported to the message loop and the peer disconnected.
+func (wh *Whisper) storeValidated(p *Peer, pending <-chan *validation, errc chan<- error) {
+	for v := range pending {
+		ok, err := v.wait(wh.quit)
+		if err != nil {
+			errc <- err
+			p.peer.Disconnect(p2p.DiscSubprotocolError)
+			return
+		}
+		if ok {
+			wh.store(v.envelope, p)
+		}
+	}
+}
+
+// decodeEnvelopes decodes the envelopes contained in a messages packet, which
+// is either a bundle of envelopes or a single one (as sent by older nodes).
+func decodeEnvelopes(packet p2p.Msg) ([]*Envelope, error) {
+	raw := make([]byte, packet.Size)
+	if _, err := io.ReadFull(packet.Payload, raw); err != nil {
+		return nil, err
+	}
+	content, _, err := rlp.SplitList(raw)
+	if err != nil {
+		return nil, err
+	}
+	if kind, _, _, err := rlp.Split(content); err == nil && kind == rlp.List {
+		var envelopes []*Envelope
+		if err := rlp.DecodeBytes(raw, &envelopes); err != nil {
+			return nil, err
+		}
+		return envelopes, nil
+	}
+	envelope := new(Envelope)
+	if err := rlp.DecodeBytes(raw, envelope); err != nil {
+		return nil, err
+	}
+	return []*Envelope{envelope}, nil
+}
+
 // add inserts a new envelope into the message pool to be distributed within the
 // whisper network. It also inserts the envelope into the expiration pool at the
-// appropriate time-stamp. In case of error, connection should be dropped.
-func (wh *Whisper) add(envelope *Envelope) (bool, error) {
+// appropriate time-stamp, and queues it up for transmission to all the peers
+// except the origin (nil for local envelopes). In case of error, connection
+// should be dropped.
+func (wh *Whisper) add(envelope *Envelope, origin *Peer) (bool, error) {
+	if wh.pool.has(envelope.Hash()) {
+		return wh.store(envelope, origin), nil
+	}
+	if ok, err := wh.validate(envelope); !ok {
+		return false, err
+	}
+	return wh.store(envelope, origin), nil
+}
+
+// validation is an envelope scheduled for validation by the shared workers.
+type validation struct {
+	envelope *Envelope
+	ok       bool
+	err      error
+	done     chan struct{} // Closed when the envelope has been validated, nil if already pooled
+}
+
+// validateAsync schedules an envelope for validation, unless it is already in
+// the pool and thus known to be valid.
+func (wh *Whisper) validateAsync(envelope *Envelope) *validation {
+	v := &validation{envelope: envelope}
+	if wh.pool.has(envelope.Hash()) {
+		v.ok = true
+		return v
+	}
+	v.done = make(chan struct{})
+	select {
+	case wh.validations <- v:
+	case <-wh.quit:
+		close(v.done)
+	}
+	return v
+}
+
+// wait blocks until the envelope is validated, returning whether it should be
+// stored. Envelopes still pending when whisper stops are dropped.
+func (v *validation) wait(quit chan struct{}) (bool, error) {
+	if v.done != nil {
+		select {
+		case <-v.done:
+		case <-quit:
+			return false, nil
+		}
+	}
+	return v.ok, v.err
+}
+
+// processValidations validates the envelopes received from all the peers during
+// the lifetime of the whisper node.
+func (wh *Whisper) processValidations() {
+	for {
+		select {
+		case <-wh.quit:
+			return
+
+		case v := <-wh.validations:
+			v.ok, v.err = wh.validate(v.envelope)
+			close(v.done)
+		}
+	}
+}
+
+// validate checks whether an envelope is acceptable into the pool, recalculating
+// its PoW if needed. Envelopes not worth keeping but not outright invalid are
+// rejected without an error.
+func (wh *Whisper) validate(envelope *Envelope) (bool, error) {
 	now := uint32(time.Now().Unix())
 	sent := envelope.Expiry - envelope.TTL
 
@@ -603,47 +744,62 @@ func (wh *Whisper) add(envelope *Envelope) (bool, error) {
 		return false, nil // drop envelope without error
 	}
 
-	hash := envelope.Hash()
+	return true, nil
+}
 
-	wh.poolMu.Lock()
-	_, alreadyCached := wh.envelopes[hash]
-	if !alreadyCached {
-		wh.envelopes[hash] = envelope
-		if wh.expirations[envelope.Expiry] == nil {
-			wh.expirations[envelope.Expiry] = set.NewNonTS()
-		}
-		if !wh.expirations[envelope.Expiry].Has(hash) {
-			wh.expirations[envelope.Expiry].Add(hash)
-		}
+// store inserts a validated envelope into the pool, marking it known to its
+// origin peer. If the envelope is new, the local filters are notified and the
+// other peers scheduled to receive it.
+func (wh *Whisper) store(envelope *Envelope, origin *Peer) bool {
+	if origin != nil {
+		origin.mark(envelope)
 	}
-	wh.poolMu.Unlock()
-
-	if alreadyCached {
+	if !wh.pool.insert(envelope) {
 		log.Trace("whisper envelope already cached", "hash", envelope.Hash().Hex())
-	} else {
-		log.Trace("cached whisper envelope", "hash", envelope.Hash().Hex())
-		wh.statsMu.Lock()
-		wh.stats.memoryUsed += envelope.size()
-		wh.statsMu.Unlock()
-		wh.postEvent(envelope, false) // notify the local node about the new message
-		if wh.mailServer != nil {
-			wh.mailServer.Archive(envelope)
-		}
+		return true
+	}
+	log.Trace("cached whisper envelope", "hash", envelope.Hash().Hex())
+	wh.statsMu.Lock()
+	wh.stats.memoryUsed += envelope.size()
+	wh.statsMu.Unlock()
+
+	wh.postEvent(envelope, false) // notify the local node about the new message
+	wh.forward(envelope)
+	if wh.mailServer != nil {
+		wh.mailServer.Archive(envelope)
+	}
+	return true
+}
+
+// forward queues a newly pooled envelope for transmission to all the peers not
+// yet knowing about it.
+func (wh *Whisper) forward(envelope *Envelope) {
+	wh.peerMu.RLock()
+	defer wh.peerMu.RUnlock()
+
+	for peer := range wh.peers {
+		peer.enqueue(envelope)
 	}
-	return true, nil
 }
 
 // postEvent queues the message for further processing.
+//
+// The processing queues don't need to agree with the delivery order: workers
+// never wait for deliveries, so every queued message eventually gets processed
+// and delivered. Slow consumers thus only hold up the posters waiting for room.
 func (w *Whisper) postEvent(envelope *Envelope, isP2P bool) {
 	// if the version of incoming message is higher than
 	// currently supported version, we can not decrypt it,
 	// and therefore just ignore this message
 	if envelope.Ver() <= EnvelopeVersion {
+		d := &delivery{envelope: envelope, p2p: isP2P, done: make(chan struct{})}
+
+		w.deliveryQueue <- d
 		if isP2P {
-			w.p2pMsgQueue <- envelope
+			w.p2pMsgQueue <- d
 		} else {
 			w.checkOverflow()
-			w.messageQueue <- envelope
+			w.messageQueue <- d
 		}
 	}
 }
@@ -665,19 +821,42 @@ func (w *Whisper) checkOverflow() {
 	}
 }
 
-// processQueue delivers the messages to the watchers during the lifetime of the whisper node.
+// processQueue matches the queued messages against the installed filters,
+// decrypting them where needed, during the lifetime of the whisper node. Multiple
+// messages are processed concurrently, the results are handed to the watchers
+// by deliver.
 func (w *Whisper) processQueue() {
-	var e *Envelope
+	var d *delivery
 	for {
 		select {
 		case <-w.quit:
 			return
 
-		case e = <-w.messageQueue:
-			w.filters.NotifyWatchers(e, false)
+		case d = <-w.messageQueue:
+		case d = <-w.p2pMsgQueue:
+		}
+		d.matches = w.filters.match(d.envelope, d.p2p)
+		close(d.done)
+	}
+}
+
+// deliver triggers the watchers with the processed messages in the order they
+// were queued, so every filter receives its messages in arrival order.
+func (w *Whisper) deliver() {
+	for {
+		select {
+		case <-w.quit:
+			return
 
-		case e = <-w.p2pMsgQueue:
-			w.filters.NotifyWatchers(e, true)
+		case d := <-w.deliveryQueue:
+			select {
+			case <-d.done:
+			case <-w.quit:
+				return
+			}
+			for _, m := range d.matches {
+				m.filter.Trigger(m.msg)
+			}
 		}
 	}
 }
@@ -703,28 +882,15 @@ func (w *Whisper) update() {
 // expire iterates over all the expiration timestamps, removing all stale
 // messages from the pools.
 func (w *Whisper) expire() {
-	w.poolMu.Lock()
-	defer w.poolMu.Unlock()
+	cleared, size := w.pool.expire(uint32(time.Now().Unix()))
 
 	w.statsMu.Lock()
 	defer w.statsMu.Unlock()
+
 	w.stats.reset()
-	now := uint32(time.Now().Unix())
-	for expiry, hashSet := range w.expirations {
-		if expiry < now {
-			// Dump all expired messages and remove timestamp
-			hashSet.Each(func(v interface{}) bool {
-				sz := w.envelopes[v.(common.Hash)].size()
-				delete(w.envelopes, v.(common.Hash))
-				w.stats.messagesCleared++
-				w.stats.memoryCleared += sz
-				w.stats.memoryUsed -= sz
-				return true
-			})
-			w.expirations[expiry].Clear()
-			delete(w.expirations, expiry)
-		}
-	}
+	w.stats.messagesCleared = cleared
+	w.stats.memoryCleared = size
+	w.stats.memoryUsed -= size
 }
 
 // Stats returns the whisper node statistics.
@@ -737,25 +903,15 @@ func (w *Whisper) Stats() Statistics {
 
 // Envelopes retrieves all the messages currently pooled by the node.
 func (w *Whisper) Envelopes() []*Envelope {
-	w.poolMu.RLock()
-	defer w.poolMu.RUnlock()
-
-	all := make([]*Envelope, 0, len(w.envelopes))
-	for _, envelope := range w.envelopes {
-		all = append(all, envelope)
-	}
-	return all
+	return w.pool.all()
 }
 
 // Messages iterates through all currently floating envelopes
 // and retrieves all the messages, that this filter could decrypt.
 func (w *Whisper) Messages(id string) []*ReceivedMessage {
 	result := make([]*ReceivedMessage, 0)
-	w.poolMu.RLock()
-	defer w.poolMu.RUnlock()
-
 	if filter := w.filters.Get(id); filter != nil {
-		for _, env := range w.envelopes {
+		for _, env := range w.pool.all() {
 			msg := filter.processEnvelope(env)
 			if msg != nil {
 				result = append(result, msg)
@@ -767,11 +923,7 @@ func (w *Whisper) Messages(id string) []*ReceivedMessage {
 
 // isEnvelopeCached checks if envelope with specific hash has already been received and cached.
 func (w *Whisper) isEnvelopeCached(hash common.Hash) bool {
-	w.poolMu.Lock()
-	defer w.poolMu.Unlock()
-
-	_, exist := w.envelopes[hash]
-	return exist
+	return w.pool.has(hash)
 }
 
 // reset resets the node's statistics after each expiry cycle.
@@ -618,3 +618,32 @@ func TestCustomization(t *testing.T) {
 		t.Fatalf("failed to get whisper messages")
 	}
 }
+
+func TestDeliveryOrder(t *testing.T) {
+	envelopes, params := makeIngressEnvelopes(t, 256)
+
+	w := New(&Config{MaxMessageSize: DefaultMaxMessageSize, MinimumAcceptedPOW: 0.000001})
+	w.Start(nil)
+	defer w.Stop()
+
+	filter := &Filter{KeySym: params.KeySym, Topics: [][]byte{params.Topic[:]}}
+	if _, err := w.Subscribe(filter); err != nil {
+		t.Fatalf("failed to install filter: %v", err)
+	}
+	if err := deliverEnvelopes(w, envelopes); err != nil {
+		t.Fatalf("failed to deliver envelopes: %v", err)
+	}
+	var received []*ReceivedMessage
+	for start := time.Now(); len(received) < len(envelopes) && time.Since(start) < 5*time.Second; {
+		received = append(received, filter.Retrieve()...)
+		time.Sleep(10 * time.Millisecond)
+	}
+	if len(received) != len(envelopes) {
+		t.Fatalf("received message count mismatch: have %d, want %d", len(received), len(envelopes))
+	}
+	for i, msg := range received {
+		if msg.EnvelopeHash != envelopes[i].Hash() {
+			t.Fatalf("message %d: out of order delivery", i)
+		}
+	}
+}